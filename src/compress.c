@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/blkdev.h>
+#include <linux/lz4.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include "compress.h"
+
+/* Buffers of a CPU, they are used with preemption disabled */
+struct lsbdd_zip_ws {
+	/* Data of a block, as it was written or decompressed */
+	char *data;
+	/* The block, as it is in the log */
+	char *zip;
+	void *wrkmem;
+};
+
+static struct lsbdd_zip_ws __percpu *lsbdd_zip_ws;
+/* Decompresses the reads, on the CPU that completed them */
+static struct workqueue_struct *lsbdd_zip_wq;
+/* BDs with compression, the buffers exist while there are any */
+static u32 lsbdd_zip_users;
+
+static void lsbdd_zip_free_ws(void)
+{
+	struct lsbdd_zip_ws *ws = NULL;
+	s32 cpu;
+
+	for_each_possible_cpu(cpu) {
+		ws = per_cpu_ptr(lsbdd_zip_ws, cpu);
+		vfree(ws->data);
+		vfree(ws->zip);
+		vfree(ws->wrkmem);
+	}
+	free_percpu(lsbdd_zip_ws);
+	lsbdd_zip_ws = NULL;
+}
+
+/**
+ * Takes a reference to the buffers and the workqueue, the first BD with
+ * compression allocates them. Called from the parameter setters and the
+ * module exit, which don't run concurrently.
+ *
+ * It returns 0 on success, -ENOMEM otherwise.
+ */
+s32 lsbdd_zip_get(void)
+{
+	struct lsbdd_zip_ws *ws = NULL;
+	s32 cpu;
+
+	if (lsbdd_zip_users++)
+		return 0;
+
+	lsbdd_zip_ws = alloc_percpu(struct lsbdd_zip_ws);
+	if (!lsbdd_zip_ws)
+		goto mem_err;
+	for_each_possible_cpu(cpu) {
+		ws = per_cpu_ptr(lsbdd_zip_ws, cpu);
+		ws->data = vmalloc(LSBDD_ZIP_MAX_BLOCK);
+		ws->zip = vmalloc(LSBDD_ZIP_MAX_BLOCK);
+		ws->wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+		if (!ws->data || !ws->zip || !ws->wrkmem)
+			goto mem_err;
+	}
+
+	lsbdd_zip_wq = alloc_workqueue("lsbdd_zip", WQ_HIGHPRI | WQ_MEM_RECLAIM, 0);
+	if (!lsbdd_zip_wq)
+		goto mem_err;
+	return 0;
+
+mem_err:
+	if (lsbdd_zip_ws)
+		lsbdd_zip_free_ws();
+	lsbdd_zip_users--;
+	return -ENOMEM;
+}
+
+/* Drops a reference, the last one waits for the reads in the workqueue */
+void lsbdd_zip_put(void)
+{
+	if (--lsbdd_zip_users)
+		return;
+
+	destroy_workqueue(lsbdd_zip_wq);
+	lsbdd_zip_wq = NULL;
+	lsbdd_zip_free_ws();
+}
+
+/* Frees the pages of a bio made by lsbdd_zip_compress() or lsbdd_zip_read() */
+void lsbdd_zip_free_pages(struct bio *bio)
+{
+	u16 i;
+
+	for (i = 0; i < bio->bi_vcnt; i++)
+		__free_page(bio->bi_io_vec[i].bv_page);
+}
+
+static struct bio *lsbdd_zip_alloc(struct block_device *bdev, u32 size, blk_opf_t opf, struct bio_set *bs)
+{
+	u16 nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	struct page *page = NULL;
+	struct bio *bio = NULL;
+	u16 i;
+
+	bio = bio_alloc_bioset(bdev, nr_pages, opf, GFP_NOIO, bs);
+	if (!bio)
+		return NULL;
+
+	for (i = 0; i < nr_pages; i++) {
+		page = alloc_page(GFP_NOIO);
+		if (!page) {
+			lsbdd_zip_free_pages(bio);
+			bio_put(bio);
+			return NULL;
+		}
+		__bio_add_page(bio, page, PAGE_SIZE, 0);
+	}
+	bio->bi_iter.bi_size = size;
+	return bio;
+}
+
+/**
+ * Compresses the data of a write with LZ4 into a new bio to bdev, that
+ * writes the block: the length of the LZ4 data, the data and zeroes up to
+ * the end of the logical block of bdev. Writes up to LSBDD_ZIP_MAX_BLOCK are
+ * compressed, if that saves a logical block at least.
+ *
+ * It returns the new bio or NULL, if the data is to be stored as is.
+ */
+struct bio *lsbdd_zip_compress(struct bio *bio, struct block_device *bdev, struct bio_set *bs)
+{
+	u32 lbs = bdev_logical_block_size(bdev);
+	u32 size = bio->bi_iter.bi_size;
+	struct lsbdd_zip_ws *ws = NULL;
+	struct bio *zip = NULL;
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	u32 copied = 0;
+	u32 stored = 0;
+	s32 len;
+	u16 i;
+
+	if (size <= lbs || size > LSBDD_ZIP_MAX_BLOCK)
+		return NULL;
+
+	/* The pages are taken for the largest block, that is worth it */
+	zip = lsbdd_zip_alloc(bdev, size - lbs, bio->bi_opf, bs);
+	if (!zip)
+		return NULL;
+	zip->bi_ioprio = bio->bi_ioprio;
+
+	ws = get_cpu_ptr(lsbdd_zip_ws);
+	bio_for_each_segment(bvec, bio, iter) {
+		memcpy_from_bvec(ws->data + copied, &bvec);
+		copied += bvec.bv_len;
+	}
+	len = LZ4_compress_default(ws->data, ws->zip + LSBDD_ZIP_HEADER, size,
+			size - lbs - LSBDD_ZIP_HEADER, ws->wrkmem);
+	if (len > 0) {
+		*(__le32 *)ws->zip = cpu_to_le32(len);
+		stored = round_up(len + LSBDD_ZIP_HEADER, lbs);
+		memset(ws->zip + LSBDD_ZIP_HEADER + len, 0, stored - LSBDD_ZIP_HEADER - len);
+		for (i = 0, copied = 0; copied < stored; i++, copied += PAGE_SIZE)
+			memcpy(page_address(zip->bi_io_vec[i].bv_page), ws->zip + copied,
+				min_t(u32, stored - copied, PAGE_SIZE));
+	}
+	put_cpu_ptr(lsbdd_zip_ws);
+
+	if (len <= 0) {
+		lsbdd_zip_free_pages(zip);
+		bio_put(zip);
+		return NULL;
+	}
+	zip->bi_iter.bi_size = stored;
+	return zip;
+}
+
+static void lsbdd_zip_read_work(struct work_struct *work)
+{
+	struct lsbdd_zip_read *zr = container_of(work, struct lsbdd_zip_read, work);
+	blk_status_t status = zr->read->bi_status;
+	struct lsbdd_zip_ws *ws = NULL;
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	u32 copied, len;
+	u16 i;
+
+	if (!status) {
+		ws = get_cpu_ptr(lsbdd_zip_ws);
+		for (i = 0, copied = 0; copied < zr->stored_size; i++, copied += PAGE_SIZE)
+			memcpy(ws->zip + copied, page_address(zr->read->bi_io_vec[i].bv_page),
+				min_t(u32, zr->stored_size - copied, PAGE_SIZE));
+		len = le32_to_cpu(*(__le32 *)ws->zip);
+		if (len > zr->stored_size - LSBDD_ZIP_HEADER ||
+			LZ4_decompress_safe(ws->zip + LSBDD_ZIP_HEADER, ws->data, len, zr->block_size) != zr->block_size) {
+			status = BLK_STS_IOERR;
+		} else {
+			copied = zr->offset;
+			__bio_for_each_segment(bvec, zr->bio, iter, zr->iter) {
+				memcpy_to_bvec(&bvec, ws->data + copied);
+				copied += bvec.bv_len;
+			}
+		}
+		put_cpu_ptr(lsbdd_zip_ws);
+		if (status)
+			pr_err_ratelimited("Compressed block of %u bytes is corrupted\n", zr->block_size);
+	}
+
+	if (status)
+		zr->parent->bi_status = status;
+	bio_endio(zr->parent);
+	lsbdd_zip_free_pages(zr->read);
+	bio_put(zr->read);
+	kfree(zr);
+}
+
+static void lsbdd_zip_read_end_io(struct bio *read)
+{
+	struct lsbdd_zip_read *zr = read->bi_private;
+
+	queue_work(lsbdd_zip_wq, &zr->work);
+}
+
+/**
+ * Reads the compressed block of rs_info from sector of bdev, to fill the
+ * part iter of bio with its data from offset on. The parent doesn't complete
+ * until the part is filled, it gets the error if that fails.
+ *
+ * It returns 0 on success, -ENOMEM if the read can't be allocated.
+ */
+s32 lsbdd_zip_read(struct bio *parent, struct bio *bio, struct bvec_iter *iter, struct block_device *bdev,
+		sector_t sector, const struct redir_sector_info *rs_info, u32 offset, struct bio_set *bs)
+{
+	struct lsbdd_zip_read *zr = NULL;
+
+	zr = kmalloc(sizeof(*zr), GFP_NOIO);
+	if (!zr)
+		return -ENOMEM;
+
+	zr->read = lsbdd_zip_alloc(bdev, rs_info->stored_size, REQ_OP_READ, bs);
+	if (!zr->read) {
+		kfree(zr);
+		return -ENOMEM;
+	}
+
+	INIT_WORK(&zr->work, lsbdd_zip_read_work);
+	zr->bio = bio;
+	zr->iter = *iter;
+	zr->offset = offset;
+	zr->block_size = rs_info->block_size;
+	zr->stored_size = rs_info->stored_size;
+	zr->parent = parent;
+	zr->read->bi_iter.bi_sector = sector;
+	zr->read->bi_ioprio = bio->bi_ioprio;
+	zr->read->bi_private = zr;
+	zr->read->bi_end_io = lsbdd_zip_read_end_io;
+
+	bio_inc_remaining(parent);
+	submit_bio(zr->read);
+	return 0;
+}
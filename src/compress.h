@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/bio.h>
+#include <linux/workqueue.h>
+#include "utils/ds-control.h"
+
+/* Largest write, that is compressed, its sizes must fit the mapping value */
+#define LSBDD_ZIP_MAX_BLOCK (DS_VALUE_ZIP_MAX_SECTORS << SECTOR_SHIFT)
+/* Length of the LZ4 data, that is stored in front of it in the block */
+#define LSBDD_ZIP_HEADER sizeof(__le32)
+
+/*
+ * Read of a compressed block for a part of a bio. The block is read into
+ * pages of its own and decompressed by a worker on the CPU, that completed
+ * the read, which then copies the part out and ends the parent.
+ */
+struct lsbdd_zip_read {
+	struct work_struct work;
+	struct bio *read;
+	/* Bio and the part of it, that is filled */
+	struct bio *bio;
+	struct bvec_iter iter;
+	/* Offset of the part in the data of the block and the size of the data */
+	u32 offset;
+	u32 block_size;
+	u32 stored_size;
+	/* Bio, that holds a reference until the part is filled */
+	struct bio *parent;
+};
+
+s32 lsbdd_zip_get(void);
+void lsbdd_zip_put(void);
+struct bio *lsbdd_zip_compress(struct bio *bio, struct block_device *bdev, struct bio_set *bs);
+void lsbdd_zip_free_pages(struct bio *bio);
+s32 lsbdd_zip_read(struct bio *parent, struct bio *bio, struct bvec_iter *iter, struct block_device *bdev,
+		sector_t sector, const struct redir_sector_info *rs_info, u32 offset, struct bio_set *bs);
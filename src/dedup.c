@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/xxhash.h>
+#include "dedup.h"
+
+#define LSBDD_DEDUP_SEED_LO 0
+#define LSBDD_DEDUP_SEED_HI 0x9e3779b97f4a7c15ULL
+
+struct lsbdd_dedup *lsbdd_dedup_alloc(void)
+{
+	struct lsbdd_dedup *dd = kvzalloc(sizeof(*dd), GFP_KERNEL);
+
+	if (!dd)
+		return NULL;
+
+	spin_lock_init(&dd->lock);
+	hash_init(dd->by_fp);
+	hash_init(dd->by_sector);
+	return dd;
+}
+
+void lsbdd_dedup_free(struct lsbdd_dedup *dd)
+{
+	struct lsbdd_dedup_entry *entry = NULL;
+	struct hlist_node *tmp = NULL;
+	u32 bkt;
+
+	if (!dd)
+		return;
+
+	hash_for_each_safe(dd->by_fp, bkt, tmp, entry, by_fp)
+		kfree(entry);
+	kvfree(dd);
+}
+
+/**
+ * Fingerprints the data of the bio. 128 bits make a collision unlikely
+ * enough, that blocks with equal fingerprints are taken as equal without
+ * reading the stored one back.
+ */
+void lsbdd_dedup_hash(struct bio *bio, struct lsbdd_dedup_fp *fp)
+{
+	struct xxh64_state lo, hi;
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	void *data = NULL;
+
+	xxh64_reset(&lo, LSBDD_DEDUP_SEED_LO);
+	xxh64_reset(&hi, LSBDD_DEDUP_SEED_HI);
+	bio_for_each_segment(bvec, bio, iter) {
+		data = bvec_kmap_local(&bvec);
+		xxh64_update(&lo, data, bvec.bv_len);
+		xxh64_update(&hi, data, bvec.bv_len);
+		kunmap_local(data);
+	}
+	fp->lo = xxh64_digest(&lo);
+	fp->hi = xxh64_digest(&hi);
+}
+
+static void lsbdd_dedup_unref(struct lsbdd_dedup *dd, struct lsbdd_dedup_entry *entry)
+{
+	if (--entry->refs)
+		return;
+
+	hash_del(&entry->by_fp);
+	hash_del(&entry->by_sector);
+	dd->nr_entries--;
+	kfree(entry);
+}
+
+/**
+ * Looks for a written block with the fingerprint and takes a reference to
+ * it for a new mapping.
+ *
+ * It returns the block or NULL if there is none.
+ */
+struct lsbdd_dedup_entry *lsbdd_dedup_get(struct lsbdd_dedup *dd, const struct lsbdd_dedup_fp *fp, u32 block_size)
+{
+	struct lsbdd_dedup_entry *entry = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	hash_for_each_possible(dd->by_fp, entry, by_fp, fp->lo) {
+		if (entry->fp.lo == fp->lo && entry->fp.hi == fp->hi && entry->block_size == block_size &&
+			entry->ready) {
+			entry->refs++;
+			dd->hits++;
+			dd->saved_bytes += block_size;
+			break;
+		}
+	}
+	if (!entry)
+		dd->misses++;
+	spin_unlock_irqrestore(&dd->lock, flags);
+
+	return entry;
+}
+
+/**
+ * Adds a block, that is about to be written, with a reference for its
+ * mapping and one for the write, that lsbdd_dedup_complete() drops.
+ *
+ * It returns the block or NULL if it isn't indexed (the index is full or a
+ * block with the fingerprint is indexed already).
+ */
+struct lsbdd_dedup_entry *lsbdd_dedup_add(struct lsbdd_dedup *dd, const struct lsbdd_dedup_fp *fp,
+		sector_t redirected_sector, u32 block_size)
+{
+	struct lsbdd_dedup_entry *entry = NULL;
+	struct lsbdd_dedup_entry *new = NULL;
+	unsigned long flags;
+
+	new = kmalloc(sizeof(*new), GFP_NOIO);
+	if (!new)
+		return NULL;
+	new->fp = *fp;
+	new->redirected_sector = redirected_sector;
+	new->block_size = block_size;
+	new->refs = 2;
+	new->writing = true;
+	new->ready = false;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	if (dd->nr_entries >= LSBDD_DEDUP_MAX_ENTRIES)
+		goto skip;
+	hash_for_each_possible(dd->by_fp, entry, by_fp, fp->lo) {
+		if (entry->fp.lo == fp->lo && entry->fp.hi == fp->hi)
+			goto skip;
+	}
+	hash_add(dd->by_fp, &new->by_fp, fp->lo);
+	hash_add(dd->by_sector, &new->by_sector, redirected_sector);
+	dd->nr_entries++;
+	spin_unlock_irqrestore(&dd->lock, flags);
+	return new;
+
+skip:
+	spin_unlock_irqrestore(&dd->lock, flags);
+	kfree(new);
+	return NULL;
+}
+
+/* Drops the reference of the write of the block, which is shared only if it succeeded */
+void lsbdd_dedup_complete(struct lsbdd_dedup *dd, struct lsbdd_dedup_entry *entry, bool written)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	entry->writing = false;
+	entry->ready = written;
+	lsbdd_dedup_unref(dd, entry);
+	spin_unlock_irqrestore(&dd->lock, flags);
+}
+
+/**
+ * Drops the reference of a mapping, that pointed to the block at the
+ * redirected sector.
+ *
+ * It returns true if no mapping points to the block anymore (or it wasn't
+ * indexed), false if it is still in use.
+ */
+bool lsbdd_dedup_put(struct lsbdd_dedup *dd, sector_t redirected_sector)
+{
+	struct lsbdd_dedup_entry *entry = NULL;
+	unsigned long flags;
+	bool unused = true;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	hash_for_each_possible(dd->by_sector, entry, by_sector, redirected_sector) {
+		if (entry->redirected_sector == redirected_sector) {
+			/* The write in flight holds a reference as well, but isn't a mapping */
+			unused = entry->refs - entry->writing == 1;
+			lsbdd_dedup_unref(dd, entry);
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dd->lock, flags);
+
+	return unused;
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/bio.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+
+#define LSBDD_DEDUP_HASH_BITS 16
+/* Blocks in the content index of a BD, new ones aren't added above it */
+#define LSBDD_DEDUP_MAX_ENTRIES (1 << 20)
+/* Blocks, that are hashed and shared, writes are split into them (4 KiB) */
+#define LSBDD_DEDUP_BLOCK_SECTORS 8
+/* Clones in flight, from which writes are hashed by the workqueue */
+#define LSBDD_DEDUP_DEFER_DEPTH 32
+
+/* Fingerprint of the data of a block, two xxh64 with different seeds */
+struct lsbdd_dedup_fp {
+	u64 lo;
+	u64 hi;
+};
+
+/* Block of the log, that any number of mappings may point to */
+struct lsbdd_dedup_entry {
+	struct hlist_node by_fp;
+	struct hlist_node by_sector;
+	struct lsbdd_dedup_fp fp;
+	sector_t redirected_sector;
+	u32 block_size;
+	/* Mappings to the block and the write of it, while it is in flight */
+	u32 refs;
+	bool writing;
+	/* Set once the write of the block succeeded, only then it is shared */
+	bool ready;
+};
+
+/* Content index of a BD */
+struct lsbdd_dedup {
+	/* Protects everything below, taken from the completions as well */
+	spinlock_t lock;
+	DECLARE_HASHTABLE(by_fp, LSBDD_DEDUP_HASH_BITS);
+	DECLARE_HASHTABLE(by_sector, LSBDD_DEDUP_HASH_BITS);
+	u32 nr_entries;
+	u64 hits;
+	u64 misses;
+	u64 saved_bytes;
+};
+
+struct lsbdd_dedup *lsbdd_dedup_alloc(void);
+void lsbdd_dedup_free(struct lsbdd_dedup *dd);
+void lsbdd_dedup_hash(struct bio *bio, struct lsbdd_dedup_fp *fp);
+struct lsbdd_dedup_entry *lsbdd_dedup_get(struct lsbdd_dedup *dd, const struct lsbdd_dedup_fp *fp, u32 block_size);
+struct lsbdd_dedup_entry *lsbdd_dedup_add(struct lsbdd_dedup *dd, const struct lsbdd_dedup_fp *fp,
+		sector_t redirected_sector, u32 block_size);
+void lsbdd_dedup_complete(struct lsbdd_dedup *dd, struct lsbdd_dedup_entry *entry, bool written);
+bool lsbdd_dedup_put(struct lsbdd_dedup *dd, sector_t redirected_sector);
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "utils/ds-control.h"
+#include "main.h"
+#include "defrag.h"
+
+/* Tells if hi follows lo in the logical space, but not in the log */
+static bool lsbdd_defrag_split(sector_t lo_key, u64 lo_value, sector_t hi_key, u64 hi_value)
+{
+	struct redir_sector_info lo, hi;
+
+	ds_unpack_value(lo_value, &lo);
+	ds_unpack_value(hi_value, &hi);
+	return lo_key + (lo.block_size >> SECTOR_SHIFT) == hi_key &&
+		lo.redirected_sector + ds_stored_sectors(&lo) != hi.redirected_sector;
+}
+
+/* Closes the window of the scan, it is kept if it is fragmented enough and there is room */
+static void lsbdd_defrag_close_window(struct lsbdd_defrag *df)
+{
+	if (df->started && df->splits >= LSBDD_DEFRAG_MIN_SPLITS && df->nr_found < LSBDD_DEFRAG_MAX_WINDOWS)
+		df->found[df->nr_found++] = df->window;
+	df->started = false;
+}
+
+/*
+ * Accounts one entry of the scan. The entries can come in ascending or in
+ * descending key order, a pair of neighbours is looked at from the lower key.
+ */
+static void lsbdd_defrag_account(struct lsbdd_defrag *df, const struct ds_entry *entry)
+{
+	sector_t window = entry->key >> LSBDD_DEFRAG_WINDOW_SHIFT;
+
+	if (!df->started || window != df->window) {
+		lsbdd_defrag_close_window(df);
+		df->window = window;
+		df->splits = 0;
+		df->started = true;
+	} else if (entry->key < df->prev.key ?
+			lsbdd_defrag_split(entry->key, entry->value, df->prev.key, df->prev.value) :
+			lsbdd_defrag_split(df->prev.key, df->prev.value, entry->key, entry->value)) {
+		df->splits++;
+	}
+	df->prev = *entry;
+}
+
+/**
+ * Goes on with the scan of the mapping for fragmented windows, up to
+ * LSBDD_DEFRAG_SCAN_BATCHES batches under ds_lock held for read. The scan
+ * starts over once it reached the end or the data structure was switched.
+ * The hashtable has no key order to scan in, it isn't defragmented.
+ *
+ * It returns 0 on success, negative error code otherwise.
+ */
+static s32 lsbdd_defrag_scan(struct lsbdd_defrag *df)
+{
+	struct bd_manager *manager = df->manager;
+	struct ds_entry *entries = NULL;
+	s32 read = 0, i;
+	u32 batch;
+
+	entries = kmalloc_array(DS_MIGRATE_BATCH, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	for (batch = 0; batch < LSBDD_DEFRAG_SCAN_BATCHES && df->nr_found < LSBDD_DEFRAG_MAX_WINDOWS; batch++) {
+		down_read(&manager->ds_lock);
+		if (manager->sel_data_struct != df->ds) {
+			df->ds = manager->sel_data_struct;
+			memset(&df->cursor, 0, sizeof(df->cursor));
+			df->started = false;
+		}
+		if (df->ds->type == HASHTABLE_TYPE)
+			read = 0;
+		else
+			read = ds_read_batch(df->ds, &df->cursor, entries, DS_MIGRATE_BATCH);
+		up_read(&manager->ds_lock);
+
+		if (read < 0)
+			break;
+		for (i = 0; i < read; i++)
+			lsbdd_defrag_account(df, &entries[i]);
+		if (!df->cursor.done)
+			continue;
+
+		lsbdd_defrag_close_window(df);
+		memset(&df->cursor, 0, sizeof(df->cursor));
+		WRITE_ONCE(df->scans, df->scans + 1);
+		break;
+	}
+
+	kfree(entries);
+	return read < 0 ? read : 0;
+}
+
+/**
+ * Collects the mappings, that start in the window, into moves in key order,
+ * but the ones of compressed blocks, which are read whole anyway. The walk
+ * goes down from the end of the window, ds_prev() is strict, so it never
+ * takes the first mapping of the next window. Must be called with ds_lock
+ * held, moves has room for LSBDD_DEFRAG_WINDOW_SECTORS mappings.
+ *
+ * It returns the number of the collected mappings.
+ */
+u32 lsbdd_defrag_collect(struct data_struct *ds, sector_t window, struct lsbdd_tier_move *moves)
+{
+	struct redir_sector_info rs_info;
+	struct lsbdd_tier_move tmp;
+	sector_t start = window << LSBDD_DEFRAG_WINDOW_SHIFT;
+	sector_t key = start + LSBDD_DEFRAG_WINDOW_SECTORS;
+	u32 nr = 0, i;
+
+	while (nr < LSBDD_DEFRAG_WINDOW_SECTORS && !ds_prev(ds, key, &key, &rs_info) && key >= start) {
+		if (rs_info.stored_size)
+			continue;
+		moves[nr].key = key;
+		moves[nr++].old_value = ds_pack_value(&rs_info);
+	}
+
+	for (i = 0; i < nr / 2; i++) {
+		tmp = moves[i];
+		moves[i] = moves[nr - 1 - i];
+		moves[nr - 1 - i] = tmp;
+	}
+	return nr;
+}
+
+/**
+ * Appends the mappings, that start in the window, to the log in key order.
+ * They are collected under ds_lock held for read, and only copied once the
+ * writes, that were in flight meanwhile, completed: a mapping is inserted
+ * before its block is written. The mappings are pointed to the copy under one
+ * hold of ds_lock for write, the ones that changed during the copy are left
+ * as they are. Compressed blocks are read whole anyway, they stay in place.
+ *
+ * It returns the copied bytes, 0 if the window isn't fragmented anymore,
+ * negative error code otherwise.
+ */
+static s64 lsbdd_defrag_window(struct lsbdd_defrag *df, sector_t window)
+{
+	struct bd_manager *manager = df->manager;
+	struct lsbdd_tier_move *moves = df->moves;
+	struct redir_sector_info rs_info;
+	sector_t total = 0, redirect;
+	u32 nr, splits = 0, i;
+	s32 status = 0;
+
+	down_read(&manager->ds_lock);
+	nr = lsbdd_defrag_collect(manager->sel_data_struct, window, moves);
+	up_read(&manager->ds_lock);
+
+	for (i = 1; i < nr; i++)
+		splits += lsbdd_defrag_split(moves[i - 1].key, moves[i - 1].old_value, moves[i].key, moves[i].old_value);
+	if (splits < LSBDD_DEFRAG_MIN_SPLITS)
+		return 0;
+
+	synchronize_srcu(&df->writes);
+
+	for (i = 0; i < nr; i++) {
+		ds_unpack_value(moves[i].old_value, &rs_info);
+		total += rs_info.block_size >> SECTOR_SHIFT;
+	}
+	down_write(&manager->ds_lock);
+	status = lsbdd_stripe_alloc(manager, total, &redirect);
+	up_write(&manager->ds_lock);
+	if (status)
+		return status;
+
+	for (i = 0; i < nr; i++) {
+		ds_unpack_value(moves[i].old_value, &rs_info);
+		rs_info.redirected_sector = redirect;
+		redirect += rs_info.block_size >> SECTOR_SHIFT;
+		moves[i].new_value = ds_pack_value(&rs_info);
+	}
+
+	status = lsbdd_tier_copy(manager, LSBDD_IO_DEFRAG, moves, nr);
+	if (status)
+		return status;
+
+	down_write(&manager->ds_lock);
+	for (i = 0; i < nr; i++) {
+		if (ds_lookup(manager->sel_data_struct, moves[i].key, &rs_info) ||
+			ds_pack_value(&rs_info) != moves[i].old_value) {
+			df->raced++;
+			continue;
+		}
+
+		ds_remove(manager->sel_data_struct, moves[i].key);
+		ds_unpack_value(moves[i].new_value, &rs_info);
+		status = ds_insert(manager->sel_data_struct, moves[i].key, &rs_info);
+		if (status) {
+			ds_unpack_value(moves[i].old_value, &rs_info);
+			ds_insert(manager->sel_data_struct, moves[i].key, &rs_info);
+			break;
+		}
+		ds_migration_capture(&manager->migration, moves[i].key, &rs_info);
+	}
+	df->windows++;
+	df->moved_bytes += (u64)total << SECTOR_SHIFT;
+	/* The copied mappings follow each other in the log, the merge pass folds them */
+	if (manager->hybrid)
+		lsbdd_hybrid_merge(manager);
+	up_write(&manager->ds_lock);
+
+	return status ? status : (s64)total << SECTOR_SHIFT;
+}
+
+/*
+ * Moves the fragmented windows, that were found, as long as the budget of
+ * the run lasts, the rest is left for the next run. The scan only goes on
+ * while there is room for more windows.
+ */
+static void lsbdd_defrag_work(struct work_struct *work)
+{
+	struct lsbdd_defrag *df = container_of(to_delayed_work(work), struct lsbdd_defrag, work);
+	u64 budget = div_u64(df->rate * LSBDD_DEFRAG_INTERVAL_MS, MSEC_PER_SEC);
+	u64 used = 0;
+	s64 moved = 0;
+	s32 status;
+	u32 i;
+
+	status = lsbdd_defrag_scan(df);
+	for (i = 0; i < df->nr_found && !status && used < budget && !READ_ONCE(df->stop); i++) {
+		moved = lsbdd_defrag_window(df, df->found[i]);
+		if (moved < 0)
+			status = moved;
+		else
+			used += moved;
+	}
+	df->nr_found -= i;
+	memmove(df->found, df->found + i, df->nr_found * sizeof(*df->found));
+
+	if (status)
+		pr_err_ratelimited("Defragmentation failed with code %d\n", status);
+	if (!READ_ONCE(df->stop))
+		queue_delayed_work(system_unbound_wq, &df->work, msecs_to_jiffies(LSBDD_DEFRAG_INTERVAL_MS));
+}
+
+/**
+ * Sets up the background defragmentation of a BD, that copies up to rate_mb
+ * MiB per second, and starts its worker.
+ *
+ * It returns 0 on success, negative error code otherwise.
+ */
+s32 lsbdd_defrag_init(struct bd_manager *manager, u32 rate_mb)
+{
+	struct lsbdd_defrag *df = NULL;
+	s32 status;
+
+	df = kzalloc(sizeof(*df), GFP_KERNEL);
+	if (!df)
+		return -ENOMEM;
+
+	df->moves = kvmalloc_array(LSBDD_DEFRAG_WINDOW_SECTORS, sizeof(*df->moves), GFP_KERNEL);
+	if (!df->moves) {
+		kfree(df);
+		return -ENOMEM;
+	}
+
+	status = init_srcu_struct(&df->writes);
+	if (status) {
+		kvfree(df->moves);
+		kfree(df);
+		return status;
+	}
+
+	df->manager = manager;
+	df->rate = (u64)rate_mb << 20;
+	INIT_DELAYED_WORK(&df->work, lsbdd_defrag_work);
+	manager->defrag = df;
+	queue_delayed_work(system_unbound_wq, &df->work, msecs_to_jiffies(LSBDD_DEFRAG_INTERVAL_MS));
+
+	pr_info("Defragmenting BD: up to %u MiB/s\n", rate_mb);
+	return 0;
+}
+
+/* Stops the worker and frees the state, must be called once no I/O comes to the BD */
+void lsbdd_defrag_free(struct bd_manager *manager)
+{
+	struct lsbdd_defrag *df = manager->defrag;
+
+	if (!df)
+		return;
+
+	WRITE_ONCE(df->stop, true);
+	cancel_delayed_work_sync(&df->work);
+	cleanup_srcu_struct(&df->writes);
+	kvfree(df->moves);
+	kfree(df);
+	manager->defrag = NULL;
+}
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/srcu.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include "utils/ds-control.h"
+
+/* The worker runs once per interval and copies at most rate * interval */
+#define LSBDD_DEFRAG_INTERVAL_MS 1000
+/* Logical windows, that are looked at and moved as a whole (1 MiB) */
+#define LSBDD_DEFRAG_WINDOW_SHIFT 11
+#define LSBDD_DEFRAG_WINDOW_SECTORS (1U << LSBDD_DEFRAG_WINDOW_SHIFT)
+/* Discontinuities in a window, that make it worth moving */
+#define LSBDD_DEFRAG_MIN_SPLITS 4
+/* Windows found per run at most, a run moves them before it scans further */
+#define LSBDD_DEFRAG_MAX_WINDOWS 64
+/* Batches of DS_MIGRATE_BATCH mappings scanned per run at most */
+#define LSBDD_DEFRAG_SCAN_BATCHES 64
+
+struct bd_manager;
+struct lsbdd_tier_move;
+
+/*
+ * Background defragmentation of a BD. The worker scans the mapping in key
+ * order, a bit further every run, for logical windows, whose mappings are
+ * adjacent but scattered over the log. Such a window is read and appended
+ * to the log again in key order, then its mappings are pointed to the copy
+ * under one hold of ds_lock, unless they changed meanwhile.
+ */
+struct lsbdd_defrag {
+	struct bd_manager *manager;
+	struct delayed_work work;
+	/* Writes in flight, a copy waits for them, the blocks may not be written yet */
+	struct srcu_struct writes;
+	/* Bytes per second, that the worker may copy */
+	u64 rate;
+	/* Moves of a window, kept for the worker */
+	struct lsbdd_tier_move *moves;
+	/* Scan, that goes on in the next run, and the window it is in */
+	struct data_struct *ds;
+	struct ds_cursor cursor;
+	struct ds_entry prev;
+	sector_t window;
+	u32 splits;
+	bool started;
+	sector_t found[LSBDD_DEFRAG_MAX_WINDOWS];
+	u32 nr_found;
+	bool stop;
+	/* Scans, that went through the whole mapping */
+	u64 scans;
+	/* Below is protected by ds_lock */
+	u64 windows;
+	u64 moved_bytes;
+	/* Mappings, that were overwritten while they were copied */
+	u64 raced;
+};
+
+s32 lsbdd_defrag_init(struct bd_manager *manager, u32 rate_mb);
+void lsbdd_defrag_free(struct bd_manager *manager);
+u32 lsbdd_defrag_collect(struct data_struct *ds, sector_t window, struct lsbdd_tier_move *moves);
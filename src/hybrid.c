@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/log2.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include "utils/ds-control.h"
+#include "main.h"
+#include "hybrid.h"
+
+/* Drops the mapping of key, its sectors are accounted as overwritten */
+static void lsbdd_hybrid_drop(struct bd_manager *manager, sector_t key, u32 sectors)
+{
+	ds_remove(manager->sel_data_struct, key);
+	ds_migration_capture(&manager->migration, key, NULL);
+	manager->nr_mappings--;
+	this_cpu_add(manager->stats->overwritten_bytes, (u64)sectors << SECTOR_SHIFT);
+}
+
+/* Maps key to rs_info in place of old, which is restored if that fails */
+static s32 lsbdd_hybrid_replace(struct bd_manager *manager, sector_t key, const struct redir_sector_info *old,
+		const struct redir_sector_info *rs_info)
+{
+	s32 status;
+
+	ds_remove(manager->sel_data_struct, key);
+	status = ds_insert(manager->sel_data_struct, key, rs_info);
+	if (status) {
+		ds_insert(manager->sel_data_struct, key, old);
+		return status;
+	}
+
+	ds_migration_capture(&manager->migration, key, rs_info);
+	return 0;
+}
+
+/* Maps the part of old from offset sectors on under key, as a mapping of its own */
+static s32 lsbdd_hybrid_rekey(struct bd_manager *manager, sector_t key, const struct redir_sector_info *old,
+		u32 offset)
+{
+	struct redir_sector_info part = {
+		.redirected_sector = old->redirected_sector + offset,
+		.block_size = old->block_size - (offset << SECTOR_SHIFT),
+	};
+	s32 status;
+
+	status = ds_insert(manager->sel_data_struct, key, &part);
+	if (status)
+		return status;
+
+	ds_migration_capture(&manager->migration, key, &part);
+	manager->nr_mappings++;
+	return 0;
+}
+
+/* Sectors a folded mapping may span, in the data structure and in the one a migration goes to */
+static u32 lsbdd_hybrid_max_sectors(struct bd_manager *manager)
+{
+	u32 extent = ds_max_extent(manager->sel_data_struct);
+
+	if (ds_migration_running(&manager->migration))
+		extent = min(extent, ds_max_extent(manager->migration.target));
+	return extent;
+}
+
+/*
+ * Tells if the mapping of next continues the one of key in the logical space
+ * and in the log, and both are in one coarse block, that the data structure
+ * can map by a single mapping.
+ */
+static bool lsbdd_hybrid_foldable(struct lsbdd_hybrid *hy, sector_t key, const struct redir_sector_info *rs_info,
+		sector_t next_key, const struct redir_sector_info *next)
+{
+	u32 sectors = rs_info->block_size >> SECTOR_SHIFT;
+
+	return sectors + (next->block_size >> SECTOR_SHIFT) <= lsbdd_hybrid_max_sectors(hy->manager) &&
+		key + sectors == next_key &&
+		rs_info->redirected_sector + sectors == next->redirected_sector &&
+		key >> hy->block_shift == (next_key + (next->block_size >> SECTOR_SHIFT) - 1) >> hy->block_shift;
+}
+
+static void lsbdd_hybrid_work(struct work_struct *work);
+
+/**
+ * Sets up the hybrid mapping of a BD with coarse blocks of block_kb, which is
+ * rounded down to a power of two within the limits.
+ *
+ * It returns 0 on success, -ENOMEM otherwise.
+ */
+s32 lsbdd_hybrid_init(struct bd_manager *manager, u32 block_kb)
+{
+	struct lsbdd_hybrid *hy = NULL;
+
+	hy = kzalloc(sizeof(*hy), GFP_KERNEL);
+	if (!hy)
+		return -ENOMEM;
+
+	block_kb = clamp_t(u32, block_kb, LSBDD_HYBRID_MIN_KB, LSBDD_HYBRID_MAX_KB);
+	hy->manager = manager;
+	hy->block_shift = ilog2(block_kb) + 10 - SECTOR_SHIFT;
+	INIT_WORK(&hy->work, lsbdd_hybrid_work);
+	manager->hybrid = hy;
+
+	pr_info("Hybrid BD: coarse blocks of %u KiB\n", 1U << (hy->block_shift + SECTOR_SHIFT - 10));
+	return 0;
+}
+
+/* Stops the merge pass and frees the state, must be called once no I/O comes to the BD */
+void lsbdd_hybrid_free(struct bd_manager *manager)
+{
+	struct lsbdd_hybrid *hy = manager->hybrid;
+
+	if (!hy)
+		return;
+
+	WRITE_ONCE(hy->stop, true);
+	cancel_work_sync(&hy->work);
+	kfree(hy);
+	manager->hybrid = NULL;
+}
+
+/**
+ * Cuts the mappings, that the write of sectors at original overlaps, before
+ * it is mapped. The ones starting inside of the write are dropped, or keep
+ * only their part after it. The one holding original keeps its part before
+ * the write under its key, and its part after the write is mapped under the
+ * end of the write. If it starts at original, it keeps only the written
+ * sectors, so that the overwrite accounts just them. Must be called with ds_lock held for write.
+ *
+ * It returns 0 on success, negative error code if a mapping can't be inserted.
+ */
+s32 lsbdd_hybrid_cut(struct bd_manager *manager, sector_t original, u32 sectors)
+{
+	struct data_struct *ds = manager->sel_data_struct;
+	struct redir_sector_info old, head;
+	sector_t written_end = original + sectors;
+	sector_t key = written_end;
+	sector_t start, end;
+	s32 status;
+
+	/*
+	 * The walk down from the end of the write stops at the mapping holding
+	 * original. ds_prev() is strict, a mapping starting at the end of the
+	 * write isn't overlapped and is never seen.
+	 */
+	for (;;) {
+		if (ds_prev(ds, key, &start, &old))
+			return 0;
+		if (start <= original)
+			break;
+
+		end = start + (old.block_size >> SECTOR_SHIFT);
+		key = start;
+		if (end > written_end) {
+			status = lsbdd_hybrid_rekey(manager, written_end, &old, written_end - start);
+			if (status)
+				return status;
+			manager->hybrid->cut++;
+			lsbdd_hybrid_drop(manager, start, written_end - start);
+		} else {
+			lsbdd_hybrid_drop(manager, start, ds_stored_sectors(&old));
+		}
+	}
+
+	end = start + (old.block_size >> SECTOR_SHIFT);
+	if (end <= original || (start == original && end <= written_end))
+		return 0;
+
+	if (end > written_end) {
+		status = lsbdd_hybrid_rekey(manager, written_end, &old, written_end - start);
+		if (status)
+			return status;
+	}
+
+	head = old;
+	head.block_size = ((start < original ? original : written_end) - start) << SECTOR_SHIFT;
+	status = lsbdd_hybrid_replace(manager, start, &old, &head);
+	if (status) {
+		if (end > written_end) {
+			ds_remove(ds, written_end);
+			ds_migration_capture(&manager->migration, written_end, NULL);
+			manager->nr_mappings--;
+		}
+		return status;
+	}
+
+	if (start < original)
+		this_cpu_add(manager->stats->overwritten_bytes,
+			(u64)(min(end, written_end) - original) << SECTOR_SHIFT);
+	manager->hybrid->cut++;
+	return 0;
+}
+
+/**
+ * Extends the mapping before original by the block of a write, that isn't
+ * mapped, if the block continues it (see lsbdd_hybrid_foldable()). A block,
+ * that gets a mapping of its own, counts towards the next merge pass. Must be
+ * called with ds_lock held for write.
+ *
+ * It returns 1 if the mapping was extended, 0 if the block is to be mapped
+ * on its own, negative error code if the mapping can't be replaced.
+ */
+s32 lsbdd_hybrid_extend(struct bd_manager *manager, sector_t original, const struct redir_sector_info *rs_info)
+{
+	struct lsbdd_hybrid *hy = manager->hybrid;
+	struct redir_sector_info prev, merged;
+	sector_t prev_key;
+	s32 status;
+
+	if (ds_prev(manager->sel_data_struct, original, &prev_key, &prev) ||
+		!lsbdd_hybrid_foldable(hy, prev_key, &prev, original, rs_info)) {
+		if (++hy->fine >= LSBDD_HYBRID_MERGE_INTERVAL)
+			lsbdd_hybrid_merge(manager);
+		return 0;
+	}
+
+	merged = prev;
+	merged.block_size += rs_info->block_size;
+	status = lsbdd_hybrid_replace(manager, prev_key, &prev, &merged);
+	if (status)
+		return status;
+
+	hy->extended++;
+	return 1;
+}
+
+/**
+ * Folds two mappings, that follow each other in key order, into the lower
+ * one, if it is continued by the higher one. On success lo is updated to the
+ * folded mapping.
+ *
+ * It returns 1 if they were folded, 0 if not, negative error code if the
+ * lower mapping can't be replaced.
+ */
+static s32 lsbdd_hybrid_fold(struct bd_manager *manager, sector_t lo_key, struct redir_sector_info *lo,
+		sector_t hi_key, const struct redir_sector_info *hi)
+{
+	struct redir_sector_info merged = *lo;
+	s32 status;
+
+	if (!lsbdd_hybrid_foldable(manager->hybrid, lo_key, lo, hi_key, hi))
+		return 0;
+
+	merged.block_size += hi->block_size;
+	ds_remove(manager->sel_data_struct, hi_key);
+	status = lsbdd_hybrid_replace(manager, lo_key, lo, &merged);
+	if (status) {
+		ds_insert(manager->sel_data_struct, hi_key, hi);
+		return status;
+	}
+
+	ds_migration_capture(&manager->migration, hi_key, NULL);
+	manager->nr_mappings--;
+	*lo = merged;
+	return 1;
+}
+
+/*
+ * Walks the mapping in batches under ds_lock held for write and folds the
+ * neighbours, that continue each other. The walk keeps the last mapping it
+ * saw, which is checked again after the lock was dropped. The hashtable has
+ * no key order to walk in, a migration to another backend ends the pass.
+ */
+static void lsbdd_hybrid_work(struct work_struct *work)
+{
+	struct lsbdd_hybrid *hy = container_of(work, struct lsbdd_hybrid, work);
+	struct bd_manager *manager = hy->manager;
+	struct redir_sector_info run, cur, check;
+	struct ds_entry *entries = NULL;
+	struct ds_cursor cursor = {};
+	struct data_struct *ds = NULL;
+	sector_t run_key = 0;
+	bool has_run = false;
+	u64 merged = 0;
+	s32 read, i;
+
+	entries = kmalloc_array(DS_MIGRATE_BATCH, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return;
+
+	down_read(&manager->ds_lock);
+	ds = manager->sel_data_struct;
+	up_read(&manager->ds_lock);
+	if (ds->type == HASHTABLE_TYPE)
+		goto out;
+
+	while (!cursor.done && !READ_ONCE(hy->stop)) {
+		down_write(&manager->ds_lock);
+		if (manager->sel_data_struct != ds) {
+			up_write(&manager->ds_lock);
+			break;
+		}
+		if (has_run && (ds_lookup(ds, run_key, &check) || ds_pack_value(&check) != ds_pack_value(&run)))
+			has_run = false;
+
+		read = ds_read_batch(ds, &cursor, entries, DS_MIGRATE_BATCH);
+		for (i = 0; i < read; i++) {
+			ds_unpack_value(entries[i].value, &cur);
+			/* Ordered backends are read from the highest key down, DFTL up */
+			if (has_run && entries[i].key < run_key && lsbdd_hybrid_fold(manager, entries[i].key, &cur,
+					run_key, &run) > 0) {
+				merged++;
+			} else if (has_run && entries[i].key > run_key && lsbdd_hybrid_fold(manager, run_key, &run,
+					entries[i].key, &cur) > 0) {
+				merged++;
+				continue;
+			}
+			run = cur;
+			run_key = entries[i].key;
+			has_run = true;
+		}
+		hy->merged += merged;
+		merged = 0;
+		up_write(&manager->ds_lock);
+		if (read < 0)
+			break;
+		cond_resched();
+	}
+
+	down_write(&manager->ds_lock);
+	hy->passes++;
+	up_write(&manager->ds_lock);
+out:
+	kfree(entries);
+}
+
+/* Queues a merge pass, called with ds_lock held for write */
+void lsbdd_hybrid_merge(struct bd_manager *manager)
+{
+	manager->hybrid->fine = 0;
+	queue_work(system_unbound_wq, &manager->hybrid->work);
+}
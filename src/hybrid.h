@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/* Sizes of a coarse block, it must fit the block size of a mapping value */
+#define LSBDD_HYBRID_MIN_KB 8
+#define LSBDD_HYBRID_MAX_KB 16384
+/* Mappings, that weren't folded into the one before them, between two merge passes */
+#define LSBDD_HYBRID_MERGE_INTERVAL (1 << 16)
+
+struct bd_manager;
+struct redir_sector_info;
+
+/*
+ * Hybrid mapping of a BD. The logical space is cut in aligned coarse blocks:
+ * a write, that continues the mapping before it in the same coarse block both
+ * in the logical space and in the log, extends that mapping, so a coarse
+ * block written in order takes a single one. A write into a mapping cuts it
+ * around the written sectors, the fine mappings of random updates stay until
+ * the merge pass finds their neighbours contiguous in the log again and folds
+ * them back. So mappings never overlap, and their number follows the random
+ * writes instead of the capacity.
+ */
+struct lsbdd_hybrid {
+	struct bd_manager *manager;
+	struct work_struct work;
+	u8 block_shift;
+	/* Below is protected by ds_lock */
+	u32 fine;
+	bool stop;
+	u64 extended;
+	u64 cut;
+	u64 merged;
+	u64 passes;
+};
+
+s32 lsbdd_hybrid_init(struct bd_manager *manager, u32 block_kb);
+void lsbdd_hybrid_free(struct bd_manager *manager);
+s32 lsbdd_hybrid_cut(struct bd_manager *manager, sector_t original, u32 sectors);
+s32 lsbdd_hybrid_extend(struct bd_manager *manager, sector_t original, const struct redir_sector_info *rs_info);
+void lsbdd_hybrid_merge(struct bd_manager *manager);
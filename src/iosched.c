@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/bio.h>
+#include <linux/delay.h>
+#include <linux/ioprio.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include "iosched.h"
+
+/*
+ * Backs off by one more step, if the foreground reads were slower than the
+ * target since the last time, or by one step less otherwise.
+ */
+static void lsbdd_iosched_adjust(struct lsbdd_iosched *sched, u64 now)
+{
+	u64 reads = READ_ONCE(sched->fg_reads);
+	u64 target = sched->target_ns;
+	bool slow;
+
+	spin_lock(&sched->lock);
+	if (now < sched->adjust_ns) {
+		spin_unlock(&sched->lock);
+		return;
+	}
+
+	sched->adjust_ns = now + LSBDD_IOSCHED_ADJUST_MS * NSEC_PER_MSEC;
+	if (!target)
+		target = READ_ONCE(sched->lat_slow) * LSBDD_IOSCHED_SLOW_FACTOR;
+	/* Without foreground reads meanwhile there is nothing to back off for */
+	slow = target && reads != sched->seen_reads && READ_ONCE(sched->lat_fast) > target;
+	if (slow && sched->backoff < LSBDD_IOSCHED_MAX_BACKOFF) {
+		WRITE_ONCE(sched->backoff, sched->backoff + 1);
+		sched->backoffs++;
+	} else if (!slow && sched->backoff) {
+		WRITE_ONCE(sched->backoff, sched->backoff - 1);
+	}
+	sched->seen_reads = reads;
+	spin_unlock(&sched->lock);
+}
+
+/* Sets up the scheduler of a BD with the budgets of the classes and the latency target */
+void lsbdd_iosched_init(struct lsbdd_iosched *sched, const u32 *bandwidth_mb, const u32 *iops, u32 target_us)
+{
+	u32 i;
+
+	for (i = 0; i < LSBDD_IO_NR_CLASSES; i++) {
+		sched->budgets[i].bandwidth = (u64)bandwidth_mb[i] << 20;
+		sched->budgets[i].iops = iops[i];
+	}
+	sched->target_ns = (u64)target_us * NSEC_PER_USEC;
+	atomic_set(&sched->bg_inflight, 0);
+	spin_lock_init(&sched->lock);
+}
+
+/* Accounts the latency of a foreground read, concurrent completions may lose a sample */
+void lsbdd_iosched_read_done(struct lsbdd_iosched *sched, u64 ns)
+{
+	u64 fast = READ_ONCE(sched->lat_fast);
+	u64 slow = READ_ONCE(sched->lat_slow);
+
+	WRITE_ONCE(sched->lat_fast, fast ? fast - (fast >> 3) + (ns >> 3) : ns);
+	if (!atomic_read(&sched->bg_inflight))
+		WRITE_ONCE(sched->lat_slow, slow ? slow - (slow >> 8) + (ns >> 8) : ns);
+	WRITE_ONCE(sched->fg_reads, sched->fg_reads + 1);
+}
+
+/**
+ * Waits until the class may send the background bio and tags it: the idle
+ * priority class, and a write is marked as background for the throttling of
+ * the backing device. The budget is spent on the bio, time that the class
+ * didn't use isn't saved up for later. Must be paired with
+ * lsbdd_iosched_end() once the bio completed.
+ *
+ * It returns the time the bio is sent at in ns.
+ */
+u64 lsbdd_iosched_begin(struct lsbdd_iosched *sched, enum lsbdd_io_class class, struct bio *bio)
+{
+	struct lsbdd_io_budget *budget = &sched->budgets[class];
+	u64 now = ktime_get_ns();
+	u64 cost = 0;
+
+	lsbdd_iosched_adjust(sched, now);
+	if (budget->next_ns > now) {
+		fsleep(div_u64(budget->next_ns - now, NSEC_PER_USEC));
+		budget->throttled_ns += budget->next_ns - now;
+		now = ktime_get_ns();
+	}
+
+	if (budget->bandwidth)
+		cost = div64_u64((u64)bio->bi_iter.bi_size * NSEC_PER_SEC, budget->bandwidth);
+	if (budget->iops)
+		cost = max_t(u64, cost, div_u64(NSEC_PER_SEC, budget->iops));
+	budget->next_ns = max(budget->next_ns, now) + cost;
+	budget->ios++;
+	budget->bytes += bio->bi_iter.bi_size;
+
+	bio->bi_ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+	if (op_is_write(bio_op(bio)))
+		bio->bi_opf |= REQ_BACKGROUND;
+	atomic_inc(&sched->bg_inflight);
+	return now;
+}
+
+/* Ends a background bio, a backing off class keeps the device idle for a while after it */
+void lsbdd_iosched_end(struct lsbdd_iosched *sched, enum lsbdd_io_class class, u64 start_ns)
+{
+	struct lsbdd_io_budget *budget = &sched->budgets[class];
+	u32 backoff = READ_ONCE(sched->backoff);
+	u64 now = ktime_get_ns();
+
+	atomic_dec(&sched->bg_inflight);
+	if (backoff)
+		budget->next_ns = max(budget->next_ns, now + (now - start_ns) * ((1ULL << backoff) - 1));
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* The backoff is reconsidered at most once per interval */
+#define LSBDD_IOSCHED_ADJUST_MS 100
+/* Background I/O takes at most 1 / 2^backoff of the time of the device */
+#define LSBDD_IOSCHED_MAX_BACKOFF 6
+/* The foreground is slow above this multiple of its latency without background I/O */
+#define LSBDD_IOSCHED_SLOW_FACTOR 2
+/* One in that many foreground reads updates the latency averages */
+#define LSBDD_IOSCHED_SAMPLE_MASK 7
+
+struct bio;
+
+/* Classes of the I/O, that the driver sends on its own, indexes of the budget parameters */
+enum lsbdd_io_class {
+	LSBDD_IO_TIER,
+	LSBDD_IO_DEFRAG,
+	LSBDD_IO_NR_CLASSES
+};
+
+/* Budget and pacing of a class, only the worker of the class touches it */
+struct lsbdd_io_budget {
+	/* Bytes and I/Os per second, 0 is unlimited */
+	u64 bandwidth;
+	u32 iops;
+	/* Time, before which the next I/O of the class isn't sent */
+	u64 next_ns;
+	u64 ios;
+	u64 bytes;
+	u64 throttled_ns;
+};
+
+/*
+ * Scheduler of the background I/O of a BD. Every background bio is sent
+ * with the idle priority class and waits for the budget of its class. The
+ * latency of the foreground reads is followed by a fast moving average, and
+ * by a slow one, that is only updated while no background I/O is in flight.
+ * Once the fast one goes above the target (by default SLOW_FACTOR times the
+ * slow one), background I/O backs off: after every I/O its class waits for
+ * 2^backoff - 1 times the time it took.
+ */
+struct lsbdd_iosched {
+	struct lsbdd_io_budget budgets[LSBDD_IO_NR_CLASSES];
+	/* Foreground read latency target in ns, 0 follows the slow average */
+	u64 target_ns;
+	/* Latency averages in ns and the sampled reads */
+	u64 lat_fast;
+	u64 lat_slow;
+	u64 fg_reads;
+	/* Background bios in flight */
+	atomic_t bg_inflight;
+	/* Below is protected by lock */
+	spinlock_t lock;
+	u32 backoff;
+	u64 adjust_ns;
+	u64 seen_reads;
+	u64 backoffs;
+};
+
+void lsbdd_iosched_init(struct lsbdd_iosched *sched, const u32 *bandwidth_mb, const u32 *iops, u32 target_us);
+void lsbdd_iosched_read_done(struct lsbdd_iosched *sched, u64 ns);
+u64 lsbdd_iosched_begin(struct lsbdd_iosched *sched, enum lsbdd_io_class class, struct bio *bio);
+void lsbdd_iosched_end(struct lsbdd_iosched *sched, enum lsbdd_io_class class, u64 start_ns);
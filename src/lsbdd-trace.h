@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ * Tracepoints of the remap path, all of them are off by default:
+ *
+ *	echo 1 > /sys/kernel/tracing/events/lsbdd/enable
+ *	cat /sys/kernel/tracing/trace_pipe
+ *
+ * or perf record -e 'lsbdd:*', bpftrace -e 'tracepoint:lsbdd:lsbdd_ds_op { ... }'.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lsbdd
+
+#if !defined(_LSBDD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LSBDD_TRACE_H
+
+#include <linux/blkdev.h>
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+#include "utils/ds-control.h"
+#include "main.h"
+
+TRACE_DEFINE_ENUM(BTREE_TYPE);
+TRACE_DEFINE_ENUM(SKIPLIST_TYPE);
+TRACE_DEFINE_ENUM(HASHTABLE_TYPE);
+TRACE_DEFINE_ENUM(RBTREE_TYPE);
+TRACE_DEFINE_ENUM(LEARNED_TYPE);
+TRACE_DEFINE_ENUM(DFTL_TYPE);
+TRACE_DEFINE_ENUM(PAGETABLE_TYPE);
+
+TRACE_DEFINE_ENUM(LSBDD_REMAP_WRITE);
+TRACE_DEFINE_ENUM(LSBDD_REMAP_OVERWRITE);
+TRACE_DEFINE_ENUM(LSBDD_REMAP_HIT);
+TRACE_DEFINE_ENUM(LSBDD_REMAP_PREV);
+TRACE_DEFINE_ENUM(LSBDD_REMAP_SYSTEM);
+
+TRACE_DEFINE_ENUM(LSBDD_DS_LOOKUP);
+TRACE_DEFINE_ENUM(LSBDD_DS_INSERT);
+TRACE_DEFINE_ENUM(LSBDD_DS_REMOVE);
+TRACE_DEFINE_ENUM(LSBDD_DS_PREV);
+TRACE_DEFINE_ENUM(LSBDD_DS_LAST);
+
+#define show_ds_type(type)						\
+	__print_symbolic(type,						\
+		{ BTREE_TYPE, "bt" },					\
+		{ SKIPLIST_TYPE, "sl" },				\
+		{ HASHTABLE_TYPE, "ht" },				\
+		{ RBTREE_TYPE, "rb" },					\
+		{ LEARNED_TYPE, "li" },					\
+		{ DFTL_TYPE, "df" },					\
+		{ PAGETABLE_TYPE, "pt" })
+
+#define show_remap_type(type)						\
+	__print_symbolic(type,						\
+		{ LSBDD_REMAP_WRITE, "write" },				\
+		{ LSBDD_REMAP_OVERWRITE, "overwrite" },			\
+		{ LSBDD_REMAP_HIT, "hit" },				\
+		{ LSBDD_REMAP_PREV, "prev" },				\
+		{ LSBDD_REMAP_SYSTEM, "system" })
+
+#define show_ds_op(op)							\
+	__print_symbolic(op,						\
+		{ LSBDD_DS_LOOKUP, "lookup" },				\
+		{ LSBDD_DS_INSERT, "insert" },				\
+		{ LSBDD_DS_REMOVE, "remove" },				\
+		{ LSBDD_DS_PREV, "prev" },				\
+		{ LSBDD_DS_LAST, "last" })
+
+/* A bio sent to the virtual device, deferred ones are mapped by the workqueue */
+TRACE_EVENT(lsbdd_submit,
+
+	TP_PROTO(struct bio *bio, bool deferred),
+
+	TP_ARGS(bio, deferred),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, sector)
+		__field(unsigned int, size)
+		__field(enum req_op, op)
+		__field(bool, deferred)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio->bi_bdev->bd_dev;
+		__entry->sector = bio->bi_iter.bi_sector;
+		__entry->size = bio->bi_iter.bi_size;
+		__entry->op = bio_op(bio);
+		__entry->deferred = deferred;
+	),
+
+	TP_printk("%d,%d %s sector=%llu size=%u%s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->op == REQ_OP_WRITE ? "write" : "read",
+		  (unsigned long long)__entry->sector, __entry->size,
+		  __entry->deferred ? " deferred" : "")
+);
+
+/*
+ * How the bio was mapped: a write to a new or an already mapped sector, a read
+ * that hit a mapping, was resolved through the previous one (splits is the
+ * number of bios split off the clone), or went through as a system bio.
+ */
+TRACE_EVENT(lsbdd_remap,
+
+	TP_PROTO(struct bio *bio, enum lsbdd_remap_type type, sector_t redirect, u32 splits),
+
+	TP_ARGS(bio, type, redirect, splits),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(sector_t, sector)
+		__field(sector_t, redirect)
+		__field(unsigned int, size)
+		__field(enum lsbdd_remap_type, type)
+		__field(u32, splits)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio->bi_bdev->bd_dev;
+		__entry->sector = bio->bi_iter.bi_sector;
+		__entry->redirect = redirect;
+		__entry->size = bio->bi_iter.bi_size;
+		__entry->type = type;
+		__entry->splits = splits;
+	),
+
+	TP_printk("%d,%d %s sector=%llu -> %llu size=%u splits=%u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  show_remap_type(__entry->type),
+		  (unsigned long long)__entry->sector,
+		  (unsigned long long)__entry->redirect,
+		  __entry->size, __entry->splits)
+);
+
+/*
+ * Mapping index operation. start is the ktime_get_ns() taken before the
+ * operation, 0 if the event was enabled in between.
+ */
+TRACE_EVENT(lsbdd_ds_op,
+
+	TP_PROTO(struct bd_manager *manager, enum lsbdd_ds_op op, sector_t key, s32 status, u64 start),
+
+	TP_ARGS(manager, op, key, status, start),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(enum data_type, type)
+		__field(enum lsbdd_ds_op, op)
+		__field(sector_t, key)
+		__field(s32, status)
+		__field(u64, duration)
+	),
+
+	TP_fast_assign(
+		__entry->dev = disk_devt(manager->vbd_disk);
+		__entry->type = manager->sel_data_struct->type;
+		__entry->op = op;
+		__entry->key = key;
+		__entry->status = status;
+		__entry->duration = start ? ktime_get_ns() - start : 0;
+	),
+
+	TP_printk("%d,%d %s %s key=%llu status=%d ns=%llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  show_ds_type(__entry->type), show_ds_op(__entry->op),
+		  (unsigned long long)__entry->key, __entry->status,
+		  (unsigned long long)__entry->duration)
+);
+
+/* Completion of a clone on the backing device, before the original bio ends */
+TRACE_EVENT(lsbdd_complete,
+
+	TP_PROTO(struct bio *clone, struct bio *bio),
+
+	TP_ARGS(clone, bio),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(dev_t, backing_dev)
+		__field(enum req_op, op)
+		__field(int, error)
+	),
+
+	TP_fast_assign(
+		__entry->dev = bio->bi_bdev->bd_dev;
+		__entry->backing_dev = clone->bi_bdev->bd_dev;
+		__entry->op = bio_op(clone);
+		__entry->error = blk_status_to_errno(clone->bi_status);
+	),
+
+	TP_printk("%d,%d (%d,%d) %s error=%d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  MAJOR(__entry->backing_dev), MINOR(__entry->backing_dev),
+		  __entry->op == REQ_OP_WRITE ? "write" : "read", __entry->error)
+);
+
+#endif /* _LSBDD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lsbdd-trace
+#include <trace/define_trace.h>
@@ -2,38 +2,96 @@
 
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/debugfs.h>
+#include <linux/ioprio.h>
 #include <linux/list.h>
+#include <linux/log2.h>
 #include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/string.h>
+#include <linux/stringify.h>
 #include "utils/ds-control.h"
+#include "utils/dftl.h"
+#include "utils/ds-frag.h"
 #include "main.h"
 
+#define CREATE_TRACE_POINTS
+#include "lsbdd-trace.h"
+
+/*
+ * Runs a mapping index operation. Lookups and inserts are always timed for the
+ * latency histograms, the rest only while the lsbdd_ds_op tracepoint is enabled.
+ */
+#define TIMED_DS_OP(manager, op, key, call)					\
+	({									\
+		u64 __start = (op == LSBDD_DS_LOOKUP || op == LSBDD_DS_INSERT ||	\
+			trace_lsbdd_ds_op_enabled()) ? ktime_get_ns() : 0;	\
+		s32 __status = (call);						\
+		if (op == LSBDD_DS_LOOKUP)					\
+			lsbdd_hist_add(manager, LSBDD_HIST_LOOKUP, __start);	\
+		else if (op == LSBDD_DS_INSERT)					\
+			lsbdd_hist_add(manager, LSBDD_HIST_INSERT, __start);	\
+		trace_lsbdd_ds_op(manager, op, key, __status, __start);		\
+		__status;							\
+	})
+
+#define LSBDD_STAT(manager, field) lsbdd_stat_sum(manager, offsetof(struct lsbdd_stats, field))
+
 MODULE_DESCRIPTION("Log-Structured virtual Block Device Driver module");
 MODULE_AUTHOR("Mike Gavrilenko - @qrutyy");
 MODULE_LICENSE("Dual MIT/GPL");
 
 static s32  bdd_major;
 char sel_ds[LSBDD_MAX_DS_NAME_LEN + 1];
-struct bio_set *bdd_pool;
 struct list_head bd_list;
-sector_t next_free_sector = LSBDD_SECTOR_OFFSET;
-
-static s32  vector_add_bd(struct bd_manager *current_bdev_manager)
+static bool auto_migrate;
+static u32 dftl_cache_size = DFTL_CACHE_DEFAULT_MB;
+static u32 stripe_segment_size = LSBDD_STRIPE_SEGMENT_DEFAULT_KB;
+static bool stripe_least_loaded;
+static bool tiering;
+static u32 tier_promote_reads = 2;
+static bool dedup;
+static bool compress;
+static u32 zoned_open_zones = LSBDD_ZONED_OPEN_DEFAULT;
+static u32 hybrid_block_size;
+static u32 defrag_rate;
+/* Background I/O budgets by enum lsbdd_io_class, 0 is unlimited */
+static u32 bg_bandwidth[LSBDD_IO_NR_CLASSES];
+static u32 bg_iops[LSBDD_IO_NR_CLASSES];
+static u32 fg_latency_target;
+static struct workqueue_struct *lsbdd_wq;
+/* Hashes the writes of BDs with dedup off the submitting CPU */
+static struct workqueue_struct *lsbdd_hash_wq;
+static struct dentry *lsbdd_debugfs;
+
+static const char *lsbdd_hist_names[] = {"read", "write", "lookup", "insert"};
+
+static void lsbdd_hist_add(struct bd_manager *manager, enum lsbdd_hist hist, u64 start_ns)
 {
-	list_add_tail(&current_bdev_manager->list, &bd_list);
+	u64 ns = ktime_get_ns() - start_ns;
 
-	return 0;
+	this_cpu_inc(manager->stats->hist[hist][min_t(u32, ilog2(ns | 1), LSBDD_HIST_BUCKETS - 1)]);
 }
 
-static struct bd_manager *get_bd_manager_by_name(char *vbd_name)
+/* Sums up the per-CPU u64 counter at offset in struct lsbdd_stats */
+static u64 lsbdd_stat_sum(struct bd_manager *manager, size_t offset)
 {
-	struct bd_manager *entry;
+	u64 sum = 0;
+	s32 cpu;
 
-	list_for_each_entry(entry, &bd_list, list) {
-		if (!strcmp(entry->vbd_disk->disk_name, vbd_name))
-			return entry;
-	}
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((char *)per_cpu_ptr(manager->stats, cpu) + offset);
 
-	return NULL;
+	return sum;
+}
+
+static s32  vector_add_bd(struct bd_manager *current_bdev_manager)
+{
+	list_add_tail(&current_bdev_manager->list, &bd_list);
+
+	return 0;
 }
 
 static struct bd_manager *get_list_element_by_index(u16 index)
@@ -71,111 +129,381 @@ static struct bdev_handle *open_bd_on_rw(char *bd_path)
 							 NULL);
 }
 
-static void bdd_bio_end_io(struct bio *bio)
+static void lsbdd_zone_append_done(struct work_struct *work);
+
+/*
+ * Lets lsbdd_poll_bio() find the polled clone of the bio: its bi_private
+ * points to the io and REQ_DRV tells that it does, until the completion
+ * undoes it with lsbdd_poll_finish().
+ */
+static void lsbdd_poll_prepare(struct bio *bio, struct lsbdd_io *io)
+{
+	io->polled = true;
+	io->private = bio->bi_private;
+	WRITE_ONCE(bio->bi_private, io);
+	smp_wmb();
+	bio->bi_opf |= REQ_DRV;
+	/* Bio-based drivers set the cookie themselves, bio_poll() skips the bio otherwise */
+	WRITE_ONCE(bio->bi_cookie, ~BLK_QC_T_NONE);
+}
+
+static void lsbdd_poll_finish(struct bio *bio, struct lsbdd_io *io)
 {
-	bio_endio(bio->bi_private);
-	bio_put(bio);
+	bio->bi_opf &= ~REQ_DRV;
+	smp_wmb();
+	WRITE_ONCE(bio->bi_private, io->private);
+}
+
+static void lsbdd_io_free_rcu(struct rcu_head *rcu)
+{
+	bio_put(&container_of(rcu, struct lsbdd_io, rcu)->clone);
 }
 
 /**
- * Configures write operations in clone segments for the specified BIO.
- * Allocates memory for original and redirected sector data, retrieves the current
- * redirection info from the chosen data structure, and updates the mapping if necessary.
- * The redirected sector is then set in the clone BIO for processing.
+ * Polls the backing device of the clone of a polled bio. Called under RCU,
+ * the bio may have completed, even been reused, meanwhile: the io is only
+ * taken, if REQ_DRV is seen set both before and after bi_private is read.
  *
- * @main_bio - The original BIO representing the main device I/O operation.
- * @clone_bio - The clone BIO representing the redirected I/O operation.
- * @bd_manager - Manager that stores information about used ds and bdd in whole.
+ * It returns the number of completions found.
+ */
+static int lsbdd_poll_bio(struct bio *bio, struct io_comp_batch *iob, unsigned int flags)
+{
+	struct lsbdd_io *io = NULL;
+
+	if (!(READ_ONCE(bio->bi_opf) & REQ_DRV))
+		return 0;
+	smp_rmb();
+	io = READ_ONCE(bio->bi_private);
+	smp_rmb();
+	if (!(READ_ONCE(bio->bi_opf) & REQ_DRV))
+		return 0;
+
+	return bio_poll(&io->clone, iob, flags);
+}
+
+static void bdd_bio_end_io(struct bio *clone)
+{
+	struct lsbdd_io *io = container_of(clone, struct lsbdd_io, clone);
+	struct bio *bio = clone->bi_private;
+
+	/* The mapping of an append is only known now, it is inserted under ds_lock */
+	if (io->zone && bio_op(clone) == REQ_OP_ZONE_APPEND) {
+		INIT_WORK(&io->work, lsbdd_zone_append_done);
+		queue_work(lsbdd_wq, &io->work);
+		return;
+	}
+
+	trace_lsbdd_complete(clone, bio);
+	if (io->stripe)
+		atomic_dec(&io->stripe->inflight);
+	if (io->zone)
+		lsbdd_zoned_put(io->manager->zoned, io->zone);
+	if (io->segment)
+		atomic_dec(&io->segment->users);
+	if (io->dedup)
+		lsbdd_dedup_complete(io->manager->dedup, io->dedup, !clone->bi_status);
+	if (io->defrag_idx >= 0)
+		srcu_up_read(&io->manager->defrag->writes, io->defrag_idx);
+	if (io->zip)
+		lsbdd_zip_free_pages(clone);
+	if (clone->bi_status) {
+		bio->bi_status = clone->bi_status;
+		this_cpu_inc(io->manager->stats->errors);
+	}
+	if (bio_op(bio) == REQ_OP_READ) {
+		lsbdd_hist_add(io->manager, LSBDD_HIST_READ, io->start_ns);
+		if (!(this_cpu_inc_return(io->manager->stats->read_samples) & LSBDD_IOSCHED_SAMPLE_MASK))
+			lsbdd_iosched_read_done(&io->manager->iosched, ktime_get_ns() - io->start_ns);
+	} else if (bio_op(bio) == REQ_OP_WRITE) {
+		lsbdd_hist_add(io->manager, LSBDD_HIST_WRITE, io->start_ns);
+	}
+
+	if (io->polled)
+		lsbdd_poll_finish(bio, io);
+
+	bio_end_io_acct(bio, io->start_jiffies);
+	bio_endio(bio);
+	if (io->polled)
+		call_rcu(&io->rcu, lsbdd_io_free_rcu);
+	else
+		bio_put(clone);
+}
+
+/**
+ * Takes sectors of the log for a write. The log is striped over the backing
+ * devices in segments of stripe_segment_size: a segment is filled on one
+ * device, then the head moves to the next device with room, round-robin, or
+ * to the one with the fewest clones in flight if stripe_least_loaded is set.
+ * A write is never split between devices, it may end past its segment.
+ * Must be called with ds_lock held for write.
  *
- * It returns 0 on success, -ENOMEM if memory allocation fails.
+ * It returns 0 on success, -ENOSPC if no device has room for the write.
  */
-static s32 setup_write_in_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *current_redirect_manager)
+s32 lsbdd_stripe_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect)
 {
-	s8 status;
-	struct sectors *sectors = NULL;
-	struct redir_sector_info *old_rs_info = NULL;
-	struct redir_sector_info *curr_rs_info = NULL;
+	struct lsbdd_stripe *stripe = &manager->stripes[manager->cur_stripe];
+	u8 picked = LSBDD_MAX_STRIPES;
+	u8 i, next;
+
+	if (manager->tier)
+		return lsbdd_tier_alloc(manager, sectors, redirect);
+	if (manager->pool)
+		return lsbdd_pool_alloc(manager, sectors, redirect);
+
+	if (stripe->next_free_sector >= manager->segment_end ||
+		stripe->next_free_sector + sectors > stripe->capacity) {
+		/* The current device goes last, so a single one still gets a new segment */
+		for (i = 1; i <= manager->nr_stripes; i++) {
+			next = (manager->cur_stripe + i) % manager->nr_stripes;
+			stripe = &manager->stripes[next];
+			if (stripe->next_free_sector + sectors > stripe->capacity)
+				continue;
+			if (picked == LSBDD_MAX_STRIPES) {
+				picked = next;
+				if (!stripe_least_loaded)
+					break;
+			} else if (atomic_read(&stripe->inflight) < atomic_read(&manager->stripes[picked].inflight)) {
+				picked = next;
+			}
+		}
+		if (picked == LSBDD_MAX_STRIPES)
+			return -ENOSPC;
 
-	sectors = kzalloc(sizeof(struct sectors), GFP_KERNEL);
-	curr_rs_info = kzalloc(sizeof(struct redir_sector_info), GFP_KERNEL);
+		manager->cur_stripe = picked;
+		stripe = &manager->stripes[picked];
+		manager->segment_end = stripe->next_free_sector + manager->segment_sectors;
+	}
 
-	if (!(sectors && curr_rs_info))
-		goto mem_err;
+	*redirect = lsbdd_stripe_sector(manager->cur_stripe, stripe->next_free_sector);
+	stripe->next_free_sector += sectors;
+	return 0;
+}
 
-	sectors->original = main_bio->bi_iter.bi_sector;
-	sectors->redirect = next_free_sector;
+/**
+ * Sends the clone to the backing device, that holds the redirected sector of
+ * rs_info, and leaves only the sector on that device in rs_info. A clone to
+ * the fast tier holds its segment until the completion, a read of a zoned BD
+ * its zone.
+ */
+static void lsbdd_stripe_target(struct bd_manager *manager, struct bio *clone, struct redir_sector_info *rs_info)
+{
+	struct lsbdd_io *io = container_of(clone, struct lsbdd_io, clone);
+	u8 index = lsbdd_stripe_index(rs_info->redirected_sector);
+
+	io->stripe = &manager->stripes[index];
+	bio_set_dev(clone, io->stripe->bd_handler->bdev);
+	rs_info->redirected_sector &= LSBDD_STRIPE_SECTOR_MASK;
+	if (manager->tier && index == LSBDD_TIER_FAST)
+		io->segment = lsbdd_tier_get(manager, rs_info->redirected_sector);
+	if (manager->zoned && bio_op(clone) == REQ_OP_READ)
+		io->zone = lsbdd_zoned_get(manager->zoned, rs_info->redirected_sector);
+}
 
-	pr_debug("Original sector: bi_sector = %llu, block_size %u\n",
-			main_bio->bi_iter.bi_sector, clone_bio->bi_iter.bi_size);
+/**
+ * Maps the original sector to the block of rs_info, in place of its previous
+ * mapping, if there is one. The previous block is accounted as garbage,
+ * unless other mappings share it. A hybrid BD first cuts the mappings, that
+ * the block overlaps, and extends the mapping before it instead, if the block
+ * continues that one. Must be called with ds_lock held for write.
+ *
+ * It returns 1 if a mapping was replaced, 0 if the sector wasn't mapped,
+ * negative error code if the insertion fails.
+ */
+static s32 lsbdd_map_block(struct bd_manager *manager, sector_t original, struct redir_sector_info *rs_info)
+{
+	struct redir_sector_info old_rs_info;
+	bool overwrite;
+	s32 status = 0;
 
-	curr_rs_info->block_size = main_bio->bi_iter.bi_size;
-	curr_rs_info->redirected_sector = sectors->redirect;
+	if (manager->hybrid) {
+		status = lsbdd_hybrid_cut(manager, original, rs_info->block_size >> SECTOR_SHIFT);
+		if (status)
+			return status;
+	}
 
-	old_rs_info = ds_lookup(current_redirect_manager->sel_data_struct, sectors->original);
-	if (!old_rs_info)
+	overwrite = !TIMED_DS_OP(manager, LSBDD_DS_LOOKUP, original,
+			ds_lookup(manager->sel_data_struct, original, &old_rs_info));
+	if (!overwrite) {
 		pr_debug("WRITE: Lookup in data structure _ failed\n");
+	} else {
+		TIMED_DS_OP(manager, LSBDD_DS_REMOVE, original,
+			(ds_remove(manager->sel_data_struct, original), 0));
+		ds_migration_capture(&manager->migration, original, NULL);
+		if (manager->zoned)
+			lsbdd_zoned_account(manager->zoned, &old_rs_info, false);
+		/* A block, that other mappings share, isn't garbage yet */
+		if (!manager->dedup || lsbdd_dedup_put(manager->dedup, old_rs_info.redirected_sector))
+			this_cpu_add(manager->stats->overwritten_bytes, ds_stored_sectors(&old_rs_info) << SECTOR_SHIFT);
+	}
 
-	pr_debug("WRITE: Old rs %p", old_rs_info);
-	pr_info("WRITE: key: %llu, sec: %llu\n", sectors->original, curr_rs_info->redirected_sector);
+	if (!overwrite && manager->hybrid) {
+		status = lsbdd_hybrid_extend(manager, original, rs_info);
+		if (status < 0)
+			return status;
+	}
 
-	if (old_rs_info && !(old_rs_info->redirected_sector == sectors->redirect && old_rs_info->block_size == curr_rs_info->block_size)) {
-		ds_remove(current_redirect_manager->sel_data_struct, sectors->original);
+	if (!status) {
+		status = TIMED_DS_OP(manager, LSBDD_DS_INSERT, original,
+				ds_insert(manager->sel_data_struct, original, rs_info));
 		if (status)
-			goto insert_err;
+			return status;
+		ds_migration_capture(&manager->migration, original, rs_info);
+		if (manager->zoned)
+			lsbdd_zoned_account(manager->zoned, rs_info, true);
+		if (!overwrite)
+			manager->nr_mappings++;
+	}
+
+	atomic64_inc(&manager->op_stats.inserts);
+	if (original > manager->op_stats.max_key) {
+		atomic64_inc(&manager->op_stats.appends);
+		manager->op_stats.max_key = original;
+	}
+	return overwrite;
+}
+
+/**
+ * Configures write operations in clone segments for the specified BIO.
+ * Builds the redirection info on stack and maps the original sector to it
+ * with lsbdd_map_block(). The value is copied inline into the index, so
+ * nothing is allocated per mapping. The redirected sector is then set in the
+ * clone BIO for processing.
+ *
+ * With dedup, a block, that is in the log already, is only mapped again. A
+ * clone with compressed data takes only the sectors of the compressed block.
+ *
+ * @main_bio - The original BIO representing the main device I/O operation.
+ * @clone_bio - The clone BIO representing the redirected I/O operation.
+ * @bd_manager - Manager that stores information about used ds and bdd in whole.
+ * @fp - Fingerprint of the data, NULL if the BD doesn't deduplicate
+ *
+ * It returns 0 on success, LSBDD_WRITE_DEDUPED if there is nothing to write,
+ * negative error code if the insertion fails.
+ */
+static s32 setup_write_in_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *current_redirect_manager,
+		const struct lsbdd_dedup_fp *fp)
+{
+	struct lsbdd_io *io = container_of(clone_bio, struct lsbdd_io, clone);
+	struct lsbdd_dedup_entry *shared = NULL;
+	s32 status;
+	struct sectors sectors;
+	struct redir_sector_info curr_rs_info;
+	bool overwrite;
+
+	sectors.original = main_bio->bi_iter.bi_sector;
+	if (fp)
+		shared = lsbdd_dedup_get(current_redirect_manager->dedup, fp, main_bio->bi_iter.bi_size);
+	if (shared) {
+		sectors.redirect = shared->redirected_sector;
 	} else {
-		next_free_sector += curr_rs_info->block_size / SECTOR_SIZE;
+		status = lsbdd_stripe_alloc(current_redirect_manager, clone_bio->bi_iter.bi_size / SECTOR_SIZE,
+				&sectors.redirect);
+		if (status) {
+			pr_err("No space left in the log for %u bytes\n", main_bio->bi_iter.bi_size);
+			return status;
+		}
+		if (fp)
+			io->dedup = lsbdd_dedup_add(current_redirect_manager->dedup, fp, sectors.redirect,
+					main_bio->bi_iter.bi_size);
+	}
+
+	pr_debug("Original sector: bi_sector = %llu, block_size %u\n",
+			main_bio->bi_iter.bi_sector, clone_bio->bi_iter.bi_size);
+
+	curr_rs_info.block_size = main_bio->bi_iter.bi_size;
+	curr_rs_info.stored_size = io->zip ? clone_bio->bi_iter.bi_size : 0;
+	curr_rs_info.redirected_sector = sectors.redirect;
+
+	status = lsbdd_map_block(current_redirect_manager, sectors.original, &curr_rs_info);
+	if (status < 0)
+		goto insert_err;
+	overwrite = status;
+
+	if (shared) {
+		trace_lsbdd_remap(main_bio, overwrite ? LSBDD_REMAP_OVERWRITE : LSBDD_REMAP_WRITE,
+				sectors.redirect, 0);
+		return LSBDD_WRITE_DEDUPED;
 	}
 
-	status = ds_insert(current_redirect_manager->sel_data_struct, sectors->original, curr_rs_info);
-	clone_bio->bi_iter.bi_sector = sectors->redirect;
-	pr_debug("original %llu, redirected %llu\n", sectors->original, sectors->redirect);
+	lsbdd_stripe_target(current_redirect_manager, clone_bio, &curr_rs_info);
+	clone_bio->bi_iter.bi_sector = curr_rs_info.redirected_sector;
+	trace_lsbdd_remap(main_bio, overwrite ? LSBDD_REMAP_OVERWRITE : LSBDD_REMAP_WRITE,
+			sectors.redirect, 0);
 
 	return 0;
 
 insert_err:
-	pr_err("Failed inserting key: %llu vallue: %p in _\n", sectors->original, curr_rs_info);
-	kfree(sectors);
-	kfree(curr_rs_info);
+	pr_err("Failed inserting key: %llu sector: %llu in _\n", sectors.original, curr_rs_info.redirected_sector);
+	if (shared || io->dedup)
+		lsbdd_dedup_put(current_redirect_manager->dedup, sectors.redirect);
 	return status;
-
-mem_err:
-pr_err("Memory allocation failed\n");
-	kfree(sectors);
-	kfree(curr_rs_info);
-	return -ENOMEM;
 }
 
 /**
- * Prepares a BIO split for partial handling of a clone BIO. Splits the clone BIO
- * s32 o two parts, so the first half (split_bio) can be processed independently.
- * This function submits the split_bio to be read separately from the remaining
- * data in clone_bio.
- *
- * @clone_bio - The clone BIO to be split.
- * @main_bio - The main BIO containing the primary I/O request data.
- * @nearest_bs - The block size in bytes closest to the current data segment.
+ * Configures a write of a zoned BD as a zone append to one of its open
+ * zones. The device picks the sector of the block, so the mapping is only
+ * inserted by lsbdd_zone_append_done(), once the append completed.
  *
- * It returns nearest_bs on successful split, -1 if memory allocation fails.
+ * It returns 0 on success, -ENOSPC if no zone has room for the write.
  */
-static s32 setup_bio_split(struct bio *clone_bio, struct bio *main_bio, s32 nearest_bs)
+static s32 setup_zone_append(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *current_redirect_manager)
 {
-	struct bio *split_bio = NULL; // first half of splitted bio
+	struct lsbdd_io *io = container_of(clone_bio, struct lsbdd_io, clone);
 
-	split_bio = bio_split(clone_bio, nearest_bs / SECTOR_SIZE, GFP_KERNEL, bdd_pool);
-	if (!split_bio)
-		return -1;
+	/* An empty flush has no block to map, it goes to the device as it is */
+	if (!main_bio->bi_iter.bi_size)
+		return 0;
 
-	pr_debug("RECURSIVE READ p1: bs = %u, main to read = %u, st sec = %llu\n",
-		split_bio->bi_iter.bi_size, main_bio->bi_iter.bi_size, split_bio->bi_iter.bi_sector);
-	pr_debug("RECURSIVE READ p2: bs = %u, main to read = %u,  st sec = %llu\n",
-		clone_bio->bi_iter.bi_size, main_bio->bi_iter.bi_size, clone_bio->bi_iter.bi_sector);
+	io->zone = lsbdd_zoned_alloc(current_redirect_manager->zoned, main_bio->bi_iter.bi_size >> SECTOR_SHIFT);
+	if (!io->zone) {
+		pr_err("No zone left for %u bytes\n", main_bio->bi_iter.bi_size);
+		return -ENOSPC;
+	}
 
-	submit_bio(split_bio);
-	pr_debug("Submitted bio first part of splitted main_bio\n\n");
+	clone_bio->bi_opf = REQ_OP_ZONE_APPEND | (main_bio->bi_opf & ~REQ_OP_MASK);
+	clone_bio->bi_iter.bi_sector = io->zone->start;
+	return 0;
+}
 
-	return nearest_bs;
+/* Looks the key up in the mapping of the BD and in the frozen ones below it */
+static s32 lsbdd_lookup(struct bd_manager *manager, sector_t key, struct redir_sector_info *rs_info)
+{
+	if (!ds_lookup(manager->sel_data_struct, key, rs_info))
+		return 0;
+	return manager->frozen ? lsbdd_snap_lookup(manager->frozen, key, rs_info) : -ENOENT;
 }
 
+/* Looks for the predecessor of key in the mapping of the BD and in the frozen ones */
+static s32 lsbdd_prev(struct bd_manager *manager, sector_t key, sector_t *prev_key,
+		struct redir_sector_info *rs_info)
+{
+	s32 status;
+
+	if (!manager->frozen)
+		return ds_prev(manager->sel_data_struct, key, prev_key, rs_info);
+
+	status = ds_empty_check(manager->sel_data_struct) ? -ENOENT :
+		ds_prev(manager->sel_data_struct, key, prev_key, rs_info);
+	return lsbdd_snap_prev(manager->frozen, key, status, prev_key, rs_info);
+}
+
+/* Takes the last mapping of the BD, the frozen mappings included */
+static s32 lsbdd_last(struct bd_manager *manager, sector_t key, struct redir_sector_info *rs_info)
+{
+	s32 status;
+
+	if (!manager->frozen)
+		return ds_last(manager->sel_data_struct, key, rs_info);
+
+	status = ds_empty_check(manager->sel_data_struct) ? -ENOENT :
+		ds_last(manager->sel_data_struct, key, rs_info);
+	return lsbdd_snap_last(manager->frozen, status, rs_info);
+}
+
+static bool lsbdd_empty(struct bd_manager *manager)
+{
+	return ds_empty_check(manager->sel_data_struct) && (!manager->frozen || lsbdd_snap_empty(manager->frozen));
+}
 
 /**
  * Identifies and handles system BIOs for the given BIO operation.
@@ -195,21 +523,30 @@ static s32 setup_bio_split(struct bio *clone_bio, struct bio *main_bio, s32 near
  *
  * Return:
  * - -1 if the BIO is identified as a system BIO.
+ * - LSBDD_READ_UNMAPPED if the BD is a thin volume or zoned, with no mappings yet.
  * - 0 if the BIO is redirected or otherwise successfully processed.
  */
 static s16 check_system_bio(struct bd_manager *redirect_manager, struct sectors *sectors, struct bio *bio)
 {
-	struct redir_sector_info *last_rs = NULL;
+	struct redir_sector_info last_rs;
+
+	/* Thin volumes and zoned BDs have no data outside of their mappings */
+	if (redirect_manager->pool || redirect_manager->zoned)
+		return lsbdd_empty(redirect_manager) ? LSBDD_READ_UNMAPPED : 0;
 
-	if (ds_empty_check(redirect_manager->sel_data_struct)) {
+	if (lsbdd_empty(redirect_manager)) {
 		bio->bi_iter.bi_sector = sectors->original;
 		return -1;
 	}
 
-	last_rs = ds_last(redirect_manager->sel_data_struct, sectors->original);
-	pr_debug("READ: last_rs = %llu\n", last_rs->redirected_sector);
+	if (TIMED_DS_OP(redirect_manager, LSBDD_DS_LAST, sectors->original,
+			lsbdd_last(redirect_manager, sectors->original, &last_rs))) {
+		bio->bi_iter.bi_sector = sectors->original;
+		return -1;
+	}
+	pr_debug("READ: last_rs = %llu\n", last_rs.redirected_sector);
 
-	if (sectors->original > last_rs->redirected_sector) {
+	if (sectors->original > (last_rs.redirected_sector & LSBDD_STRIPE_SECTOR_MASK)) {
 		bio->bi_iter.bi_sector = sectors->original;
 		pr_debug("Recognised system bio\n");
 		return -1;
@@ -218,265 +555,1313 @@ static s16 check_system_bio(struct bd_manager *redirect_manager, struct sectors
 }
 
 /**
- * Configures read operations for clone segments based on redirection info from
- * the chosen data structure. This function retrieves the mapped or previous sector information,
- * determines the appropriate sector to read, and optionally splits the clone BIO
- * if more data is required. Handles cases where redirected and original sector
- * start points differ.
+ * Looks for the mapping, that covers the sector: the one, that starts at it,
+ * or the one before it, if that one reaches it. The rbtree answers by a
+ * single query (see ds_cover()), that also finds a mapping further back.
  *
- * @main_bio - The primary BIO representing the main device I/O operation.
- * @clone_bio - The clone BIO representing the redirected I/O operation.
- * @redirect_manager - Manages redirection data for mapped sectors.
- *
- * It returns 0 on success, -ENOMEM if memory allocation fails, or -1 on split error.
+ * It returns 0 if a mapping covers the sector, -ENOENT otherwise.
  */
-static s32 setup_read_from_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *redirect_manager)
+static s32 lsbdd_find_mapping(struct bd_manager *manager, sector_t sector, sector_t *key,
+		struct redir_sector_info *rs_info)
 {
-	struct redir_sector_info *curr_rs_info = NULL;
-	struct redir_sector_info *prev_rs_info = NULL;
-	struct sectors *sectors = NULL;
-	sector_t prev_sector_val = 0;
-	sector_t *prev_sector = &prev_sector_val;
-	s32 to_end_of_block = 0;
-	s32 to_read_in_clone = 0;
-	s16 status = 0;
+	s32 status;
+
+	if (!manager->frozen && manager->sel_data_struct->type == RBTREE_TYPE) {
+		status = TIMED_DS_OP(manager, LSBDD_DS_LOOKUP, sector,
+				ds_cover(manager->sel_data_struct, sector, key, rs_info));
+		atomic64_inc(&manager->op_stats.lookups);
+		if (!status && *key != sector)
+			this_cpu_inc(manager->stats->prev_reads);
+		return status;
+	}
 
-	if (main_bio->bi_iter.bi_size == 0)
+	*key = sector;
+	status = TIMED_DS_OP(manager, LSBDD_DS_LOOKUP, sector, lsbdd_lookup(manager, sector, rs_info));
+	atomic64_inc(&manager->op_stats.lookups);
+	if (!status)
 		return 0;
 
-	curr_rs_info = kzalloc(sizeof(struct redir_sector_info), GFP_KERNEL);
-	prev_rs_info = kzalloc(sizeof(struct redir_sector_info), GFP_KERNEL);
-	sectors = kzalloc(sizeof(struct sectors), GFP_KERNEL);
+	status = TIMED_DS_OP(manager, LSBDD_DS_PREV, sector, lsbdd_prev(manager, sector, key, rs_info));
+	atomic64_inc(&manager->op_stats.prevs);
+	if (status || sector >= *key + (rs_info->block_size >> SECTOR_SHIFT))
+		return -ENOENT;
+	this_cpu_inc(manager->stats->prev_reads);
+	return 0;
+}
 
-	if (!(sectors && curr_rs_info && prev_rs_info))
-		goto mem_err;
+/* Finds the first mapping, that starts in (from, end), it returns end if there is none */
+static sector_t lsbdd_next_mapped(struct bd_manager *manager, sector_t from, sector_t end)
+{
+	struct redir_sector_info rs_info;
+	sector_t key = end;
+	sector_t next = end;
 
-	sectors->original = main_bio->bi_iter.bi_sector;
-	curr_rs_info = ds_lookup(redirect_manager->sel_data_struct, sectors->original);
+	while (!lsbdd_prev(manager, key, &key, &rs_info) && key > from)
+		next = key;
+	return next;
+}
 
-	pr_info("READ: key: %llu\n", sectors->original);
+/* Zero-fills the part of the bio */
+static void lsbdd_zero_part(struct bio *bio, struct bvec_iter part)
+{
+	struct bvec_iter iter;
+	struct bio_vec bvec;
 
-	if (!curr_rs_info) { // Read & Write sector starts aren't equal.
-		status = check_system_bio(redirect_manager, sectors, clone_bio);
-		if (status)
-			return 0;
+	__bio_for_each_segment(bvec, bio, iter, part)
+		memzero_bvec(&bvec);
+}
 
-		pr_debug("READ: Sector: %llu isnt mapped\n", sectors->original);
+/* Completes a part of a read, the clone completes once all of its parts did */
+static void lsbdd_read_part_end_io(struct bio *read)
+{
+	struct lsbdd_io *io = container_of(read, struct lsbdd_io, clone);
+	struct bio *clone_bio = read->bi_private;
+
+	atomic_dec(&io->stripe->inflight);
+	if (io->zone)
+		lsbdd_zoned_put(io->manager->zoned, io->zone);
+	if (io->segment)
+		atomic_dec(&io->segment->users);
+	if (read->bi_status && !clone_bio->bi_status)
+		clone_bio->bi_status = read->bi_status;
+	bio_put(read);
+	bio_endio(clone_bio);
+}
 
-		prev_rs_info = ds_prev(redirect_manager->sel_data_struct, sectors->original, prev_sector);
-		sectors->redirect = prev_rs_info->redirected_sector * SECTOR_SIZE + (sectors->original - *prev_sector) * SECTOR_SIZE;
-		to_end_of_block = (prev_rs_info->redirected_sector * SECTOR_SIZE + prev_rs_info->block_size) - sectors->redirect;
-		to_read_in_clone = main_bio->bi_iter.bi_size - to_end_of_block;
-		/* Address of main block end (reading from operation pba + bi_size) - End of previous block */
+/**
+ * Sends a clone of the part of the bio to the redirected sector, the parent
+ * waits for it. The part is accounted in flight on its stripe and holds its
+ * fast tier segment or zone, as the clone would.
+ */
+static s32 lsbdd_read_part(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *redirect_manager,
+		struct bvec_iter *part, sector_t redirected_sector)
+{
+	struct redir_sector_info rs_info = { .redirected_sector = redirected_sector };
+	struct lsbdd_io *io = NULL;
+	struct bio *read = NULL;
+
+	read = bio_alloc_clone(redirect_manager->stripes[0].bd_handler->bdev, main_bio, GFP_NOIO,
+			&redirect_manager->bio_pool);
+	if (!read)
+		return -ENOMEM;
+
+	io = container_of(read, struct lsbdd_io, clone);
+	io->manager = redirect_manager;
+	io->segment = NULL;
+	io->zone = NULL;
+	lsbdd_stripe_target(redirect_manager, read, &rs_info);
+	read->bi_iter = *part;
+	read->bi_iter.bi_sector = rs_info.redirected_sector;
+	read->bi_private = clone_bio;
+	read->bi_end_io = lsbdd_read_part_end_io;
+	/* Nothing polls the parts, the clone isn't sent */
+	bio_clear_polled(read);
+	bio_inc_remaining(clone_bio);
+	atomic_inc(&io->stripe->inflight);
+	submit_bio(read);
+	return 0;
+}
 
-		clone_bio->bi_iter.bi_sector = prev_rs_info->redirected_sector + (prev_rs_info->block_size - to_end_of_block) / SECTOR_SIZE;
+/**
+ * Configures a read, mapping by mapping. A read, that a single mapping
+ * covers, is sent by the clone itself. Otherwise every mapping, that the
+ * read covers, is read by a part of its own, from the stripe of its block:
+ * the neighbouring blocks may be anywhere in the log, on other stripes, in
+ * other zones or on the other tier. A part in a compressed block is read
+ * with the whole block and copied out, once a worker decompressed it.
+ * Sectors without a mapping are zero-filled up to the next mapping, the
+ * rest of a system bio is read from the original sectors. The parts hold
+ * the clone, which isn't sent itself, until they complete.
+ *
+ * @main_bio - The primary BIO representing the main device I/O operation.
+ * @clone_bio - The clone BIO, that completes the main one.
+ * @redirect_manager - Manages redirection data for mapped sectors.
+ *
+ * It returns 0 if the clone is to be sent, LSBDD_READ_UNMAPPED if a thin
+ * volume or a zoned BD has no data yet, LSBDD_READ_SPLIT if the parts were
+ * sent instead, negative error code if a part can't be allocated.
+ */
+static s32 setup_read_from_clone_segments(struct bio *main_bio, struct bio *clone_bio, struct bd_manager *redirect_manager)
+{
+	struct bvec_iter iter = main_bio->bi_iter;
+	struct redir_sector_info rs_info;
+	struct lsbdd_stripe *stripe = NULL;
+	struct bvec_iter part;
+	struct sectors sectors;
+	sector_t key, end;
+	u32 offset;
+	u32 parts = 0;
+	s32 status = 0;
 
-		pr_debug("To read = %d, to end = %d, main size = %u, prev_rs bs = %u, prev_rs sector = %llu\n", to_read_in_clone, to_end_of_block, main_bio->bi_iter.bi_size, prev_rs_info->block_size, prev_rs_info->redirected_sector);
-		pr_debug("Clone bio: sector = %llu, size = %u\n", clone_bio->bi_iter.bi_sector, clone_bio->bi_iter.bi_size);
+	if (main_bio->bi_iter.bi_size == 0)
+		return 0;
 
-		if (to_read_in_clone < main_bio->bi_iter.bi_size && to_read_in_clone != 0) {
-			while (to_end_of_block > 0) {
-				status = setup_bio_split(clone_bio, main_bio, to_end_of_block);
-				if (status < 0)
-					goto split_err;
+	while (iter.bi_size) {
+		sectors.original = iter.bi_sector;
+		status = lsbdd_find_mapping(redirect_manager, sectors.original, &key, &rs_info);
+		part = iter;
+		if (status) {
+			status = check_system_bio(redirect_manager, &sectors, clone_bio);
+			if (status == LSBDD_READ_UNMAPPED)
+				return status;
+			if (status) {
+				this_cpu_inc(redirect_manager->stats->system_reads);
+				trace_lsbdd_remap(main_bio, LSBDD_REMAP_SYSTEM, sectors.original, parts);
+				/* check_system_bio() pointed the clone to the original sector */
+				if (!parts && iter.bi_size == main_bio->bi_iter.bi_size)
+					return 0;
+				status = lsbdd_read_part(main_bio, clone_bio, redirect_manager, &part,
+						lsbdd_stripe_sector(0, sectors.original));
+				break;
+			}
+			pr_debug("READ: Sector: %llu isnt mapped\n", sectors.original);
+			end = iter.bi_sector + (iter.bi_size >> SECTOR_SHIFT);
+			part.bi_size = (lsbdd_next_mapped(redirect_manager, sectors.original, end) - sectors.original)
+				<< SECTOR_SHIFT;
+			lsbdd_zero_part(main_bio, part);
+		} else {
+			offset = (sectors.original - key) << SECTOR_SHIFT;
+			part.bi_size = min(iter.bi_size, rs_info.block_size - offset);
+			if (redirect_manager->tier)
+				lsbdd_tier_access(redirect_manager, key, rs_info.redirected_sector);
+			if (part.bi_size == main_bio->bi_iter.bi_size && !rs_info.stored_size) {
+				trace_lsbdd_remap(main_bio, key == sectors.original ? LSBDD_REMAP_HIT : LSBDD_REMAP_PREV,
+						rs_info.redirected_sector, 0);
+				lsbdd_stripe_target(redirect_manager, clone_bio, &rs_info);
+				clone_bio->bi_iter.bi_sector = rs_info.redirected_sector + (offset >> SECTOR_SHIFT);
+				return 0;
+			}
 
-				if (to_read_in_clone > prev_rs_info->block_size) {
-					to_read_in_clone -= prev_rs_info->block_size;
-					to_end_of_block = prev_rs_info->block_size;
-				} else {
-					break;
-				}
+			if (rs_info.stored_size) {
+				stripe = &redirect_manager->stripes[lsbdd_stripe_index(rs_info.redirected_sector)];
+				status = lsbdd_zip_read(clone_bio, main_bio, &part, stripe->bd_handler->bdev,
+						rs_info.redirected_sector & LSBDD_STRIPE_SECTOR_MASK, &rs_info, offset,
+						&redirect_manager->bio_pool);
+			} else {
+				status = lsbdd_read_part(main_bio, clone_bio, redirect_manager, &part,
+						rs_info.redirected_sector + (offset >> SECTOR_SHIFT));
 			}
+			if (status)
+				break;
+			trace_lsbdd_remap(main_bio, key == sectors.original ? LSBDD_REMAP_HIT : LSBDD_REMAP_PREV,
+					rs_info.redirected_sector, parts);
+			parts++;
 		}
-		clone_bio->bi_iter.bi_size = (to_read_in_clone <= 0) ? to_end_of_block : to_read_in_clone;
-	} else if (curr_rs_info->redirected_sector) { // Read & Write start sectors are equal.
-		pr_debug("Found redirected sector: %llu, rs_bs = %u, main_bs = %u\n",
-			(curr_rs_info->redirected_sector), curr_rs_info->block_size, main_bio->bi_iter.bi_size);
-
-		to_read_in_clone = main_bio->bi_iter.bi_size - curr_rs_info->block_size;
-		clone_bio->bi_iter.bi_sector = curr_rs_info->redirected_sector;
-
-		while (to_read_in_clone > 0) {
-			to_read_in_clone -= setup_bio_split(clone_bio, main_bio, curr_rs_info->block_size);
-			if (status < 0)
-				goto split_err;
-		}
-		clone_bio->bi_iter.bi_size = (to_read_in_clone < 0) ? curr_rs_info->block_size + to_read_in_clone : curr_rs_info->block_size;
-		pr_debug("End of read, Clone: size: %u, sector %llu, to_read = %d\n", clone_bio->bi_iter.bi_size, clone_bio->bi_iter.bi_sector, to_read_in_clone);
+		bio_advance_iter(main_bio, &iter, part.bi_size);
 	}
-	return 0;
 
-split_err:
-	pr_err("Bio split went wrong\n");
-	kfree(curr_rs_info);
-	kfree(prev_rs_info);
-	kfree(sectors);
-	bio_io_error(main_bio);
-	return -1;
+	if (parts > 1)
+		this_cpu_add(redirect_manager->stats->splits, parts - 1);
+	return status ?: LSBDD_READ_SPLIT;
+}
 
-mem_err:
-	pr_err("Memory allocation failed.\n");
-	kfree(prev_rs_info);
-	kfree(curr_rs_info);
-	kfree(sectors);
-	return -ENOMEM;
+/**
+ * Picks the data structure that suits the operations of the last window:
+ * mostly appending writes go to the learned index, reads that need the
+ * predecessor lookup to the rbtree (O(1) last, single descent prev), the
+ * rest to the B+tree.
+ */
+static const char *pick_data_struct(struct ds_op_stats *stats)
+{
+	u64 inserts = atomic64_read(&stats->inserts);
+	u64 appends = atomic64_read(&stats->appends);
+	u64 lookups = atomic64_read(&stats->lookups);
+	u64 prevs = atomic64_read(&stats->prevs);
+
+	if (inserts && appends * 4 >= inserts * 3)
+		return available_ds[LEARNED_TYPE];
+	if (prevs * 4 >= lookups + inserts)
+		return available_ds[RBTREE_TYPE];
+	return available_ds[BTREE_TYPE];
+}
+
+/*
+ * Lowers the size of the BD's bios to the extent of the data structure, that
+ * the started migration goes to, the copy fails on a larger mapping anyway.
+ */
+static void lsbdd_migration_limits(struct bd_manager *manager)
+{
+	struct request_queue *q = manager->vbd_disk->queue;
+
+	blk_queue_max_hw_sectors(q, min(queue_max_hw_sectors(q), ds_max_extent(manager->migration.target)));
+}
+
+/**
+ * Once per LSBDD_AUTO_WINDOW operations starts a migration to the data
+ * structure picked by pick_data_struct(), if it differs from the current one.
+ * Must be called with ds_lock held for write.
+ */
+static void check_auto_migration(struct bd_manager *redirect_manager)
+{
+	struct ds_op_stats *stats = &redirect_manager->op_stats;
+	const char *picked = NULL;
+	s32 status;
+
+	if (atomic64_read(&stats->lookups) + atomic64_read(&stats->inserts) < LSBDD_AUTO_WINDOW)
+		return;
+
+	picked = pick_data_struct(stats);
+	atomic64_set(&stats->lookups, 0);
+	atomic64_set(&stats->prevs, 0);
+	atomic64_set(&stats->inserts, 0);
+	atomic64_set(&stats->appends, 0);
+
+	if (ds_migration_running(&redirect_manager->migration) ||
+		!strcmp(picked, available_ds[redirect_manager->sel_data_struct->type]))
+		return;
+
+	pr_info("Auto migration of %s: %s -> %s\n", redirect_manager->vbd_disk->disk_name,
+		available_ds[redirect_manager->sel_data_struct->type], picked);
+	status = ds_migration_start(&redirect_manager->migration, (char *)picked);
+	if (status)
+		pr_err("Failed to start auto migration: %d\n", status);
+	else
+		lsbdd_migration_limits(redirect_manager);
+}
+
+/**
+ * Maps the block of a completed zone append to the sector, that the device
+ * wrote it at, then ends the clone. Runs on lsbdd_wq, as the completion
+ * can't take ds_lock.
+ */
+static void lsbdd_zone_append_done(struct work_struct *work)
+{
+	struct lsbdd_io *io = container_of(work, struct lsbdd_io, work);
+	struct bd_manager *current_redirect_manager = io->manager;
+	struct bio *clone = &io->clone;
+	struct bio *bio = clone->bi_private;
+	struct redir_sector_info rs_info;
+	s32 status;
+
+	if (!clone->bi_status) {
+		rs_info.block_size = bio->bi_iter.bi_size;
+		rs_info.stored_size = 0;
+		rs_info.redirected_sector = lsbdd_stripe_sector(0, clone->bi_iter.bi_sector);
+
+		down_write(&current_redirect_manager->ds_lock);
+		status = lsbdd_map_block(current_redirect_manager, bio->bi_iter.bi_sector, &rs_info);
+		if (auto_migrate && status >= 0)
+			check_auto_migration(current_redirect_manager);
+		up_write(&current_redirect_manager->ds_lock);
+
+		if (status < 0) {
+			pr_err("Failed inserting key: %llu sector: %llu in _\n", bio->bi_iter.bi_sector,
+				(u64)clone->bi_iter.bi_sector);
+			clone->bi_status = BLK_STS_IOERR;
+		} else {
+			trace_lsbdd_remap(bio, status ? LSBDD_REMAP_OVERWRITE : LSBDD_REMAP_WRITE,
+					rs_info.redirected_sector, 0);
+		}
+	}
+
+	lsbdd_zoned_put(current_redirect_manager->zoned, io->zone);
+	io->zone = NULL;
+	bdd_bio_end_io(clone);
 }
 
 /**
- * lsbdd_submit_bio() - Takes the provided bio, allocates a clone (child)
+ * lsbdd_map_bio() - Takes the provided bio, allocates a clone (child)
  * for a redirect_bd. Although, it changes the way both bio's will end (+ maps
  * bio address with free one from aim BD in chosen data structure) and submits them.
+ * The bio is accounted from here to the completion of the clone, which also
+ * ends it on a setup failure, as splits of the clone may be in flight already.
  *
+ * @current_redirect_manager - Manager of the BD the bio was sent to
  * @bio - Expected bio request
  */
-static void lsbdd_submit_bio(struct bio *bio)
+static void lsbdd_map_bio(struct bd_manager *current_redirect_manager, struct bio *bio)
 {
+	struct lsbdd_stats __percpu *stats = current_redirect_manager->stats;
+	struct lsbdd_dedup_fp fp;
+	struct lsbdd_io *io = NULL;
 	struct bio *clone = NULL;
-	struct bd_manager *current_redirect_manager = NULL;
-	s16 status;
+	bool zip = false;
+	unsigned long start_jiffies;
+	u64 start_ns;
+	s16 status = 0;
 
-	pr_info("Entered submit bio\n");
+	start_ns = ktime_get_ns();
+	start_jiffies = bio_start_io_acct(bio);
 
-	current_redirect_manager = get_bd_manager_by_name(bio->bi_bdev->bd_disk->disk_name);
-	if (!current_redirect_manager)
-		goto get_err;
-
-	clone = bio_alloc_clone(current_redirect_manager->bd_handler->bdev, bio,
-							GFP_KERNEL, bdd_pool);
+	/* A compressed write sends the block instead of a clone of the data */
+	if (current_redirect_manager->zip && !current_redirect_manager->read_only && bio_op(bio) == REQ_OP_WRITE)
+		clone = lsbdd_zip_compress(bio, current_redirect_manager->stripes[0].bd_handler->bdev,
+				&current_redirect_manager->bio_pool);
+	zip = clone;
+	if (!clone)
+		clone = bio_alloc_clone(current_redirect_manager->stripes[0].bd_handler->bdev, bio,
+								GFP_NOIO, &current_redirect_manager->bio_pool);
 	if (!clone)
 		goto clone_err;
 
+	io = container_of(clone, struct lsbdd_io, clone);
+	io->manager = current_redirect_manager;
+	io->stripe = &current_redirect_manager->stripes[0];
+	io->segment = NULL;
+	io->dedup = NULL;
+	io->zip = zip;
+	io->zone = NULL;
+	io->defrag_idx = -1;
+	io->polled = false;
+	io->start_jiffies = start_jiffies;
+	io->start_ns = start_ns;
 	clone->bi_private = bio;
 	clone->bi_end_io = bdd_bio_end_io;
 
-	if (bio_op(bio) == REQ_OP_READ)
+	if (bio_op(bio) == REQ_OP_READ) {
+		this_cpu_inc(stats->reads);
+		this_cpu_add(stats->read_bytes, bio->bi_iter.bi_size);
+		down_read(&current_redirect_manager->ds_lock);
 		status = setup_read_from_clone_segments(bio, clone, current_redirect_manager);
-	else if (bio_op(bio) == REQ_OP_WRITE)
-		status = setup_write_in_clone_segments(bio, clone, current_redirect_manager);
-	else
+		up_read(&current_redirect_manager->ds_lock);
+	} else if (op_is_write(bio_op(bio)) && current_redirect_manager->read_only) {
+		status = -EROFS;
+	} else if (bio_op(bio) == REQ_OP_WRITE) {
+		this_cpu_inc(stats->writes);
+		this_cpu_add(stats->write_bytes, bio->bi_iter.bi_size);
+		if (zip) {
+			this_cpu_add(stats->compressed_bytes, bio->bi_iter.bi_size);
+			this_cpu_add(stats->compressed_stored_bytes, clone->bi_iter.bi_size);
+		}
+		if (current_redirect_manager->zoned) {
+			/* The mapping is inserted on completion, nothing to take ds_lock for */
+			status = setup_zone_append(bio, clone, current_redirect_manager);
+		} else {
+			if (current_redirect_manager->dedup && bio->bi_iter.bi_size)
+				lsbdd_dedup_hash(bio, &fp);
+			/* Held until the completion, the defragmentation doesn't copy blocks, that aren't written yet */
+			if (current_redirect_manager->defrag)
+				io->defrag_idx = srcu_down_read(&current_redirect_manager->defrag->writes);
+			down_write(&current_redirect_manager->ds_lock);
+			status = setup_write_in_clone_segments(bio, clone, current_redirect_manager,
+					current_redirect_manager->dedup && bio->bi_iter.bi_size ? &fp : NULL);
+			if (auto_migrate && status >= 0)
+				check_auto_migration(current_redirect_manager);
+			up_write(&current_redirect_manager->ds_lock);
+		}
+	} else {
 		pr_warn("Unknown Operation in bio\n");
+	}
 
 
+	if (status == LSBDD_READ_UNMAPPED)
+		zero_fill_bio(bio);
+	/* Nothing to send to the backing device */
+	if (status == LSBDD_READ_UNMAPPED || status == LSBDD_WRITE_DEDUPED || status == LSBDD_READ_SPLIT) {
+		io->stripe = NULL;
+		bio_endio(clone);
+		return;
+	}
 	if (status)
 		goto setup_err;
 
 
+	if (clone->bi_opf & REQ_POLLED)
+		lsbdd_poll_prepare(bio, io);
+	atomic_inc(&io->stripe->inflight);
 	submit_bio(clone);
-	pr_info("Submitted bio\n\n");
-	return;
-
-get_err:
-	pr_err("No such bd_manager with middle disk %s and not empty handler\n",
-		bio->bi_bdev->bd_disk->disk_name);
-	bdd_bio_end_io(bio);
 	return;
 
 clone_err:
 	pr_err("Bio allocation failed\n");
+	this_cpu_inc(stats->errors);
+	bio_end_io_acct(bio, start_jiffies);
 	bio_io_error(bio);
 	return;
 
 setup_err:
 	pr_err("Setup failed with code %d\n", status);
-	bio_io_error(bio);
+	io->stripe = NULL;
+	clone->bi_status = BLK_STS_IOERR;
+	bio_endio(clone);
 	return;
 }
 
+/* Maps the bios, that were queued to the list, in the order they came */
+static void lsbdd_map_queued(struct bd_manager *current_redirect_manager, spinlock_t *lock,
+		struct bio_list *queued)
+{
+	struct bio_list bios;
+	struct blk_plug plug;
+	struct bio *bio = NULL;
+
+	spin_lock_irq(lock);
+	bios = *queued;
+	bio_list_init(queued);
+	spin_unlock_irq(lock);
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(&bios)))
+		lsbdd_map_bio(current_redirect_manager, bio);
+	blk_finish_plug(&plug);
+}
+
+static void lsbdd_deferred_work(struct work_struct *work)
+{
+	struct bd_manager *current_redirect_manager = container_of(work, struct bd_manager, deferred_work);
+
+	lsbdd_map_queued(current_redirect_manager, &current_redirect_manager->deferred_lock,
+			&current_redirect_manager->deferred_bios);
+}
+
+static void lsbdd_hash_work(struct work_struct *work)
+{
+	struct lsbdd_hash_queue *queue = container_of(work, struct lsbdd_hash_queue, work);
+
+	lsbdd_map_queued(queue->manager, &queue->lock, &queue->bios);
+}
+
+/* Sets up the hash queues of a BD with dedup, one per possible CPU */
+static s32 lsbdd_hash_queues_init(struct bd_manager *manager)
+{
+	struct lsbdd_hash_queue *queue = NULL;
+	s32 cpu;
+
+	manager->hash_queues = alloc_percpu(struct lsbdd_hash_queue);
+	if (!manager->hash_queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		queue = per_cpu_ptr(manager->hash_queues, cpu);
+		queue->manager = manager;
+		spin_lock_init(&queue->lock);
+		bio_list_init(&queue->bios);
+		INIT_WORK(&queue->work, lsbdd_hash_work);
+	}
+	return 0;
+}
+
+/* Waits for the queued writes and frees the hash queues, no bios may come to the BD anymore */
+static void lsbdd_hash_queues_free(struct bd_manager *manager)
+{
+	s32 cpu;
+
+	if (!manager->hash_queues)
+		return;
+
+	for_each_possible_cpu(cpu)
+		flush_work(&per_cpu_ptr(manager->hash_queues, cpu)->work);
+	free_percpu(manager->hash_queues);
+	manager->hash_queues = NULL;
+}
+
+/**
+ * Checks if the data of a write should be hashed by the workqueue. With few
+ * clones in flight the submitter does it faster itself, with a deep queue
+ * the hashing is spread over the other CPUs: every submitting CPU queues to
+ * a work of its own, which lsbdd_hash_wq runs in parallel to the others.
+ */
+static bool lsbdd_defer_hash(struct bd_manager *current_redirect_manager, struct bio *bio)
+{
+	u32 inflight = 0;
+	u8 i;
+
+	if (!current_redirect_manager->dedup || bio_op(bio) != REQ_OP_WRITE)
+		return false;
+
+	for (i = 0; i < current_redirect_manager->nr_stripes; i++)
+		inflight += atomic_read(&current_redirect_manager->stripes[i].inflight);
+	return inflight >= LSBDD_DEDUP_DEFER_DEPTH;
+}
+
+/**
+ * lsbdd_submit_bio() - Maps the bio right away, or hands it to the
+ * deferred_work if the mapping may need to wait for I/O, which can't be
+ * done in the submit_bio() context, or to hash its data. Bios are split to
+ * the limits of the BD first.
+ *
+ * @bio - Expected bio request
+ */
+static void lsbdd_submit_bio(struct bio *bio)
+{
+	struct bd_manager *current_redirect_manager = NULL;
+	struct lsbdd_hash_queue *queue = NULL;
+	unsigned long flags;
+	bool defer;
+
+	current_redirect_manager = bio->bi_bdev->bd_disk->private_data;
+	if (!current_redirect_manager)
+		goto get_err;
+
+	/* The clones go on as they are, see lsbdd_set_limits() */
+	bio = bio_split_to_limits(bio);
+	if (!bio)
+		return;
+	/* Clones inherit the priority, a deferred one would get that of the worker otherwise */
+	if (!bio->bi_ioprio)
+		bio->bi_ioprio = get_current_ioprio();
+
+	defer = current_redirect_manager->defer_io || lsbdd_defer_hash(current_redirect_manager, bio);
+	trace_lsbdd_submit(bio, defer);
+	if (defer && current_redirect_manager->defer_io) {
+		spin_lock_irqsave(&current_redirect_manager->deferred_lock, flags);
+		bio_list_add(&current_redirect_manager->deferred_bios, bio);
+		spin_unlock_irqrestore(&current_redirect_manager->deferred_lock, flags);
+		queue_work(lsbdd_wq, &current_redirect_manager->deferred_work);
+		return;
+	}
+	if (defer) {
+		/* The submitter may move to another CPU meanwhile, the lock keeps the queue consistent */
+		queue = raw_cpu_ptr(current_redirect_manager->hash_queues);
+		spin_lock_irqsave(&queue->lock, flags);
+		bio_list_add(&queue->bios, bio);
+		spin_unlock_irqrestore(&queue->lock, flags);
+		queue_work(lsbdd_hash_wq, &queue->work);
+		return;
+	}
+
+	lsbdd_map_bio(current_redirect_manager, bio);
+	return;
+
+get_err:
+	pr_err("No such bd_manager with middle disk %s and not empty handler\n",
+		bio->bi_bdev->bd_disk->disk_name);
+	bio_io_error(bio);
+}
+
 static const struct block_device_operations lsbdd_bio_ops = {
 	.owner = THIS_MODULE,
 	.submit_bio = lsbdd_submit_bio,
+	.poll_bio = lsbdd_poll_bio,
 };
 
-/**
- * init_disk_bd() - Initialises gendisk structure, for 'middle' disk
- * @vbd_name: name of creating BD
- *
- * DOESN'T SET UP the disks capacity, check lsbdd_submit_bio()
- * AND DOESN'T ADD disk if there was one already TO FIX?
+/**
+ * Derives the limits of a BD from its backing devices, so a bio is split
+ * once, by lsbdd_submit_bio(), and its clone is taken by every device as it
+ * is. A block can't be larger than its mapping records, writes of a BD with
+ * compression are split at LSBDD_ZIP_MAX_BLOCK, so large ones are still
+ * compressed. Striped BDs prefer I/O of a segment on every device.
+ */
+static void lsbdd_set_limits(struct bd_manager *manager, struct request_queue *q)
+{
+	struct block_device *bdev = NULL;
+	struct request_queue *backing = NULL;
+	u32 lbs = SECTOR_SIZE, pbs = SECTOR_SIZE;
+	u32 io_min = 0, io_opt = 0, dma = 0;
+	/* A block must be found back by ds_prev() from its last sector */
+	u32 max_sectors = ds_max_extent(manager->sel_data_struct);
+	u32 segment_size = UINT_MAX;
+	u16 segments = USHRT_MAX;
+	unsigned long boundary = ULONG_MAX, virt_boundary = 0;
+	u8 i;
+
+	for (i = 0; i < manager->nr_stripes; i++) {
+		bdev = manager->stripes[i].bd_handler->bdev;
+		backing = bdev_get_queue(bdev);
+		lbs = max(lbs, bdev_logical_block_size(bdev));
+		pbs = max(pbs, bdev_physical_block_size(bdev));
+		io_min = max(io_min, bdev_io_min(bdev));
+		io_opt = max(io_opt, bdev_io_opt(bdev));
+		dma = max(dma, bdev_dma_alignment(bdev));
+		max_sectors = min(max_sectors, queue_max_hw_sectors(backing));
+		segments = min(segments, queue_max_segments(backing));
+		segment_size = min(segment_size, queue_max_segment_size(backing));
+		boundary = min(boundary, queue_segment_boundary(backing));
+		virt_boundary = max(virt_boundary, queue_virt_boundary(backing));
+	}
+	if (manager->nr_stripes > 1 && !manager->tier)
+		io_opt = max_t(u64, io_opt, (u64)(manager->segment_sectors << SECTOR_SHIFT) * manager->nr_stripes);
+	/* A write of a whole coarse block takes a single mapping */
+	if (manager->hybrid)
+		io_opt = max(io_opt, 1U << (manager->hybrid->block_shift + SECTOR_SHIFT));
+
+	blk_queue_logical_block_size(q, lbs);
+	blk_queue_physical_block_size(q, pbs);
+	blk_queue_io_min(q, max(io_min, pbs));
+	blk_queue_io_opt(q, io_opt);
+	blk_queue_dma_alignment(q, dma);
+	blk_queue_max_hw_sectors(q, max_sectors);
+	blk_queue_max_segments(q, segments);
+	blk_queue_max_segment_size(q, segment_size);
+	blk_queue_segment_boundary(q, boundary);
+	/* Lifts the segment size, the boundary splits the segments instead */
+	if (virt_boundary)
+		blk_queue_virt_boundary(q, virt_boundary);
+	if (manager->zip)
+		blk_queue_chunk_sectors(q, DS_VALUE_ZIP_MAX_SECTORS);
+	/* Duplicates are found block by block, a larger write would have to match as a whole */
+	if (manager->dedup)
+		blk_queue_chunk_sectors(q, LSBDD_DEDUP_BLOCK_SECTORS);
+	if (manager->zoned)
+		lsbdd_zoned_limits(manager->zoned, q);
+}
+
+/**
+ * init_disk_bd() - Initialises gendisk structure, for 'middle' disk
+ * @vbd_name: name of creating BD
+ *
+ * DOESN'T SET UP the disks capacity, check lsbdd_submit_bio()
+ * AND DOESN'T ADD disk if there was one already TO FIX?
+ */
+static struct gendisk *init_disk_bd(char *vbd_name)
+{
+	struct gendisk *new_disk = NULL;
+	struct bd_manager *linked_manager = NULL;
+	sector_t capacity = 0;
+	bool poll = true;
+	u8 i;
+
+	new_disk = blk_alloc_disk(NUMA_NO_NODE);
+
+	new_disk->major = bdd_major;
+	new_disk->first_minor = 1;
+	new_disk->minors = LSBDD_MAX_MINORS_AM;
+	new_disk->fops = &lsbdd_bio_ops;
+	blk_queue_flag_set(QUEUE_FLAG_IO_STAT, new_disk->queue);
+
+	if (vbd_name) {
+		strcpy(new_disk->disk_name, vbd_name);
+	} else {
+		pr_warn("vbd_name is NULL, nothing to copy\n");
+		return NULL;
+	}
+
+	if (list_empty(&bd_list)) {
+		pr_warn("Couldn't init disk, bc list is empty\n");
+		return NULL;
+	}
+
+	linked_manager = list_last_entry(&bd_list, struct bd_manager, list);
+	new_disk->private_data = linked_manager;
+	for (i = 0; i < linked_manager->nr_stripes; i++) {
+		capacity += linked_manager->stripes[i].capacity;
+		poll &= test_bit(QUEUE_FLAG_POLL,
+				&bdev_get_queue(linked_manager->stripes[i].bd_handler->bdev)->queue_flags);
+	}
+	/* Polled bios are passed on to the backing devices, which must all poll */
+	if (poll)
+		blk_queue_flag_set(QUEUE_FLAG_POLL, new_disk->queue);
+	/* The fast tier only holds blocks of the slow one for a while */
+	if (linked_manager->tier)
+		capacity = linked_manager->stripes[LSBDD_TIER_SLOW].capacity;
+	else if (linked_manager->virtual_sectors)
+		capacity = linked_manager->virtual_sectors;
+	lsbdd_set_limits(linked_manager, new_disk->queue);
+	set_disk_ro(new_disk, linked_manager->read_only);
+	set_capacity(new_disk, capacity);
+	return new_disk;
+}
+
+/**
+ * Opens the backing devices of a BD, that stripes its log over them.
+ *
+ * @bd_paths - comma separated paths, modified by the parsing
+ *
+ * It returns 0 on success, negative error code otherwise, the opened devices
+ * are released then.
+ */
+static s32 open_stripes(struct bd_manager *manager, char *bd_paths)
+{
+	struct lsbdd_stripe *stripe = NULL;
+	struct bdev_handle *handle = NULL;
+	char *path = NULL;
+	s32 status = 0;
+	u8 i;
+
+	/* Bit 63 of a packed value marks compressed blocks, the stripe index stays below it */
+	BUILD_BUG_ON(LSBDD_MAX_STRIPES > 1 << (63 - DS_VALUE_BS_BITS - LSBDD_STRIPE_SECTOR_BITS));
+
+	while ((path = strsep(&bd_paths, ","))) {
+		if (manager->nr_stripes == LSBDD_MAX_STRIPES) {
+			pr_err("At most %d backing devices are supported\n", LSBDD_MAX_STRIPES);
+			status = -E2BIG;
+			goto release;
+		}
+
+		handle = open_bd_on_rw(path);
+		if (IS_ERR(handle)) {
+			pr_err("Couldnt open bd by path: %s\n", path);
+			status = PTR_ERR(handle);
+			goto release;
+		}
+		for (i = 0; i < manager->nr_stripes; i++) {
+			if (manager->stripes[i].bd_handler->bdev == handle->bdev) {
+				pr_err("%s is listed twice\n", path);
+				bdev_release(handle);
+				status = -EINVAL;
+				goto release;
+			}
+		}
+
+		stripe = &manager->stripes[manager->nr_stripes++];
+		stripe->bd_handler = handle;
+		stripe->next_free_sector = LSBDD_SECTOR_OFFSET;
+		/* The rest can't be addressed by a redirected sector */
+		stripe->capacity = min_t(sector_t, get_capacity(handle->bdev->bd_disk), LSBDD_STRIPE_SECTOR_MASK);
+		atomic_set(&stripe->inflight, 0);
+	}
+
+	manager->cur_stripe = 0;
+	manager->segment_sectors = max_t(sector_t, (sector_t)stripe_segment_size << (10 - SECTOR_SHIFT), 1);
+	manager->segment_end = LSBDD_SECTOR_OFFSET + manager->segment_sectors;
+	return 0;
+
+release:
+	while (manager->nr_stripes)
+		bdev_release(manager->stripes[--manager->nr_stripes].bd_handler);
+	return status;
+}
+
+/**
+ * Opens the backing devices of the origin of a snapshot again, for reads
+ * only, so the snapshot doesn't depend on the origin staying around.
+ *
+ * It returns 0 on success, negative error code otherwise, the opened devices
+ * are released then.
+ */
+static s32 open_snapshot_stripes(struct bd_manager *manager, struct bd_manager *origin)
+{
+	struct lsbdd_stripe *stripe = NULL;
+	struct bdev_handle *handle = NULL;
+	u8 i;
+
+	for (i = 0; i < origin->nr_stripes; i++) {
+		handle = bdev_open_by_dev(origin->stripes[i].bd_handler->bdev->bd_dev, BLK_OPEN_READ, NULL, NULL);
+		if (IS_ERR(handle)) {
+			while (manager->nr_stripes)
+				bdev_release(manager->stripes[--manager->nr_stripes].bd_handler);
+			return PTR_ERR(handle);
+		}
+
+		stripe = &manager->stripes[manager->nr_stripes++];
+		stripe->bd_handler = handle;
+		stripe->next_free_sector = LSBDD_SECTOR_OFFSET;
+		stripe->capacity = origin->stripes[i].capacity;
+		atomic_set(&stripe->inflight, 0);
+	}
+	return 0;
+}
+
+/**
+ * check_and_open_bd() - Checks if name is occupied, if so - opens the BD, if
+ * not - return -EINVAL. Additionally adds the BD to the vector.
+ * and initialises data_struct.
+ *
+ * @bd_path - comma separated paths of the backing devices
+ * @virtual_sectors - capacity of a thin volume in the pool on bd_path or of
+ * a snapshot, 0 if the BD is neither of them
+ * @origin - BD, that the new one is a snapshot of, or NULL, its devices are
+ * opened instead of bd_path
+ */
+static s32 check_and_open_bd(char *bd_path, sector_t virtual_sectors, struct bd_manager *origin)
+{
+	struct bd_manager *current_bdev_manager = kzalloc(sizeof(struct bd_manager), GFP_KERNEL);
+	struct data_struct *curr_ds = kzalloc(sizeof(struct data_struct), GFP_KERNEL);
+	s32 status;
+
+	if (!curr_ds + !current_bdev_manager > 0)
+		goto mem_err;
+
+	current_bdev_manager->stats = alloc_percpu(struct lsbdd_stats);
+	if (!current_bdev_manager->stats)
+		goto mem_err;
+
+	if (origin)
+		status = open_snapshot_stripes(current_bdev_manager, origin);
+	else if (virtual_sectors)
+		status = lsbdd_pool_join(current_bdev_manager, bd_path, virtual_sectors);
+	else
+		status = open_stripes(current_bdev_manager, bd_path);
+
+	if (status)
+		goto free_bdev;
+
+	status = bioset_init(&current_bdev_manager->bio_pool, BIO_POOL_SIZE, offsetof(struct lsbdd_io, clone),
+			BIOSET_NEED_BVECS);
+	if (status) {
+		pr_err("Couldn't allocate bio set\n");
+		goto release_stripes;
+	}
+
+	if (origin) {
+		current_bdev_manager->read_only = true;
+		current_bdev_manager->virtual_sectors = virtual_sectors;
+	}
+	current_bdev_manager->vbd_name = bd_path;
+	current_bdev_manager->sel_data_struct = curr_ds;
+	init_rwsem(&current_bdev_manager->ds_lock);
+	spin_lock_init(&current_bdev_manager->deferred_lock);
+	bio_list_init(&current_bdev_manager->deferred_bios);
+	INIT_WORK(&current_bdev_manager->deferred_work, lsbdd_deferred_work);
+	ds_migration_init(&current_bdev_manager->migration, &current_bdev_manager->sel_data_struct,
+			&current_bdev_manager->ds_lock);
+	lsbdd_iosched_init(&current_bdev_manager->iosched, bg_bandwidth, bg_iops, fg_latency_target);
+
+	vector_add_bd(current_bdev_manager);
+
+	if (origin)
+		pr_info("Succesfully added a snapshot of %s to vector\n", origin->vbd_disk->disk_name);
+	else
+		pr_info("Succesfully added %s to vector\n", bd_path);
+
+	return 0;
+
+release_stripes:
+	lsbdd_pool_leave(current_bdev_manager);
+	while (current_bdev_manager->nr_stripes)
+		bdev_release(current_bdev_manager->stripes[--current_bdev_manager->nr_stripes].bd_handler);
+free_bdev:
+	free_percpu(current_bdev_manager->stats);
+	kfree(curr_ds);
+	kfree(current_bdev_manager);
+	return status;
+
+mem_err:
+	if (current_bdev_manager)
+		free_percpu(current_bdev_manager->stats);
+	kfree(current_bdev_manager);
+	kfree(curr_ds);
+	return -ENOMEM;
+}
+
+static char *create_disk_name_by_index(s32 index)
+{
+	char *disk_name =
+		kmalloc(strlen(LSBDD_BLKDEV_NAME_PREFIX) + snprintf(NULL, 0, "%d", index) + 1,
+				GFP_KERNEL);
+
+	if (disk_name != NULL)
+		sprintf(disk_name, "%s%d", LSBDD_BLKDEV_NAME_PREFIX, index);
+
+	return disk_name;
+}
+
+/**
+ * Prints the counters of a BD. Write amplification is the ratio of the bytes
+ * written to the backing device (data and the on-disk index) to the bytes
+ * written to the BD, overwritten bytes are the garbage left in the log.
+ * Mappings frozen by snapshots are counted apart from the index entries.
+ * Every backing device gets a "stripe<i>" line with its name, the sectors of
+ * the log on it, its capacity and the I/Os in flight.
+ */
+static s32 lsbdd_debugfs_stats_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	sector_t log_sectors[LSBDD_MAX_STRIPES];
+	struct lsbdd_snap_layer *layer = NULL;
+	enum data_type type;
+	u64 nr_mappings, index_bytes, meta_written, write_bytes, wa;
+	u64 frozen = 0;
+	u8 i;
+
+	down_read(&manager->ds_lock);
+	type = manager->sel_data_struct->type;
+	nr_mappings = manager->nr_mappings;
+	for (layer = manager->frozen; layer; layer = layer->below)
+		frozen += layer->nr_mappings;
+	index_bytes = ds_mem_usage(manager->sel_data_struct, nr_mappings);
+	meta_written = ds_meta_written(manager->sel_data_struct);
+	for (i = 0; i < manager->nr_stripes; i++)
+		log_sectors[i] = manager->stripes[i].next_free_sector - LSBDD_SECTOR_OFFSET;
+	up_read(&manager->ds_lock);
+
+	write_bytes = LSBDD_STAT(manager, write_bytes);
+	wa = write_bytes ? div64_u64((write_bytes + meta_written) * 1000, write_bytes) : 1000;
+
+	seq_printf(m, "data_struct: %s\n", available_ds[type]);
+	seq_printf(m, "reads: %llu\n", LSBDD_STAT(manager, reads));
+	seq_printf(m, "writes: %llu\n", LSBDD_STAT(manager, writes));
+	seq_printf(m, "read_bytes: %llu\n", LSBDD_STAT(manager, read_bytes));
+	seq_printf(m, "write_bytes: %llu\n", write_bytes);
+	seq_printf(m, "splits: %llu\n", LSBDD_STAT(manager, splits));
+	seq_printf(m, "prev_reads: %llu\n", LSBDD_STAT(manager, prev_reads));
+	seq_printf(m, "system_reads: %llu\n", LSBDD_STAT(manager, system_reads));
+	seq_printf(m, "errors: %llu\n", LSBDD_STAT(manager, errors));
+	seq_printf(m, "index_entries: %llu\n", nr_mappings);
+	seq_printf(m, "frozen_index_entries: %llu\n", frozen);
+	seq_printf(m, "index_bytes: %llu\n", index_bytes);
+	seq_printf(m, "index_written_bytes: %llu\n", meta_written);
+	seq_printf(m, "overwritten_bytes: %llu\n", LSBDD_STAT(manager, overwritten_bytes));
+	seq_printf(m, "compressed_bytes: %llu\n", LSBDD_STAT(manager, compressed_bytes));
+	seq_printf(m, "compressed_stored_bytes: %llu\n", LSBDD_STAT(manager, compressed_stored_bytes));
+	seq_printf(m, "write_amplification: %llu.%03llu\n", wa / 1000, wa % 1000);
+	for (i = 0; i < manager->nr_stripes; i++)
+		seq_printf(m, "stripe%u: %s %llu/%llu %d\n", i,
+			manager->stripes[i].bd_handler->bdev->bd_disk->disk_name, (u64)log_sectors[i],
+			(u64)manager->stripes[i].capacity, atomic_read(&manager->stripes[i].inflight));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_stats);
+
+/**
+ * Prints the non-empty buckets of the latency histograms of a BD, one per
+ * line: "<histogram> <lower bound in ns> <count>".
+ */
+static s32 lsbdd_debugfs_latency_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	u64 count;
+	u32 hist, bucket;
+
+	for (hist = 0; hist < LSBDD_HIST_NR; hist++) {
+		for (bucket = 0; bucket < LSBDD_HIST_BUCKETS; bucket++) {
+			count = LSBDD_STAT(manager, hist[hist][bucket]);
+			if (count)
+				seq_printf(m, "%s %llu %llu\n", lsbdd_hist_names[hist],
+					bucket ? 1ULL << bucket : 0, count);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_latency);
+
+/**
+ * Scans the mapping of a BD and prints its fragmentation. The amplification
+ * is the one of a sequential read of the mapped sectors in requests of
+ * DS_FRAG_SCAN_SECTORS: every discontinuity costs one more request to the
+ * backing device, every split one more bio. Percentiles are the lower
+ * bounds of the log2 buckets of the extent lengths, listed as
+ * "extent_hist <lower bound in sectors> <count>".
+ */
+static s32 lsbdd_debugfs_fragmentation_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct ds_frag_report *report = NULL;
+	u64 avg, per_mb, requests, amp, split_amp;
+	s32 status;
+	u32 bucket;
+
+	report = kzalloc(sizeof(*report), GFP_KERNEL);
+	if (!report)
+		return -ENOMEM;
+
+	status = ds_frag_scan(&manager->sel_data_struct, &manager->ds_lock, report);
+	if (status)
+		goto out;
+
+	requests = max_t(u64, DIV_ROUND_UP_ULL(report->mapped_sectors, DS_FRAG_SCAN_SECTORS), 1);
+	avg = report->extents ? div64_u64(report->mapped_sectors * 1000, report->extents) : 0;
+	per_mb = report->mapped_sectors ? div64_u64(report->discontinuities * (SZ_1M >> SECTOR_SHIFT) * 1000,
+			report->mapped_sectors) : 0;
+	amp = div64_u64((requests + report->discontinuities) * 1000, requests);
+	split_amp = div64_u64((requests + report->splits) * 1000, requests);
+
+	seq_printf(m, "mappings: %llu\n", report->mappings);
+	seq_printf(m, "extents: %llu\n", report->extents);
+	seq_printf(m, "mapped_sectors: %llu\n", report->mapped_sectors);
+	seq_printf(m, "holes: %llu\n", report->holes);
+	seq_printf(m, "discontinuities: %llu\n", report->discontinuities);
+	seq_printf(m, "extent_sectors_avg: %llu.%03llu\n", avg / 1000, avg % 1000);
+	seq_printf(m, "extent_sectors_p50: %llu\n", ds_frag_percentile(report, 50));
+	seq_printf(m, "extent_sectors_p90: %llu\n", ds_frag_percentile(report, 90));
+	seq_printf(m, "extent_sectors_p99: %llu\n", ds_frag_percentile(report, 99));
+	seq_printf(m, "extent_sectors_max: %llu\n", report->max_extent);
+	seq_printf(m, "discontinuities_per_mb: %llu.%03llu\n", per_mb / 1000, per_mb % 1000);
+	seq_printf(m, "seq_read_amplification: %llu.%03llu\n", amp / 1000, amp % 1000);
+	seq_printf(m, "seq_read_split_amplification: %llu.%03llu\n", split_amp / 1000, split_amp % 1000);
+	for (bucket = 0; bucket < DS_FRAG_HIST_BUCKETS; bucket++)
+		if (report->hist[bucket])
+			seq_printf(m, "extent_hist %llu %llu\n", 1ULL << bucket, report->hist[bucket]);
+
+out:
+	kfree(report);
+	return status;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_fragmentation);
+
+/* Prints the state of the fast tier and the data moved between the tiers */
+static s32 lsbdd_debugfs_tier_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct lsbdd_tier *tier = manager->tier;
+
+	down_read(&manager->ds_lock);
+	seq_printf(m, "segments: %u\n", tier->nr_segments);
+	seq_printf(m, "free_segments: %u\n", tier->nr_free);
+	seq_printf(m, "demoted_segments: %llu\n", tier->demoted_segments);
+	seq_printf(m, "demoted_bytes: %llu\n", tier->demoted_bytes);
+	seq_printf(m, "promoted_bytes: %llu\n", tier->promoted_bytes);
+	seq_printf(m, "slow_writes: %llu\n", tier->slow_writes);
+	seq_printf(m, "tracked_reads: %d\n", atomic_read(&tier->nr_tracked));
+	up_read(&manager->ds_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_tier);
+
+/*
+ * Prints the space of a thin volume and of its pool. Allocated sectors are
+ * the log written so far, overwritten blocks aren't reclaimed from it.
+ */
+static s32 lsbdd_debugfs_pool_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct lsbdd_pool *pool = manager->pool;
+	sector_t volume_allocated, pool_allocated;
+	u32 nr_volumes;
+
+	down_read(&manager->ds_lock);
+	volume_allocated = manager->stripes[0].next_free_sector - LSBDD_SECTOR_OFFSET;
+	up_read(&manager->ds_lock);
+	spin_lock(&pool->lock);
+	pool_allocated = pool->next_free_sector - LSBDD_SECTOR_OFFSET;
+	spin_unlock(&pool->lock);
+	/* Changed by the parameter setters, which don't take the pool lock */
+	nr_volumes = READ_ONCE(pool->nr_volumes);
+
+	seq_printf(m, "virtual_sectors: %llu\n", (u64)manager->virtual_sectors);
+	seq_printf(m, "allocated_sectors: %llu\n", (u64)volume_allocated);
+	seq_printf(m, "pool_device: %s\n", pool->bd_handler->bdev->bd_disk->disk_name);
+	seq_printf(m, "pool_volumes: %u\n", nr_volumes);
+	seq_printf(m, "pool_capacity_sectors: %llu\n", (u64)pool->capacity);
+	seq_printf(m, "pool_virtual_sectors: %llu\n", (u64)READ_ONCE(pool->virtual_sectors));
+	seq_printf(m, "pool_allocated_sectors: %llu\n", (u64)pool_allocated);
+	seq_printf(m, "pool_free_sectors: %llu\n", (u64)(pool->capacity - LSBDD_SECTOR_OFFSET - pool_allocated));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_pool);
+
+/*
+ * Prints the content index of a BD. saved_bytes are the writes, that were
+ * only mapped to a block in the log.
+ */
+static s32 lsbdd_debugfs_dedup_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct lsbdd_dedup *dd = manager->dedup;
+	u64 hits, misses, saved_bytes;
+	u32 nr_entries;
+
+	spin_lock_irq(&dd->lock);
+	nr_entries = dd->nr_entries;
+	hits = dd->hits;
+	misses = dd->misses;
+	saved_bytes = dd->saved_bytes;
+	spin_unlock_irq(&dd->lock);
+
+	seq_printf(m, "entries: %u\n", nr_entries);
+	seq_printf(m, "hits: %llu\n", hits);
+	seq_printf(m, "misses: %llu\n", misses);
+	seq_printf(m, "saved_bytes: %llu\n", saved_bytes);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_dedup);
+
+/*
+ * Prints the zones of a zoned BD. Finished zones were retired with room
+ * left, reset ones had no mapped block left and were used again.
+ */
+static s32 lsbdd_debugfs_zones_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct lsbdd_zoned *zd = manager->zoned;
+	u64 appends, finishes, resets;
+	u32 nr_free, nr_open = 0;
+	u32 i;
+
+	spin_lock_irq(&zd->lock);
+	nr_free = zd->nr_free;
+	for (i = 0; i < zd->nr_open; i++)
+		nr_open += !!zd->open[i];
+	appends = zd->appends;
+	finishes = zd->finishes;
+	resets = zd->resets;
+	spin_unlock_irq(&zd->lock);
+
+	seq_printf(m, "zones: %u\n", zd->nr_zones);
+	seq_printf(m, "zone_sectors: %llu\n", 1ULL << zd->zone_shift);
+	seq_printf(m, "capacity_sectors: %llu\n", (u64)zd->capacity);
+	seq_printf(m, "free_zones: %u\n", nr_free);
+	seq_printf(m, "open_zones: %u/%u\n", nr_open, zd->nr_open);
+	seq_printf(m, "appends: %llu\n", appends);
+	seq_printf(m, "finished_zones: %llu\n", finishes);
+	seq_printf(m, "reset_zones: %llu\n", resets);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_zones);
+
+/*
+ * Prints the hybrid mapping of a BD. Extended writes took no mapping of their
+ * own, cut mappings were overwritten in part, merged ones were folded back
+ * by the merge passes.
  */
-static struct gendisk *init_disk_bd(char *vbd_name)
+static s32 lsbdd_debugfs_hybrid_show(struct seq_file *m, void *v)
 {
-	struct gendisk *new_disk = NULL;
-	struct bd_manager *linked_manager = NULL;
+	struct bd_manager *manager = m->private;
+	struct lsbdd_hybrid *hy = manager->hybrid;
+
+	down_read(&manager->ds_lock);
+	seq_printf(m, "block_sectors: %u\n", 1U << hy->block_shift);
+	seq_printf(m, "mappings: %llu\n", manager->nr_mappings);
+	seq_printf(m, "extended_writes: %llu\n", hy->extended);
+	seq_printf(m, "cut_mappings: %llu\n", hy->cut);
+	seq_printf(m, "merged_mappings: %llu\n", hy->merged);
+	seq_printf(m, "merge_passes: %llu\n", hy->passes);
+	up_read(&manager->ds_lock);
 
-	new_disk = blk_alloc_disk(NUMA_NO_NODE);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_hybrid);
 
-	new_disk->major = bdd_major;
-	new_disk->first_minor = 1;
-	new_disk->minors = LSBDD_MAX_MINORS_AM;
-	new_disk->fops = &lsbdd_bio_ops;
+/*
+ * Prints the defragmentation of a BD. Raced mappings were overwritten while
+ * their window was copied, they kept the new data.
+ */
+static s32 lsbdd_debugfs_defrag_show(struct seq_file *m, void *v)
+{
+	struct bd_manager *manager = m->private;
+	struct lsbdd_defrag *df = manager->defrag;
 
-	if (vbd_name) {
-		strcpy(new_disk->disk_name, vbd_name);
-	} else {
-		pr_warn("vbd_name is NULL, nothing to copy\n");
-		return NULL;
-	}
+	down_read(&manager->ds_lock);
+	seq_printf(m, "rate_bytes: %llu\n", df->rate);
+	seq_printf(m, "scans: %llu\n", READ_ONCE(df->scans));
+	seq_printf(m, "windows: %llu\n", df->windows);
+	seq_printf(m, "moved_bytes: %llu\n", df->moved_bytes);
+	seq_printf(m, "raced_mappings: %llu\n", df->raced);
+	up_read(&manager->ds_lock);
 
-	if (list_empty(&bd_list)) {
-		pr_warn("Couldn't init disk, bc list is empty\n");
-		return NULL;
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_defrag);
+
+/*
+ * Prints the background I/O scheduler of a BD: the foreground read latency
+ * averages, the backoff and a line per class with its budget, the I/Os and
+ * bytes it sent and the time it waited.
+ */
+static s32 lsbdd_debugfs_iosched_show(struct seq_file *m, void *v)
+{
+	static const char * const classes[] = {"tier", "defrag"};
+	struct bd_manager *manager = m->private;
+	struct lsbdd_iosched *sched = &manager->iosched;
+	struct lsbdd_io_budget *budget = NULL;
+	u32 i;
+
+	seq_printf(m, "target_ns: %llu\n", sched->target_ns);
+	seq_printf(m, "fg_read_fast_ns: %llu\n", READ_ONCE(sched->lat_fast));
+	seq_printf(m, "fg_read_slow_ns: %llu\n", READ_ONCE(sched->lat_slow));
+	spin_lock(&sched->lock);
+	seq_printf(m, "backoff: %u\n", sched->backoff);
+	seq_printf(m, "backoffs: %llu\n", sched->backoffs);
+	spin_unlock(&sched->lock);
+	for (i = 0; i < LSBDD_IO_NR_CLASSES; i++) {
+		budget = &sched->budgets[i];
+		seq_printf(m, "%s: bandwidth %llu iops %u ios %llu bytes %llu throttled_ns %llu\n", classes[i],
+			budget->bandwidth, budget->iops, READ_ONCE(budget->ios), READ_ONCE(budget->bytes),
+			READ_ONCE(budget->throttled_ns));
 	}
 
-	linked_manager = list_last_entry(&bd_list, struct bd_manager, list);
-	set_capacity(new_disk,
-				 get_capacity(linked_manager->bd_handler->bdev->bd_disk));
-	return new_disk;
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(lsbdd_debugfs_iosched);
 
-/**
- * check_and_open_bd() - Checks if name is occupied, if so - opens the BD, if
- * not - return -EINVAL. Additionally adds the BD to the vector.
- * and initialises data_struct.
+/*
+ * State of a reader of the mapping file. entries[index] is the record at
+ * position pos, a new batch is read under ds_lock once they are used up.
  */
-static s32 check_and_open_bd(char *bd_path)
+struct lsbdd_dump {
+	struct bd_manager *manager;
+	struct data_struct *ds;
+	struct ds_cursor cursor;
+	struct ds_entry entries[DS_FRAG_BATCH];
+	u32 nr;
+	u32 index;
+	loff_t pos;
+};
+
+static void *lsbdd_dump_entry(struct lsbdd_dump *dump)
 {
-	struct bd_manager *current_bdev_manager = kzalloc(sizeof(struct bd_manager), GFP_KERNEL);
-	struct bdev_handle *current_bdev_handle = NULL;
-	struct data_struct *curr_ds = kzalloc(sizeof(struct data_struct), GFP_KERNEL);
+	struct bd_manager *manager = dump->manager;
+	s32 read = 0;
+
+	if (dump->index < dump->nr)
+		return &dump->entries[dump->index];
+
+	down_read(&manager->ds_lock);
+	if (!dump->ds)
+		dump->ds = manager->sel_data_struct;
+	/* The dump ends, if the data structure was switched meanwhile */
+	if (manager->sel_data_struct == dump->ds)
+		read = ds_read_batch(dump->ds, &dump->cursor, dump->entries, DS_FRAG_BATCH);
+	up_read(&manager->ds_lock);
+
+	if (read <= 0)
+		return read ? ERR_PTR(read) : NULL;
+
+	dump->nr = read;
+	dump->index = 0;
+	return &dump->entries[0];
+}
 
-	if (!curr_ds + !current_bdev_manager > 0)
-		goto mem_err;
+static void *lsbdd_dump_start(struct seq_file *m, loff_t *pos)
+{
+	struct lsbdd_dump *dump = m->private;
+
+	if (!*pos) {
+		memset(&dump->cursor, 0, sizeof(dump->cursor));
+		dump->ds = NULL;
+		dump->nr = 0;
+		dump->index = 0;
+		dump->pos = 0;
+	}
+	/* Only sequential reads, the walk can't be restarted at an offset */
+	if (*pos != dump->pos)
+		return NULL;
 
-	current_bdev_handle = open_bd_on_rw(bd_path);
+	return lsbdd_dump_entry(dump);
+}
 
-	if (IS_ERR(current_bdev_handle))
-		goto free_bdev;
+static void *lsbdd_dump_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct lsbdd_dump *dump = m->private;
 
-	current_bdev_manager->bd_handler = current_bdev_handle;
-	current_bdev_manager->vbd_name = bd_path;
-	current_bdev_manager->sel_data_struct = curr_ds;
+	dump->index++;
+	dump->pos = ++*pos;
+	return lsbdd_dump_entry(dump);
+}
 
-	vector_add_bd(current_bdev_manager);
+static void lsbdd_dump_stop(struct seq_file *m, void *v)
+{
+}
 
-	pr_info("Succesfully added %s to vector\n", bd_path);
+static s32 lsbdd_dump_show(struct seq_file *m, void *v)
+{
+	struct ds_entry *entry = v;
+	struct redir_sector_info rs_info;
 
+	ds_unpack_value(entry->value, &rs_info);
+	seq_printf(m, "%llu %u %llu %u\n", (u64)entry->key, lsbdd_stripe_index(rs_info.redirected_sector),
+		(u64)(rs_info.redirected_sector & LSBDD_STRIPE_SECTOR_MASK), rs_info.block_size >> SECTOR_SHIFT);
 	return 0;
-
-free_bdev:
-	pr_err("Couldnt open bd by path: %s\n", bd_path);
-	kfree(curr_ds);
-	kfree(current_bdev_manager);
-	return PTR_ERR(current_bdev_handle);
-
-mem_err:
-	kfree(current_bdev_manager);
-	kfree(curr_ds);
-	return -ENOMEM;
 }
 
-static char *create_disk_name_by_index(s32 index)
+static const struct seq_operations lsbdd_dump_seq_ops = {
+	.start = lsbdd_dump_start,
+	.next = lsbdd_dump_next,
+	.stop = lsbdd_dump_stop,
+	.show = lsbdd_dump_show,
+};
+
+static s32 lsbdd_debugfs_mapping_open(struct inode *inode, struct file *file)
 {
-	char *disk_name =
-		kmalloc(strlen(LSBDD_BLKDEV_NAME_PREFIX) + snprintf(NULL, 0, "%d", index) + 1,
-				GFP_KERNEL);
+	struct lsbdd_dump *dump = NULL;
 
-	if (disk_name != NULL)
-		sprintf(disk_name, "%s%d", LSBDD_BLKDEV_NAME_PREFIX, index);
+	dump = __seq_open_private(file, &lsbdd_dump_seq_ops, sizeof(*dump));
+	if (!dump)
+		return -ENOMEM;
 
-	return disk_name;
+	dump->manager = inode->i_private;
+	return 0;
 }
 
+/*
+ * Streams the mapping of a BD as "<logical sector> <backing device index>
+ * <physical sector> <sectors>" lines, in the walk order of the backend
+ * (see ds_read_batch()).
+ */
+static const struct file_operations lsbdd_debugfs_mapping_fops = {
+	.owner = THIS_MODULE,
+	.open = lsbdd_debugfs_mapping_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+};
+
 /**
  * Sets the name for a new BD, that will be used as 'device in the middle'.
  * Adds disk to the last bd_manager, that was modified by adding bd_handler
@@ -490,6 +1875,7 @@ static s32 create_bd(s32 name_index)
 	char *disk_name = NULL;
 	s8 status;
 	struct gendisk *new_disk = NULL;
+	struct bd_manager *manager = NULL;
 
 	disk_name = create_disk_name_by_index(name_index);
 
@@ -515,10 +1901,33 @@ static s32 create_bd(s32 name_index)
 	pr_debug("Status after add_disk with name %s: %d\n", disk_name, status);
 
 	if (status) {
+		list_last_entry(&bd_list, struct bd_manager, list)->vbd_disk = NULL;
 		put_disk(new_disk);
+		new_disk = NULL;
 		goto disk_init_err;
 	}
 
+	manager = list_last_entry(&bd_list, struct bd_manager, list);
+	manager->debugfs_dir = debugfs_create_dir(disk_name, lsbdd_debugfs);
+	debugfs_create_file("stats", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_stats_fops);
+	debugfs_create_file("latency", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_latency_fops);
+	debugfs_create_file("fragmentation", 0444, manager->debugfs_dir, manager,
+			&lsbdd_debugfs_fragmentation_fops);
+	debugfs_create_file("mapping", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_mapping_fops);
+	if (manager->tier)
+		debugfs_create_file("tier", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_tier_fops);
+	if (manager->pool)
+		debugfs_create_file("pool", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_pool_fops);
+	if (manager->dedup)
+		debugfs_create_file("dedup", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_dedup_fops);
+	if (manager->zoned)
+		debugfs_create_file("zones", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_zones_fops);
+	if (manager->hybrid)
+		debugfs_create_file("hybrid", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_hybrid_fops);
+	if (manager->defrag)
+		debugfs_create_file("defrag", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_defrag_fops);
+	debugfs_create_file("iosched", 0444, manager->debugfs_dir, manager, &lsbdd_debugfs_iosched_fops);
+
 	return 0;
 
 mem_err:
@@ -535,21 +1944,51 @@ disk_init_err:
 
 static s8 delete_bd(u16 index)
 {
-	if (get_list_element_by_index(index)->bd_handler) {
-		bdev_release(get_list_element_by_index(index)->bd_handler);
-		get_list_element_by_index(index)->bd_handler = NULL;
-	} else {
+	struct bd_manager *manager = NULL;
+
+	debugfs_remove_recursive(get_list_element_by_index(index)->debugfs_dir);
+	get_list_element_by_index(index)->debugfs_dir = NULL;
+	flush_work(&get_list_element_by_index(index)->deferred_work);
+	manager = get_list_element_by_index(index);
+	lsbdd_hash_queues_free(manager);
+	if (!manager->nr_stripes)
 		pr_info("BD with num %d is empty\n", index + 1);
-	}
 	if (get_list_element_by_index(index)->vbd_disk) {
 		del_gendisk(get_list_element_by_index(index)->vbd_disk);
 		put_disk(get_list_element_by_index(index)->vbd_disk);
 		get_list_element_by_index(index)->vbd_disk = NULL;
 	}
+	/* The tier worker copies between the devices, so it stops before they are released */
+	lsbdd_tier_free(manager);
+	lsbdd_defrag_free(manager);
+	lsbdd_hybrid_free(manager);
+	lsbdd_dedup_free(manager->dedup);
+	manager->dedup = NULL;
+	/* Completed zone appends are mapped by lsbdd_wq and the zone worker resets zones */
+	if (manager->zoned) {
+		flush_workqueue(lsbdd_wq);
+		lsbdd_zoned_free(manager);
+	}
+	if (manager->zip) {
+		lsbdd_zip_put();
+		manager->zip = false;
+	}
+	/* The DFTL table is written back to the first device, it is freed while it is open */
+	ds_migration_stop(&get_list_element_by_index(index)->migration);
 	if (get_list_element_by_index(index)->sel_data_struct) {
 		ds_free(get_list_element_by_index(index)->sel_data_struct);
 		get_list_element_by_index(index)->sel_data_struct = NULL;
 	}
+	lsbdd_snap_put(manager->frozen);
+	manager->frozen = NULL;
+	/* Polled clones go back to bio_pool from RCU callbacks */
+	rcu_barrier();
+	bioset_exit(&manager->bio_pool);
+	lsbdd_pool_leave(manager);
+	while (manager->nr_stripes)
+		bdev_release(manager->stripes[--manager->nr_stripes].bd_handler);
+	free_percpu(get_list_element_by_index(index)->stats);
+	get_list_element_by_index(index)->stats = NULL;
 
 	list_del(&(get_list_element_by_index(index)->list));
 
@@ -566,10 +2005,11 @@ static s8 delete_bd(u16 index)
 static s32 lsbdd_get_vbd_names(char *buf, const struct kernel_param *kp)
 {
 	struct bd_manager *current_manager = NULL;
-	u8 total_length = 0;
-	u8 offset = 0;
+	s32 total_length = 0;
+	s32 offset = 0;
+	s32 length = 0;
 	u8 i = 0;
-	u8 length = 0;
+	u8 j;
 
 	if (list_empty(&bd_list)) {
 		pr_warn("Vector is empty\n");
@@ -577,12 +2017,14 @@ static s32 lsbdd_get_vbd_names(char *buf, const struct kernel_param *kp)
 	}
 
 	list_for_each_entry(current_manager, &bd_list, list) {
-		if (current_manager->bd_handler != NULL) {
+		if (current_manager->nr_stripes) {
 			i++;
-			length = sprintf(
-				buf + offset, "%d. %s -> %s\n", i,
-				current_manager->vbd_disk->disk_name,
-				current_manager->bd_handler->bdev->bd_disk->disk_name);
+			length = sprintf(buf + offset, "%d. %s ->", i, current_manager->vbd_disk->disk_name);
+			/* Striped BDs list all of their backing devices */
+			for (j = 0; j < current_manager->nr_stripes && length >= 0; j++)
+				length += sprintf(buf + offset + length, "%s%s", j ? "," : " ",
+					current_manager->stripes[j].bd_handler->bdev->bd_disk->disk_name);
+			length += sprintf(buf + offset + length, "\n");
 
 			if (length < 0) {
 				pr_err("Error in formatting string\n");
@@ -674,46 +2116,391 @@ static s32  lsbdd_set_data_struct(const char *arg, const struct kernel_param *kp
 }
 
 /**
- * Function links 'middle' BD and the aim one, for vector purposes. (creates,
- * opens and links)
- * @arg - "from_disk_postfix path"
+ * Function starts an online migration of the BD mapping to another data
+ * structure. I/O continues meanwhile, the BD switches over once the copy is
+ * done (check get_migration_status).
+ * @arg - "index type", index from get_vbd_names
  */
-static s32  lsbdd_set_redirect_bd(const char *arg, const struct kernel_param *kp)
+static s32 lsbdd_migrate_data_struct(const char *arg, const struct kernel_param *kp)
 {
-	s8 status;
+	struct bd_manager *current_manager = NULL;
+	char new_ds[LSBDD_MAX_DS_NAME_LEN + 1];
 	s32 index;
-	char path[LSBDD_MAX_BD_NAME_LENGTH];
+	s32 status;
 
-	if (sscanf(arg, "%d %s", &index, path) != 2) {
+	if (sscanf(arg, "%d %2s", &index, new_ds) != 2) {
 		pr_err("Wrong input, 2 values are required\n");
 		return -EINVAL;
 	}
 
-	status = check_and_open_bd(path);
+	if (check_available_ds(new_ds)) {
+		pr_err("%s is not supported. Check available data structure by set_data_structs\n", new_ds);
+		return -EINVAL;
+	}
+
+	current_manager = index > 0 ? get_list_element_by_index(index - 1) : NULL;
+	if (!current_manager || !current_manager->sel_data_struct) {
+		pr_err("No BD with index %d\n", index);
+		return -ENODEV;
+	}
+
+	if (current_manager->hybrid && !strcmp(new_ds, available_ds[DFTL_TYPE])) {
+		pr_err("BD %d maps by coarse blocks, %s can't look back that far\n", index, new_ds);
+		return -EINVAL;
+	}
+
+	down_write(&current_manager->ds_lock);
+	if (!strcmp(new_ds, available_ds[current_manager->sel_data_struct->type])) {
+		pr_info("BD %d already uses %s\n", index, new_ds);
+		status = 0;
+	} else {
+		status = ds_migration_start(&current_manager->migration, new_ds);
+		if (!status)
+			lsbdd_migration_limits(current_manager);
+	}
+	up_write(&current_manager->ds_lock);
+
+	if (status)
+		pr_err("Failed to start migration: %d\n", status);
+	return status;
+}
+
+/**
+ * Prints the data structure of every BD and the progress of running
+ * migrations.
+ */
+static s32 lsbdd_get_migration_status(char *buf, const struct kernel_param *kp)
+{
+	struct bd_manager *current_manager = NULL;
+	struct ds_migration *mig = NULL;
+	s32 offset = 0;
+	u16 i = 0;
+
+	list_for_each_entry(current_manager, &bd_list, list) {
+		i++;
+		if (!current_manager->sel_data_struct)
+			continue;
+
+		mig = &current_manager->migration;
+		down_read(&current_manager->ds_lock);
+		offset += sprintf(buf + offset, "%d. %s: %s", i, current_manager->vbd_disk->disk_name,
+				available_ds[current_manager->sel_data_struct->type]);
+		if (ds_migration_running(mig))
+			offset += sprintf(buf + offset, " -> %s (%llu copied)", available_ds[mig->target->type],
+					READ_ONCE(mig->copied));
+		else if (mig->status)
+			offset += sprintf(buf + offset, " (last migration failed: %d)", mig->status);
+		up_read(&current_manager->ds_lock);
+		offset += sprintf(buf + offset, "\n");
+	}
+
+	return offset;
+}
+
+/**
+ * Opens the backing devices of a new BD, sets up its mapping and adds its
+ * disk.
+ *
+ * @index - index for the disk name
+ * @path - comma separated paths of the backing devices
+ * @virtual_sectors - capacity of a thin volume, 0 if the BD isn't thin
+ */
+static s32 lsbdd_add_bd(s32 index, char *path, sector_t virtual_sectors)
+{
+	struct bd_manager *current_manager = NULL;
+	bool zoned = false;
+	s8 status;
+	u8 i;
+
+	status = check_and_open_bd(path, virtual_sectors, NULL);
 
 	if (!list_empty(&bd_list))
 		bdd_major = register_blkdev(0, LSBDD_BLKDEV_NAME_PREFIX);
 
 	if (status)
-		return PTR_ERR(&status);
+		return status;
+
+	current_manager = list_last_entry(&bd_list, struct bd_manager, list);
+	if (!strcmp(sel_ds, available_ds[DFTL_TYPE])) {
+		status = ds_init_dftl(current_manager->sel_data_struct, current_manager->stripes[0].bd_handler->bdev,
+				(u64)dftl_cache_size << (20 - PAGE_SHIFT));
+		current_manager->defer_io = true;
+	} else {
+		status = ds_init(current_manager->sel_data_struct, sel_ds);
+	}
+	if (status) {
+		kfree(current_manager->sel_data_struct);
+		current_manager->sel_data_struct = NULL;
+		goto delete;
+	}
+	current_manager->stripes[0].capacity = ds_capacity(current_manager->sel_data_struct,
+			current_manager->stripes[0].capacity);
+
+	for (i = 0; i < current_manager->nr_stripes; i++)
+		zoned |= bdev_is_zoned(current_manager->stripes[i].bd_handler->bdev);
+	if (zoned) {
+		status = lsbdd_zoned_init(current_manager, zoned_open_zones);
+		if (status) {
+			pr_err("A zoned device must be the only one of a BD with a mapping in memory\n");
+			goto delete;
+		}
+	}
+
+	if (tiering) {
+		if (current_manager->pool) {
+			pr_err("A thin volume can't be tiered\n");
+			goto invalid;
+		}
+		status = lsbdd_tier_init(current_manager, tier_promote_reads);
+		if (status)
+			goto delete;
+	}
+
+	/* The tier worker moves blocks by their data size, zone appends are sent as they are */
+	if (compress) {
+		if (current_manager->tier || current_manager->zoned) {
+			pr_err("Tiered and zoned BDs don't compress\n");
+			goto invalid;
+		}
+		status = lsbdd_zip_get();
+		if (status)
+			goto delete;
+		current_manager->zip = true;
+	}
+
+	/*
+	 * The tier worker moves blocks, which would leave the index pointing at
+	 * old copies, and the zones are reset by the mappings they hold.
+	 */
+	if (dedup) {
+		if (current_manager->tier || current_manager->zip || current_manager->zoned) {
+			pr_err("Tiered, compressing and zoned BDs don't deduplicate\n");
+			goto invalid;
+		}
+		current_manager->dedup = lsbdd_dedup_alloc();
+		if (!current_manager->dedup) {
+			status = -ENOMEM;
+			goto delete;
+		}
+		status = lsbdd_hash_queues_init(current_manager);
+		if (status)
+			goto delete;
+	}
+
+	/*
+	 * A coarse mapping may span tier segments and zones, which are accounted
+	 * by the blocks in them, and neither a shared nor a compressed block can
+	 * be cut.
+	 */
+	if (hybrid_block_size) {
+		if (current_manager->tier || current_manager->zoned || current_manager->dedup || current_manager->zip) {
+			pr_err("Tiered, zoned, deduplicating and compressing BDs don't map by coarse blocks\n");
+			goto invalid;
+		}
+		status = lsbdd_hybrid_init(current_manager, hybrid_block_size);
+		if (status)
+			goto delete;
+	}
+
+	/*
+	 * Tier segments and zones are freed by their own workers, and the copy of
+	 * a shared block wouldn't be in the content index. A thin volume copies
+	 * only its own blocks, to sectors that the pool log gives it. Only the
+	 * top mapping of a snapshot origin is moved, the frozen layers keep
+	 * pointing to the old blocks, that the log never overwrites, and a
+	 * mapping, that a new snapshot froze meanwhile, isn't in the top anymore
+	 * and is left as it is.
+	 */
+	if (defrag_rate) {
+		if (current_manager->tier || current_manager->zoned || current_manager->dedup) {
+			pr_err("Tiered, zoned and deduplicating BDs aren't defragmented\n");
+			goto invalid;
+		}
+		status = lsbdd_defrag_init(current_manager, defrag_rate);
+		if (status)
+			goto delete;
+	}
 
-	status = ds_init(list_last_entry(&bd_list, struct bd_manager, list)->sel_data_struct, sel_ds);
-	pr_info("%p\n", list_last_entry(&bd_list, struct bd_manager, list)->sel_data_struct);
+	status = create_bd(index);
 	if (status)
+		goto delete;
+
+	return 0;
+
+invalid:
+	status = -EINVAL;
+delete:
+	/* Nothing was sent to the BD yet, it is taken down as a deleted one */
+	delete_bd(list_count_nodes(&bd_list) - 1);
+	return status;
+}
+
+/**
+ * Function links 'middle' BD and the aim one, for vector purposes. (creates,
+ * opens and links)
+ * @arg - "from_disk_postfix path[,path...]", the log is striped over the
+ * listed devices
+ */
+static s32  lsbdd_set_redirect_bd(const char *arg, const struct kernel_param *kp)
+{
+	s32 index;
+	char path[LSBDD_MAX_PATHS_LENGTH + 1];
+
+	if (sscanf(arg, "%d %" __stringify(LSBDD_MAX_PATHS_LENGTH) "s", &index, path) != 2) {
+		pr_err("Wrong input, 2 values are required\n");
+		return -EINVAL;
+	}
+
+	/* The DFTL table is on the first device and maps only its sectors */
+	if (!strcmp(sel_ds, available_ds[DFTL_TYPE]) && strchr(path, ',')) {
+		pr_err("%s can't be striped over several devices\n", sel_ds);
+		return -EINVAL;
+	}
+
+	/* dftl_prev() only looks back DFTL_PREV_SCAN sectors, a coarse mapping is longer */
+	if (!strcmp(sel_ds, available_ds[DFTL_TYPE]) && hybrid_block_size) {
+		pr_err("%s can't map by coarse blocks\n", sel_ds);
+		return -EINVAL;
+	}
+
+	if (tiering && (!strchr(path, ',') || strchr(path, ',') != strrchr(path, ','))) {
+		pr_err("Tiering needs two devices: fast,slow\n");
+		return -EINVAL;
+	}
+
+	return lsbdd_add_bd(index, path, 0);
+}
+
+/**
+ * Function adds a thin volume to the pool on a backing device, the pool is
+ * created with its first volume and released with its last one.
+ * @arg - "index path size", size is the virtual capacity of the volume in MiB
+ */
+static s32 lsbdd_set_thin_bd(const char *arg, const struct kernel_param *kp)
+{
+	char path[LSBDD_MAX_PATHS_LENGTH + 1];
+	s32 index;
+	u64 size;
+
+	if (sscanf(arg, "%d %" __stringify(LSBDD_MAX_PATHS_LENGTH) "s %llu", &index, path, &size) != 3 ||
+		!size || size > (U64_MAX >> (20 - SECTOR_SHIFT))) {
+		pr_err("Wrong input, 3 values are required\n");
+		return -EINVAL;
+	}
+
+	/* Every volume has its own mapping, the DFTL table would be shared */
+	if (!strcmp(sel_ds, available_ds[DFTL_TYPE]) || strchr(path, ',')) {
+		pr_err("A thin volume is on one device and can't use %s\n", available_ds[DFTL_TYPE]);
+		return -EINVAL;
+	}
+
+	return lsbdd_add_bd(index, path, size << (20 - SECTOR_SHIFT));
+}
+
+/**
+ * Function creates a read-only snapshot of a BD as a new BD. The mapping of
+ * the BD is frozen and shared with the snapshot, the BD goes on with an empty
+ * mapping on top of it, so nothing is copied or written.
+ * @arg - "index from_disk_postfix", index of the BD from get_vbd_names
+ */
+static s32 lsbdd_create_snapshot(const char *arg, const struct kernel_param *kp)
+{
+	struct bd_manager *origin = NULL;
+	struct bd_manager *snapshot = NULL;
+	struct lsbdd_snap_layer *layer = NULL;
+	struct data_struct *top = NULL;
+	enum data_type type;
+	s32 index, name_index;
+	s32 status;
+
+	if (sscanf(arg, "%d %d", &index, &name_index) != 2) {
+		pr_err("Wrong input, 2 values are required\n");
+		return -EINVAL;
+	}
+
+	origin = index > 0 ? get_list_element_by_index(index - 1) : NULL;
+	if (!origin || !origin->vbd_disk) {
+		pr_err("No BD with index %d\n", index);
+		return -ENODEV;
+	}
+
+	down_read(&origin->ds_lock);
+	type = origin->sel_data_struct->type;
+	up_read(&origin->ds_lock);
+	/*
+	 * The tier worker moves blocks of the log, the DFTL table is on the device,
+	 * the zones are reset by the mappings of the BD only and hybrid mappings
+	 * are cut in place. The unmapped sectors of a thin volume are zeros, on
+	 * the shared pool device they may hold the data of other volumes.
+	 */
+	if (origin->tier || origin->zoned || origin->hybrid || origin->pool || type == DFTL_TYPE) {
+		pr_err("BD %d can't have snapshots\n", index);
+		return -EOPNOTSUPP;
+	}
+
+	top = kzalloc(sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+	status = ds_init(top, (char *)available_ds[type]);
+	if (status) {
+		kfree(top);
 		return status;
+	}
 
-	status = create_bd(index);
+	status = check_and_open_bd(NULL, get_capacity(origin->vbd_disk), origin);
+	if (status)
+		goto free_top;
+	snapshot = list_last_entry(&bd_list, struct bd_manager, list);
+	if (origin->zip) {
+		status = lsbdd_zip_get();
+		if (status)
+			goto delete_snapshot;
+		snapshot->zip = true;
+	}
+	status = ds_init(snapshot->sel_data_struct, (char *)available_ds[type]);
+	if (status) {
+		kfree(snapshot->sel_data_struct);
+		snapshot->sel_data_struct = NULL;
+		goto delete_snapshot;
+	}
 
+	down_write(&origin->ds_lock);
+	if (ds_migration_running(&origin->migration) || origin->sel_data_struct->type != type) {
+		status = -EBUSY;
+	} else {
+		layer = lsbdd_snap_freeze(origin->sel_data_struct, origin->nr_mappings, origin->frozen);
+		if (layer) {
+			origin->sel_data_struct = top;
+			origin->frozen = layer;
+			origin->nr_mappings = 0;
+		} else {
+			status = -ENOMEM;
+		}
+	}
+	up_write(&origin->ds_lock);
 	if (status)
-		return status;
+		goto delete_snapshot;
+	snapshot->frozen = layer;
 
-	return 0;
+	/* The origin keeps its new top, the frozen layer is put by the snapshot */
+	status = create_bd(name_index);
+	if (status) {
+		delete_bd(list_count_nodes(&bd_list) - 1);
+		pr_err("Failed to create a snapshot of BD %d: %d\n", index, status);
+	}
+	return status;
+
+delete_snapshot:
+	delete_bd(list_count_nodes(&bd_list) - 1);
+free_top:
+	pr_err("Failed to create a snapshot of BD %d: %d\n", index, status);
+	ds_free(top);
+	kfree(top);
+	return status;
 }
 
 static s32  __init lsbdd_init(void)
 {
-	s8 status;
-
 	pr_info("LSBDD module initialised\n");
 	bdd_major = register_blkdev(0, LSBDD_BLKDEV_NAME_PREFIX);
 
@@ -722,24 +2509,21 @@ static s32  __init lsbdd_init(void)
 		BUG();
 	}
 
-	bdd_pool = kzalloc(sizeof(struct bio_set), GFP_KERNEL);
-
-	if (!bdd_pool)
+	lsbdd_wq = alloc_workqueue("lsbdd", WQ_MEM_RECLAIM, 0);
+	if (!lsbdd_wq)
 		goto mem_err;
-
-	status = bioset_init(bdd_pool, BIO_POOL_SIZE, 0, 0);
-
-	if (status) {
-		pr_err("Couldn't allocate bio set");
+	lsbdd_hash_wq = alloc_workqueue("lsbdd_hash", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!lsbdd_hash_wq) {
+		destroy_workqueue(lsbdd_wq);
 		goto mem_err;
 	}
 
 	INIT_LIST_HEAD(&bd_list);
+	lsbdd_debugfs = debugfs_create_dir("lsbdd", NULL);
 
 	return 0;
 
 mem_err:
-	kfree(bdd_pool);
 	pr_err("Memory allocation failed\n");
 	return -ENOMEM;
 }
@@ -759,8 +2543,9 @@ static void __exit lsbdd_exit(void)
 		kfree(entry);
 	}
 
-	bioset_exit(bdd_pool);
-	kfree(bdd_pool);
+	debugfs_remove_recursive(lsbdd_debugfs);
+	destroy_workqueue(lsbdd_hash_wq);
+	destroy_workqueue(lsbdd_wq);
 	unregister_blkdev(bdd_major, LSBDD_BLKDEV_NAME_PREFIX);
 
 	pr_info("BDR module exited\n");
@@ -781,22 +2566,83 @@ static const struct kernel_param_ops lsbdd_redirect_ops = {
 	.get = NULL,
 };
 
+static const struct kernel_param_ops lsbdd_thin_ops = {
+	.set = lsbdd_set_thin_bd,
+	.get = NULL,
+};
+
+static const struct kernel_param_ops lsbdd_snapshot_ops = {
+	.set = lsbdd_create_snapshot,
+	.get = NULL,
+};
+
 static const struct kernel_param_ops lsbdd_ds_ops = {
 	.set = lsbdd_set_data_struct,
 	.get = lsbdd_get_data_structs,
 };
 
+static const struct kernel_param_ops lsbdd_migrate_ops = {
+	.set = lsbdd_migrate_data_struct,
+	.get = lsbdd_get_migration_status,
+};
+
 MODULE_PARM_DESC(delete_bd, "Delete BD");
 module_param_cb(delete_bd, &lsbdd_delete_ops, NULL, 0200);
 
 MODULE_PARM_DESC(get_vbd_names, "Get list of disks and their redirect bd's");
 module_param_cb(get_vbd_names, &lsbdd_get_bd_ops, NULL, 0644);
 
-MODULE_PARM_DESC(set_redirect_bd, "Link local disk with redirect aim bd");
+MODULE_PARM_DESC(set_redirect_bd, "Link local disk with redirect aim bd(s)");
 module_param_cb(set_redirect_bd, &lsbdd_redirect_ops, NULL, 0200);
 
+MODULE_PARM_DESC(set_thin_bd, "Add a thin volume of the given size in MiB to the pool on a bd");
+module_param_cb(set_thin_bd, &lsbdd_thin_ops, NULL, 0200);
+
+MODULE_PARM_DESC(create_snapshot, "Create a read-only snapshot of a BD as a new BD");
+module_param_cb(create_snapshot, &lsbdd_snapshot_ops, NULL, 0200);
+
 MODULE_PARM_DESC(set_data_structure, "Set data structure to be used in mapping");
 module_param_cb(set_data_structure, &lsbdd_ds_ops, NULL, 0644);
 
+MODULE_PARM_DESC(migrate_data_structure, "Migrate BD mapping to another data structure online");
+module_param_cb(migrate_data_structure, &lsbdd_migrate_ops, NULL, 0644);
+
+MODULE_PARM_DESC(auto_migrate, "Pick the data structure of every BD from its observed operations");
+module_param(auto_migrate, bool, 0644);
+
+MODULE_PARM_DESC(dftl_cache_size, "Memory for cached DFTL translation pages per BD, in MiB");
+module_param(dftl_cache_size, uint, 0644);
+
+MODULE_PARM_DESC(stripe_segment_size, "Log written to one backing device of a striped BD before moving to the next, in KiB");
+module_param(stripe_segment_size, uint, 0644);
+
+MODULE_PARM_DESC(stripe_least_loaded, "Put new segments of striped BDs on the device with the fewest I/Os in flight");
+module_param(stripe_least_loaded, bool, 0644);
+
+MODULE_PARM_DESC(tiering, "Use the two devices of new BDs as a fast tier in front of a slow one");
+module_param(tiering, bool, 0644);
+
+MODULE_PARM_DESC(tier_promote_reads, "Reads of a slow tier block, that move it back to the fast tier, 0 disables it");
+module_param(tier_promote_reads, uint, 0644);
+
+MODULE_PARM_DESC(dedup, "Map writes of new BDs, whose data is in the log already, to the stored block");
+module_param(dedup, bool, 0644);
+
+MODULE_PARM_DESC(compress, "Compress the writes of new BDs with LZ4 before they are put in the log");
+module_param(compress, bool, 0644);
+
+MODULE_PARM_DESC(zoned_open_zones, "Zones of new BDs on zoned devices, that are appended to in parallel");
+module_param(zoned_open_zones, uint, 0644);
+MODULE_PARM_DESC(hybrid_block_size, "Coarse block of new BDs in KiB, writes in order in it share a mapping, 0 disables");
+module_param(hybrid_block_size, uint, 0644);
+MODULE_PARM_DESC(defrag_rate, "MiB per second, that new BDs may copy to defragment their log, 0 disables");
+module_param(defrag_rate, uint, 0644);
+MODULE_PARM_DESC(bg_bandwidth, "MiB per second of the background I/O of new BDs by class (tier,defrag), 0 is unlimited");
+module_param_array(bg_bandwidth, uint, NULL, 0644);
+MODULE_PARM_DESC(bg_iops, "I/Os per second of the background I/O of new BDs by class (tier,defrag), 0 is unlimited");
+module_param_array(bg_iops, uint, NULL, 0644);
+MODULE_PARM_DESC(fg_latency_target, "Foreground read latency in us, above which background I/O backs off, 0 follows the latency without it");
+module_param(fg_latency_target, uint, 0644);
+
 module_init(lsbdd_init);
 module_exit(lsbdd_exit);
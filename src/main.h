@@ -2,28 +2,234 @@
 
 #pragma once
 
+#include <linux/atomic.h>
+#include <linux/bio.h>
+#include <linux/rcupdate.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include "utils/ds-migrate.h"
+#include "tier.h"
+#include "pool.h"
+#include "snap.h"
+#include "dedup.h"
+#include "compress.h"
+#include "zoned.h"
+#include "hybrid.h"
+#include "defrag.h"
+#include "iosched.h"
+
 #define LSBDD_MAX_BD_NAME_LENGTH 15
 #define LSBDD_MAX_MINORS_AM 20
 #define LSBDD_MAX_DS_NAME_LEN 2
 #define LSBDD_BLKDEV_NAME_PREFIX "lsvbd"
 #define LSBDD_SECTOR_OFFSET 32
+/* Read setup result for a read of a thin volume, that hits no mapping and is zero-filled */
+#define LSBDD_READ_UNMAPPED 1
+/* Write setup result for a write, whose data is in the log already */
+#define LSBDD_WRITE_DEDUPED 2
+/* Read setup result for a read, whose parts were sent on their own */
+#define LSBDD_READ_SPLIT 3
+/* Backing devices a BD can stripe its log over, and the length of their list */
+#define LSBDD_MAX_STRIPES 8
+#define LSBDD_MAX_PATHS_LENGTH 127
+/* Log written to one backing device before the head moves to the next one */
+#define LSBDD_STRIPE_SEGMENT_DEFAULT_KB 1024
+/*
+ * A redirected sector holds the sector on its backing device in the lower
+ * LSBDD_STRIPE_SECTOR_BITS and the index of the device above them.
+ */
+#define LSBDD_STRIPE_SECTOR_BITS 40
+#define LSBDD_STRIPE_SECTOR_MASK ((1ULL << LSBDD_STRIPE_SECTOR_BITS) - 1)
+/* Number of mapping operations between two auto migration decisions */
+#define LSBDD_AUTO_WINDOW (1 << 16)
+/* log2 buckets of the latency histograms, the last one takes everything above 2^31 ns */
+#define LSBDD_HIST_BUCKETS 32
+
+/* Indexed by enum data_type */
+static const char *available_ds[] = {"bt", "sl", "ht", "rb", "li", "df", "pt"};
+
+/* Outcome of the remap of one bio, see the lsbdd_remap tracepoint */
+enum lsbdd_remap_type {
+	LSBDD_REMAP_WRITE,
+	LSBDD_REMAP_OVERWRITE,
+	LSBDD_REMAP_HIT,
+	LSBDD_REMAP_PREV,
+	LSBDD_REMAP_SYSTEM
+};
+
+/* Mapping index operations, see the lsbdd_ds_op tracepoint */
+enum lsbdd_ds_op {
+	LSBDD_DS_LOOKUP,
+	LSBDD_DS_INSERT,
+	LSBDD_DS_REMOVE,
+	LSBDD_DS_PREV,
+	LSBDD_DS_LAST
+};
+
+/* Latency histograms of a BD, see the latency file in debugfs */
+enum lsbdd_hist {
+	LSBDD_HIST_READ,
+	LSBDD_HIST_WRITE,
+	LSBDD_HIST_LOOKUP,
+	LSBDD_HIST_INSERT,
+	LSBDD_HIST_NR
+};
+
+/*
+ * Per-CPU counters of a BD, they are only summed up when the stats file in
+ * debugfs is read. Read and write latencies are taken from the mapping of the
+ * bio to the completion of its clone, index ones around the ds_* call.
+ */
+struct lsbdd_stats {
+	u64 reads;
+	u64 writes;
+	u64 read_bytes;
+	u64 write_bytes;
+	u64 splits;
+	u64 prev_reads;
+	u64 system_reads;
+	u64 overwritten_bytes;
+	/* Data of the compressed writes and the size of their blocks in the log */
+	u64 compressed_bytes;
+	u64 compressed_stored_bytes;
+	u64 errors;
+	u64 hist[LSBDD_HIST_NR][LSBDD_HIST_BUCKETS];
+	/* Completed reads, every LSBDD_IOSCHED_SAMPLE_MASK + 1st is a latency sample */
+	u32 read_samples;
+};
 
-static const char *available_ds[] = {"bt", "sl", "ht", "rb"};
+/* Mapping operations seen in the current auto migration window */
+struct ds_op_stats {
+	atomic64_t lookups;
+	atomic64_t prevs;
+	atomic64_t inserts;
+	atomic64_t appends;
+	sector_t max_key;
+};
 
-struct redir_sector_info {
-	sector_t redirected_sector;
-	u32 block_size;
+/* Backing device of a BD with its part of the log */
+struct lsbdd_stripe {
+	struct bdev_handle *bd_handler;
+	/* Log head and its limit on the device, protected by ds_lock */
+	sector_t next_free_sector;
+	sector_t capacity;
+	/* Clones in flight, looked at by the least loaded placement */
+	atomic_t inflight;
 };
 
 struct bd_manager {
 	char *vbd_name;
 	struct gendisk *vbd_disk;
-	struct bdev_handle *bd_handler;
+	struct lsbdd_stripe stripes[LSBDD_MAX_STRIPES];
+	u8 nr_stripes;
+	/* Device of the segment the log head is in and its end, protected by ds_lock */
+	u8 cur_stripe;
+	sector_t segment_end;
+	sector_t segment_sectors;
+	/* Set if the stripes are a fast and a slow tier instead */
+	struct lsbdd_tier *tier;
+	/* Set for a thin volume, its only stripe is the device of the pool */
+	struct lsbdd_pool *pool;
+	/* Capacity of a thin volume or a snapshot, 0 if it is that of the stripes */
+	sector_t virtual_sectors;
+	/* Mappings below sel_data_struct, that were frozen by snapshots */
+	struct lsbdd_snap_layer *frozen;
+	/* Set for a snapshot, it has no log of its own */
+	bool read_only;
+	/* Content index of the written blocks, if the BD deduplicates them */
+	struct lsbdd_dedup *dedup;
+	/* Set if writes are compressed, reads are then sent block by block */
+	bool zip;
+	/* Set if the backing device is zoned, writes are then zone appends */
+	struct lsbdd_zoned *zoned;
+	/* Set if sequential writes share the mappings of coarse blocks */
+	struct lsbdd_hybrid *hybrid;
+	/* Set if fragmented ranges are moved together in the background */
+	struct lsbdd_defrag *defrag;
+	/* Taken for read by reads, for write by writes and the ds switch */
+	struct rw_semaphore ds_lock;
 	struct data_struct *sel_data_struct;
+	struct ds_migration migration;
+	struct ds_op_stats op_stats;
+	/* Budgets of the background I/O, that the driver sends on its own */
+	struct lsbdd_iosched iosched;
+	struct lsbdd_stats __percpu *stats;
+	/* Clones and splits of the BD's bios */
+	struct bio_set bio_pool;
+	/* Number of mappings in the index, protected by ds_lock */
+	u64 nr_mappings;
+	struct dentry *debugfs_dir;
+	/*
+	 * Set if mapping lookups may wait for I/O (DFTL), bios are then handled
+	 * by deferred_work instead of the submit_bio() context.
+	 */
+	bool defer_io;
+	spinlock_t deferred_lock;
+	struct bio_list deferred_bios;
+	struct work_struct deferred_work;
+	/* Writes to hash of a BD with dedup, per submitting CPU (see lsbdd_defer_hash()) */
+	struct lsbdd_hash_queue __percpu *hash_queues;
 	struct list_head list;
 };
 
+/*
+ * Writes, that a CPU handed to lsbdd_hash_wq to be hashed and mapped. Every
+ * CPU queues to its own work, so the workqueue hashes them in parallel.
+ */
+struct lsbdd_hash_queue {
+	struct bd_manager *manager;
+	spinlock_t lock;
+	struct bio_list bios;
+	struct work_struct work;
+};
+
+/*
+ * Front pad of the clones allocated from bio_pool, keeps what the completion
+ * needs for the accounting of the original bio.
+ */
+struct lsbdd_io {
+	struct bd_manager *manager;
+	/* Backing device the clone was sent to, NULL if it wasn't */
+	struct lsbdd_stripe *stripe;
+	/* Fast tier segment the clone uses, if the BD is tiered */
+	struct lsbdd_tier_segment *segment;
+	/* Indexed block the clone writes, it is shared once the write succeeds */
+	struct lsbdd_dedup_entry *dedup;
+	/* Set if the clone writes compressed data, its pages are freed on completion */
+	bool zip;
+	/* Zone the clone appends to or reads from, if the BD is zoned */
+	struct lsbdd_zone *zone;
+	/* SRCU index of a write of a defragmented BD, -1 otherwise */
+	int defrag_idx;
+	/* Maps the block of a zone append, once it completed */
+	struct work_struct work;
+	/*
+	 * Set if the clone is polled, the original bio then points to the io
+	 * instead of its bi_private, which is kept here, until the completion.
+	 * The clone is freed after an RCU grace period, pollers may still see it.
+	 */
+	bool polled;
+	void *private;
+	struct rcu_head rcu;
+	unsigned long start_jiffies;
+	u64 start_ns;
+	struct bio clone;
+};
+
 struct sectors {
 	sector_t original;
 	sector_t redirect;
 };
+
+static inline sector_t lsbdd_stripe_sector(u8 stripe, sector_t sector)
+{
+	return ((sector_t)stripe << LSBDD_STRIPE_SECTOR_BITS) | sector;
+}
+
+static inline u8 lsbdd_stripe_index(sector_t redirected_sector)
+{
+	return redirected_sector >> LSBDD_STRIPE_SECTOR_BITS;
+}
+
+s32 lsbdd_stripe_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect);
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include "main.h"
+#include "pool.h"
+
+/* Protected by the kernel_param_lock of the module, as bd_list */
+static LIST_HEAD(lsbdd_pools);
+
+/**
+ * Adds the BD to the thin pool of the backing device at bd_path, the pool
+ * is created by its first volume. The BD gets the pool device as its only
+ * stripe, but takes its sectors with lsbdd_pool_alloc().
+ *
+ * @virtual_sectors - capacity the volume advertises, may exceed the pool
+ *
+ * It returns 0 on success, negative error code otherwise.
+ */
+s32 lsbdd_pool_join(struct bd_manager *manager, char *bd_path, sector_t virtual_sectors)
+{
+	struct lsbdd_pool *pool = NULL;
+	struct bdev_handle *handle = NULL;
+
+	handle = bdev_open_by_path(bd_path, BLK_OPEN_WRITE | BLK_OPEN_READ, NULL, NULL);
+	if (IS_ERR(handle)) {
+		pr_err("Couldnt open bd by path: %s\n", bd_path);
+		return PTR_ERR(handle);
+	}
+
+	list_for_each_entry(pool, &lsbdd_pools, list) {
+		if (pool->bd_handler->bdev == handle->bdev) {
+			bdev_release(handle);
+			goto join;
+		}
+	}
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		bdev_release(handle);
+		return -ENOMEM;
+	}
+	pool->bd_handler = handle;
+	pool->next_free_sector = LSBDD_SECTOR_OFFSET;
+	pool->capacity = min_t(sector_t, get_capacity(handle->bdev->bd_disk), LSBDD_STRIPE_SECTOR_MASK);
+	spin_lock_init(&pool->lock);
+	list_add_tail(&pool->list, &lsbdd_pools);
+	pr_info("Created thin pool on %s, %llu sectors\n", bd_path, (u64)pool->capacity);
+
+join:
+	pool->nr_volumes++;
+	pool->virtual_sectors += virtual_sectors;
+	if (pool->virtual_sectors > pool->capacity)
+		pr_info("Thin pool on %s is overcommitted: %llu virtual sectors\n", bd_path,
+			(u64)pool->virtual_sectors);
+
+	manager->pool = pool;
+	manager->virtual_sectors = virtual_sectors;
+	manager->stripes[0].bd_handler = pool->bd_handler;
+	manager->stripes[0].next_free_sector = LSBDD_SECTOR_OFFSET;
+	manager->stripes[0].capacity = pool->capacity;
+	atomic_set(&manager->stripes[0].inflight, 0);
+	manager->nr_stripes = 1;
+	return 0;
+}
+
+/* Removes the BD from its pool, the pool is freed with its last volume */
+void lsbdd_pool_leave(struct bd_manager *manager)
+{
+	struct lsbdd_pool *pool = manager->pool;
+
+	if (!pool)
+		return;
+
+	manager->pool = NULL;
+	manager->nr_stripes = 0;
+	pool->virtual_sectors -= manager->virtual_sectors;
+	if (--pool->nr_volumes)
+		return;
+
+	list_del(&pool->list);
+	bdev_release(pool->bd_handler);
+	kfree(pool);
+}
+
+/**
+ * Takes sectors of the pool log for a write of a thin volume. Must be called
+ * with ds_lock of the volume held for write, the log head is shared with the
+ * other volumes under the pool lock. The stripe of the volume counts its
+ * share of the log.
+ *
+ * It returns 0 on success, -ENOSPC if the pool is full.
+ */
+s32 lsbdd_pool_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect)
+{
+	struct lsbdd_pool *pool = manager->pool;
+	s32 status = 0;
+
+	spin_lock(&pool->lock);
+	if (pool->next_free_sector + sectors > pool->capacity) {
+		status = -ENOSPC;
+	} else {
+		*redirect = pool->next_free_sector;
+		pool->next_free_sector += sectors;
+	}
+	spin_unlock(&pool->lock);
+
+	if (!status)
+		manager->stripes[0].next_free_sector += sectors;
+	return status;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/blkdev.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct bd_manager;
+
+/*
+ * Thin pool: one backing device, whose log is shared by several thin
+ * volumes. Every volume keeps its own mapping, all of them append to the
+ * same log head, so the device sees sequential writes whatever the volumes do.
+ */
+struct lsbdd_pool {
+	struct bdev_handle *bd_handler;
+	/* Log head, protected by lock */
+	sector_t next_free_sector;
+	sector_t capacity;
+	spinlock_t lock;
+	/* Thin volumes in the pool, the last one releases it */
+	u32 nr_volumes;
+	/* Sum of the virtual capacities of the volumes */
+	sector_t virtual_sectors;
+	struct list_head list;
+};
+
+s32 lsbdd_pool_join(struct bd_manager *manager, char *bd_path, sector_t virtual_sectors);
+void lsbdd_pool_leave(struct bd_manager *manager);
+s32 lsbdd_pool_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect);
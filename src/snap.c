@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/slab.h>
+#include "main.h"
+#include "snap.h"
+
+/**
+ * Makes a layer of the mapping ds, that is taken over by it, on top of the
+ * layers below (their reference is taken over as well). It starts with two
+ * references: the BD, that goes on above it, and the snapshot.
+ *
+ * It returns the layer or NULL if there is no memory for it.
+ */
+struct lsbdd_snap_layer *lsbdd_snap_freeze(struct data_struct *ds, u64 nr_mappings,
+		struct lsbdd_snap_layer *below)
+{
+	struct lsbdd_snap_layer *layer = kzalloc(sizeof(*layer), GFP_KERNEL);
+
+	if (!layer)
+		return NULL;
+
+	layer->ds = ds;
+	layer->below = below;
+	layer->nr_mappings = nr_mappings;
+	refcount_set(&layer->ref, 2);
+	return layer;
+}
+
+/* Drops a reference to the layer, the layers without users are freed */
+void lsbdd_snap_put(struct lsbdd_snap_layer *layer)
+{
+	struct lsbdd_snap_layer *below = NULL;
+
+	while (layer && refcount_dec_and_test(&layer->ref)) {
+		below = layer->below;
+		ds_free(layer->ds);
+		kfree(layer->ds);
+		kfree(layer);
+		layer = below;
+	}
+}
+
+/**
+ * Looks the key up in the layers, the newest mapping of it wins.
+ *
+ * It returns 0 if it is found, -ENOENT otherwise.
+ */
+s32 lsbdd_snap_lookup(struct lsbdd_snap_layer *layer, sector_t key, struct redir_sector_info *rs_info)
+{
+	for (; layer; layer = layer->below) {
+		if (!ds_lookup(layer->ds, key, rs_info))
+			return 0;
+	}
+	return -ENOENT;
+}
+
+/**
+ * Looks for a predecessor of key in the layers, that is greater than the
+ * one found above them (in prev_key and rs_info, if status is 0). The newer
+ * mapping wins on equal keys, as it would replace the older one in a single
+ * mapping.
+ *
+ * It returns 0 if there is a predecessor, -ENOENT otherwise.
+ */
+s32 lsbdd_snap_prev(struct lsbdd_snap_layer *layer, sector_t key, s32 status, sector_t *prev_key,
+		struct redir_sector_info *rs_info)
+{
+	struct redir_sector_info layer_info;
+	sector_t layer_key;
+
+	for (; layer; layer = layer->below) {
+		if (ds_empty_check(layer->ds) || ds_prev(layer->ds, key, &layer_key, &layer_info))
+			continue;
+		if (!status && layer_key <= *prev_key)
+			continue;
+		*prev_key = layer_key;
+		*rs_info = layer_info;
+		status = 0;
+	}
+	return status ? -ENOENT : 0;
+}
+
+/**
+ * Takes the last mapping of the layers, if its block lies further on its
+ * device than the one found above them (in rs_info, if status is 0).
+ *
+ * It returns 0 if there is a mapping, -ENOENT otherwise.
+ */
+s32 lsbdd_snap_last(struct lsbdd_snap_layer *layer, s32 status, struct redir_sector_info *rs_info)
+{
+	struct redir_sector_info layer_info;
+
+	for (; layer; layer = layer->below) {
+		if (ds_empty_check(layer->ds) || ds_last(layer->ds, 0, &layer_info))
+			continue;
+		if (!status && (layer_info.redirected_sector & LSBDD_STRIPE_SECTOR_MASK) <=
+			(rs_info->redirected_sector & LSBDD_STRIPE_SECTOR_MASK))
+			continue;
+		*rs_info = layer_info;
+		status = 0;
+	}
+	return status ? -ENOENT : 0;
+}
+
+bool lsbdd_snap_empty(struct lsbdd_snap_layer *layer)
+{
+	for (; layer; layer = layer->below) {
+		if (!ds_empty_check(layer->ds))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/refcount.h>
+#include "utils/ds-control.h"
+
+/*
+ * Frozen mapping of a BD, that was taken by a snapshot. The BD goes on with
+ * a new empty mapping on top of it, the snapshot reads only the frozen one.
+ * The log never overwrites a block, so the blocks of the layer stay valid
+ * without any copy. Layers are never changed, so ds_lock of any of their
+ * users is enough to read them.
+ */
+struct lsbdd_snap_layer {
+	struct data_struct *ds;
+	/* Older layer, this one holds a reference to it */
+	struct lsbdd_snap_layer *below;
+	/* BDs and layers above, that read this layer */
+	refcount_t ref;
+	/* Mappings in ds when it was frozen */
+	u64 nr_mappings;
+};
+
+struct lsbdd_snap_layer *lsbdd_snap_freeze(struct data_struct *ds, u64 nr_mappings,
+		struct lsbdd_snap_layer *below);
+void lsbdd_snap_put(struct lsbdd_snap_layer *layer);
+s32 lsbdd_snap_lookup(struct lsbdd_snap_layer *layer, sector_t key, struct redir_sector_info *rs_info);
+s32 lsbdd_snap_prev(struct lsbdd_snap_layer *layer, sector_t key, s32 status, sector_t *prev_key,
+		struct redir_sector_info *rs_info);
+s32 lsbdd_snap_last(struct lsbdd_snap_layer *layer, s32 status, struct redir_sector_info *rs_info);
+bool lsbdd_snap_empty(struct lsbdd_snap_layer *layer);
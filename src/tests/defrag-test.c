@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * KUnit suite of the defragmentation: the mappings, that the move of a
+ * window collects, on each ds-control backend, but the hashtable, which
+ * isn't defragmented, and DFTL, which needs a backing device.
+ */
+
+#include <kunit/test.h>
+#include <linux/slab.h>
+#include "../utils/ds-control.h"
+#include "../tier.h"
+#include "../defrag.h"
+
+static const char * const df_test_names[] = {"bt", "sl", "rb", "li", "pt"};
+
+static void df_test_name_desc(const char * const *name, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s", *name);
+}
+
+KUNIT_ARRAY_PARAM(df_test, df_test_names, df_test_name_desc);
+
+static void df_test_free(void *ds)
+{
+	ds_free(ds);
+}
+
+static struct data_struct *df_test_init(struct kunit *test)
+{
+	const char * const *name = test->param_value;
+	struct data_struct *ds = NULL;
+
+	ds = kunit_kzalloc(test, sizeof(struct data_struct), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ds);
+	KUNIT_ASSERT_EQ(test, ds_init(ds, (char *)*name), 0);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, df_test_free, ds), 0);
+
+	return ds;
+}
+
+static void df_test_insert(struct kunit *test, struct data_struct *ds, sector_t key, u32 stored_sectors)
+{
+	struct redir_sector_info rs_info = {
+		.redirected_sector = 3 * key + 64,
+		.block_size = 8 << SECTOR_SHIFT,
+		.stored_size = stored_sectors << SECTOR_SHIFT,
+	};
+
+	KUNIT_ASSERT_EQ_MSG(test, ds_insert(ds, key, &rs_info), 0, "key %llu", key);
+}
+
+/*
+ * A window with a mapping right before it and one right at its end: the
+ * walk takes each mapping inside of it once, in key order, and skips the
+ * compressed one.
+ */
+static void df_test_collect(struct kunit *test)
+{
+	struct data_struct *ds = df_test_init(test);
+	struct lsbdd_tier_move *moves = NULL;
+	sector_t start = LSBDD_DEFRAG_WINDOW_SECTORS;
+	sector_t end = start + LSBDD_DEFRAG_WINDOW_SECTORS;
+	sector_t key;
+	u32 nr, i;
+
+	moves = kunit_kmalloc_array(test, LSBDD_DEFRAG_WINDOW_SECTORS, sizeof(*moves), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, moves);
+
+	df_test_insert(test, ds, start - 8, 0);
+	for (key = start; key < end; key += 64)
+		df_test_insert(test, ds, key, 0);
+	df_test_insert(test, ds, start + 8, 2);
+	df_test_insert(test, ds, end, 0);
+
+	nr = lsbdd_defrag_collect(ds, 1, moves);
+	KUNIT_ASSERT_EQ(test, nr, LSBDD_DEFRAG_WINDOW_SECTORS / 64);
+	for (i = 0; i < nr; i++)
+		KUNIT_EXPECT_EQ_MSG(test, moves[i].key, start + 64 * i, "move %u", i);
+
+	/* The window before holds only its last mapping */
+	nr = lsbdd_defrag_collect(ds, 0, moves);
+	KUNIT_EXPECT_EQ(test, nr, 1);
+	KUNIT_EXPECT_EQ(test, moves[0].key, start - 8);
+}
+
+static struct kunit_case defrag_test_cases[] = {
+	KUNIT_CASE_PARAM(df_test_collect, df_test_gen_params),
+	{}
+};
+
+static struct kunit_suite defrag_test_suite = {
+	.name = "lsbdd-defrag",
+	.test_cases = defrag_test_cases,
+};
+
+kunit_test_suite(defrag_test_suite);
@@ -0,0 +1,659 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * KUnit suite of the mapping layer. Every case runs on each ds-control
+ * backend; DFTL needs a backing device and is skipped (test/bench covers it
+ * on a RAM device).
+ *
+ * Built into the module with "make kunit", the results are in dmesg and in
+ * /sys/kernel/debug/kunit/lsbdd-ds-control/results.
+ */
+
+#include <kunit/test.h>
+#include <linux/hashtable.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include "../utils/ds-control.h"
+#include "../utils/hashtable-utils.h"
+
+/* Number of keys of the timed cases */
+#define DS_TEST_PERF_KEYS (1 << 14)
+/* Odd multiplier, turns the index into a pseudo-random permutation of the keys */
+#define DS_TEST_PERF_MULT 2654435761ULL
+
+/*
+ * Multiplier of the ns/op budgets of the timed cases, 0 only reports the
+ * numbers. The budgets are ~20 times what the backends do on a desktop CPU,
+ * so only large regressions fail.
+ */
+static u32 kunit_perf_scale = 1;
+module_param(kunit_perf_scale, uint, 0644);
+MODULE_PARM_DESC(kunit_perf_scale, "Multiplier of the KUnit ns/op budgets, 0 disables them");
+
+struct ds_test_budget {
+	u64 insert;
+	u64 lookup;
+	u64 prev;
+};
+
+/* Indexed by enum data_type, in ns/op over DS_TEST_PERF_KEYS random keys */
+static const struct ds_test_budget ds_test_budgets[] = {
+	{ .insert = 5000, .lookup = 3000, .prev = 3000 },		/* bt */
+	{ .insert = 15000, .lookup = 7000, .prev = 7000 },		/* sl */
+	{ .insert = 2000, .lookup = 12000, .prev = 35000 },		/* ht */
+	{ .insert = 5000, .lookup = 3000, .prev = 3000 },		/* rb */
+	{ .insert = 12000, .lookup = 1000, .prev = 1000 },		/* li */
+	{ .insert = 0, .lookup = 0, .prev = 0 },			/* df */
+	{ .insert = 3000, .lookup = 1000, .prev = 3000 },		/* pt */
+};
+
+static const char * const ds_test_names[] = {"bt", "sl", "ht", "rb", "li", "df", "pt"};
+
+static void ds_test_name_desc(const char * const *name, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s", *name);
+}
+
+KUNIT_ARRAY_PARAM(ds_test, ds_test_names, ds_test_name_desc);
+
+static void ds_test_free(void *ds)
+{
+	ds_free(ds);
+}
+
+static struct data_struct *ds_test_init(struct kunit *test)
+{
+	const char * const *name = test->param_value;
+	struct data_struct *ds = NULL;
+	s32 status;
+
+	ds = kunit_kzalloc(test, sizeof(struct data_struct), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ds);
+
+	status = ds_init(ds, (char *)*name);
+	if (status == -EOPNOTSUPP)
+		kunit_skip(test, "%s needs a backing device", *name);
+	KUNIT_ASSERT_EQ(test, status, 0);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, ds_test_free, ds), 0);
+
+	return ds;
+}
+
+/* Redirected sector of a key in the tests, never 0 */
+static sector_t ds_test_redirect(sector_t key)
+{
+	return 2 * key + 32;
+}
+
+static void ds_test_insert(struct kunit *test, struct data_struct *ds, sector_t key, u32 sectors)
+{
+	struct redir_sector_info rs_info = {
+		.redirected_sector = ds_test_redirect(key),
+		.block_size = sectors << SECTOR_SHIFT,
+	};
+
+	KUNIT_ASSERT_EQ_MSG(test, ds_insert(ds, key, &rs_info), 0, "key %llu", key);
+}
+
+static void ds_test_expect_mapped(struct kunit *test, struct data_struct *ds, sector_t key, u32 sectors)
+{
+	struct redir_sector_info rs_info = {0};
+
+	KUNIT_EXPECT_EQ_MSG(test, ds_lookup(ds, key, &rs_info), 0, "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.redirected_sector, ds_test_redirect(key), "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.block_size, sectors << SECTOR_SHIFT, "key %llu", key);
+}
+
+static void ds_test_expect_unmapped(struct kunit *test, struct data_struct *ds, sector_t key)
+{
+	struct redir_sector_info rs_info = {0};
+
+	KUNIT_EXPECT_NE_MSG(test, ds_lookup(ds, key, &rs_info), 0, "key %llu", key);
+}
+
+static void ds_test_expect_prev(struct kunit *test, struct data_struct *ds, sector_t key, sector_t expected)
+{
+	struct redir_sector_info rs_info = {0};
+	sector_t prev_key = 0;
+
+	KUNIT_EXPECT_EQ_MSG(test, ds_prev(ds, key, &prev_key, &rs_info), 0, "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, prev_key, expected, "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.redirected_sector, ds_test_redirect(expected), "key %llu", key);
+}
+
+static void ds_test_expect_last(struct kunit *test, struct data_struct *ds, sector_t expected)
+{
+	struct redir_sector_info rs_info = {0};
+
+	KUNIT_EXPECT_EQ(test, ds_last(ds, 0, &rs_info), 0);
+	KUNIT_EXPECT_EQ(test, rs_info.redirected_sector, ds_test_redirect(expected));
+}
+
+static void ds_test_empty(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {0};
+	sector_t prev_key = 0;
+
+	KUNIT_EXPECT_TRUE(test, ds_empty_check(ds));
+	ds_test_expect_unmapped(test, ds, 1);
+	ds_test_expect_unmapped(test, ds, 1ULL << 40);
+	KUNIT_EXPECT_NE(test, ds_last(ds, 0, &rs_info), 0);
+	KUNIT_EXPECT_NE(test, ds_prev(ds, 100, &prev_key, &rs_info), 0);
+
+	ds_test_insert(test, ds, 100, 8);
+	KUNIT_EXPECT_FALSE(test, ds_empty_check(ds));
+	ds_remove(ds, 100);
+	KUNIT_EXPECT_TRUE(test, ds_empty_check(ds));
+	ds_test_expect_unmapped(test, ds, 100);
+}
+
+/* The hashtable maps blocks up to a chunk only, its predecessor looks no further back */
+static void ds_test_value_bounds(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {
+		.redirected_sector = DS_VALUE_MAX_SECTOR,
+		.block_size = ds_max_extent(ds) << SECTOR_SHIFT,
+	};
+	struct redir_sector_info found = {0};
+
+	KUNIT_EXPECT_LE(test, ds_max_extent(ds), DS_VALUE_BS_MASK);
+	KUNIT_ASSERT_EQ(test, ds_insert(ds, 8, &rs_info), 0);
+	KUNIT_EXPECT_EQ(test, ds_lookup(ds, 8, &found), 0);
+	KUNIT_EXPECT_EQ(test, found.redirected_sector, DS_VALUE_MAX_SECTOR);
+	KUNIT_EXPECT_EQ(test, found.block_size, rs_info.block_size);
+
+	rs_info.redirected_sector = DS_VALUE_MAX_SECTOR + 1;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	rs_info.redirected_sector = 1;
+	rs_info.block_size = (DS_VALUE_BS_MASK + 1) << SECTOR_SHIFT;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	rs_info.block_size = (ds_max_extent(ds) + 1) << SECTOR_SHIFT;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	rs_info.block_size = SECTOR_SIZE + 1;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	ds_test_expect_unmapped(test, ds, 1 << 20);
+}
+
+/* Mappings of compressed blocks keep both sizes, the stored one can't exceed the data */
+static void ds_test_zip_value(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {
+		.redirected_sector = DS_VALUE_MAX_SECTOR,
+		.block_size = DS_VALUE_ZIP_MAX_SECTORS << SECTOR_SHIFT,
+		.stored_size = SECTOR_SIZE,
+	};
+	struct redir_sector_info found = {0};
+
+	KUNIT_ASSERT_EQ(test, ds_insert(ds, 8, &rs_info), 0);
+	KUNIT_EXPECT_EQ(test, ds_lookup(ds, 8, &found), 0);
+	KUNIT_EXPECT_EQ(test, found.redirected_sector, DS_VALUE_MAX_SECTOR);
+	KUNIT_EXPECT_EQ(test, found.block_size, rs_info.block_size);
+	KUNIT_EXPECT_EQ(test, found.stored_size, SECTOR_SIZE);
+	KUNIT_EXPECT_EQ(test, ds_stored_sectors(&found), 1);
+
+	ds_test_insert(test, ds, 16, 8);
+	ds_test_expect_mapped(test, ds, 16, 8);
+	KUNIT_EXPECT_EQ(test, ds_lookup(ds, 16, &found), 0);
+	KUNIT_EXPECT_EQ(test, found.stored_size, 0);
+
+	rs_info.block_size = (DS_VALUE_ZIP_MAX_SECTORS + 1) << SECTOR_SHIFT;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	rs_info.block_size = 4096;
+	rs_info.stored_size = 4096 + SECTOR_SIZE;
+	KUNIT_EXPECT_EQ(test, ds_insert(ds, 1 << 20, &rs_info), -ERANGE);
+	ds_test_expect_unmapped(test, ds, 1 << 20);
+}
+
+static void ds_test_insert_lookup(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	sector_t key;
+
+	/* Both ends of the key space the driver uses, and every bucket edge in between */
+	ds_test_insert(test, ds, 1, 1);
+	ds_test_insert(test, ds, (1ULL << 45) - 8, 8);
+	for (key = CHUNK_SIZE; key < 64 * CHUNK_SIZE; key += CHUNK_SIZE) {
+		ds_test_insert(test, ds, key - 8, 8);
+		ds_test_insert(test, ds, key, 8);
+	}
+
+	ds_test_expect_mapped(test, ds, 1, 1);
+	ds_test_expect_mapped(test, ds, (1ULL << 45) - 8, 8);
+	ds_test_expect_unmapped(test, ds, 2);
+	ds_test_expect_unmapped(test, ds, (1ULL << 45) - 9);
+	for (key = CHUNK_SIZE; key < 64 * CHUNK_SIZE; key += CHUNK_SIZE) {
+		ds_test_expect_mapped(test, ds, key - 8, 8);
+		ds_test_expect_mapped(test, ds, key, 8);
+		ds_test_expect_unmapped(test, ds, key - 4);
+		ds_test_expect_unmapped(test, ds, key + 4);
+	}
+	ds_test_expect_last(test, ds, (1ULL << 45) - 8);
+}
+
+/* Overwrites go as in the driver: the old mapping is removed, then the new one inserted */
+static void ds_test_overwrite(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {
+		.redirected_sector = 7777,
+		.block_size = 4096,
+	};
+	struct redir_sector_info found = {0};
+	sector_t key;
+
+	for (key = 8; key <= 1024; key += 8)
+		ds_test_insert(test, ds, key, 8);
+
+	for (key = 8; key <= 1024; key += 16) {
+		ds_remove(ds, key);
+		KUNIT_ASSERT_EQ(test, ds_insert(ds, key, &rs_info), 0);
+	}
+
+	for (key = 8; key <= 1024; key += 8) {
+		if (key % 16 == 8) {
+			KUNIT_EXPECT_EQ(test, ds_lookup(ds, key, &found), 0);
+			KUNIT_EXPECT_EQ(test, found.redirected_sector, 7777);
+		} else {
+			ds_test_expect_mapped(test, ds, key, 8);
+		}
+	}
+}
+
+static void ds_test_remove(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	sector_t key;
+
+	for (key = 8; key <= 4096; key += 8)
+		ds_test_insert(test, ds, key, 8);
+
+	/* The greatest key goes first, so last has to move down */
+	ds_remove(ds, 4096);
+	ds_test_expect_last(test, ds, 4088);
+	ds_test_expect_unmapped(test, ds, 4096);
+
+	for (key = 8; key < 4096; key += 16)
+		ds_remove(ds, key);
+	for (key = 8; key < 4096; key += 8) {
+		if (key % 16 == 8)
+			ds_test_expect_unmapped(test, ds, key);
+		else
+			ds_test_expect_mapped(test, ds, key, 8);
+	}
+	ds_test_expect_last(test, ds, 4080);
+
+	/* Removing an unmapped key changes nothing */
+	ds_remove(ds, 5000);
+	ds_test_expect_last(test, ds, 4080);
+
+	/* A last key far above the rest, so the new last is past the looked down chunks */
+	ds_test_insert(test, ds, 1ULL << 30, 8);
+	ds_test_expect_last(test, ds, 1ULL << 30);
+	ds_remove(ds, 1ULL << 30);
+	ds_test_expect_last(test, ds, 4080);
+
+	for (key = 16; key < 4096; key += 16)
+		ds_remove(ds, key);
+	KUNIT_EXPECT_TRUE(test, ds_empty_check(ds));
+}
+
+static void ds_test_last(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	sector_t key;
+
+	ds_test_insert(test, ds, 64, 8);
+	ds_test_expect_last(test, ds, 64);
+
+	/* Descending inserts keep the first one as the last */
+	for (key = 56; key > 0; key -= 8)
+		ds_test_insert(test, ds, key, 8);
+	ds_test_expect_last(test, ds, 64);
+
+	ds_test_insert(test, ds, 10 * CHUNK_SIZE, 8);
+	ds_test_expect_last(test, ds, 10 * CHUNK_SIZE);
+}
+
+/*
+ * Predecessor as the read path uses it: the probed sector lies inside the
+ * block, that starts at the predecessor. Blocks cross the bucket edges of the
+ * hashtable, and fill several B+tree/skiplist nodes, some of them are then
+ * removed, so that the separators of the inner nodes go stale. The
+ * predecessor is strict: a mapped key gets the mapping before it.
+ */
+static void ds_test_prev(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {0};
+	sector_t prev_key = 0;
+	sector_t key;
+
+	for (key = CHUNK_SIZE; key <= 32 * CHUNK_SIZE; key += CHUNK_SIZE) {
+		ds_test_insert(test, ds, key - 16, 32);
+		ds_test_insert(test, ds, key + 16, 8);
+		ds_test_insert(test, ds, key + 24, 8);
+	}
+
+	KUNIT_EXPECT_NE(test, ds_prev(ds, CHUNK_SIZE - 20, &prev_key, &rs_info), 0);
+	KUNIT_EXPECT_NE(test, ds_prev(ds, CHUNK_SIZE - 16, &prev_key, &rs_info), 0);
+	for (key = CHUNK_SIZE; key <= 32 * CHUNK_SIZE; key += CHUNK_SIZE) {
+		ds_test_expect_prev(test, ds, key - 15, key - 16);
+		ds_test_expect_prev(test, ds, key, key - 16);
+		ds_test_expect_prev(test, ds, key + 15, key - 16);
+		ds_test_expect_prev(test, ds, key + 17, key + 16);
+		ds_test_expect_prev(test, ds, key + 31, key + 24);
+		ds_test_expect_prev(test, ds, key + 16, key - 16);
+		ds_test_expect_prev(test, ds, key + 24, key + 16);
+		if (key > CHUNK_SIZE)
+			ds_test_expect_prev(test, ds, key - 16, key - CHUNK_SIZE + 24);
+	}
+
+	for (key = CHUNK_SIZE; key <= 32 * CHUNK_SIZE; key += 2 * CHUNK_SIZE) {
+		ds_remove(ds, key + 16);
+		ds_remove(ds, key + 24);
+	}
+	for (key = CHUNK_SIZE; key <= 32 * CHUNK_SIZE; key += 2 * CHUNK_SIZE) {
+		ds_test_expect_prev(test, ds, key + 8, key - 16);
+		ds_test_expect_prev(test, ds, key + CHUNK_SIZE + 1, key + CHUNK_SIZE - 16);
+		ds_test_expect_prev(test, ds, key + CHUNK_SIZE - 16, key - 16);
+	}
+}
+
+/*
+ * Read across a hole: the read path walks the predecessors down from the end
+ * of the read to the hole, to find where the next mapping starts. Every
+ * mapping in between comes once, so the walk ends on every backend.
+ */
+static void ds_test_prev_walk(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info = {0};
+	sector_t from = CHUNK_SIZE - 64;
+	sector_t end = CHUNK_SIZE + 64;
+	sector_t key = end;
+	sector_t next = end;
+	u32 steps = 0;
+
+	ds_test_insert(test, ds, from - 8, 8);
+	for (key = CHUNK_SIZE - 16; key < end + 16; key += 8)
+		ds_test_insert(test, ds, key, 8);
+
+	key = end;
+	while (!ds_prev(ds, key, &key, &rs_info) && key > from) {
+		KUNIT_ASSERT_LT_MSG(test, key, next, "key %llu came twice", key);
+		next = key;
+		steps++;
+	}
+	KUNIT_EXPECT_EQ(test, next, CHUNK_SIZE - 16);
+	KUNIT_EXPECT_EQ(test, key, from - 8);
+	KUNIT_EXPECT_EQ(test, steps, 10);
+}
+
+static void ds_test_expect_cover(struct kunit *test, struct data_struct *ds, sector_t sector, sector_t expected)
+{
+	struct redir_sector_info rs_info = {0};
+	sector_t key = 0;
+
+	KUNIT_EXPECT_EQ_MSG(test, ds_cover(ds, sector, &key, &rs_info), 0, "sector %llu", sector);
+	KUNIT_EXPECT_EQ_MSG(test, key, expected, "sector %llu", sector);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.redirected_sector, ds_test_redirect(expected), "sector %llu", sector);
+}
+
+static void ds_test_expect_uncovered(struct kunit *test, struct data_struct *ds, sector_t sector)
+{
+	struct redir_sector_info rs_info = {0};
+	sector_t key = 0;
+
+	KUNIT_EXPECT_NE_MSG(test, ds_cover(ds, sector, &key, &rs_info), 0, "sector %llu", sector);
+}
+
+/*
+ * The mapping of a sector as a read looks for it. The rbtree also finds a
+ * block, that a later write at a key inside of it cut short, so it is
+ * compared with a scan of every mapping over overlapping blocks.
+ */
+static void ds_test_cover(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	u8 *sectors = NULL;
+	sector_t sector, key, expected;
+	u32 i, slot;
+
+	ds_test_insert(test, ds, 64, 16);
+	ds_test_insert(test, ds, 96, 8);
+	ds_test_expect_uncovered(test, ds, 63);
+	ds_test_expect_cover(test, ds, 64, 64);
+	ds_test_expect_cover(test, ds, 79, 64);
+	ds_test_expect_uncovered(test, ds, 80);
+	ds_test_expect_cover(test, ds, 100, 96);
+	ds_test_expect_uncovered(test, ds, 104);
+
+	ds_test_insert(test, ds, 1024, 64);
+	ds_test_insert(test, ds, 1040, 4);
+	ds_test_expect_cover(test, ds, 1042, 1040);
+	if (ds->type != RBTREE_TYPE) {
+		ds_test_expect_uncovered(test, ds, 1050);
+		return;
+	}
+	ds_test_expect_cover(test, ds, 1050, 1024);
+	ds_remove(ds, 1024);
+	ds_remove(ds, 1040);
+
+	/* Slots of 16 sectors from 2048 on, blocks of up to 68 sectors */
+	sectors = kunit_kzalloc(test, 1024, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, sectors);
+	for (i = 0; i < 512; i++) {
+		slot = (i * DS_TEST_PERF_MULT) & 1023;
+		sectors[slot] = 8 + (i * 7) % 61;
+		ds_test_insert(test, ds, 2048 + 16 * slot, sectors[slot]);
+	}
+	for (i = 0; i < 512; i += 3) {
+		slot = (i * DS_TEST_PERF_MULT) & 1023;
+		ds_remove(ds, 2048 + 16 * slot);
+		sectors[slot] = 0;
+	}
+
+	for (sector = 2048; sector < 2048 + 16 * 1024 + 80; sector++) {
+		expected = 0;
+		for (slot = 0; slot < 1024; slot++) {
+			key = 2048 + 16 * slot;
+			if (sectors[slot] && key <= sector && sector < key + sectors[slot])
+				expected = key;
+		}
+		if (expected)
+			ds_test_expect_cover(test, ds, sector, expected);
+		else
+			ds_test_expect_uncovered(test, ds, sector);
+	}
+}
+
+/*
+ * Sub-block writes between aligned 4K blocks, the page table keeps them apart
+ * from its tables, so the predecessor and the last key cross the two.
+ */
+static void ds_test_unaligned(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	sector_t key;
+
+	for (key = 64; key <= 64 * 64; key += 64) {
+		ds_test_insert(test, ds, key, 8);
+		ds_test_insert(test, ds, key + 9, 2);
+		ds_test_insert(test, ds, key + 13, 1);
+	}
+	ds_test_expect_last(test, ds, 64 * 64 + 13);
+
+	for (key = 64; key <= 64 * 64; key += 64) {
+		ds_test_expect_mapped(test, ds, key, 8);
+		ds_test_expect_mapped(test, ds, key + 9, 2);
+		ds_test_expect_mapped(test, ds, key + 13, 1);
+		ds_test_expect_unmapped(test, ds, key + 8);
+		ds_test_expect_prev(test, ds, key + 9, key);
+		ds_test_expect_prev(test, ds, key + 10, key + 9);
+		ds_test_expect_prev(test, ds, key + 60, key + 13);
+		ds_test_expect_prev(test, ds, key + 64, key + 13);
+	}
+
+	for (key = 64; key <= 64 * 64; key += 64)
+		ds_remove(ds, key + 13);
+	ds_test_expect_last(test, ds, 64 * 64 + 9);
+	for (key = 64; key <= 64 * 64; key += 64) {
+		ds_remove(ds, key);
+		ds_remove(ds, key + 9);
+	}
+	KUNIT_EXPECT_TRUE(test, ds_empty_check(ds));
+}
+
+/* Copy into every other backend, as a migration does */
+static void ds_test_copy(struct kunit *test)
+{
+	struct data_struct *src = ds_test_init(test);
+	struct data_struct *dst = NULL;
+	struct ds_cursor cursor;
+	sector_t key;
+	s32 copied;
+	u32 i;
+
+	for (key = 8; key <= 8 * 1024; key += 8)
+		ds_test_insert(test, src, key, 8);
+
+	for (i = 0; i < ARRAY_SIZE(ds_test_names); i++) {
+		if (i == DFTL_TYPE)
+			continue;
+
+		dst = kunit_kzalloc(test, sizeof(struct data_struct), GFP_KERNEL);
+		KUNIT_ASSERT_NOT_NULL(test, dst);
+		KUNIT_ASSERT_EQ(test, ds_init(dst, (char *)ds_test_names[i]), 0);
+		KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, ds_test_free, dst), 0);
+
+		memset(&cursor, 0, sizeof(cursor));
+		copied = 0;
+		while (!cursor.done) {
+			s32 status = ds_copy_batch(src, dst, &cursor, 100);
+
+			KUNIT_ASSERT_GE(test, status, 0);
+			copied += status;
+		}
+		KUNIT_EXPECT_EQ_MSG(test, copied, 1024, "to %s", ds_test_names[i]);
+		for (key = 8; key <= 8 * 1024; key += 8)
+			ds_test_expect_mapped(test, dst, key, 8);
+		ds_test_expect_last(test, dst, 8 * 1024);
+	}
+}
+
+/* Batches of an odd size, so the hashtable walk stops inside of buckets */
+static void ds_test_read_batch(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	struct redir_sector_info rs_info;
+	struct ds_entry entries[7];
+	struct ds_cursor cursor = {0};
+	bool *seen = NULL;
+	u32 read = 0;
+	s32 status, i;
+	sector_t key;
+
+	seen = kunit_kzalloc(test, 1024 + 1, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, seen);
+
+	for (key = 8; key <= 8 * 1024; key += 8)
+		ds_test_insert(test, ds, key, 8);
+
+	while ((status = ds_read_batch(ds, &cursor, entries, ARRAY_SIZE(entries))) > 0) {
+		for (i = 0; i < status; i++) {
+			key = entries[i].key;
+			ds_unpack_value(entries[i].value, &rs_info);
+			KUNIT_ASSERT_TRUE_MSG(test, key && key <= 8 * 1024 && !(key % 8), "key %llu", key);
+			KUNIT_EXPECT_FALSE_MSG(test, seen[key / 8], "key %llu read twice", key);
+			KUNIT_EXPECT_EQ_MSG(test, rs_info.redirected_sector, ds_test_redirect(key), "key %llu", key);
+			seen[key / 8] = true;
+		}
+		read += status;
+	}
+	KUNIT_EXPECT_EQ(test, status, 0);
+	KUNIT_EXPECT_EQ(test, read, 1024);
+	KUNIT_EXPECT_EQ(test, ds_read_batch(ds, &cursor, entries, ARRAY_SIZE(entries)), 0);
+}
+
+static sector_t ds_test_perf_key(u32 i)
+{
+	/* Permutation of [0, DS_TEST_PERF_KEYS), spread out to 8 sector blocks */
+	return (((i * DS_TEST_PERF_MULT) & (DS_TEST_PERF_KEYS - 1)) + 1) * 64;
+}
+
+static void ds_test_expect_budget(struct kunit *test, const char *op, u64 ns, u64 budget, u32 scale)
+{
+	u64 per_op = div_u64(ns, DS_TEST_PERF_KEYS);
+
+	kunit_info(test, "%s: %llu ns/op\n", op, per_op);
+	if (scale)
+		KUNIT_EXPECT_LE_MSG(test, per_op, budget * scale, "%s is over the budget", op);
+}
+
+/*
+ * Times insert, lookup and prev over random keys. The budgets aren't enforced
+ * on kernels with debug options, that slow down every allocation.
+ */
+static void ds_test_perf(struct kunit *test)
+{
+	struct data_struct *ds = ds_test_init(test);
+	const struct ds_test_budget *budget = &ds_test_budgets[ds->type];
+	struct redir_sector_info rs_info = {0};
+	sector_t prev_key = 0;
+	u64 start, ns;
+	u32 scale = kunit_perf_scale;
+	u32 misses = 0;
+	u32 i;
+
+	if (IS_ENABLED(CONFIG_KASAN) || IS_ENABLED(CONFIG_PROVE_LOCKING) || IS_ENABLED(CONFIG_DEBUG_KMEMLEAK))
+		scale = 0;
+
+	start = ktime_get_ns();
+	for (i = 0; i < DS_TEST_PERF_KEYS; i++)
+		ds_test_insert(test, ds, ds_test_perf_key(i), 8);
+	ns = ktime_get_ns() - start;
+	ds_test_expect_budget(test, "insert", ns, budget->insert, scale);
+
+	start = ktime_get_ns();
+	for (i = 0; i < DS_TEST_PERF_KEYS; i++)
+		misses += !!ds_lookup(ds, ds_test_perf_key(i), &rs_info);
+	ns = ktime_get_ns() - start;
+	KUNIT_EXPECT_EQ(test, misses, 0);
+	ds_test_expect_budget(test, "lookup", ns, budget->lookup, scale);
+
+	start = ktime_get_ns();
+	for (i = 0; i < DS_TEST_PERF_KEYS; i++)
+		misses += !!ds_prev(ds, ds_test_perf_key(i) + 4, &prev_key, &rs_info);
+	ns = ktime_get_ns() - start;
+	KUNIT_EXPECT_EQ(test, misses, 0);
+	ds_test_expect_budget(test, "prev", ns, budget->prev, scale);
+}
+
+static struct kunit_case ds_control_test_cases[] = {
+	KUNIT_CASE_PARAM(ds_test_empty, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_value_bounds, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_zip_value, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_insert_lookup, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_overwrite, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_remove, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_last, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_prev, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_prev_walk, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_cover, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_unaligned, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_copy, ds_test_gen_params),
+	KUNIT_CASE_PARAM(ds_test_read_batch, ds_test_gen_params),
+	KUNIT_CASE_PARAM_ATTR(ds_test_perf, ds_test_gen_params, {.speed = KUNIT_SPEED_SLOW}),
+	{}
+};
+
+static struct kunit_suite ds_control_test_suite = {
+	.name = "lsbdd-ds-control",
+	.test_cases = ds_control_test_cases,
+};
+
+kunit_test_suite(ds_control_test_suite);
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * KUnit suite of the hybrid mapping: the cuts of the mappings, that a write
+ * overlaps, on each ds-control backend a hybrid BD may use (DFTL is refused).
+ */
+
+#include <kunit/test.h>
+#include <linux/percpu.h>
+#include "../utils/ds-control.h"
+#include "../main.h"
+
+/* Coarse blocks of the tests, large enough to hold every write of them */
+#define HY_TEST_BLOCK_KB 64
+
+static const char * const hy_test_names[] = {"bt", "sl", "ht", "rb", "li", "pt"};
+
+static void hy_test_name_desc(const char * const *name, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s", *name);
+}
+
+KUNIT_ARRAY_PARAM(hy_test, hy_test_names, hy_test_name_desc);
+
+static void hy_test_free(void *data)
+{
+	struct bd_manager *manager = data;
+
+	lsbdd_hybrid_free(manager);
+	free_percpu(manager->stats);
+	ds_free(manager->sel_data_struct);
+}
+
+static struct bd_manager *hy_test_init(struct kunit *test)
+{
+	const char * const *name = test->param_value;
+	struct bd_manager *manager = NULL;
+
+	manager = kunit_kzalloc(test, sizeof(struct bd_manager), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, manager);
+	manager->sel_data_struct = kunit_kzalloc(test, sizeof(struct data_struct), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, manager->sel_data_struct);
+	KUNIT_ASSERT_EQ(test, ds_init(manager->sel_data_struct, (char *)*name), 0);
+
+	manager->stats = alloc_percpu(struct lsbdd_stats);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, hy_test_free, manager), 0);
+	KUNIT_ASSERT_NOT_NULL(test, manager->stats);
+	KUNIT_ASSERT_EQ(test, lsbdd_hybrid_init(manager, HY_TEST_BLOCK_KB), 0);
+
+	return manager;
+}
+
+static void hy_test_map(struct kunit *test, struct bd_manager *manager, sector_t key, u32 sectors,
+		sector_t redirected_sector)
+{
+	struct redir_sector_info rs_info = {
+		.redirected_sector = redirected_sector,
+		.block_size = sectors << SECTOR_SHIFT,
+	};
+
+	KUNIT_ASSERT_EQ_MSG(test, ds_insert(manager->sel_data_struct, key, &rs_info), 0, "key %llu", key);
+	manager->nr_mappings++;
+}
+
+static void hy_test_expect(struct kunit *test, struct bd_manager *manager, sector_t key, u32 sectors,
+		sector_t redirected_sector)
+{
+	struct redir_sector_info rs_info = {0};
+
+	KUNIT_EXPECT_EQ_MSG(test, ds_lookup(manager->sel_data_struct, key, &rs_info), 0, "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.redirected_sector, redirected_sector, "key %llu", key);
+	KUNIT_EXPECT_EQ_MSG(test, rs_info.block_size, sectors << SECTOR_SHIFT, "key %llu", key);
+}
+
+/* A write, that ends where the next mapping starts, leaves that mapping as it is */
+static void hy_test_cut_end_on_mapping(struct kunit *test)
+{
+	struct bd_manager *manager = hy_test_init(test);
+
+	hy_test_map(test, manager, 0, 16, 1000);
+	hy_test_map(test, manager, 16, 16, 5000);
+
+	KUNIT_EXPECT_EQ(test, lsbdd_hybrid_cut(manager, 8, 8), 0);
+	hy_test_expect(test, manager, 0, 8, 1000);
+	hy_test_expect(test, manager, 16, 16, 5000);
+	KUNIT_EXPECT_EQ(test, manager->nr_mappings, 2);
+
+	/* The whole first mapping, it is replaced by the write itself */
+	KUNIT_EXPECT_EQ(test, lsbdd_hybrid_cut(manager, 0, 8), 0);
+	hy_test_expect(test, manager, 0, 8, 1000);
+	hy_test_expect(test, manager, 16, 16, 5000);
+	KUNIT_EXPECT_EQ(test, manager->nr_mappings, 2);
+}
+
+/* A write across two mappings keeps the head of the first and the tail of the second */
+static void hy_test_cut_across(struct kunit *test)
+{
+	struct bd_manager *manager = hy_test_init(test);
+	struct redir_sector_info rs_info = {0};
+
+	hy_test_map(test, manager, 0, 16, 1000);
+	hy_test_map(test, manager, 16, 16, 5000);
+	hy_test_map(test, manager, 32, 8, 9000);
+
+	KUNIT_EXPECT_EQ(test, lsbdd_hybrid_cut(manager, 4, 20), 0);
+	hy_test_expect(test, manager, 0, 4, 1000);
+	KUNIT_EXPECT_NE(test, ds_lookup(manager->sel_data_struct, 16, &rs_info), 0);
+	hy_test_expect(test, manager, 24, 8, 5008);
+	hy_test_expect(test, manager, 32, 8, 9000);
+	KUNIT_EXPECT_EQ(test, manager->nr_mappings, 3);
+}
+
+static struct kunit_case hybrid_test_cases[] = {
+	KUNIT_CASE_PARAM(hy_test_cut_end_on_mapping, hy_test_gen_params),
+	KUNIT_CASE_PARAM(hy_test_cut_across, hy_test_gen_params),
+	{}
+};
+
+static struct kunit_suite hybrid_test_suite = {
+	.name = "lsbdd-hybrid",
+	.test_cases = hybrid_test_cases,
+};
+
+kunit_test_suite(hybrid_test_suite);
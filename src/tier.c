@@ -0,0 +1,636 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include "utils/ds-control.h"
+#include "main.h"
+#include "tier.h"
+
+/* Data of the moves, written at dst once full or the next move doesn't follow it */
+struct lsbdd_tier_buf {
+	struct page *pages[LSBDD_TIER_COPY_PAGES];
+	/* Budget of the background I/O, that the copy is sent with */
+	enum lsbdd_io_class class;
+	u32 fill;
+	u8 dst_stripe;
+	sector_t dst_sector;
+};
+
+static sector_t lsbdd_tier_segment_start(struct lsbdd_tier *tier, u32 index)
+{
+	return LSBDD_SECTOR_OFFSET + (sector_t)index * tier->manager->segment_sectors;
+}
+
+static u32 lsbdd_tier_segment_index(struct lsbdd_tier *tier, sector_t sector)
+{
+	return div64_u64(sector - LSBDD_SECTOR_OFFSET, tier->manager->segment_sectors);
+}
+
+static bool lsbdd_tier_below(struct lsbdd_tier *tier, u32 percent)
+{
+	return (u64)READ_ONCE(tier->nr_free) * 100 < (u64)tier->nr_segments * percent;
+}
+
+/**
+ * Takes sectors in the fast tier log, a new segment is started if the block
+ * doesn't fit in the current one. Must be called with ds_lock held for write.
+ *
+ * It returns 0 on success, -ENOSPC if there is no free segment.
+ */
+static s32 lsbdd_tier_alloc_fast(struct lsbdd_tier *tier, u32 sectors, sector_t *redirect)
+{
+	sector_t segment_sectors = tier->manager->segment_sectors;
+	u32 i, next = 0;
+
+	if (sectors > segment_sectors)
+		return -ENOSPC;
+
+	if (tier->cur == LSBDD_TIER_NONE ||
+		tier->cur_pos + sectors > lsbdd_tier_segment_start(tier, tier->cur) + segment_sectors) {
+		for (i = 1; i <= tier->nr_segments; i++) {
+			next = (tier->cur + i) % tier->nr_segments;
+			if (tier->segments[next].free)
+				break;
+		}
+		if (i > tier->nr_segments)
+			return -ENOSPC;
+
+		tier->segments[next].free = false;
+		tier->nr_free--;
+		tier->cur = next;
+		tier->cur_pos = lsbdd_tier_segment_start(tier, next);
+		if (lsbdd_tier_below(tier, LSBDD_TIER_LOW_FREE))
+			queue_work(system_unbound_wq, &tier->work);
+	}
+
+	WRITE_ONCE(tier->segments[tier->cur].atime, jiffies);
+	*redirect = lsbdd_stripe_sector(LSBDD_TIER_FAST, tier->cur_pos);
+	tier->cur_pos += sectors;
+	return 0;
+}
+
+/**
+ * Takes sectors of the log for a write of a tiered BD. Blocks go to the fast
+ * tier, only if it is full (or the block is larger than a segment) they are
+ * written to the slow one directly. Must be called with ds_lock held for write.
+ *
+ * It returns 0 on success, -ENOSPC if no tier has room for the write.
+ */
+s32 lsbdd_tier_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect)
+{
+	struct lsbdd_stripe *slow = &manager->stripes[LSBDD_TIER_SLOW];
+	struct lsbdd_tier *tier = manager->tier;
+
+	if (!lsbdd_tier_alloc_fast(tier, sectors, redirect))
+		return 0;
+
+	queue_work(system_unbound_wq, &tier->work);
+	if (slow->next_free_sector + sectors > slow->capacity)
+		return -ENOSPC;
+
+	*redirect = lsbdd_stripe_sector(LSBDD_TIER_SLOW, slow->next_free_sector);
+	slow->next_free_sector += sectors;
+	tier->slow_writes++;
+	return 0;
+}
+
+/**
+ * Counts a clone, that was sent to the fast tier sector, in the users of its
+ * segment, which isn't reused until they complete.
+ *
+ * It returns the segment, its users are decremented by the completion.
+ */
+struct lsbdd_tier_segment *lsbdd_tier_get(struct bd_manager *manager, sector_t sector)
+{
+	struct lsbdd_tier *tier = manager->tier;
+	struct lsbdd_tier_segment *segment = NULL;
+
+	segment = &tier->segments[min(lsbdd_tier_segment_index(tier, sector), tier->nr_segments - 1)];
+	atomic_inc(&segment->users);
+	return segment;
+}
+
+/**
+ * Records a read of the block at key: it refreshes the segment of a fast
+ * block and counts the reads of a slow one, the worker promotes it once
+ * there are promote_reads of them. Called with ds_lock held.
+ */
+void lsbdd_tier_access(struct bd_manager *manager, sector_t key, sector_t redirected_sector)
+{
+	struct lsbdd_tier *tier = manager->tier;
+	sector_t sector = redirected_sector & LSBDD_STRIPE_SECTOR_MASK;
+	unsigned long count;
+	void *entry = NULL;
+
+	if (lsbdd_stripe_index(redirected_sector) == LSBDD_TIER_FAST) {
+		WRITE_ONCE(tier->segments[min(lsbdd_tier_segment_index(tier, sector),
+			tier->nr_segments - 1)].atime, jiffies);
+		return;
+	}
+	if (!tier->promote_reads)
+		return;
+
+	entry = xa_load(&tier->reads, key);
+	count = entry ? xa_to_value(entry) + 1 : 1;
+	if (count == 1 && atomic_inc_return(&tier->nr_tracked) > LSBDD_TIER_TRACKED_MAX) {
+		queue_work(system_unbound_wq, &tier->work);
+		return;
+	}
+	/* Concurrent reads may lose a count, it only delays the promotion */
+	xa_store(&tier->reads, key, xa_mk_value(count), GFP_NOWAIT);
+	if (count == tier->promote_reads)
+		queue_work(system_unbound_wq, &tier->work);
+}
+
+static s32 lsbdd_tier_io(struct bd_manager *manager, u8 stripe, blk_opf_t opf, sector_t sector,
+		struct lsbdd_tier_buf *buf, u32 offset, u32 bytes)
+{
+	struct bio *bio = NULL;
+	u32 page_offset, len;
+	u64 start_ns;
+	s32 status;
+
+	bio = bio_alloc(manager->stripes[stripe].bd_handler->bdev, DIV_ROUND_UP((offset & ~PAGE_MASK) + bytes, PAGE_SIZE), opf, GFP_NOIO);
+	bio->bi_iter.bi_sector = sector;
+	while (bytes) {
+		page_offset = offset & ~PAGE_MASK;
+		len = min_t(u32, bytes, PAGE_SIZE - page_offset);
+		__bio_add_page(bio, buf->pages[offset >> PAGE_SHIFT], len, page_offset);
+		offset += len;
+		bytes -= len;
+	}
+
+	start_ns = lsbdd_iosched_begin(&manager->iosched, buf->class, bio);
+	status = submit_bio_wait(bio);
+	lsbdd_iosched_end(&manager->iosched, buf->class, start_ns);
+	bio_put(bio);
+	return status;
+}
+
+static s32 lsbdd_tier_flush(struct bd_manager *manager, struct lsbdd_tier_buf *buf)
+{
+	s32 status;
+
+	if (!buf->fill)
+		return 0;
+
+	status = lsbdd_tier_io(manager, buf->dst_stripe, REQ_OP_WRITE, buf->dst_sector, buf, 0, buf->fill);
+	buf->fill = 0;
+	return status;
+}
+
+/**
+ * Copies the data of the moves from their old to their new location. Moves
+ * with consecutive new locations are written with one bio per buffer. The
+ * defragmentation moves blocks within the log with it too, the I/O is sent
+ * within the budget of class.
+ *
+ * It returns 0 on success, negative error code otherwise.
+ */
+s32 lsbdd_tier_copy(struct bd_manager *manager, enum lsbdd_io_class class, struct lsbdd_tier_move *moves, u32 nr)
+{
+	struct redir_sector_info src, dst;
+	struct lsbdd_tier_buf *buf = NULL;
+	sector_t dst_sector;
+	u32 done, piece, bytes, i;
+	s32 status = 0;
+
+	if (!nr)
+		return 0;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	buf->class = class;
+	for (i = 0; i < LSBDD_TIER_COPY_PAGES; i++) {
+		buf->pages[i] = alloc_page(GFP_KERNEL);
+		if (!buf->pages[i]) {
+			status = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nr && !status; i++) {
+		ds_unpack_value(moves[i].old_value, &src);
+		ds_unpack_value(moves[i].new_value, &dst);
+		/* A compressed block is copied as it is stored */
+		bytes = ds_stored_sectors(&src) << SECTOR_SHIFT;
+
+		for (done = 0; done < bytes && !status; done += piece) {
+			dst_sector = (dst.redirected_sector & LSBDD_STRIPE_SECTOR_MASK) + (done >> SECTOR_SHIFT);
+			if (buf->fill && (buf->fill == LSBDD_TIER_COPY_PAGES * PAGE_SIZE ||
+				buf->dst_stripe != lsbdd_stripe_index(dst.redirected_sector) ||
+				buf->dst_sector + (buf->fill >> SECTOR_SHIFT) != dst_sector)) {
+				status = lsbdd_tier_flush(manager, buf);
+				if (status)
+					break;
+			}
+			if (!buf->fill) {
+				buf->dst_stripe = lsbdd_stripe_index(dst.redirected_sector);
+				buf->dst_sector = dst_sector;
+			}
+
+			piece = min_t(u32, bytes - done, LSBDD_TIER_COPY_PAGES * PAGE_SIZE - buf->fill);
+			status = lsbdd_tier_io(manager, lsbdd_stripe_index(src.redirected_sector), REQ_OP_READ,
+					(src.redirected_sector & LSBDD_STRIPE_SECTOR_MASK) + (done >> SECTOR_SHIFT),
+					buf, buf->fill, piece);
+			buf->fill += piece;
+		}
+	}
+	if (!status)
+		status = lsbdd_tier_flush(manager, buf);
+
+out:
+	for (i = 0; i < LSBDD_TIER_COPY_PAGES; i++)
+		if (buf->pages[i])
+			__free_page(buf->pages[i]);
+	kfree(buf);
+	return status;
+}
+
+/**
+ * Points the mappings of the moves to their new location, unless they were
+ * overwritten during the copy.
+ *
+ * It returns 0 on success, negative error code if a mapping couldn't be
+ * changed, it then still points to the old location.
+ */
+static s32 lsbdd_tier_remap(struct bd_manager *manager, struct lsbdd_tier_move *moves, u32 nr)
+{
+	struct redir_sector_info rs_info;
+	s32 status = 0;
+	u32 i;
+
+	down_write(&manager->ds_lock);
+	for (i = 0; i < nr; i++) {
+		if (ds_lookup(manager->sel_data_struct, moves[i].key, &rs_info) ||
+			ds_pack_value(&rs_info) != moves[i].old_value)
+			continue;
+
+		ds_remove(manager->sel_data_struct, moves[i].key);
+		ds_unpack_value(moves[i].new_value, &rs_info);
+		status = ds_insert(manager->sel_data_struct, moves[i].key, &rs_info);
+		if (status) {
+			ds_unpack_value(moves[i].old_value, &rs_info);
+			ds_insert(manager->sel_data_struct, moves[i].key, &rs_info);
+			break;
+		}
+		ds_migration_capture(&manager->migration, moves[i].key, &rs_info);
+	}
+	up_write(&manager->ds_lock);
+
+	return status;
+}
+
+static int lsbdd_tier_move_cmp(const void *a, const void *b)
+{
+	const struct lsbdd_tier_move *ma = a, *mb = b;
+
+	if (ma->old_value == mb->old_value)
+		return 0;
+	return ma->old_value < mb->old_value ? -1 : 1;
+}
+
+/**
+ * Picks up to max of the least recently used closed segments without
+ * clones in flight. Must be called with ds_lock held.
+ *
+ * It returns the number of the picked segments, the coldest first.
+ */
+static u32 lsbdd_tier_pick_victims(struct lsbdd_tier *tier, u32 *victims, u32 max)
+{
+	struct lsbdd_tier_segment *segment = NULL;
+	u32 nr = 0;
+	u32 i, j;
+
+	for (i = 0; i < tier->nr_segments && max; i++) {
+		segment = &tier->segments[i];
+		if (segment->free || i == tier->cur || atomic_read(&segment->users))
+			continue;
+		if (nr == max && !time_before(segment->atime, tier->segments[victims[max - 1]].atime))
+			continue;
+
+		j = nr < max ? nr++ : max - 1;
+		while (j && time_before(segment->atime, tier->segments[victims[j - 1]].atime)) {
+			victims[j] = victims[j - 1];
+			j--;
+		}
+		victims[j] = i;
+	}
+
+	return nr;
+}
+
+/**
+ * Collects the mappings into the segments, that are being demoted, by a walk
+ * of the mapping in batches under ds_lock held for read.
+ *
+ * It returns 0 on success, -EAGAIN if the data structure was switched
+ * meanwhile, or another negative error code.
+ */
+static s32 lsbdd_tier_collect(struct lsbdd_tier *tier, struct lsbdd_tier_move **moves, u32 *nr)
+{
+	struct bd_manager *manager = tier->manager;
+	struct lsbdd_tier_move *grown = NULL;
+	struct ds_entry *entries = NULL;
+	struct data_struct *ds = NULL;
+	struct redir_sector_info rs_info;
+	struct ds_cursor cursor = {};
+	sector_t sector;
+	u32 capacity = 0;
+	s32 status = 0;
+	s32 read, i;
+
+	entries = kmalloc_array(DS_MIGRATE_BATCH, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	down_read(&manager->ds_lock);
+	ds = manager->sel_data_struct;
+	up_read(&manager->ds_lock);
+
+	for (;;) {
+		down_read(&manager->ds_lock);
+		if (manager->sel_data_struct != ds)
+			read = -EAGAIN;
+		else
+			read = ds_read_batch(ds, &cursor, entries, DS_MIGRATE_BATCH);
+		up_read(&manager->ds_lock);
+
+		if (read <= 0) {
+			status = read;
+			break;
+		}
+
+		for (i = 0; i < read; i++) {
+			ds_unpack_value(entries[i].value, &rs_info);
+			sector = rs_info.redirected_sector & LSBDD_STRIPE_SECTOR_MASK;
+			if (lsbdd_stripe_index(rs_info.redirected_sector) != LSBDD_TIER_FAST ||
+				!tier->segments[lsbdd_tier_segment_index(tier, sector)].demoting)
+				continue;
+
+			if (*nr == capacity) {
+				capacity = capacity ? capacity * 2 : DS_MIGRATE_BATCH;
+				grown = kvmalloc_array(capacity, sizeof(**moves), GFP_KERNEL);
+				if (!grown) {
+					status = -ENOMEM;
+					goto out;
+				}
+				if (*moves)
+					memcpy(grown, *moves, *nr * sizeof(**moves));
+				kvfree(*moves);
+				*moves = grown;
+			}
+			(*moves)[*nr].key = entries[i].key;
+			(*moves)[(*nr)++].old_value = entries[i].value;
+		}
+		cond_resched();
+	}
+
+out:
+	kfree(entries);
+	return status;
+}
+
+/**
+ * Moves the collected blocks to the slow tier log, in the order of their
+ * fast sectors, so both tiers are accessed sequentially.
+ *
+ * It returns 0 on success, negative error code otherwise.
+ */
+static s32 lsbdd_tier_move_slow(struct lsbdd_tier *tier, struct lsbdd_tier_move *moves, u32 nr, u64 *bytes)
+{
+	struct bd_manager *manager = tier->manager;
+	struct lsbdd_stripe *slow = &manager->stripes[LSBDD_TIER_SLOW];
+	struct redir_sector_info rs_info;
+	sector_t total = 0;
+	s32 status = 0;
+	u32 i;
+
+	sort(moves, nr, sizeof(*moves), lsbdd_tier_move_cmp, NULL);
+
+	down_write(&manager->ds_lock);
+	for (i = 0; i < nr; i++) {
+		ds_unpack_value(moves[i].old_value, &rs_info);
+		total += ds_stored_sectors(&rs_info);
+	}
+	if (slow->next_free_sector + total > slow->capacity) {
+		status = -ENOSPC;
+	} else {
+		for (i = 0; i < nr; i++) {
+			ds_unpack_value(moves[i].old_value, &rs_info);
+			rs_info.redirected_sector = lsbdd_stripe_sector(LSBDD_TIER_SLOW, slow->next_free_sector);
+			slow->next_free_sector += ds_stored_sectors(&rs_info);
+			moves[i].new_value = ds_pack_value(&rs_info);
+			*bytes += ds_stored_sectors(&rs_info) << SECTOR_SHIFT;
+		}
+	}
+	up_write(&manager->ds_lock);
+	if (status)
+		return status;
+
+	status = lsbdd_tier_copy(manager, LSBDD_IO_TIER, moves, nr);
+	if (!status)
+		status = lsbdd_tier_remap(manager, moves, nr);
+	return status;
+}
+
+/**
+ * Moves the live blocks of up to LSBDD_TIER_BATCH_SEGMENTS of the coldest
+ * fast segments to the slow tier and frees the segments. A batched walk may
+ * miss mappings, that are moved around by concurrent inserts, so the mapping
+ * is walked again, until nothing points into the segments.
+ *
+ * It returns the number of freed segments or negative error code.
+ */
+static s32 lsbdd_tier_demote(struct lsbdd_tier *tier)
+{
+	struct bd_manager *manager = tier->manager;
+	struct lsbdd_tier_move *moves = NULL;
+	u32 victims[LSBDD_TIER_BATCH_SEGMENTS];
+	u32 nr_victims, want;
+	u32 nr_moves = 0;
+	u32 pass = 0;
+	u64 bytes = 0;
+	s32 status;
+	u32 i;
+
+	down_read(&manager->ds_lock);
+	want = div_u64((u64)tier->nr_segments * LSBDD_TIER_HIGH_FREE, 100) - tier->nr_free;
+	nr_victims = lsbdd_tier_pick_victims(tier, victims, min_t(u32, want, LSBDD_TIER_BATCH_SEGMENTS));
+	for (i = 0; i < nr_victims; i++)
+		tier->segments[victims[i]].demoting = true;
+	up_read(&manager->ds_lock);
+
+	if (!nr_victims)
+		return 0;
+
+	for (;;) {
+		nr_moves = 0;
+		status = lsbdd_tier_collect(tier, &moves, &nr_moves);
+		if (status || !nr_moves)
+			break;
+		if (pass++ == LSBDD_TIER_DEMOTE_PASSES) {
+			status = -EAGAIN;
+			break;
+		}
+		status = lsbdd_tier_move_slow(tier, moves, nr_moves, &bytes);
+		if (status)
+			break;
+	}
+	if (status)
+		goto out;
+
+	/* Reads, that were set up before the remap, may still be in flight */
+	for (i = 0; i < nr_victims; i++)
+		while (atomic_read(&tier->segments[victims[i]].users))
+			msleep(1);
+
+	down_write(&manager->ds_lock);
+	for (i = 0; i < nr_victims; i++)
+		tier->segments[victims[i]].free = true;
+	tier->nr_free += nr_victims;
+	tier->demoted_segments += nr_victims;
+	tier->demoted_bytes += bytes;
+	up_write(&manager->ds_lock);
+	status = nr_victims;
+
+out:
+	for (i = 0; i < nr_victims; i++)
+		WRITE_ONCE(tier->segments[victims[i]].demoting, false);
+	kvfree(moves);
+	return status;
+}
+
+/**
+ * Moves the slow blocks, that were read promote_reads times since the last
+ * run, back to the fast tier, as long as it stays above the low watermark.
+ */
+static void lsbdd_tier_promote(struct lsbdd_tier *tier)
+{
+	struct bd_manager *manager = tier->manager;
+	struct lsbdd_tier_move *moves = NULL;
+	struct redir_sector_info rs_info;
+	sector_t redirect;
+	unsigned long key;
+	void *entry = NULL;
+	u32 nr = 0, i, j;
+	u64 bytes = 0;
+
+	moves = kmalloc_array(LSBDD_TIER_PROMOTE_BATCH, sizeof(*moves), GFP_KERNEL);
+	if (!moves)
+		return;
+
+	xa_for_each(&tier->reads, key, entry) {
+		if (xa_to_value(entry) < tier->promote_reads)
+			continue;
+		moves[nr++].key = key;
+		if (nr == LSBDD_TIER_PROMOTE_BATCH)
+			break;
+	}
+
+	down_write(&manager->ds_lock);
+	for (i = 0, j = 0; i < nr && !lsbdd_tier_below(tier, LSBDD_TIER_LOW_FREE); i++) {
+		if (ds_lookup(manager->sel_data_struct, moves[i].key, &rs_info) ||
+			lsbdd_stripe_index(rs_info.redirected_sector) != LSBDD_TIER_SLOW)
+			continue;
+		if (lsbdd_tier_alloc_fast(tier, ds_stored_sectors(&rs_info), &redirect))
+			break;
+
+		moves[j].key = moves[i].key;
+		moves[j].old_value = ds_pack_value(&rs_info);
+		rs_info.redirected_sector = redirect;
+		moves[j++].new_value = ds_pack_value(&rs_info);
+		bytes += ds_stored_sectors(&rs_info) << SECTOR_SHIFT;
+	}
+	up_write(&manager->ds_lock);
+
+	if (j && !lsbdd_tier_copy(manager, LSBDD_IO_TIER, moves, j) && !lsbdd_tier_remap(manager, moves, j))
+		WRITE_ONCE(tier->promoted_bytes, tier->promoted_bytes + bytes);
+	kfree(moves);
+}
+
+static void lsbdd_tier_work(struct work_struct *work)
+{
+	struct lsbdd_tier *tier = container_of(work, struct lsbdd_tier, work);
+	s32 status = 0;
+
+	if (tier->promote_reads)
+		lsbdd_tier_promote(tier);
+	/* Starts a new window of read counts */
+	xa_destroy(&tier->reads);
+	atomic_set(&tier->nr_tracked, 0);
+
+	while (!READ_ONCE(tier->stop) && lsbdd_tier_below(tier, LSBDD_TIER_HIGH_FREE)) {
+		status = lsbdd_tier_demote(tier);
+		if (status <= 0)
+			break;
+		cond_resched();
+	}
+	if (status < 0)
+		pr_err("Demotion to the slow tier failed with code %d\n", status);
+}
+
+/**
+ * Sets up the BD as tiered, the first stripe is the fast tier, that is
+ * split into segments of segment_sectors, the second one is the slow tier.
+ *
+ * It returns 0 on success, -EINVAL if the fast device has no room for a
+ * segment, or -ENOMEM.
+ */
+s32 lsbdd_tier_init(struct bd_manager *manager, u32 promote_reads)
+{
+	struct lsbdd_tier *tier = NULL;
+	u64 nr_segments;
+	u32 i;
+
+	nr_segments = div64_u64(manager->stripes[LSBDD_TIER_FAST].capacity - LSBDD_SECTOR_OFFSET,
+			manager->segment_sectors);
+	if (!nr_segments || nr_segments >= LSBDD_TIER_NONE)
+		return -EINVAL;
+
+	tier = kzalloc(sizeof(*tier), GFP_KERNEL);
+	if (!tier)
+		return -ENOMEM;
+
+	tier->segments = kvcalloc(nr_segments, sizeof(*tier->segments), GFP_KERNEL);
+	if (!tier->segments) {
+		kfree(tier);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_segments; i++)
+		tier->segments[i].free = true;
+	tier->manager = manager;
+	tier->nr_segments = nr_segments;
+	tier->nr_free = nr_segments;
+	tier->promote_reads = promote_reads;
+	tier->cur = LSBDD_TIER_NONE;
+	xa_init(&tier->reads);
+	INIT_WORK(&tier->work, lsbdd_tier_work);
+	manager->tier = tier;
+
+	pr_info("Tiered BD: %llu fast segments of %llu sectors\n", nr_segments, (u64)manager->segment_sectors);
+	return 0;
+}
+
+/* Stops the worker and frees the tiers, must be called once no I/O comes to the BD */
+void lsbdd_tier_free(struct bd_manager *manager)
+{
+	struct lsbdd_tier *tier = manager->tier;
+
+	if (!tier)
+		return;
+
+	WRITE_ONCE(tier->stop, true);
+	cancel_work_sync(&tier->work);
+	xa_destroy(&tier->reads);
+	kvfree(tier->segments);
+	kfree(tier);
+	manager->tier = NULL;
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+#include "iosched.h"
+
+/* Stripes of a tiered BD */
+#define LSBDD_TIER_FAST 0
+#define LSBDD_TIER_SLOW 1
+/* Demotion starts below LOW percent of free fast segments and goes on up to HIGH */
+#define LSBDD_TIER_LOW_FREE 10
+#define LSBDD_TIER_HIGH_FREE 20
+/* Segments demoted per pass of the mapping */
+#define LSBDD_TIER_BATCH_SEGMENTS 16
+/* Walks of the mapping per demotion, that may find blocks left in the segments */
+#define LSBDD_TIER_DEMOTE_PASSES 4
+/* Blocks promoted per run of the worker */
+#define LSBDD_TIER_PROMOTE_BATCH 256
+/* Slow blocks, whose reads are counted at once, the window restarts above it */
+#define LSBDD_TIER_TRACKED_MAX (1 << 16)
+/* Pages of the copy buffer, a bio of any sector offset in it fits BIO_MAX_VECS */
+#define LSBDD_TIER_COPY_PAGES 128
+#define LSBDD_TIER_NONE U32_MAX
+
+struct bd_manager;
+
+/* Block to move to another place in the log, values are packed */
+struct lsbdd_tier_move {
+	sector_t key;
+	u64 old_value;
+	u64 new_value;
+};
+
+/* Segment of the fast tier, the log is written in them and they are demoted whole */
+struct lsbdd_tier_segment {
+	/* Last write to or read from the segment in jiffies */
+	unsigned long atime;
+	/* Clones in flight to the segment */
+	atomic_t users;
+	bool free;
+	bool demoting;
+};
+
+/*
+ * Two-tier BD: new blocks go to the log on the fast device, the worker moves
+ * the least recently used segments to the log on the slow one, once few of
+ * them are free, and brings back slow blocks, that are read again.
+ */
+struct lsbdd_tier {
+	struct bd_manager *manager;
+	struct work_struct work;
+	struct lsbdd_tier_segment *segments;
+	u32 nr_segments;
+	/* Reads of a slow block in a window, that promote it, 0 disables promotion */
+	u32 promote_reads;
+	/* Below is protected by ds_lock */
+	u32 nr_free;
+	u32 cur;
+	sector_t cur_pos;
+	/* Read counts of slow blocks by key, reset after every run */
+	struct xarray reads;
+	atomic_t nr_tracked;
+	bool stop;
+	u64 demoted_segments;
+	u64 demoted_bytes;
+	u64 promoted_bytes;
+	u64 slow_writes;
+};
+
+s32 lsbdd_tier_init(struct bd_manager *manager, u32 promote_reads);
+void lsbdd_tier_free(struct bd_manager *manager);
+s32 lsbdd_tier_alloc(struct bd_manager *manager, u32 sectors, sector_t *redirect);
+struct lsbdd_tier_segment *lsbdd_tier_get(struct bd_manager *manager, sector_t sector);
+void lsbdd_tier_access(struct bd_manager *manager, sector_t key, sector_t redirected_sector);
+s32 lsbdd_tier_copy(struct bd_manager *manager, enum lsbdd_io_class class, struct lsbdd_tier_move *moves, u32 nr);
@@ -156,7 +156,9 @@ void *btree_get_prev_no_rep(struct btree_head *head, struct btree_geo *geo,
 
 	if (head->height == 0)
 		return NULL;
-
+	/* Strictly below the key, as the other backends of ds_prev() */
+	dec_key(geo, key);
+retry:
 	node = head->node;
 	for (height = head->height ; height > 1; height--) {
 		for (i = 0; i < geo->no_pairs; i++)
@@ -185,11 +187,29 @@ void *btree_get_prev_no_rep(struct btree_head *head, struct btree_geo *geo,
 		}
 	}
 miss:
-	if (retry_key) {
+	/*
+	 * Separator keys of the inner nodes aren't updated on removal, so the
+	 * leaf may hold no key below ours: continue under the separator.
+	 */
+	if (retry_key && !keyzero(geo, retry_key)) {
 		longcpy(key, retry_key, geo->keylen);
+		dec_key(geo, key);
 		retry_key = NULL;
-		pr_err("B+Tree: get_prev: key miss\n");
+		goto retry;
 	}
-	prev_key = NULL;
 	return NULL;
 }
+
+/**
+ * Estimates the memory taken by a btree_geo64 tree with nr_entries keys, the
+ * nodes aren't counted by lib/btree. Leaves are taken as filled by 3/4 and the
+ * inner levels as adding one node per (fill - 1) nodes below them.
+ */
+u64 btree_mem_estimate(u64 nr_entries)
+{
+	struct btree_geo *geo = &btree_geo64;
+	u64 fill = geo->no_pairs * 3 / 4;
+	u64 leaves = DIV_ROUND_UP(nr_entries, fill);
+
+	return (leaves + DIV_ROUND_UP(leaves, fill - 1)) * (geo->no_longs + geo->no_pairs) * sizeof(long);
+}
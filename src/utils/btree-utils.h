@@ -14,3 +14,4 @@ struct btree {
 void *btree_last_no_rep(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
 void *btree_get_next(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
 void *btree_get_prev_no_rep(struct btree_head *head, struct btree_geo *geo, unsigned long *key, unsigned long *prev_key);
+u64 btree_mem_estimate(u64 nr_entries);
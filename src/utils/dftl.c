@@ -0,0 +1,562 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Demand-paged mapping table, after DFTL (Gupta et al., ASPLOS'09).
+ *
+ * Every sector of the device has a u64 slot with the packed mapping value,
+ * slots are grouped into translation pages stored at the end of the backing
+ * device. Lookups bring the page in on demand, the cache is capped by
+ * max_cached and by a shrinker. Dirty pages are written back lazily: only
+ * when the LRU tail has to go, and then a whole batch of them at once.
+ *
+ * Page reads wait for the I/O, so the callers must not run in the
+ * submit_bio() context of a stacked device.
+ */
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "dftl.h"
+#include "ds-control.h"
+
+struct dftl_wb_batch {
+	atomic_t pending;
+	struct completion done;
+	blk_status_t status;
+};
+
+static sector_t dftl_page_sector(struct dftl *dftl, u64 index)
+{
+	return dftl->table_start + index * DFTL_PAGE_SECTORS;
+}
+
+static u64 *dftl_page_entries(struct dftl_page *tp)
+{
+	return page_address(tp->page);
+}
+
+static void dftl_free_page(struct dftl *dftl, struct dftl_page *tp)
+{
+	xa_erase(&dftl->pages, tp->index);
+	list_del(&tp->lru);
+	if (tp->dirty)
+		dftl->nr_dirty--;
+	dftl->nr_cached--;
+	__free_page(tp->page);
+	kfree(tp);
+}
+
+static void dftl_wb_end_io(struct bio *bio)
+{
+	struct dftl_wb_batch *batch = bio->bi_private;
+
+	if (bio->bi_status)
+		batch->status = bio->bi_status;
+	bio_put(bio);
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/**
+ * Writes back up to nr dirty pages, starting from the LRU tail, in one
+ * plugged batch. Must be called with the lock held.
+ *
+ * It returns the number of cleaned pages or negative error code.
+ */
+static s32 dftl_writeback(struct dftl *dftl, u32 nr)
+{
+	struct dftl_page *batch_pages[DFTL_WRITEBACK_BATCH];
+	struct dftl_wb_batch batch;
+	struct dftl_page *tp = NULL;
+	struct bio *bio = NULL;
+	struct blk_plug plug;
+	u32 i, count = 0;
+
+	nr = min_t(u32, nr, DFTL_WRITEBACK_BATCH);
+	atomic_set(&batch.pending, 1);
+	init_completion(&batch.done);
+	batch.status = BLK_STS_OK;
+
+	blk_start_plug(&plug);
+	list_for_each_entry_reverse(tp, &dftl->lru, lru) {
+		if (!tp->dirty)
+			continue;
+
+		bio = bio_alloc(dftl->bdev, 1, REQ_OP_WRITE, GFP_NOIO);
+		bio->bi_iter.bi_sector = dftl_page_sector(dftl, tp->index);
+		__bio_add_page(bio, tp->page, PAGE_SIZE, 0);
+		bio->bi_end_io = dftl_wb_end_io;
+		bio->bi_private = &batch;
+		atomic_inc(&batch.pending);
+		submit_bio(bio);
+
+		batch_pages[count++] = tp;
+		if (count == nr)
+			break;
+	}
+	blk_finish_plug(&plug);
+
+	if (atomic_dec_and_test(&batch.pending))
+		complete(&batch.done);
+	wait_for_completion_io(&batch.done);
+
+	if (batch.status) {
+		pr_err("DFTL: translation page writeback failed\n");
+		return blk_status_to_errno(batch.status);
+	}
+
+	for (i = 0; i < count; i++) {
+		batch_pages[i]->dirty = false;
+		set_bit(batch_pages[i]->index, dftl->on_disk);
+	}
+	dftl->nr_dirty -= count;
+	dftl->pages_written += count;
+
+	return count;
+}
+
+static void dftl_writeback_work(struct work_struct *work)
+{
+	struct dftl *dftl = container_of(work, struct dftl, writeback_work);
+
+	mutex_lock(&dftl->lock);
+	if (dftl->nr_dirty)
+		dftl_writeback(dftl, DFTL_WRITEBACK_BATCH);
+	mutex_unlock(&dftl->lock);
+}
+
+/**
+ * Evicts pages from the LRU tail until there is room for one more.
+ * Must be called with the lock held.
+ */
+static s32 dftl_make_room(struct dftl *dftl)
+{
+	struct dftl_page *tp = NULL;
+	s32 status;
+
+	while (dftl->nr_cached >= dftl->max_cached) {
+		tp = list_last_entry(&dftl->lru, struct dftl_page, lru);
+		if (tp->dirty) {
+			status = dftl_writeback(dftl, DFTL_WRITEBACK_BATCH);
+			if (status < 0)
+				return status;
+			continue;
+		}
+		dftl_free_page(dftl, tp);
+	}
+
+	return 0;
+}
+
+static s32 dftl_read_page(struct dftl *dftl, struct dftl_page *tp)
+{
+	struct bio_vec bvec;
+	struct bio bio;
+	s32 status;
+
+	bio_init(&bio, dftl->bdev, &bvec, 1, REQ_OP_READ);
+	bio.bi_iter.bi_sector = dftl_page_sector(dftl, tp->index);
+	__bio_add_page(&bio, tp->page, PAGE_SIZE, 0);
+	status = submit_bio_wait(&bio);
+	bio_uninit(&bio);
+	if (!status)
+		dftl->pages_read++;
+
+	return status;
+}
+
+/**
+ * Returns the cached translation page, bringing it in if needed.
+ * Must be called with the lock held.
+ *
+ * It returns the page, NULL if it is all-zero and create is false, or
+ * ERR_PTR on allocation or I/O failure.
+ */
+static struct dftl_page *dftl_get_page(struct dftl *dftl, u64 index, bool create)
+{
+	struct dftl_page *tp = NULL;
+	s32 status;
+
+	tp = xa_load(&dftl->pages, index);
+	if (tp) {
+		list_move(&tp->lru, &dftl->lru);
+		return tp;
+	}
+
+	if (!create && !test_bit(index, dftl->on_disk))
+		return NULL;
+
+	status = dftl_make_room(dftl);
+	if (status)
+		return ERR_PTR(status);
+
+	tp = kzalloc(sizeof(struct dftl_page), GFP_NOIO);
+	if (!tp)
+		return ERR_PTR(-ENOMEM);
+
+	tp->index = index;
+	tp->page = alloc_page(GFP_NOIO | __GFP_ZERO);
+	if (!tp->page) {
+		status = -ENOMEM;
+		goto free_tp;
+	}
+
+	if (test_bit(index, dftl->on_disk)) {
+		status = dftl_read_page(dftl, tp);
+		if (status) {
+			pr_err("DFTL: failed to read translation page %llu\n", index);
+			goto free_page;
+		}
+	}
+
+	status = xa_err(xa_store(&dftl->pages, index, tp, GFP_NOIO));
+	if (status)
+		goto free_page;
+
+	list_add(&tp->lru, &dftl->lru);
+	dftl->nr_cached++;
+
+	return tp;
+
+free_page:
+	__free_page(tp->page);
+free_tp:
+	kfree(tp);
+	return ERR_PTR(status);
+}
+
+/**
+ * Finds the greatest mapped key in [key - limit, key]. Pages that were never
+ * written are skipped without I/O. Must be called with the lock held.
+ *
+ * It returns 0 on success, -ENOENT if there is none, or the I/O error.
+ */
+static s32 dftl_scan_back(struct dftl *dftl, sector_t key, u64 limit, sector_t *found_key, u64 *value)
+{
+	sector_t end = key > limit ? key - limit : 0;
+	struct dftl_page *tp = NULL;
+	u64 *entries = NULL;
+	u64 index;
+	u32 i;
+
+	for (;;) {
+		index = key / DFTL_ENTRIES_PER_PAGE;
+		tp = dftl_get_page(dftl, index, false);
+		if (IS_ERR(tp))
+			return PTR_ERR(tp);
+
+		if (tp) {
+			entries = dftl_page_entries(tp);
+			for (i = key % DFTL_ENTRIES_PER_PAGE; ; i--) {
+				if (index * DFTL_ENTRIES_PER_PAGE + i < end)
+					return -ENOENT;
+				if (entries[i]) {
+					*found_key = index * DFTL_ENTRIES_PER_PAGE + i;
+					*value = entries[i];
+					return 0;
+				}
+				if (!i)
+					break;
+			}
+		}
+
+		if (!index || index * DFTL_ENTRIES_PER_PAGE <= end)
+			return -ENOENT;
+		key = index * DFTL_ENTRIES_PER_PAGE - 1;
+	}
+}
+
+static unsigned long dftl_shrink_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct dftl *dftl = shrinker->private_data;
+	u64 clean = READ_ONCE(dftl->nr_cached) - READ_ONCE(dftl->nr_dirty);
+
+	return clean ? clean : SHRINK_EMPTY;
+}
+
+/*
+ * Drops clean pages from the LRU tail. Dirty ones are left to the writeback
+ * work, reclaim may be running on behalf of our own I/O.
+ */
+static unsigned long dftl_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct dftl *dftl = shrinker->private_data;
+	struct dftl_page *tp, *tmp;
+	unsigned long freed = 0;
+	bool skipped_dirty = false;
+
+	if (!mutex_trylock(&dftl->lock))
+		return SHRINK_STOP;
+
+	list_for_each_entry_safe_reverse(tp, tmp, &dftl->lru, lru) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		if (tp->dirty) {
+			skipped_dirty = true;
+			continue;
+		}
+		dftl_free_page(dftl, tp);
+		freed++;
+	}
+	mutex_unlock(&dftl->lock);
+
+	if (skipped_dirty)
+		queue_work(system_unbound_wq, &dftl->writeback_work);
+
+	return freed;
+}
+
+/**
+ * Sets up a table for the whole backing device: the tail is taken by the
+ * translation pages, the rest (nr_keys sectors) is the mapped area.
+ *
+ * It returns the table, NULL if the device is too small or on allocation failure.
+ */
+struct dftl *dftl_init(struct block_device *bdev, u64 max_cached)
+{
+	struct dftl *dftl = NULL;
+	u64 nr_pages;
+
+	nr_pages = div_u64(bdev_nr_sectors(bdev), DFTL_ENTRIES_PER_PAGE + DFTL_PAGE_SECTORS);
+	if (!nr_pages) {
+		pr_err("DFTL: %pg is too small for a translation table\n", bdev);
+		return NULL;
+	}
+
+	dftl = kzalloc(sizeof(struct dftl), GFP_KERNEL);
+	if (!dftl)
+		return NULL;
+
+	dftl->bdev = bdev;
+	dftl->nr_pages = nr_pages;
+	dftl->nr_keys = nr_pages * DFTL_ENTRIES_PER_PAGE;
+	dftl->table_start = dftl->nr_keys;
+	dftl->max_cached = max_t(u64, max_cached, 1);
+	mutex_init(&dftl->lock);
+	xa_init(&dftl->pages);
+	INIT_LIST_HEAD(&dftl->lru);
+	INIT_WORK(&dftl->writeback_work, dftl_writeback_work);
+
+	dftl->on_disk = kvcalloc(BITS_TO_LONGS(nr_pages), sizeof(unsigned long), GFP_KERNEL);
+	dftl->mapped = kvcalloc(BITS_TO_LONGS(nr_pages), sizeof(unsigned long), GFP_KERNEL);
+	if (!dftl->on_disk || !dftl->mapped)
+		goto mem_err;
+
+	dftl->shrinker = shrinker_alloc(0, "lsbdd-dftl-%pg", bdev);
+	if (!dftl->shrinker)
+		goto mem_err;
+
+	dftl->shrinker->count_objects = dftl_shrink_count;
+	dftl->shrinker->scan_objects = dftl_shrink_scan;
+	dftl->shrinker->private_data = dftl;
+	shrinker_register(dftl->shrinker);
+
+	pr_info("DFTL: %llu translation pages at sector %llu, cache of %llu pages\n",
+		nr_pages, dftl->table_start, dftl->max_cached);
+	return dftl;
+
+mem_err:
+	kvfree(dftl->mapped);
+	kvfree(dftl->on_disk);
+	kfree(dftl);
+	return NULL;
+}
+
+void dftl_free(struct dftl *dftl)
+{
+	struct dftl_page *tp, *tmp;
+
+	shrinker_free(dftl->shrinker);
+	cancel_work_sync(&dftl->writeback_work);
+
+	list_for_each_entry_safe(tp, tmp, &dftl->lru, lru)
+		dftl_free_page(dftl, tp);
+
+	xa_destroy(&dftl->pages);
+	kvfree(dftl->mapped);
+	kvfree(dftl->on_disk);
+	kfree(dftl);
+}
+
+/**
+ * Stores the value in the slot of key. Mapped blocks must stay out of the
+ * translation area.
+ *
+ * It returns 0 on success, -ERANGE if the key is out of the mapped area,
+ * -ENOSPC if the block overlaps the table, or the page error.
+ */
+s32 dftl_insert(struct dftl *dftl, sector_t key, u64 value)
+{
+	struct redir_sector_info rs_info;
+	struct dftl_page *tp = NULL;
+	u64 *slot = NULL;
+
+	if (key >= dftl->nr_keys)
+		return -ERANGE;
+
+	ds_unpack_value(value, &rs_info);
+	if (rs_info.redirected_sector + ds_stored_sectors(&rs_info) > dftl->table_start)
+		return -ENOSPC;
+
+	mutex_lock(&dftl->lock);
+	tp = dftl_get_page(dftl, key / DFTL_ENTRIES_PER_PAGE, true);
+	if (IS_ERR(tp)) {
+		mutex_unlock(&dftl->lock);
+		return PTR_ERR(tp);
+	}
+
+	slot = &dftl_page_entries(tp)[key % DFTL_ENTRIES_PER_PAGE];
+	if (!*slot) {
+		dftl->nr_entries++;
+		__set_bit(tp->index, dftl->mapped);
+	}
+	*slot = value;
+	if (!tp->dirty) {
+		tp->dirty = true;
+		dftl->nr_dirty++;
+	}
+	if (dftl->nr_entries == 1 || key > dftl->max_key)
+		dftl->max_key = key;
+	mutex_unlock(&dftl->lock);
+
+	return 0;
+}
+
+/*
+ * Finds max_key again, once it was removed: the last page with mapped slots
+ * holds it, so one translation page is read at most. Must be called with the
+ * lock held.
+ */
+static void dftl_update_max(struct dftl *dftl)
+{
+	u64 last = dftl->max_key / DFTL_ENTRIES_PER_PAGE;
+	u64 index = find_last_bit(dftl->mapped, last + 1);
+	u64 value;
+
+	if (index > last)
+		return;
+	dftl_scan_back(dftl, (index + 1) * DFTL_ENTRIES_PER_PAGE - 1, DFTL_ENTRIES_PER_PAGE - 1,
+			&dftl->max_key, &value);
+}
+
+void dftl_remove(struct dftl *dftl, sector_t key)
+{
+	struct dftl_page *tp = NULL;
+	u64 *slot = NULL;
+
+	if (key >= dftl->nr_keys)
+		return;
+
+	mutex_lock(&dftl->lock);
+	tp = dftl_get_page(dftl, key / DFTL_ENTRIES_PER_PAGE, false);
+	if (IS_ERR_OR_NULL(tp))
+		goto unlock;
+
+	slot = &dftl_page_entries(tp)[key % DFTL_ENTRIES_PER_PAGE];
+	if (!*slot)
+		goto unlock;
+
+	*slot = 0;
+	dftl->nr_entries--;
+	if (!tp->dirty) {
+		tp->dirty = true;
+		dftl->nr_dirty++;
+	}
+	if (!memchr_inv(dftl_page_entries(tp), 0, PAGE_SIZE))
+		__clear_bit(tp->index, dftl->mapped);
+	if (dftl->nr_entries && key == dftl->max_key)
+		dftl_update_max(dftl);
+
+unlock:
+	mutex_unlock(&dftl->lock);
+}
+
+/* Reads the slot of key, must be called with the lock held */
+static s32 dftl_lookup_locked(struct dftl *dftl, sector_t key, u64 *value)
+{
+	struct dftl_page *tp = NULL;
+
+	tp = dftl_get_page(dftl, key / DFTL_ENTRIES_PER_PAGE, false);
+	if (IS_ERR(tp))
+		return PTR_ERR(tp);
+	if (!tp)
+		return -ENOENT;
+	*value = dftl_page_entries(tp)[key % DFTL_ENTRIES_PER_PAGE];
+	return *value ? 0 : -ENOENT;
+}
+
+s32 dftl_lookup(struct dftl *dftl, sector_t key, u64 *value)
+{
+	s32 status;
+
+	if (key >= dftl->nr_keys)
+		return -ENOENT;
+
+	mutex_lock(&dftl->lock);
+	status = dftl_lookup_locked(dftl, key, value);
+	mutex_unlock(&dftl->lock);
+
+	return status;
+}
+
+/**
+ * Finds the greatest mapped key strictly less than the given one, looking
+ * back at most DFTL_PREV_SCAN sectors: a block that starts further away
+ * can't cover the key.
+ */
+s32 dftl_prev(struct dftl *dftl, sector_t key, sector_t *prev_key, u64 *value)
+{
+	s32 status;
+
+	if (!key)
+		return -ENOENT;
+
+	key = min_t(sector_t, key, dftl->nr_keys);
+	mutex_lock(&dftl->lock);
+	status = dftl_scan_back(dftl, key - 1, DFTL_PREV_SCAN - 1, prev_key, value);
+	mutex_unlock(&dftl->lock);
+
+	return status;
+}
+
+s32 dftl_last(struct dftl *dftl, sector_t *last_key, u64 *value)
+{
+	s32 status = -ENOENT;
+
+	/* Held through the lookup, a concurrent remove may move max_key */
+	mutex_lock(&dftl->lock);
+	if (dftl->nr_entries) {
+		*last_key = dftl->max_key;
+		status = dftl_lookup_locked(dftl, *last_key, value);
+	}
+	mutex_unlock(&dftl->lock);
+
+	return status;
+}
+
+/**
+ * Copies the slots of translation page index into entries
+ * (DFTL_ENTRIES_PER_PAGE of them).
+ */
+s32 dftl_read_entries(struct dftl *dftl, u64 index, u64 *entries)
+{
+	struct dftl_page *tp = NULL;
+	s32 status = 0;
+
+	mutex_lock(&dftl->lock);
+	tp = dftl_get_page(dftl, index, false);
+	if (IS_ERR(tp))
+		status = PTR_ERR(tp);
+	else if (tp)
+		memcpy(entries, dftl_page_entries(tp), PAGE_SIZE);
+	else
+		memset(entries, 0, PAGE_SIZE);
+	mutex_unlock(&dftl->lock);
+
+	return status;
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/blk_types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+
+/* Mapping slots (one per sector of the device) in a translation page */
+#define DFTL_ENTRIES_PER_PAGE (PAGE_SIZE / sizeof(u64))
+#define DFTL_PAGE_SECTORS (PAGE_SIZE >> SECTOR_SHIFT)
+/* Dirty pages written back at once, when the LRU tail has to be evicted */
+#define DFTL_WRITEBACK_BATCH 32
+/* How far back dftl_prev() looks, no mapped block is larger than that */
+#define DFTL_PREV_SCAN (BIO_MAX_VECS * PAGE_SIZE >> SECTOR_SHIFT)
+#define DFTL_CACHE_DEFAULT_MB 64
+
+/* Cached translation page, entries[i] is the packed value of key index * EPP + i */
+struct dftl_page {
+	struct list_head lru;
+	struct page *page;
+	u64 index;
+	bool dirty;
+};
+
+/*
+ * Demand-paged mapping table (DFTL). The whole table lives on the backing
+ * device in translation pages at its end, only a bounded LRU set of them is
+ * kept in memory. Pages that were never written
+ * back are all-zero and are not read from the device.
+ *
+ * The table is a cache for the in-memory state of the driver, it is not
+ * persistent across reloads.
+ */
+struct dftl {
+	struct block_device *bdev;
+	sector_t table_start;
+	u64 nr_keys;
+	u64 nr_pages;
+	/* Below is protected by lock */
+	struct mutex lock;
+	struct xarray pages;
+	struct list_head lru;
+	unsigned long *on_disk;
+	/* Pages with mapped slots, max_key is found again through them */
+	unsigned long *mapped;
+	u64 nr_cached;
+	u64 nr_dirty;
+	u64 max_cached;
+	sector_t max_key;
+	u64 nr_entries;
+	/* Translation page I/O, for the write amplification of the BD */
+	u64 pages_read;
+	u64 pages_written;
+	struct shrinker *shrinker;
+	struct work_struct writeback_work;
+};
+
+struct dftl *dftl_init(struct block_device *bdev, u64 max_cached);
+void dftl_free(struct dftl *dftl);
+s32 dftl_insert(struct dftl *dftl, sector_t key, u64 value);
+void dftl_remove(struct dftl *dftl, sector_t key);
+s32 dftl_lookup(struct dftl *dftl, sector_t key, u64 *value);
+s32 dftl_prev(struct dftl *dftl, sector_t key, sector_t *prev_key, u64 *value);
+s32 dftl_last(struct dftl *dftl, sector_t *last_key, u64 *value);
+s32 dftl_read_entries(struct dftl *dftl, u64 index, u64 *entries);
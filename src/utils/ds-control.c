@@ -2,11 +2,15 @@
 
 #include <linux/hashtable.h>
 #include <linux/btree.h>
+#include <linux/math64.h>
 #include "ds-control.h"
 #include "btree-utils.h"
 #include "hashtable-utils.h"
 #include "skiplist.h"
 #include "rbtree.h"
+#include "learned-index.h"
+#include "dftl.h"
+#include "page-table.h"
 
 s32 ds_init(struct data_struct *ds, char *sel_ds)
 {
@@ -15,12 +19,16 @@ s32 ds_init(struct data_struct *ds, char *sel_ds)
 	struct btree_head *root = NULL;
 	struct hashtable *hash_table = NULL;
 	struct rbtree *rbtree_map = NULL;
-	struct hash_el *last_hel = NULL;
+	struct learned_index *li_map = NULL;
+	struct page_table *pt_map = NULL;
 	s32 status = 0;
 	char *bt = "bt";
 	char *sl = "sl";
 	char *ht = "ht";
 	char *rb = "rb";
+	char *li = "li";
+	char *df = "df";
+	char *pt = "pt";
 
 	if (!strncmp(sel_ds, bt, 2)) {
 		btree_map = kzalloc(sizeof(struct btree), GFP_KERNEL);
@@ -32,32 +40,52 @@ s32 ds_init(struct data_struct *ds, char *sel_ds)
 			goto mem_err;
 
 		status = btree_init(root);
-		if (status)
+		if (status) {
+			kfree(root);
+			kfree(btree_map);
 			return status;
+		}
 
 		btree_map->head = root;
 		ds->type = BTREE_TYPE;
 		ds->structure.map_btree = btree_map;
 	} else if (!strncmp(sel_ds, sl, 2)) {
 		sl_map = skiplist_init();
+		if (!sl_map)
+			goto mem_err;
 		ds->type = SKIPLIST_TYPE;
 		ds->structure.map_list = sl_map;
 	} else if (!strncmp(sel_ds, ht, 2)) {
 		hash_table = kzalloc(sizeof(struct hashtable), GFP_KERNEL);
-		last_hel = kzalloc(sizeof(struct hash_el), GFP_KERNEL);
-		hash_table->last_el = last_hel;
 		if (!hash_table)
 			goto mem_err;
 
 		hash_init(hash_table->head);
 		ds->type = HASHTABLE_TYPE;
 		ds->structure.map_hash = hash_table;
-		ds->structure.map_hash->nf_bck = 0;
 	} else if (!strncmp(sel_ds, rb, 2)) {
-		rbtree_map = kzalloc(sizeof(struct rbtree), GFP_KERNEL);
 		rbtree_map = rbtree_init();
+		if (!rbtree_map)
+			goto mem_err;
 		ds->type = RBTREE_TYPE;
 		ds->structure.map_rbtree = rbtree_map;
+	} else if (!strncmp(sel_ds, li, 2)) {
+		li_map = li_init();
+		if (!li_map)
+			goto mem_err;
+
+		ds->type = LEARNED_TYPE;
+		ds->structure.map_learned = li_map;
+	} else if (!strncmp(sel_ds, pt, 2)) {
+		pt_map = pt_init();
+		if (!pt_map)
+			goto mem_err;
+
+		ds->type = PAGETABLE_TYPE;
+		ds->structure.map_pt = pt_map;
+	} else if (!strncmp(sel_ds, df, 2)) {
+		pr_err("DFTL needs the backing device, use ds_init_dftl()\n");
+		return -EOPNOTSUPP;
 	} else {
 		pr_err("Aborted. Data structure isn't choosed.\n");
 		return -1;
@@ -66,17 +94,62 @@ s32 ds_init(struct data_struct *ds, char *sel_ds)
 
 mem_err:
 	pr_err("Memory allocation failed\n");
-	kfree(ds);
+	kfree(btree_map);
 	kfree(root);
 	kfree(hash_table);
-	kfree(last_hel);
 	return -ENOMEM;
 }
 
+/**
+ * Initialises the demand-paged mapping table on the backing device,
+ * at most cache_pages translation pages are kept in memory.
+ */
+s32 ds_init_dftl(struct data_struct *ds, struct block_device *bdev, u64 cache_pages)
+{
+	struct dftl *dftl_map = NULL;
+
+	dftl_map = dftl_init(bdev, cache_pages);
+	if (!dftl_map)
+		return -ENOMEM;
+
+	ds->type = DFTL_TYPE;
+	ds->structure.map_dftl = dftl_map;
+	return 0;
+}
+
+/**
+ * It returns the number of sectors of the device, that the data structure
+ * can map: DFTL keeps its table on the device, the rest map all of it.
+ */
+sector_t ds_capacity(struct data_struct *ds, sector_t dev_capacity)
+{
+	if (ds->type == DFTL_TYPE)
+		return min_t(sector_t, dev_capacity, ds->structure.map_dftl->nr_keys);
+	return dev_capacity;
+}
+
+/**
+ * It returns the sectors a mapping may span at most: ds_prev() of the
+ * hashtable looks back one chunk, DFTL's DFTL_PREV_SCAN sectors, a larger
+ * block wouldn't be found from its last sectors.
+ */
+u32 ds_max_extent(struct data_struct *ds)
+{
+	if (ds->type == HASHTABLE_TYPE)
+		return CHUNK_SIZE;
+	if (ds->type == DFTL_TYPE)
+		return DFTL_PREV_SCAN;
+	return DS_VALUE_BS_MASK;
+}
+
 void ds_free(struct data_struct *ds)
 {
 	if (ds->type == BTREE_TYPE) {
+		/* btree_destroy() only takes the root, the rest is reaped here */
+		btree_grim_visitor(ds->structure.map_btree->head, &btree_geo64, 0, NULL, NULL);
 		btree_destroy(ds->structure.map_btree->head);
+		kfree(ds->structure.map_btree->head);
+		kfree(ds->structure.map_btree);
 		ds->structure.map_btree = NULL;
 	}
 	if (ds->type == SKIPLIST_TYPE) {
@@ -91,32 +164,76 @@ void ds_free(struct data_struct *ds)
 		rbtree_free(ds->structure.map_rbtree);
 		ds->structure.map_rbtree = NULL;
 	}
+	if (ds->type == LEARNED_TYPE) {
+		li_free(ds->structure.map_learned);
+		ds->structure.map_learned = NULL;
+	}
+	if (ds->type == DFTL_TYPE) {
+		dftl_free(ds->structure.map_dftl);
+		ds->structure.map_dftl = NULL;
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		pt_free(ds->structure.map_pt);
+		ds->structure.map_pt = NULL;
+	}
 }
 
-void *ds_lookup(struct data_struct *ds, sector_t key)
+s32 ds_lookup(struct data_struct *ds, sector_t key, struct redir_sector_info *rs_info)
 {
 	struct skiplist_node *sl_node = NULL;
 	struct hash_el *hm_node = NULL;
 	struct rbtree_node *rb_node = NULL;
+	void *bt_value = NULL;
+	u64 li_value;
+	s32 status;
 	u64 *kp;
 
 	kp = &key;
-	if (ds->type == BTREE_TYPE)
-		return btree_lookup(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+	if (ds->type == BTREE_TYPE) {
+		bt_value = btree_lookup(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+		if (!bt_value)
+			return -ENOENT;
+		ds_unpack_value((unsigned long)bt_value, rs_info);
+		return 0;
+	}
 	if (ds->type == SKIPLIST_TYPE) {
 		sl_node = skiplist_find_node(ds->structure.map_list, key);
 		CHECK_FOR_NULL(sl_node);
-		CHECK_VALUE_AND_RETURN(sl_node);
+		CHECK_VALUE_AND_RETURN(sl_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == HASHTABLE_TYPE) {
 		hm_node = hashtable_find_node(ds->structure.map_hash, key);
 		CHECK_FOR_NULL(hm_node);
-		CHECK_VALUE_AND_RETURN(hm_node);
+		CHECK_VALUE_AND_RETURN(hm_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == RBTREE_TYPE) {
 		rb_node = rbtree_find_node(ds->structure.map_rbtree, key);
 		CHECK_FOR_NULL(rb_node);
-		CHECK_VALUE_AND_RETURN(rb_node);
+		CHECK_VALUE_AND_RETURN(rb_node, rs_info);
+		return -ENOENT;
+	}
+	if (ds->type == LEARNED_TYPE) {
+		li_value = li_lookup(ds->structure.map_learned, key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == DFTL_TYPE) {
+		status = dftl_lookup(ds->structure.map_dftl, key, &li_value);
+		if (status)
+			return status;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		li_value = pt_lookup(ds->structure.map_pt, key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
 	}
 
 	pr_err("Failed to lookup, key is NULL\n");
@@ -136,18 +253,50 @@ void ds_remove(struct data_struct *ds, sector_t key)
 		hashtable_remove(ds->structure.map_hash, key);
 	if (ds->type == RBTREE_TYPE)
 		rbtree_remove(ds->structure.map_rbtree, key);
+	if (ds->type == LEARNED_TYPE)
+		li_remove(ds->structure.map_learned, key);
+	if (ds->type == DFTL_TYPE)
+		dftl_remove(ds->structure.map_dftl, key);
+	if (ds->type == PAGETABLE_TYPE)
+		pt_remove(ds->structure.map_pt, key);
 }
 
-s32 ds_insert(struct data_struct *ds, sector_t key, void *value)
+/**
+ * Inserts a copy of rs_info under the key. The value is packed and stored
+ * inline in the index node, so the caller keeps ownership of rs_info.
+ *
+ * It returns 0 on success, -ERANGE if the value can't be packed
+ * (see ds_value_fits()) or the block is over ds_max_extent(), -ENOMEM if
+ * node allocation fails.
+ */
+s32 ds_insert(struct data_struct *ds, sector_t key, const struct redir_sector_info *rs_info)
 {
 	struct hash_el *el = NULL;
+	struct skiplist_node *sl_node = NULL;
+	u64 value;
 	u64 *kp;
 
+	if (!ds_value_fits(rs_info)) {
+		pr_err("Value (sector %llu, bs %u) doesn't fit in inline mapping\n",
+			rs_info->redirected_sector, rs_info->block_size);
+		return -ERANGE;
+	}
+	if (rs_info->block_size >> SECTOR_SHIFT > ds_max_extent(ds)) {
+		pr_err("Block of %u sectors is over the extent of the data structure\n",
+			rs_info->block_size >> SECTOR_SHIFT);
+		return -ERANGE;
+	}
+
+	value = ds_pack_value(rs_info);
 	kp = &key;
 	if (ds->type == BTREE_TYPE)
-		return btree_insert(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp, value, GFP_KERNEL);
-	if (ds->type == SKIPLIST_TYPE)
-		skiplist_add(ds->structure.map_list, key, value);
+		return btree_insert(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp,
+				(void *)(unsigned long)value, GFP_KERNEL);
+	if (ds->type == SKIPLIST_TYPE) {
+		sl_node = skiplist_add(ds->structure.map_list, key, value);
+		if (IS_ERR(sl_node))
+			return PTR_ERR(sl_node);
+	}
 	if (ds->type == HASHTABLE_TYPE) {
 		el = kzalloc(sizeof(struct hash_el), GFP_KERNEL);
 		if (!el)
@@ -156,11 +305,18 @@ s32 ds_insert(struct data_struct *ds, sector_t key, void *value)
 		el->key = key;
 		el->value = value;
 		hash_insert(ds->structure.map_hash, &el->node, key);
-		if (ds->structure.map_hash->last_el->key < key)
+		if (!ds->structure.map_hash->last_el || ds->structure.map_hash->last_el->key < key)
 			ds->structure.map_hash->last_el = el;
 	}
 	if (ds->type == RBTREE_TYPE)
-		rbtree_add(ds->structure.map_rbtree, key, value);
+		return rbtree_add_extent(ds->structure.map_rbtree, key,
+				key + (rs_info->block_size >> SECTOR_SHIFT) - 1, value);
+	if (ds->type == LEARNED_TYPE)
+		return li_insert(ds->structure.map_learned, key, value);
+	if (ds->type == DFTL_TYPE)
+		return dftl_insert(ds->structure.map_dftl, key, value);
+	if (ds->type == PAGETABLE_TYPE)
+		return pt_insert(ds->structure.map_pt, key, value);
 	return 0;
 
 mem_err:
@@ -169,75 +325,477 @@ mem_err:
 	return -ENOMEM;
 }
 
-void *ds_last(struct data_struct *ds, sector_t key)
+s32 ds_last(struct data_struct *ds, sector_t key, struct redir_sector_info *rs_info)
 {
 	struct hash_el *hm_node = NULL;
 	struct skiplist_node *sl_node = NULL;
 	struct rbtree_node *rb_node = NULL;
+	void *bt_value = NULL;
+	u64 li_value;
+	sector_t li_key;
 	u64 *kp;
 
 	kp = &key;
-	if (ds->type == BTREE_TYPE)
-		return btree_last_no_rep(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+	if (ds->type == BTREE_TYPE) {
+		bt_value = btree_last_no_rep(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp);
+		if (!bt_value)
+			return -ENOENT;
+		ds_unpack_value((unsigned long)bt_value, rs_info);
+		return 0;
+	}
 	if (ds->type == SKIPLIST_TYPE) {
 		sl_node = skiplist_last(ds->structure.map_list);
 		CHECK_FOR_NULL(sl_node);
-		CHECK_VALUE_AND_RETURN(sl_node);
+		CHECK_VALUE_AND_RETURN(sl_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == HASHTABLE_TYPE) {
 		hm_node = ds->structure.map_hash->last_el;
 		CHECK_FOR_NULL(hm_node);
-		CHECK_VALUE_AND_RETURN(hm_node);
+		CHECK_VALUE_AND_RETURN(hm_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == RBTREE_TYPE) {
 		rb_node = rbtree_last(ds->structure.map_rbtree);
 		CHECK_FOR_NULL(rb_node);
-		CHECK_VALUE_AND_RETURN(rb_node);
+		CHECK_VALUE_AND_RETURN(rb_node, rs_info);
+		return -ENOENT;
+	}
+	if (ds->type == LEARNED_TYPE) {
+		li_value = li_last(ds->structure.map_learned, &li_key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == DFTL_TYPE) {
+		if (dftl_last(ds->structure.map_dftl, &li_key, &li_value))
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		li_value = pt_last(ds->structure.map_pt, &li_key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
 	}
 	pr_err("Failed to get rs_info from get_last()\n");
 	BUG();
 }
 
-void *ds_prev(struct data_struct *ds, sector_t key, sector_t *prev_key)
+/**
+ * Finds the mapping with the greatest key strictly less than the given one,
+ * on every backend: a mapping, that starts at the key itself, is ds_lookup()'s.
+ *
+ * It returns 0 on success, -ENOENT if there is no such mapping.
+ */
+s32 ds_prev(struct data_struct *ds, sector_t key, sector_t *prev_key, struct redir_sector_info *rs_info)
 {
 	struct skiplist_node *sl_node = NULL;
 	struct hash_el *hm_node = NULL;
 	struct rbtree_node *rb_node = NULL;
+	void *bt_value = NULL;
+	u64 li_value;
 	u64 *kp;
 
 	kp = &key;
-	if (ds->type == BTREE_TYPE)
-		return btree_get_prev_no_rep(ds->structure.map_btree->head, &btree_geo64, (unsigned long *)kp, (unsigned long *)prev_key);
+	if (ds->type == BTREE_TYPE) {
+		bt_value = btree_get_prev_no_rep(ds->structure.map_btree->head, &btree_geo64,
+				(unsigned long *)kp, (unsigned long *)prev_key);
+		if (!bt_value)
+			return -ENOENT;
+		ds_unpack_value((unsigned long)bt_value, rs_info);
+		return 0;
+	}
 	if (ds->type == SKIPLIST_TYPE) {
 		sl_node = skiplist_prev(ds->structure.map_list, key, prev_key);
 		CHECK_FOR_NULL(sl_node);
-		CHECK_VALUE_AND_RETURN(sl_node);
+		CHECK_VALUE_AND_RETURN(sl_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == HASHTABLE_TYPE) {
 		hm_node = hashtable_prev(ds->structure.map_hash, key, prev_key);
 		CHECK_FOR_NULL(hm_node);
-		CHECK_VALUE_AND_RETURN(hm_node);
+		CHECK_VALUE_AND_RETURN(hm_node, rs_info);
+		return -ENOENT;
 	}
 	if (ds->type == RBTREE_TYPE) {
 		rb_node = rbtree_prev(ds->structure.map_rbtree, key, prev_key);
 		CHECK_FOR_NULL(rb_node);
-		CHECK_VALUE_AND_RETURN(rb_node);
+		CHECK_VALUE_AND_RETURN(rb_node, rs_info);
+		return -ENOENT;
+	}
+	if (ds->type == LEARNED_TYPE) {
+		li_value = li_prev(ds->structure.map_learned, key, prev_key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == DFTL_TYPE) {
+		if (dftl_prev(ds->structure.map_dftl, key, prev_key, &li_value))
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		li_value = pt_prev(ds->structure.map_pt, key, prev_key);
+		if (!li_value)
+			return -ENOENT;
+		ds_unpack_value(li_value, rs_info);
+		return 0;
 	}
 
 	pr_err("Failed to get rs_info from get_prev()\n");
 	BUG();
 }
 
+/**
+ * Finds the mapping, that covers the sector: the one with the greatest key
+ * at or before it, whose block reaches it. The rbtree finds it by the extent
+ * ends of its subtrees in one descent, the other backends take a lookup and
+ * a predecessor, so only the nearest mapping before the sector is looked at.
+ *
+ * It returns 0 on success, -ENOENT if no mapping covers the sector.
+ */
+s32 ds_cover(struct data_struct *ds, sector_t sector, sector_t *key, struct redir_sector_info *rs_info)
+{
+	struct rbtree_node *rb_node = NULL;
+
+	if (ds->type == RBTREE_TYPE) {
+		rb_node = rbtree_cover(ds->structure.map_rbtree, sector);
+		CHECK_FOR_NULL(rb_node);
+		*key = rb_node->key;
+		ds_unpack_value(rb_node->value, rs_info);
+		return 0;
+	}
+
+	*key = sector;
+	if (!ds_lookup(ds, sector, rs_info))
+		return 0;
+	if (ds_prev(ds, sector, key, rs_info) || sector >= *key + (rs_info->block_size >> SECTOR_SHIFT))
+		return -ENOENT;
+	return 0;
+}
+
 s32 ds_empty_check(struct data_struct *ds)
 {
-	if (ds->type == BTREE_TYPE && ds->structure.map_btree->head->height == 0)
+	unsigned long bt_key[MAX_KEYLEN];
+
+	/* lib/btree keeps an empty root leaf, once the last key is removed from it */
+	if (ds->type == BTREE_TYPE && !btree_last(ds->structure.map_btree->head, &btree_geo64, bt_key))
 		return 1;
-	if (ds->type == SKIPLIST_TYPE && ds->structure.map_list->head_lvl == 0)
+	if (ds->type == SKIPLIST_TYPE && skiplist_empty(ds->structure.map_list))
 		return 1;
 	if (ds->type == HASHTABLE_TYPE && hash_empty(ds->structure.map_hash->head))
 		return 1;
 	if (ds->type == RBTREE_TYPE && ds->structure.map_rbtree->node_num == 0)
 		return 1;
+	if (ds->type == LEARNED_TYPE && ds->structure.map_learned->nr_entries == 0)
+		return 1;
+	if (ds->type == DFTL_TYPE && ds->structure.map_dftl->nr_entries == 0)
+		return 1;
+	if (ds->type == PAGETABLE_TYPE && ds->structure.map_pt->nr_entries == 0 &&
+		ds->structure.map_pt->overflow->node_num == 0)
+		return 1;
 	return 0;
 }
 
+/**
+ * It returns the memory taken by the index with nr_entries mappings in bytes.
+ * The B+tree and skiplist don't count their nodes, so for them it is an
+ * estimate, a skiplist entry takes two nodes on average.
+ */
+u64 ds_mem_usage(struct data_struct *ds, u64 nr_entries)
+{
+	struct learned_index *li = NULL;
+	struct dftl *dftl = NULL;
+	struct page_table *pt = NULL;
+
+	if (ds->type == BTREE_TYPE)
+		return btree_mem_estimate(nr_entries);
+	if (ds->type == SKIPLIST_TYPE)
+		return (2 * nr_entries + ds->structure.map_list->max_lvl) * sizeof(struct skiplist_node);
+	if (ds->type == HASHTABLE_TYPE)
+		return sizeof(struct hashtable) + nr_entries * sizeof(struct hash_el);
+	if (ds->type == RBTREE_TYPE)
+		return sizeof(struct rbtree) + ds->structure.map_rbtree->node_num * sizeof(struct rbtree_node);
+	if (ds->type == LEARNED_TYPE) {
+		li = ds->structure.map_learned;
+		return sizeof(struct learned_index) + li->nr_runs * sizeof(struct li_run) +
+			li->nr_segments * sizeof(struct li_segment) +
+			li->delta->node_num * sizeof(struct rbtree_node);
+	}
+	if (ds->type == DFTL_TYPE) {
+		dftl = ds->structure.map_dftl;
+		return sizeof(struct dftl) + READ_ONCE(dftl->nr_cached) * (PAGE_SIZE + sizeof(struct dftl_page)) +
+			BITS_TO_LONGS(dftl->nr_pages) * sizeof(long);
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		pt = ds->structure.map_pt;
+		return sizeof(struct page_table) + (1 + pt->nr_tables + pt->nr_spare) * sizeof(struct pt_table) +
+			sizeof(struct rbtree) + pt->overflow->node_num * sizeof(struct rbtree_node);
+	}
+	return 0;
+}
+
+/**
+ * It returns the number of bytes the index itself wrote to the backing
+ * device, only DFTL keeps its table there.
+ */
+u64 ds_meta_written(struct data_struct *ds)
+{
+	if (ds->type == DFTL_TYPE)
+		return READ_ONCE(ds->structure.map_dftl->pages_written) * PAGE_SIZE;
+	return 0;
+}
+
+
+/**
+ * Steps the cursor of an ordered backend to the next (lower) key.
+ *
+ * It returns the packed value of the entry, 0 if the walk is over.
+ */
+static u64 ds_walk_prev(struct data_struct *ds, struct ds_cursor *cursor)
+{
+	struct skiplist_node *sl_node = NULL;
+	struct rbtree_node *rb_node = NULL;
+	void *bt_value = NULL;
+	sector_t key = cursor->key;
+	u64 value = 0;
+
+	/* Nothing below key 0, the strict predecessor walk would wrap */
+	if (cursor->started && !cursor->key)
+		return 0;
+
+	if (ds->type == BTREE_TYPE) {
+		if (cursor->started)
+			bt_value = btree_get_prev(ds->structure.map_btree->head, &btree_geo64,
+					(unsigned long *)&key);
+		else
+			bt_value = btree_last(ds->structure.map_btree->head, &btree_geo64,
+					(unsigned long *)&key);
+		value = (unsigned long)bt_value;
+	}
+	if (ds->type == SKIPLIST_TYPE) {
+		if (cursor->started)
+			sl_node = skiplist_prev(ds->structure.map_list, cursor->key, &key);
+		else
+			sl_node = skiplist_last(ds->structure.map_list);
+		if (sl_node) {
+			key = sl_node->key;
+			value = sl_node->value;
+		}
+	}
+	if (ds->type == RBTREE_TYPE) {
+		if (cursor->started)
+			rb_node = rbtree_prev(ds->structure.map_rbtree, cursor->key, &key);
+		else
+			rb_node = rbtree_last(ds->structure.map_rbtree);
+		if (rb_node) {
+			key = rb_node->key;
+			value = rb_node->value;
+		}
+	}
+	if (ds->type == LEARNED_TYPE) {
+		if (cursor->started)
+			value = li_prev(ds->structure.map_learned, cursor->key, &key);
+		else
+			value = li_last(ds->structure.map_learned, &key);
+	}
+	if (ds->type == PAGETABLE_TYPE) {
+		if (cursor->started)
+			value = pt_prev(ds->structure.map_pt, cursor->key, &key);
+		else
+			value = pt_last(ds->structure.map_pt, &key);
+	}
+
+	cursor->started = true;
+	cursor->key = key;
+	return value;
+}
+
+static s32 ds_copy_value(struct data_struct *dst, sector_t key, u64 value)
+{
+	struct redir_sector_info rs_info;
+
+	ds_unpack_value(value, &rs_info);
+	return ds_insert(dst, key, &rs_info);
+}
+
+/* DFTL is walked page by page, cursor->bucket is the translation page index */
+static s32 ds_copy_batch_dftl(struct dftl *dftl, struct data_struct *dst, struct ds_cursor *cursor, u32 nr)
+{
+	u64 *entries = NULL;
+	s32 copied = 0;
+	s32 status = 0;
+	u32 i;
+
+	entries = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	while (copied < nr && cursor->bucket < dftl->nr_pages) {
+		status = dftl_read_entries(dftl, cursor->bucket, entries);
+		if (status)
+			goto out;
+
+		for (i = 0; i < DFTL_ENTRIES_PER_PAGE; i++) {
+			if (!entries[i])
+				continue;
+			status = ds_copy_value(dst, (sector_t)cursor->bucket * DFTL_ENTRIES_PER_PAGE + i, entries[i]);
+			if (status)
+				goto out;
+			copied++;
+		}
+		cursor->bucket++;
+	}
+	cursor->done = cursor->bucket == dftl->nr_pages;
+
+out:
+	kfree(entries);
+	return status ? status : copied;
+}
+
+/**
+ * Copies up to nr entries of src into dst, continuing from the cursor.
+ * The cursor stays valid across modifications of src, so the caller only
+ * needs to exclude writers of src for the duration of one batch. Entries
+ * changed behind the cursor are not revisited, the caller has to capture them.
+ * dst is expected to not have the copied keys yet.
+ *
+ * It returns the number of copied entries (0 once the walk is over)
+ * or a negative error code.
+ */
+s32 ds_copy_batch(struct data_struct *src, struct data_struct *dst, struct ds_cursor *cursor, u32 nr)
+{
+	struct hashtable *ht = NULL;
+	struct hash_el *el = NULL;
+	s32 copied = 0;
+	s32 status;
+	u64 value;
+
+	if (cursor->done)
+		return 0;
+
+	if (src->type == DFTL_TYPE)
+		return ds_copy_batch_dftl(src->structure.map_dftl, dst, cursor, nr);
+
+	if (src->type == HASHTABLE_TYPE) {
+		ht = src->structure.map_hash;
+		while (copied < nr && cursor->bucket < HASH_SIZE(ht->head)) {
+			hlist_for_each_entry(el, &ht->head[cursor->bucket], node) {
+				status = ds_copy_value(dst, el->key, el->value);
+				if (status)
+					return status;
+				copied++;
+			}
+			cursor->bucket++;
+		}
+		cursor->done = cursor->bucket == HASH_SIZE(ht->head);
+		return copied;
+	}
+
+	while (copied < nr) {
+		value = ds_walk_prev(src, cursor);
+		if (!value) {
+			cursor->done = true;
+			break;
+		}
+		status = ds_copy_value(dst, cursor->key, value);
+		if (status)
+			return status;
+		copied++;
+	}
+
+	return copied;
+}
+
+/**
+ * Reads up to nr entries of the walk at cursor. Ordered backends are read from
+ * the highest key down, DFTL from the lowest key up and the hashtable bucket
+ * by bucket, in no key order. Unlike ds_copy_batch(), it may stop in the
+ * middle of a bucket, so entries changed between two calls can be missed or
+ * read twice: it is meant for inspection, not for copies.
+ *
+ * It returns the number of read entries, 0 once the walk is over, or
+ * negative error code.
+ */
+s32 ds_read_batch(struct data_struct *ds, struct ds_cursor *cursor, struct ds_entry *entries, u32 nr)
+{
+	struct hashtable *ht = NULL;
+	struct hash_el *el = NULL;
+	struct dftl *dftl = NULL;
+	u64 *slots = NULL;
+	s32 status = 0;
+	u32 read = 0;
+	u64 skip, i;
+	u64 value;
+
+	if (cursor->done)
+		return 0;
+
+	if (ds->type == HASHTABLE_TYPE) {
+		ht = ds->structure.map_hash;
+		/* cursor->key counts the entries already read from the bucket */
+		while (read < nr && cursor->bucket < HASH_SIZE(ht->head)) {
+			skip = cursor->key;
+			hlist_for_each_entry(el, &ht->head[cursor->bucket], node) {
+				if (skip) {
+					skip--;
+					continue;
+				}
+				if (read == nr)
+					break;
+				entries[read].key = el->key;
+				entries[read++].value = el->value;
+				cursor->key++;
+			}
+			if (el)
+				break;
+			cursor->bucket++;
+			cursor->key = 0;
+		}
+		cursor->done = cursor->bucket == HASH_SIZE(ht->head);
+		return read;
+	}
+
+	if (ds->type == DFTL_TYPE) {
+		dftl = ds->structure.map_dftl;
+		slots = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!slots)
+			return -ENOMEM;
+
+		/* cursor->key is the next slot to read */
+		while (read < nr && cursor->key < dftl->nr_keys) {
+			status = dftl_read_entries(dftl, div_u64(cursor->key, DFTL_ENTRIES_PER_PAGE), slots);
+			if (status)
+				break;
+
+			for (i = cursor->key % DFTL_ENTRIES_PER_PAGE; i < DFTL_ENTRIES_PER_PAGE && read < nr; i++) {
+				if (slots[i]) {
+					entries[read].key = cursor->key;
+					entries[read++].value = slots[i];
+				}
+				cursor->key++;
+			}
+		}
+		cursor->done = cursor->key >= dftl->nr_keys;
+		kfree(slots);
+		return status ? status : read;
+	}
+
+	while (read < nr) {
+		value = ds_walk_prev(ds, cursor);
+		if (!value) {
+			cursor->done = true;
+			break;
+		}
+		entries[read].key = cursor->key;
+		entries[read++].value = value;
+	}
+
+	return read;
+}
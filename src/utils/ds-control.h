@@ -3,24 +3,73 @@
 #pragma once
 
 #include <linux/types.h>
+#include <linux/blk_types.h>
 
 #define CHECK_FOR_NULL(node)					  \
 	do {										  \
 		if (!node)								  \
-			return NULL;						  \
+			return -ENOENT;						  \
 	} while (0)									  \
 
-#define CHECK_VALUE_AND_RETURN(node)			  \
+#define CHECK_VALUE_AND_RETURN(node, rs_info)	  \
 	do {										  \
-		if (node->value)						  \
-			return node->value;					  \
+		if (node->value) {						  \
+			ds_unpack_value(node->value, rs_info);\
+			return 0;							  \
+		}										  \
 	} while (0)									  \
 
+/*
+ * Mapping values are stored inline in the index nodes of every backend as one
+ * packed 64-bit word: the redirected sector in the upper bits and the block
+ * size (in sectors) in the lower DS_VALUE_BS_BITS. A packed value is never 0
+ * for a valid mapping, so 0 is used by the backends as "no value".
+ */
+#define DS_VALUE_BS_BITS 16
+#define DS_VALUE_BS_MASK ((1ULL << DS_VALUE_BS_BITS) - 1)
+#define DS_VALUE_MAX_SECTOR ((1ULL << (63 - DS_VALUE_BS_BITS)) - 1)
+/*
+ * The top bit marks a mapping of a compressed block. Its lower
+ * DS_VALUE_BS_BITS then hold the size of the data and the size of the block
+ * in the log, DS_VALUE_ZIP_BS_BITS each (in sectors, minus one).
+ */
+#define DS_VALUE_ZIP (1ULL << 63)
+#define DS_VALUE_ZIP_BS_BITS 8
+#define DS_VALUE_ZIP_BS_MASK ((1ULL << DS_VALUE_ZIP_BS_BITS) - 1)
+#define DS_VALUE_ZIP_MAX_SECTORS (1U << DS_VALUE_ZIP_BS_BITS)
+
 enum data_type {
 	BTREE_TYPE,
 	SKIPLIST_TYPE,
 	HASHTABLE_TYPE,
-	RBTREE_TYPE
+	RBTREE_TYPE,
+	LEARNED_TYPE,
+	DFTL_TYPE,
+	PAGETABLE_TYPE
+};
+
+struct redir_sector_info {
+	sector_t redirected_sector;
+	u32 block_size;
+	/* Bytes of the compressed block in the log, 0 if the data is stored as is */
+	u32 stored_size;
+};
+
+/*
+ * Position of a ds_copy_batch() walk. Ordered backends are walked from the
+ * highest key down, the hashtable bucket by bucket.
+ */
+struct ds_cursor {
+	sector_t key;
+	u32 bucket;
+	bool started;
+	bool done;
+};
+
+/* Mapping entry as read by ds_read_batch(), value is packed */
+struct ds_entry {
+	sector_t key;
+	u64 value;
 };
 
 struct data_struct {
@@ -30,15 +79,67 @@ struct data_struct {
 		struct skiplist *map_list;
 		struct hashtable *map_hash;
 		struct rbtree *map_rbtree;
+		struct learned_index *map_learned;
+		struct dftl *map_dftl;
+		struct page_table *map_pt;
 	} structure;
 };
 
+static inline bool ds_value_fits(const struct redir_sector_info *rs_info)
+{
+	if (rs_info->stored_size && ((rs_info->stored_size & (SECTOR_SIZE - 1)) ||
+		rs_info->stored_size > rs_info->block_size ||
+		(rs_info->block_size >> SECTOR_SHIFT) > DS_VALUE_ZIP_MAX_SECTORS))
+		return false;
+
+	return rs_info->block_size && !(rs_info->block_size & (SECTOR_SIZE - 1)) &&
+		(rs_info->block_size >> SECTOR_SHIFT) <= DS_VALUE_BS_MASK &&
+		rs_info->redirected_sector <= DS_VALUE_MAX_SECTOR;
+}
+
+/* Sectors the block of a mapping takes in the log */
+static inline u32 ds_stored_sectors(const struct redir_sector_info *rs_info)
+{
+	return (rs_info->stored_size ?: rs_info->block_size) >> SECTOR_SHIFT;
+}
+
+static inline u64 ds_pack_value(const struct redir_sector_info *rs_info)
+{
+	if (rs_info->stored_size)
+		return DS_VALUE_ZIP | ((u64)rs_info->redirected_sector << DS_VALUE_BS_BITS) |
+			((u64)((rs_info->stored_size >> SECTOR_SHIFT) - 1) << DS_VALUE_ZIP_BS_BITS) |
+			((rs_info->block_size >> SECTOR_SHIFT) - 1);
+
+	return ((u64)rs_info->redirected_sector << DS_VALUE_BS_BITS) |
+		(rs_info->block_size >> SECTOR_SHIFT);
+}
+
+static inline void ds_unpack_value(u64 value, struct redir_sector_info *rs_info)
+{
+	rs_info->redirected_sector = (value & ~DS_VALUE_ZIP) >> DS_VALUE_BS_BITS;
+	if (value & DS_VALUE_ZIP) {
+		rs_info->block_size = ((value & DS_VALUE_ZIP_BS_MASK) + 1) << SECTOR_SHIFT;
+		rs_info->stored_size = (((value >> DS_VALUE_ZIP_BS_BITS) & DS_VALUE_ZIP_BS_MASK) + 1) << SECTOR_SHIFT;
+	} else {
+		rs_info->block_size = (value & DS_VALUE_BS_MASK) << SECTOR_SHIFT;
+		rs_info->stored_size = 0;
+	}
+}
+
 int ds_init(struct data_struct *ds, char *sel_ds);
+int ds_init_dftl(struct data_struct *ds, struct block_device *bdev, u64 cache_pages);
+sector_t ds_capacity(struct data_struct *ds, sector_t dev_capacity);
+u32 ds_max_extent(struct data_struct *ds);
 void ds_free(struct data_struct *ds);
-void *ds_lookup(struct data_struct *ds, sector_t key);
+int ds_lookup(struct data_struct *ds, sector_t key, struct redir_sector_info *rs_info);
 void ds_remove(struct data_struct *ds, sector_t key);
-int ds_insert(struct data_struct *ds, sector_t key, void *value);
-void *ds_last(struct data_struct *ds, sector_t key);
-void *ds_prev(struct data_struct *ds, sector_t key, sector_t *prev_key);
+int ds_insert(struct data_struct *ds, sector_t key, const struct redir_sector_info *rs_info);
+int ds_last(struct data_struct *ds, sector_t key, struct redir_sector_info *rs_info);
+int ds_prev(struct data_struct *ds, sector_t key, sector_t *prev_key, struct redir_sector_info *rs_info);
+int ds_cover(struct data_struct *ds, sector_t sector, sector_t *key, struct redir_sector_info *rs_info);
 int ds_empty_check(struct data_struct *ds);
+u64 ds_mem_usage(struct data_struct *ds, u64 nr_entries);
+u64 ds_meta_written(struct data_struct *ds);
+int ds_copy_batch(struct data_struct *src, struct data_struct *dst, struct ds_cursor *cursor, u32 nr);
+int ds_read_batch(struct data_struct *ds, struct ds_cursor *cursor, struct ds_entry *entries, u32 nr);
 
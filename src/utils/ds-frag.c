@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include "ds-frag.h"
+
+/* Scan state, prev is the last accounted entry and extent the length of its extent */
+struct ds_frag_state {
+	struct ds_entry prev;
+	u64 extent;
+	bool started;
+};
+
+static void ds_frag_close_extent(struct ds_frag_report *report, u64 length)
+{
+	report->extents++;
+	report->hist[min_t(u32, ilog2(length), DS_FRAG_HIST_BUCKETS - 1)]++;
+	report->max_extent = max(report->max_extent, length);
+}
+
+/**
+ * Accounts one entry of the scan. The entries can come in ascending or in
+ * descending key order, a pair of neighbours is looked at from the lower key.
+ */
+static void ds_frag_account(struct ds_frag_report *report, struct ds_frag_state *state,
+		const struct ds_entry *entry)
+{
+	struct redir_sector_info lo_info, hi_info;
+	const struct ds_entry *lo, *hi;
+	u64 lo_len, len;
+
+	ds_unpack_value(entry->value, &hi_info);
+	len = hi_info.block_size >> SECTOR_SHIFT;
+	report->mappings++;
+	report->mapped_sectors += len;
+
+	if (!state->started) {
+		state->started = true;
+		state->prev = *entry;
+		state->extent = len;
+		return;
+	}
+
+	lo = entry->key < state->prev.key ? entry : &state->prev;
+	hi = lo == entry ? &state->prev : entry;
+	ds_unpack_value(lo->value, &lo_info);
+	ds_unpack_value(hi->value, &hi_info);
+	lo_len = lo_info.block_size >> SECTOR_SHIFT;
+
+	if (lo->key + lo_len < hi->key) {
+		report->holes++;
+	} else {
+		report->splits++;
+		/* Overlapping mappings can't be read in one request either */
+		if (lo->key + lo_len == hi->key &&
+			lo_info.redirected_sector + ds_stored_sectors(&lo_info) == hi_info.redirected_sector) {
+			state->extent += len;
+			state->prev = *entry;
+			return;
+		}
+		report->discontinuities++;
+	}
+
+	ds_frag_close_extent(report, state->extent);
+	state->extent = len;
+	state->prev = *entry;
+}
+
+static int ds_frag_cmp(const void *a, const void *b)
+{
+	const struct ds_entry *ea = a, *eb = b;
+
+	if (ea->key == eb->key)
+		return 0;
+	return ea->key < eb->key ? -1 : 1;
+}
+
+/**
+ * Scans the mapping of *live in batches, with lock held for read per batch,
+ * and fills the report. The hashtable has no key order, so its entries are
+ * collected and sorted first, it takes 16 bytes per mapping for the time of
+ * the scan. Writes that happen meanwhile may or may not be seen.
+ *
+ * It returns 0 on success, -EAGAIN if the data structure was switched during
+ * the scan, or another negative error code.
+ */
+int ds_frag_scan(struct data_struct **live, struct rw_semaphore *lock, struct ds_frag_report *report)
+{
+	struct ds_frag_state state = {};
+	struct ds_cursor cursor = {};
+	struct ds_entry *entries = NULL;
+	struct ds_entry *grown = NULL;
+	struct data_struct *ds = NULL;
+	size_t capacity = DS_FRAG_BATCH;
+	size_t collected = 0;
+	bool collect;
+	s32 read;
+	int status = 0;
+	size_t i;
+
+	memset(report, 0, sizeof(*report));
+
+	down_read(lock);
+	ds = *live;
+	up_read(lock);
+	collect = ds->type == HASHTABLE_TYPE;
+
+	entries = kvmalloc_array(capacity, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	for (;;) {
+		if (collect && capacity - collected < DS_FRAG_BATCH) {
+			grown = kvmalloc_array(capacity * 2, sizeof(*entries), GFP_KERNEL);
+			if (!grown) {
+				status = -ENOMEM;
+				goto out;
+			}
+			memcpy(grown, entries, collected * sizeof(*entries));
+			kvfree(entries);
+			entries = grown;
+			capacity *= 2;
+		}
+
+		down_read(lock);
+		if (*live != ds)
+			read = -EAGAIN;
+		else
+			read = ds_read_batch(ds, &cursor, entries + collected, DS_FRAG_BATCH);
+		up_read(lock);
+
+		if (read < 0) {
+			status = read;
+			goto out;
+		}
+		if (!read)
+			break;
+
+		if (collect) {
+			collected += read;
+		} else {
+			for (i = 0; i < read; i++)
+				ds_frag_account(report, &state, &entries[i]);
+		}
+		cond_resched();
+	}
+
+	if (collect) {
+		sort(entries, collected, sizeof(*entries), ds_frag_cmp, NULL);
+		for (i = 0; i < collected; i++)
+			ds_frag_account(report, &state, &entries[i]);
+	}
+	if (state.started)
+		ds_frag_close_extent(report, state.extent);
+
+out:
+	kvfree(entries);
+	return status;
+}
+
+/**
+ * It returns the lower bound of the log2 bucket, that holds the extent at
+ * the given percentile of the lengths, 0 if there are no extents.
+ */
+u64 ds_frag_percentile(const struct ds_frag_report *report, u32 percent)
+{
+	u64 rank = div_u64(report->extents * percent + 99, 100);
+	u64 seen = 0;
+	u32 i;
+
+	if (!report->extents)
+		return 0;
+
+	for (i = 0; i < DS_FRAG_HIST_BUCKETS; i++) {
+		seen += report->hist[i];
+		if (seen >= max_t(u64, rank, 1))
+			return 1ULL << i;
+	}
+	return 1ULL << (DS_FRAG_HIST_BUCKETS - 1);
+}
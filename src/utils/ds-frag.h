@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/rwsem.h>
+#include "ds-control.h"
+
+/* Entries read per hold of the read lock */
+#define DS_FRAG_BATCH 256
+/* Size of the requests of the modeled sequential read (128 KiB) */
+#define DS_FRAG_SCAN_SECTORS 256
+/* log2 buckets of the extent lengths in sectors */
+#define DS_FRAG_HIST_BUCKETS 48
+
+/*
+ * Layout of the mapping, as seen by a scan in logical order. An extent is a
+ * run of mappings, that are adjacent both logically and physically, so a
+ * read inside of it goes to the backing device as one request.
+ */
+struct ds_frag_report {
+	u64 mappings;
+	u64 extents;
+	u64 mapped_sectors;
+	/* Unmapped gaps between two mappings */
+	u64 holes;
+	/* Logically adjacent mappings, that aren't adjacent on the device */
+	u64 discontinuities;
+	/* Logically adjacent mappings, the driver splits a read there */
+	u64 splits;
+	u64 max_extent;
+	u64 hist[DS_FRAG_HIST_BUCKETS];
+};
+
+int ds_frag_scan(struct data_struct **live, struct rw_semaphore *lock, struct ds_frag_report *report);
+u64 ds_frag_percentile(const struct ds_frag_report *report, u32 percent);
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include "ds-migrate.h"
+#include "rbtree.h"
+
+static void ds_migration_release(struct ds_migration *mig)
+{
+	if (mig->target) {
+		ds_free(mig->target);
+		kfree(mig->target);
+		mig->target = NULL;
+	}
+	if (mig->delta) {
+		rbtree_free(mig->delta);
+		mig->delta = NULL;
+	}
+}
+
+/**
+ * Applies the writes captured during the copy to the target, in key order.
+ * Called with the lock held for write, so the delta can't grow meanwhile.
+ *
+ * It returns 0 on success, negative error code if an insertion fails.
+ */
+static s32 ds_migration_replay(struct ds_migration *mig)
+{
+	struct redir_sector_info rs_info;
+	struct rbtree_node *entry = NULL;
+	struct rb_node *node = NULL;
+	s32 status;
+
+	for (node = rb_first_cached(&mig->delta->root); node; node = rb_next(node)) {
+		entry = rb_entry(node, struct rbtree_node, node);
+
+		ds_remove(mig->target, entry->key);
+		if (entry->value == DS_MIGRATE_TOMBSTONE)
+			continue;
+
+		ds_unpack_value(entry->value, &rs_info);
+		status = ds_insert(mig->target, entry->key, &rs_info);
+		if (status)
+			return status;
+	}
+
+	return 0;
+}
+
+static void ds_migration_work(struct work_struct *work)
+{
+	struct ds_migration *mig = container_of(work, struct ds_migration, work);
+	struct data_struct *old = NULL;
+	s32 status = 0;
+
+	while (!mig->cursor.done) {
+		down_read(mig->lock);
+		if (mig->cancel) {
+			up_read(mig->lock);
+			break;
+		}
+		status = ds_copy_batch(*mig->live, mig->target, &mig->cursor, DS_MIGRATE_BATCH);
+		up_read(mig->lock);
+		if (status < 0)
+			break;
+
+		WRITE_ONCE(mig->copied, mig->copied + status);
+		cond_resched();
+	}
+
+	down_write(mig->lock);
+	if (mig->cancel && !mig->status)
+		mig->status = -ECANCELED;
+	else if (status < 0)
+		mig->status = status;
+
+	if (!mig->status)
+		mig->status = ds_migration_replay(mig);
+
+	if (!mig->status) {
+		old = *mig->live;
+		*mig->live = mig->target;
+		mig->target = old;
+		pr_info("Migration done, %llu entries copied\n", mig->copied);
+	} else {
+		pr_err("Migration aborted with code %d\n", mig->status);
+	}
+	ds_migration_release(mig);
+	up_write(mig->lock);
+}
+
+void ds_migration_init(struct ds_migration *mig, struct data_struct **live, struct rw_semaphore *lock)
+{
+	memset(mig, 0, sizeof(*mig));
+	INIT_WORK(&mig->work, ds_migration_work);
+	mig->live = live;
+	mig->lock = lock;
+}
+
+/**
+ * Starts rebuilding the live data structure as sel_ds in the background.
+ * Must be called with the lock held for write.
+ *
+ * It returns 0 on success, -EBUSY if a migration is already running,
+ * -ENOMEM or the ds_init() error otherwise.
+ */
+s32 ds_migration_start(struct ds_migration *mig, char *sel_ds)
+{
+	s32 status;
+
+	if (ds_migration_running(mig))
+		return -EBUSY;
+
+	mig->target = kzalloc(sizeof(struct data_struct), GFP_KERNEL);
+	if (!mig->target)
+		goto mem_err;
+
+	status = ds_init(mig->target, sel_ds);
+	if (status) {
+		kfree(mig->target);
+		mig->target = NULL;
+		return status;
+	}
+
+	mig->delta = rbtree_init();
+	if (!mig->delta)
+		goto mem_err;
+
+	memset(&mig->cursor, 0, sizeof(mig->cursor));
+	mig->copied = 0;
+	mig->status = 0;
+	mig->cancel = false;
+	queue_work(system_unbound_wq, &mig->work);
+
+	return 0;
+
+mem_err:
+	pr_err("Memory allocation failed\n");
+	ds_migration_release(mig);
+	return -ENOMEM;
+}
+
+/**
+ * Records a write to the live data structure, rs_info == NULL records a
+ * removal. Must be called with the lock held for write. If the write can't
+ * be recorded, the migration is aborted, as the target would miss it.
+ */
+void ds_migration_capture(struct ds_migration *mig, sector_t key, const struct redir_sector_info *rs_info)
+{
+	u64 value = DS_MIGRATE_TOMBSTONE;
+	s32 status;
+
+	if (!ds_migration_running(mig) || mig->cancel)
+		return;
+
+	if (rs_info)
+		value = ds_pack_value(rs_info);
+
+	status = rbtree_add(mig->delta, key, value);
+	if (status) {
+		mig->status = status;
+		mig->cancel = true;
+	}
+}
+
+/**
+ * Cancels a running migration and waits for the worker to clean up.
+ * Must be called without the lock held.
+ */
+void ds_migration_stop(struct ds_migration *mig)
+{
+	down_write(mig->lock);
+	if (ds_migration_running(mig))
+		mig->cancel = true;
+	up_write(mig->lock);
+
+	flush_work(&mig->work);
+}
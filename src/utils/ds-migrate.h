@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
+#include "ds-control.h"
+
+/* Entries copied per hold of the read lock */
+#define DS_MIGRATE_BATCH 256
+#define DS_MIGRATE_TOMBSTONE ((u64)0)
+
+/*
+ * Online rebuild of a live data structure in another backend.
+ * The copy runs in the background in batches, with the owner's lock taken
+ * for read. Writes that happen meanwhile are captured in delta (a removal is
+ * a tombstone) and replayed into the target under the write lock, right
+ * before the live pointer is switched to it.
+ */
+struct ds_migration {
+	struct work_struct work;
+	struct rw_semaphore *lock;
+	struct data_struct **live;
+	/* Below is protected by lock, target is non-NULL while running */
+	struct data_struct *target;
+	struct rbtree *delta;
+	struct ds_cursor cursor;
+	u64 copied;
+	s32 status;
+	bool cancel;
+};
+
+static inline bool ds_migration_running(struct ds_migration *mig)
+{
+	return mig->target;
+}
+
+void ds_migration_init(struct ds_migration *mig, struct data_struct **live, struct rw_semaphore *lock);
+int ds_migration_start(struct ds_migration *mig, char *sel_ds);
+void ds_migration_capture(struct ds_migration *mig, sector_t key, const struct redir_sector_info *rs_info);
+void ds_migration_stop(struct ds_migration *mig);
@@ -9,7 +9,6 @@
 void hash_insert(struct hashtable *ht, struct hlist_node *node, sector_t key)
 {
 	hlist_add_head(node, &ht->head[hash_min(BUCKET_NUM, HT_MAP_BITS)]);
-	ht->nf_bck = BUCKET_NUM;
 }
 
 void hashtable_free(struct hashtable *ht)
@@ -24,7 +23,6 @@ void hashtable_free(struct hashtable *ht)
 			kfree(el);
 		}
 	}
-	kfree(ht->last_el);
 	kfree(ht);
 }
 
@@ -41,38 +39,89 @@ struct hash_el *hashtable_find_node(struct hashtable *ht, sector_t key)
 	return NULL;
 }
 
-struct hash_el *hashtable_prev(struct hashtable *ht, sector_t key, sector_t *prev_key)
+/*
+ * Buckets are shared by chunks that hash the same, so only the elements of
+ * the chunk in question are taken into account.
+ */
+static struct hash_el *hashtable_chunk_prev(struct hashtable *ht, sector_t chunk, sector_t key)
 {
-	struct hash_el *prev_max_node = kzalloc(sizeof(struct hash_el), GFP_KERNEL);
+	struct hash_el *prev_max_node = NULL;
 	struct hash_el *el;
 
-	hlist_for_each_entry(el, &ht->head[hash_min(BUCKET_NUM, HT_MAP_BITS)], node) {
-		if (el && el->key <= key && el->key > prev_max_node->key)
+	hlist_for_each_entry(el, &ht->head[hash_min(chunk, HT_MAP_BITS)], node) {
+		if (el->key / CHUNK_SIZE == chunk && el->key < key &&
+		    (!prev_max_node || el->key > prev_max_node->key))
 			prev_max_node = el;
 	}
 
-	if (prev_max_node->key == 0) {
+	return prev_max_node;
+}
+
+struct hash_el *hashtable_prev(struct hashtable *ht, sector_t key, sector_t *prev_key)
+{
+	struct hash_el *prev_max_node = NULL;
+
+	prev_max_node = hashtable_chunk_prev(ht, BUCKET_NUM, key);
+	if (!prev_max_node && BUCKET_NUM) {
+		/* A block is never larger than a chunk, so it starts at most one chunk back */
 		pr_debug("Hashtable: Element with  is in the prev bucket\n");
-		// mb execute recursively key + mb_size
-		hlist_for_each_entry(el, &ht->head[hash_min(min(BUCKET_NUM - 1, ht->nf_bck), HT_MAP_BITS)], node) {
-			if (el && el->key <= key && el->key > prev_max_node->key)
-				prev_max_node = el;
-			pr_debug("Hashtable: prev el key = %llu\n", el->key);
-		}
-		if (prev_max_node->key == 0)
-			return NULL;
+		prev_max_node = hashtable_chunk_prev(ht, BUCKET_NUM - 1, key);
 	}
-	pr_debug("Hashtable: Element with prev key - el key=%llu, val=%p\n", prev_max_node->key, prev_max_node->value);
+	if (!prev_max_node)
+		return NULL;
+
+	pr_debug("Hashtable: Element with prev key - el key=%llu, val=%llx\n", prev_max_node->key, prev_max_node->value);
 
 	*prev_key = prev_max_node->key;
 	return prev_max_node;
 }
 
+static struct hash_el *hashtable_find_last(struct hashtable *ht)
+{
+	s32 bckt_iter = 0;
+	struct hash_el *last = NULL;
+	struct hash_el *el;
+
+	hash_for_each(ht->head, bckt_iter, el, node) {
+		if (!last || el->key > last->key)
+			last = el;
+	}
+
+	return last;
+}
+
+/*
+ * Finds the last element, once the one of key, that was the last, is
+ * removed. The rest of the keys is below it, so the chunks are looked at
+ * one bucket each, down from key: the keys of a log are mostly dense. Only
+ * after HT_LAST_SCAN_CHUNKS empty chunks the whole table is scanned.
+ */
+static struct hash_el *hashtable_last_below(struct hashtable *ht, sector_t key)
+{
+	struct hash_el *el = NULL;
+	sector_t chunk = BUCKET_NUM;
+	u32 i;
+
+	for (i = 0; i < HT_LAST_SCAN_CHUNKS; i++, chunk--) {
+		el = hashtable_chunk_prev(ht, chunk, key);
+		if (el || !chunk)
+			return el;
+	}
+
+	return hashtable_find_last(ht);
+}
+
 void hashtable_remove(struct hashtable *ht, sector_t key)
 {
-	struct hlist_node *ht_node = NULL;
+	struct hash_el *el = NULL;
+
+	el = hashtable_find_node(ht, key);
+	if (!el)
+		return;
 
-	ht_node = &hashtable_find_node(ht, key)->node;
-	hash_del(ht_node);
+	hash_del(&el->node);
+	if (ht->last_el == el)
+		ht->last_el = hashtable_last_below(ht, key);
+	kfree(el);
 }
 
@@ -5,16 +5,17 @@
 #define HT_MAP_BITS 7
 #define CHUNK_SIZE (1024 * 2)
 #define BUCKET_NUM ((sector_t)(key / (CHUNK_SIZE)))
+/* Chunks, that the removal of the last element looks down, before a full scan */
+#define HT_LAST_SCAN_CHUNKS (1 << HT_MAP_BITS)
 
 struct hashtable {
 	DECLARE_HASHTABLE(head, HT_MAP_BITS);
 	struct hash_el *last_el;
-	u8 nf_bck;
 };
 
 struct hash_el {
 	sector_t key;
-	void *value;
+	u64 value;
 	struct hlist_node node;
 };
 
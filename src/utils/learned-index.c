@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Learned index for log-structured mappings.
+ *
+ * Mappings are kept as runs that are exactly linear in key and packed value,
+ * so a sequential write stream collapses into a handful of runs. A piecewise
+ * linear model with bounded error (LI_MODEL_EPS) predicts the run of a key,
+ * making a lookup one model evaluation plus a short local search. Recent
+ * inserts and removals go to a delta rbtree, which is merged into the runs
+ * once it grows large enough. Appends that continue the last run skip the
+ * delta entirely.
+ */
+
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include "learned-index.h"
+
+struct li_builder {
+	struct li_run cur;
+	struct li_run *out;
+	u32 nr;
+};
+
+static sector_t li_run_key(struct li_run *run, u32 i)
+{
+	return run->key + i * run->key_step;
+}
+
+static u64 li_run_value(struct li_run *run, u32 i)
+{
+	return run->value + i * run->value_step;
+}
+
+static bool li_run_extends(struct li_run *run, sector_t key, u64 value)
+{
+	if (run->len == U32_MAX)
+		return false;
+	if (run->len == 1)
+		return key > run->key;
+
+	return key == li_run_key(run, run->len) && value == li_run_value(run, run->len);
+}
+
+static void li_run_append(struct li_run *run, sector_t key, u64 value)
+{
+	if (run->len == 1) {
+		run->key_step = key - run->key;
+		run->value_step = value - run->value;
+	}
+	run->len++;
+}
+
+static void li_builder_flush(struct li_builder *builder)
+{
+	if (!builder->cur.len)
+		return;
+
+	if (builder->out)
+		builder->out[builder->nr] = builder->cur;
+	builder->nr++;
+	builder->cur.len = 0;
+}
+
+/**
+ * Appends the entry to the current run or starts a new one. Without an
+ * output array the builder only counts runs.
+ */
+static void li_builder_push(struct li_builder *builder, sector_t key, u64 value)
+{
+	if (builder->cur.len && li_run_extends(&builder->cur, key, value)) {
+		li_run_append(&builder->cur, key, value);
+		return;
+	}
+
+	li_builder_flush(builder);
+	builder->cur.key = key;
+	builder->cur.key_step = 0;
+	builder->cur.value = value;
+	builder->cur.value_step = 0;
+	builder->cur.len = 1;
+}
+
+/**
+ * Fits the piecewise linear model over run start keys using a shrinking
+ * cone anchored at the first run of every segment. Slopes are 32.32 fixed
+ * point. Without an output array it only counts segments.
+ */
+static u32 li_fit(struct li_run *runs, u32 nr_runs, struct li_segment *segments)
+{
+	u64 lo = 0;
+	u64 hi = U64_MAX;
+	u64 s_lo, s_hi, x, y;
+	u32 first = 0;
+	u32 nr = 0;
+	u32 i;
+
+	for (i = 1; i <= nr_runs; i++) {
+		if (i < nr_runs) {
+			x = runs[i].key - runs[first].key;
+			y = i - first;
+			s_hi = div64_u64((y + LI_MODEL_EPS) << 32, x);
+			s_lo = y > LI_MODEL_EPS ? DIV64_U64_ROUND_UP((y - LI_MODEL_EPS) << 32, x) : 0;
+			if (max(lo, s_lo) <= min(hi, s_hi)) {
+				lo = max(lo, s_lo);
+				hi = min(hi, s_hi);
+				continue;
+			}
+		}
+
+		if (segments) {
+			segments[nr].key = runs[first].key;
+			segments[nr].slope = (hi == U64_MAX) ? 0 : lo + (hi - lo) / 2;
+			segments[nr].first = first;
+			segments[nr].last = i - 1;
+		}
+		nr++;
+		first = i;
+		lo = 0;
+		hi = U64_MAX;
+	}
+
+	return nr;
+}
+
+/* Largest i in [lo, hi] with runs[i].key <= key, runs[lo].key <= key is assumed */
+static u32 li_search_runs(struct li_run *runs, u32 lo, u32 hi, sector_t key)
+{
+	u32 mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (runs[mid].key <= key)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/**
+ * Finds the run with the greatest start key <= key: picks the model segment,
+ * evaluates it and searches LI_MODEL_EPS runs around the prediction. The
+ * window is verified, so a bad prediction only costs a search over the segment.
+ *
+ * It returns the run index, U32_MAX if every run starts after the key.
+ */
+static u32 li_find_run(struct learned_index *li, sector_t key)
+{
+	struct li_segment *seg = NULL;
+	u32 lo = 0;
+	u32 hi = 0;
+	u32 mid;
+	u64 pred;
+
+	if (!li->nr_runs || key < li->runs[0].key)
+		return U32_MAX;
+
+	hi = li->nr_segments - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (li->segments[mid].key <= key)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	seg = &li->segments[lo];
+
+	pred = seg->first + mul_u64_u64_shr(key - seg->key, seg->slope, 32);
+	pred = min_t(u64, pred, seg->last);
+	lo = max_t(u64, seg->first, pred > LI_MODEL_EPS + 1 ? pred - LI_MODEL_EPS - 1 : 0);
+	hi = min_t(u64, seg->last, pred + LI_MODEL_EPS + 1);
+
+	if (li->runs[lo].key > key || (hi < seg->last && li->runs[hi + 1].key <= key)) {
+		pr_debug("Learned index: model miss for key %llu\n", key);
+		lo = seg->first;
+		hi = seg->last;
+	}
+
+	return li_search_runs(li->runs, lo, hi, key);
+}
+
+static u64 li_base_lookup(struct learned_index *li, sector_t key)
+{
+	struct li_run *run = NULL;
+	u64 idx, rem;
+	u32 i;
+
+	i = li_find_run(li, key);
+	if (i == U32_MAX)
+		return LI_TOMBSTONE;
+
+	run = &li->runs[i];
+	if (key == run->key)
+		return run->value;
+	if (run->len == 1)
+		return LI_TOMBSTONE;
+
+	idx = div64_u64_rem(key - run->key, run->key_step, &rem);
+	if (rem || idx >= run->len)
+		return LI_TOMBSTONE;
+
+	return li_run_value(run, idx);
+}
+
+static u64 li_base_prev(struct learned_index *li, sector_t key, sector_t *prev_key)
+{
+	struct li_run *run = NULL;
+	u64 idx = 0;
+	u32 i;
+
+	if (!key)
+		return LI_TOMBSTONE;
+
+	i = li_find_run(li, key - 1);
+	if (i == U32_MAX)
+		return LI_TOMBSTONE;
+
+	run = &li->runs[i];
+	if (run->len > 1)
+		idx = min_t(u64, div64_u64(key - 1 - run->key, run->key_step), run->len - 1);
+
+	*prev_key = li_run_key(run, idx);
+	return li_run_value(run, idx);
+}
+
+static void li_merge_into(struct learned_index *li, struct li_builder *builder)
+{
+	struct rb_node *node = rb_first_cached(&li->delta->root);
+	struct rbtree_node *dnode = NULL;
+	sector_t bkey = 0;
+	u32 run = 0;
+	u32 pos = 0;
+
+	while (run < li->nr_runs || node) {
+		dnode = node ? container_of(node, struct rbtree_node, node) : NULL;
+		if (run < li->nr_runs)
+			bkey = li_run_key(&li->runs[run], pos);
+
+		if (dnode && (run >= li->nr_runs || dnode->key <= bkey)) {
+			if (run < li->nr_runs && dnode->key == bkey) {
+				/* Entry in the runs is shadowed by the delta */
+				if (++pos == li->runs[run].len) {
+					run++;
+					pos = 0;
+				}
+			}
+			if (dnode->value != LI_TOMBSTONE)
+				li_builder_push(builder, dnode->key, dnode->value);
+			node = rb_next(node);
+		} else {
+			li_builder_push(builder, bkey, li_run_value(&li->runs[run], pos));
+			if (++pos == li->runs[run].len) {
+				run++;
+				pos = 0;
+			}
+		}
+	}
+
+	li_builder_flush(builder);
+}
+
+/**
+ * Folds the delta buffer into the runs and refits the model. The old state
+ * stays in place if any allocation fails.
+ */
+static s32 li_merge(struct learned_index *li)
+{
+	struct li_builder builder = { 0 };
+	struct li_run *runs = NULL;
+	struct li_segment *segments = NULL;
+	struct rbtree *delta = NULL;
+	u32 nr_segments = 0;
+
+	li_merge_into(li, &builder);
+	if (builder.nr) {
+		runs = kvmalloc_array(builder.nr, sizeof(struct li_run), GFP_KERNEL);
+		if (!runs)
+			goto mem_err;
+
+		memset(&builder, 0, sizeof(builder));
+		builder.out = runs;
+		li_merge_into(li, &builder);
+
+		nr_segments = li_fit(runs, builder.nr, NULL);
+		segments = kvmalloc_array(nr_segments, sizeof(struct li_segment), GFP_KERNEL);
+		if (!segments)
+			goto mem_err;
+		li_fit(runs, builder.nr, segments);
+	}
+
+	delta = rbtree_init();
+	if (!delta)
+		goto mem_err;
+
+	pr_debug("Learned index: merged %llu delta entries, %u runs, %u segments\n",
+		li->delta->node_num, builder.nr, nr_segments);
+
+	rbtree_free(li->delta);
+	kvfree(li->runs);
+	kvfree(li->segments);
+	li->delta = delta;
+	li->runs = runs;
+	li->nr_runs = builder.nr;
+	li->segments = segments;
+	li->nr_segments = nr_segments;
+
+	return 0;
+
+mem_err:
+	pr_warn("Learned index: merge postponed, memory allocation failed\n");
+	kvfree(runs);
+	kvfree(segments);
+	return -ENOMEM;
+}
+
+struct learned_index *li_init(void)
+{
+	struct learned_index *li = NULL;
+
+	li = kzalloc(sizeof(struct learned_index), GFP_KERNEL);
+	if (!li)
+		return NULL;
+
+	li->delta = rbtree_init();
+	if (!li->delta) {
+		kfree(li);
+		return NULL;
+	}
+
+	return li;
+}
+
+void li_free(struct learned_index *li)
+{
+	if (!li)
+		return;
+
+	rbtree_free(li->delta);
+	kvfree(li->runs);
+	kvfree(li->segments);
+	kfree(li);
+}
+
+u64 li_lookup(struct learned_index *li, sector_t key)
+{
+	struct rbtree_node *node = NULL;
+
+	node = rbtree_find_node(li->delta, key);
+	if (node)
+		return node->value;
+
+	return li_base_lookup(li, key);
+}
+
+s32 li_insert(struct learned_index *li, sector_t key, u64 value)
+{
+	struct li_run *tail = NULL;
+	bool live;
+	s32 status;
+
+	if (li->nr_runs && key > li->max_key) {
+		tail = &li->runs[li->nr_runs - 1];
+		if (li_run_extends(tail, key, value)) {
+			li_run_append(tail, key, value);
+			li->max_key = key;
+			li->nr_entries++;
+			return 0;
+		}
+	}
+
+	live = li_lookup(li, key) != LI_TOMBSTONE;
+	status = rbtree_add(li->delta, key, value);
+	if (status)
+		return status;
+
+	if (!live)
+		li->nr_entries++;
+	li->max_key = max(li->max_key, key);
+
+	if (li->delta->node_num >= max_t(u64, LI_DELTA_MIN, li->nr_runs >> LI_DELTA_SHIFT))
+		li_merge(li);
+
+	return 0;
+}
+
+void li_remove(struct learned_index *li, sector_t key)
+{
+	struct rbtree_node *node = NULL;
+	bool in_base;
+
+	node = rbtree_find_node(li->delta, key);
+	if (node && node->value == LI_TOMBSTONE)
+		return;
+
+	in_base = li_base_lookup(li, key) != LI_TOMBSTONE;
+	if (!node && !in_base)
+		return;
+
+	if (in_base) {
+		if (rbtree_add(li->delta, key, LI_TOMBSTONE)) {
+			pr_err("Learned index: failed to remove key %llu\n", key);
+			return;
+		}
+	} else {
+		rbtree_remove(li->delta, key);
+	}
+
+	li->nr_entries--;
+}
+
+/**
+ * Finds the live entry with the greatest key strictly less than the given
+ * one. Delta entries win over the runs, tombstones hide the run entries
+ * they shadow.
+ */
+u64 li_prev(struct learned_index *li, sector_t key, sector_t *prev_key)
+{
+	struct rbtree_node *dnode = NULL;
+	sector_t delta_key = 0;
+	sector_t base_key = 0;
+	u64 base_value;
+
+	while (key) {
+		dnode = rbtree_prev(li->delta, key, &delta_key);
+		base_value = li_base_prev(li, key, &base_key);
+
+		if (base_value != LI_TOMBSTONE && (!dnode || base_key > dnode->key)) {
+			*prev_key = base_key;
+			return base_value;
+		}
+		if (!dnode)
+			return LI_TOMBSTONE;
+		if (dnode->value != LI_TOMBSTONE) {
+			*prev_key = dnode->key;
+			return dnode->value;
+		}
+		key = dnode->key;
+	}
+
+	return LI_TOMBSTONE;
+}
+
+u64 li_last(struct learned_index *li, sector_t *last_key)
+{
+	return li_prev(li, U64_MAX, last_key);
+}
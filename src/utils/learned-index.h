@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/types.h>
+#include "rbtree.h"
+
+/* Max distance (in runs) between the model prediction and the real run */
+#define LI_MODEL_EPS 8
+/* Delta buffer is merged into the runs when it reaches max(MIN, nr_runs >> SHIFT) */
+#define LI_DELTA_MIN 1024
+#define LI_DELTA_SHIFT 3
+#define LI_TOMBSTONE ((u64)0)
+
+/*
+ * Run of mappings that are exactly linear in both key and packed value:
+ * i-th entry is (key + i * key_step, value + i * value_step).
+ */
+struct li_run {
+	sector_t key;
+	sector_t key_step;
+	u64 value;
+	u64 value_step;
+	u32 len;
+};
+
+/*
+ * Piece of the linear model over run start keys. For any key in the piece
+ * first + ((key - this->key) * slope >> 32) is within LI_MODEL_EPS of the
+ * index of the run that holds it.
+ */
+struct li_segment {
+	sector_t key;
+	u64 slope;
+	u32 first;
+	u32 last;
+};
+
+struct learned_index {
+	struct li_run *runs;
+	u32 nr_runs;
+	struct li_segment *segments;
+	u32 nr_segments;
+	struct rbtree *delta;
+	sector_t max_key;
+	u64 nr_entries;
+};
+
+struct learned_index *li_init(void);
+void li_free(struct learned_index *li);
+s32 li_insert(struct learned_index *li, sector_t key, u64 value);
+void li_remove(struct learned_index *li, sector_t key);
+u64 li_lookup(struct learned_index *li, sector_t key);
+u64 li_prev(struct learned_index *li, sector_t key, sector_t *prev_key);
+u64 li_last(struct learned_index *li, sector_t *last_key);
@@ -0,0 +1,265 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Direct-mapped translation table for log-structured mappings.
+ *
+ * Works like a page table: the block number of a 4K aligned key is split
+ * into PT_LEVELS indexes of PT_FANOUT_SHIFT bits, one per level, and the
+ * last level holds the packed value in place. A lookup is PT_LEVELS array
+ * indexings with no search, tables are allocated on the first insert below
+ * them and freed once they are empty. Keys, that aren't block aligned (the
+ * sub-block and unaligned writes), or are past the tables, go to a small
+ * overflow rbtree. A key is in one of the two, as it is aligned or not.
+ */
+
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "page-table.h"
+
+static bool pt_in_tables(sector_t key)
+{
+	return !(key & ((1 << PT_BLOCK_SHIFT) - 1)) && (key >> PT_BLOCK_SHIFT) < PT_MAX_BLOCKS;
+}
+
+/* Slot of the block in the table of the level, the root is level 0 */
+static u32 pt_index(u64 block, u32 level)
+{
+	return (block >> ((PT_LEVELS - 1 - level) * PT_FANOUT_SHIFT)) & (PT_FANOUT - 1);
+}
+
+static struct pt_table *pt_alloc_table(struct page_table *pt)
+{
+	struct pt_table *table = NULL;
+
+	if (pt->nr_spare)
+		table = pt->spare[--pt->nr_spare];
+	else
+		table = kzalloc(sizeof(struct pt_table), GFP_KERNEL);
+	if (table)
+		pt->nr_tables++;
+	return table;
+}
+
+/*
+ * An empty table is all zeroes, so it is kept as a spare as it is: an
+ * overwrite removes the key before inserting it again, which would free and
+ * allocate the tables of a sparse region otherwise.
+ */
+static void pt_free_table(struct page_table *pt, struct pt_table *table)
+{
+	pt->nr_tables--;
+	if (pt->nr_spare < PT_LEVELS - 1)
+		pt->spare[pt->nr_spare++] = table;
+	else
+		kfree(table);
+}
+
+/*
+ * Frees the tables on the path of the block from the level up, that have no
+ * slot in use anymore. So every table below the root leads to a value, which
+ * bounds the scans of pt_last_below().
+ */
+static void pt_prune(struct page_table *pt, struct pt_table **path, u32 level, u64 block)
+{
+	for (; level; level--) {
+		if (memchr_inv(path[level], 0, sizeof(struct pt_table)))
+			return;
+		path[level - 1]->child[pt_index(block, level - 1)] = NULL;
+		pt_free_table(pt, path[level]);
+	}
+}
+
+static void pt_free_tables(struct pt_table *table, u32 level)
+{
+	u32 i;
+
+	if (level < PT_LEVELS - 1) {
+		for (i = 0; i < PT_FANOUT; i++) {
+			if (table->child[i])
+				pt_free_tables(table->child[i], level + 1);
+		}
+	}
+	kfree(table);
+}
+
+/**
+ * Finds the value of the greatest block under the table of the level, that
+ * has the block number prefix of the levels above. If bounded, only the
+ * blocks up to the given one are taken.
+ *
+ * It returns the value and sets found to its block, 0 if there is none.
+ */
+static u64 pt_last_below(struct pt_table *table, u32 level, u64 prefix, u64 block, bool bounded, u64 *found)
+{
+	s32 i = bounded ? pt_index(block, level) : PT_FANOUT - 1;
+	u64 value;
+
+	for (; i >= 0; i--) {
+		if (level == PT_LEVELS - 1) {
+			if (!table->value[i])
+				continue;
+			*found = prefix << PT_FANOUT_SHIFT | i;
+			return table->value[i];
+		}
+		if (!table->child[i])
+			continue;
+		value = pt_last_below(table->child[i], level + 1, prefix << PT_FANOUT_SHIFT | i, block,
+				bounded && i == pt_index(block, level), found);
+		if (value)
+			return value;
+	}
+
+	return 0;
+}
+
+struct page_table *pt_init(void)
+{
+	struct page_table *pt = NULL;
+
+	pt = kzalloc(sizeof(struct page_table), GFP_KERNEL);
+	if (!pt)
+		return NULL;
+
+	pt->root = kzalloc(sizeof(struct pt_table), GFP_KERNEL);
+	if (!pt->root)
+		goto mem_err;
+
+	pt->overflow = rbtree_init();
+	if (!pt->overflow)
+		goto mem_err;
+
+	return pt;
+
+mem_err:
+	kfree(pt->root);
+	kfree(pt);
+	return NULL;
+}
+
+void pt_free(struct page_table *pt)
+{
+	if (!pt)
+		return;
+
+	pt_free_tables(pt->root, 0);
+	while (pt->nr_spare)
+		kfree(pt->spare[--pt->nr_spare]);
+	rbtree_free(pt->overflow);
+	kfree(pt);
+}
+
+u64 pt_lookup(struct page_table *pt, sector_t key)
+{
+	struct rbtree_node *node = NULL;
+	struct pt_table *table = pt->root;
+	u64 block = key >> PT_BLOCK_SHIFT;
+	u32 level;
+
+	if (!pt_in_tables(key)) {
+		node = rbtree_find_node(pt->overflow, key);
+		return node ? node->value : 0;
+	}
+
+	for (level = 0; level < PT_LEVELS - 1; level++) {
+		table = table->child[pt_index(block, level)];
+		if (!table)
+			return 0;
+	}
+
+	return table->value[pt_index(block, PT_LEVELS - 1)];
+}
+
+s32 pt_insert(struct page_table *pt, sector_t key, u64 value)
+{
+	struct pt_table *path[PT_LEVELS];
+	u64 block = key >> PT_BLOCK_SHIFT;
+	u64 *slot = NULL;
+	u32 level;
+
+	if (!pt_in_tables(key))
+		return rbtree_add(pt->overflow, key, value);
+
+	path[0] = pt->root;
+	for (level = 1; level < PT_LEVELS; level++) {
+		path[level] = path[level - 1]->child[pt_index(block, level - 1)];
+		if (path[level])
+			continue;
+
+		path[level] = pt_alloc_table(pt);
+		if (!path[level]) {
+			pt_prune(pt, path, level - 1, block);
+			return -ENOMEM;
+		}
+		path[level - 1]->child[pt_index(block, level - 1)] = path[level];
+	}
+
+	slot = &path[PT_LEVELS - 1]->value[pt_index(block, PT_LEVELS - 1)];
+	if (!*slot)
+		pt->nr_entries++;
+	*slot = value;
+	pt->max_block = max(pt->max_block, block);
+	return 0;
+}
+
+void pt_remove(struct page_table *pt, sector_t key)
+{
+	struct pt_table *path[PT_LEVELS];
+	u64 block = key >> PT_BLOCK_SHIFT;
+	u64 *slot = NULL;
+	u32 level;
+
+	if (!pt_in_tables(key)) {
+		rbtree_remove(pt->overflow, key);
+		return;
+	}
+
+	path[0] = pt->root;
+	for (level = 1; level < PT_LEVELS; level++) {
+		path[level] = path[level - 1]->child[pt_index(block, level - 1)];
+		if (!path[level])
+			return;
+	}
+
+	slot = &path[PT_LEVELS - 1]->value[pt_index(block, PT_LEVELS - 1)];
+	if (!*slot)
+		return;
+
+	*slot = 0;
+	pt->nr_entries--;
+	pt_prune(pt, path, PT_LEVELS - 1, block);
+
+	if (block == pt->max_block && !pt_last_below(pt->root, 0, 0, block, true, &pt->max_block))
+		pt->max_block = 0;
+}
+
+/**
+ * Finds the entry with the greatest key strictly less than the given one.
+ * The tables are scanned down from the block before the key or the greatest
+ * block, the overflow is searched as well and the greater key of the two wins.
+ */
+u64 pt_prev(struct page_table *pt, sector_t key, sector_t *prev_key)
+{
+	struct rbtree_node *node = NULL;
+	sector_t overflow_key = 0;
+	u64 block = 0;
+	u64 value = 0;
+
+	if (key && pt->nr_entries)
+		value = pt_last_below(pt->root, 0, 0, min_t(u64, (key - 1) >> PT_BLOCK_SHIFT, pt->max_block),
+				true, &block);
+
+	node = rbtree_prev(pt->overflow, key, &overflow_key);
+	if (node && (!value || overflow_key > block << PT_BLOCK_SHIFT)) {
+		*prev_key = overflow_key;
+		return node->value;
+	}
+
+	if (value)
+		*prev_key = block << PT_BLOCK_SHIFT;
+	return value;
+}
+
+u64 pt_last(struct page_table *pt, sector_t *last_key)
+{
+	return pt_prev(pt, U64_MAX, last_key);
+}
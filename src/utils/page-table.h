@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/types.h>
+#include "rbtree.h"
+
+/* Keys are mapped in blocks of 4K in the tables */
+#define PT_BLOCK_SHIFT 3
+/* A table is a page of slots, PT_LEVELS of them index a block number */
+#define PT_FANOUT_SHIFT 9
+#define PT_FANOUT (1U << PT_FANOUT_SHIFT)
+#define PT_LEVELS 4
+#define PT_MAX_BLOCKS (1ULL << (PT_FANOUT_SHIFT * PT_LEVELS))
+
+/*
+ * Table of a level. The slots of the last level hold the packed values,
+ * the ones above point to the tables of the next level.
+ */
+struct pt_table {
+	union {
+		struct pt_table *child[PT_FANOUT];
+		u64 value[PT_FANOUT];
+	};
+};
+
+struct page_table {
+	struct pt_table *root;
+	/* Mappings of the keys, that aren't block aligned or are past the tables */
+	struct rbtree *overflow;
+	/* Values in the tables and the tables below the root */
+	u64 nr_entries;
+	u64 nr_tables;
+	/* Greatest block in the tables, the scans for a predecessor start there */
+	u64 max_block;
+	/* Tables emptied by the last removals, an insert takes them back first */
+	struct pt_table *spare[PT_LEVELS - 1];
+	u32 nr_spare;
+};
+
+struct page_table *pt_init(void);
+void pt_free(struct page_table *pt);
+s32 pt_insert(struct page_table *pt, sector_t key, u64 value);
+void pt_remove(struct page_table *pt, sector_t key);
+u64 pt_lookup(struct page_table *pt, sector_t key);
+u64 pt_prev(struct page_table *pt, sector_t key, sector_t *prev_key);
+u64 pt_last(struct page_table *pt, sector_t *last_key);
@@ -6,14 +6,28 @@
  * Modified by Mikhail Gavrilenko on 14.11.24
  * Changes: rename functions/types, add get_last and get_prev methods
  * + some refactoring and NULL initialisation.
+ *
+ * Moved to rb_root_cached with a cached rightmost node (O(1) get_last),
+ * get_prev is a single descent. Every node is augmented with the greatest
+ * extent end of its subtree, so the extent covering a sector is found
+ * without a lookup and a get_prev.
  */
 
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/types.h>
+#include <linux/rbtree_augmented.h>
 #include "rbtree.h"
 
-static struct rbtree_node *create_rbtree_node(sector_t key, void **value)
+static inline sector_t rbtree_node_last(struct rbtree_node *data)
+{
+	return data->last;
+}
+
+RB_DECLARE_CALLBACKS_MAX(static, rbtree_augment_cb, struct rbtree_node, node,
+			 sector_t, subtree_last, rbtree_node_last);
+
+static struct rbtree_node *create_rbtree_node(sector_t key, sector_t last, u64 value)
 {
 	struct rbtree_node *node = NULL;
 
@@ -21,6 +35,8 @@ static struct rbtree_node *create_rbtree_node(sector_t key, void **value)
 	if (!node)
 		return NULL;
 	node->key = key;
+	node->last = last;
+	node->subtree_last = last;
 	node->value = value;
 
 	return node;
@@ -28,17 +44,9 @@ static struct rbtree_node *create_rbtree_node(sector_t key, void **value)
 
 static void free_rbtree_node(struct rbtree_node *node)
 {
-	kfree(node->value);
 	kfree(node);
 }
 
-static s32 compare_keys(sector_t lkey, sector_t rkey)
-{
-	if (!(lkey && rkey))
-		return -2;
-	return lkey < rkey ? -1 : (lkey == rkey ? 0 : 1);
-}
-
 static struct rbtree_node *__rbtree_underlying_search(struct rb_root *root,
 							 sector_t key)
 {
@@ -49,15 +57,10 @@ static struct rbtree_node *__rbtree_underlying_search(struct rb_root *root,
 	while (node) {
 		struct rbtree_node *data =
 			container_of(node, struct rbtree_node, node);
-		s32 result = compare_keys(key, data->key);
-
-		if (result == -2)
-			return NULL;
 
-		if (result < 0)
+		if (key < data->key)
 			node = node->rb_left;
-
-		else if (result > 0)
+		else if (key > data->key)
 			node = node->rb_right;
 		else
 			return data;
@@ -66,47 +69,52 @@ static struct rbtree_node *__rbtree_underlying_search(struct rb_root *root,
 	return NULL;
 }
 
-static s32 __rbtree_underlying_insert(struct rb_root *root, sector_t key, void *value)
+/**
+ * Inserts the extent or overwrites the one with the same key. Tracks whether
+ * the new node ends up leftmost/rightmost to keep both caches valid.
+ *
+ * It returns sizeof(struct rbtree_node) if a node was added, 0 on overwrite,
+ * -ENOMEM if node allocation fails.
+ */
+static s32 __rbtree_underlying_insert(struct rbtree *rbt, sector_t key, sector_t last, u64 value)
 {
-	bool overwrite;
 	struct rb_node **new = NULL;
 	struct rb_node *parent = NULL;
 	struct rbtree_node *data = NULL;
 	struct rbtree_node *this = NULL;
-	s32 result;
+	bool leftmost = true;
+	bool rightmost = true;
 
-	overwrite = 0;
-	new = &(root->rb_node);
-	parent = NULL;
+	new = &(rbt->root.rb_root.rb_node);
 
 	while (*new) {
 		this = container_of(*new, struct rbtree_node, node);
-
-		result = compare_keys(key, this->key);
 		parent = *new;
 
-		if (result < 0) {
+		if (key < this->key) {
 			new = &((*new)->rb_left);
-		} else if (result > 0) {
+			rightmost = false;
+		} else if (key > this->key) {
 			new = &((*new)->rb_right);
+			leftmost = false;
 		} else {
-			overwrite = true;
 			this->value = value;
+			this->last = last;
+			rbtree_augment_cb.propagate(&this->node, NULL);
 			return 0;
 		}
 	}
 
-	if (!overwrite) {
-		data = create_rbtree_node(key, value);
-		if (!data)
-			goto no_mem;
-		rb_link_node(&data->node, parent, new);
-		rb_insert_color(&data->node, root);
-	}
-	return sizeof(struct rbtree_node);
+	data = create_rbtree_node(key, last, value);
+	if (!data)
+		return -ENOMEM;
 
-no_mem:
-	return -ENOMEM;
+	rb_link_node(&data->node, parent, new);
+	rb_insert_augmented_cached(&data->node, &rbt->root, leftmost, &rbtree_augment_cb);
+	if (rightmost)
+		rbt->rightmost = &data->node;
+
+	return sizeof(struct rbtree_node);
 }
 
 struct rbtree *rbtree_init(void)
@@ -117,19 +125,20 @@ struct rbtree *rbtree_init(void)
 	if (!new_tree)
 		return NULL;
 
-	new_tree->root = RB_ROOT;
+	new_tree->root = RB_ROOT_CACHED;
+	new_tree->rightmost = NULL;
 	new_tree->node_num = 0;
 	return new_tree;
 }
 
 void rbtree_free(struct rbtree *rbt)
 {
+	struct rbtree_node *pos, *node = NULL;
+
 	if (!rbt)
 		return;
 
-	struct rbtree_node *pos, *node = NULL;
-
-	rbtree_postorder_for_each_entry_safe(pos, node, &(rbt->root), node)
+	rbtree_postorder_for_each_entry_safe(pos, node, &(rbt->root.rb_root), node)
 		free_rbtree_node(pos);
 
 	kfree(rbt);
@@ -139,90 +148,134 @@ void rbtree_remove(struct rbtree *rbt, sector_t key)
 {
 	struct rbtree_node *data = NULL;
 
-	data = __rbtree_underlying_search(&(rbt->root), key);
+	data = __rbtree_underlying_search(&(rbt->root.rb_root), key);
 	if (data == NULL)
 		return;
-	if (data) {
-		rb_erase(&(data->node), &(rbt->root));
-		free_rbtree_node(data);
-	}
+
+	if (rbt->rightmost == &data->node)
+		rbt->rightmost = rb_prev(&data->node);
+	rb_erase_augmented_cached(&(data->node), &(rbt->root), &rbtree_augment_cb);
+	free_rbtree_node(data);
 	rbt->node_num--;
 }
 
-void rbtree_add(struct rbtree *rbt, sector_t key, void *value)
+/* Inserts the extent [key, last], the one with the same key is overwritten */
+s32 rbtree_add_extent(struct rbtree *rbt, sector_t key, sector_t last, u64 value)
+{
+	s32 status;
+
+	status = __rbtree_underlying_insert(rbt, key, last, value);
+	if (status < 0)
+		return status;
+
+	if (status)
+		rbt->node_num++;
+	return 0;
+}
+
+s32 rbtree_add(struct rbtree *rbt, sector_t key, u64 value)
 {
-	__rbtree_underlying_insert(&(rbt->root), key, value);
-	rbt->node_num++;
+	return rbtree_add_extent(rbt, key, key, value);
 }
 
 struct rbtree_node *rbtree_find_node(struct rbtree *rbt, sector_t key)
 {
 	struct rbtree_node *target = NULL;
 
-	target = __rbtree_underlying_search(&(rbt->root), key);
+	target = __rbtree_underlying_search(&(rbt->root.rb_root), key);
 	return target;
 }
 
 struct rbtree_node *rbtree_last(struct rbtree *rbt)
 {
-	struct rb_root root = rbt->root;
-	struct rb_node *node = root.rb_node;
-
-	if (!node)
+	if (!rbt->rightmost)
 		return NULL;
 
-	if (!(node->rb_left && node->rb_right))
-		return NULL;
+	return container_of(rbt->rightmost, struct rbtree_node, node);
+}
 
-	struct rbtree_node *data =
-			container_of(node, struct rbtree_node, node);
-	if (!(data->key && data->value))
-		return NULL;
+/**
+ * Finds the node with the greatest key strictly less than the given one
+ * in a single descent from the root.
+ */
+struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev_key)
+{
+	struct rb_node *node = rbt->root.rb_root.rb_node;
+	struct rbtree_node *prev = NULL;
 
 	while (node) {
-		if (node->rb_right)
+		struct rbtree_node *data = container_of(node, struct rbtree_node, node);
+
+		if (data->key < key) {
+			prev = data;
 			node = node->rb_right;
-		else
-			break;
+		} else {
+			node = node->rb_left;
+		}
 	}
 
-	return container_of(node, struct rbtree_node, node);
+	if (!prev)
+		return NULL;
+
+	*prev_key = prev->key;
+	return prev;
 }
 
-struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev_key)
+/* Finds the extent with the greatest key in the subtree, that reaches the sector */
+static struct rbtree_node *rbtree_subtree_cover(struct rb_node *node, sector_t sector)
 {
-	struct rbtree_node *curr = NULL;
-	struct rb_root root = rbt->root;
-
-	curr = __rbtree_underlying_search(&root, key);
-	if (!curr) {
-		struct rb_node *ancestor = root.rb_node;
-		struct rbtree_node *prev = NULL;
-
-		while (ancestor) {
-			struct rbtree_node *ancestor_data = container_of(ancestor, struct rbtree_node, node);
-
-			if (compare_keys(ancestor_data->key, key) < 0) {
-				prev = ancestor_data;
-				ancestor = ancestor->rb_right;
-			} else {
-				ancestor = ancestor->rb_left;
-			}
-		}
-		*prev_key = prev->key;
-		return prev;
+	struct rbtree_node *data = NULL;
+
+	while (node) {
+		data = container_of(node, struct rbtree_node, node);
+		if (node->rb_right &&
+			container_of(node->rb_right, struct rbtree_node, node)->subtree_last >= sector)
+			node = node->rb_right;
+		else if (data->last >= sector)
+			return data;
+		else
+			node = node->rb_left;
 	}
+	return NULL;
+}
 
-	struct rb_node *node = &curr->node;
+/**
+ * Finds the extent with the greatest key at or before the sector, that
+ * covers it. The keys up to the sector are the nodes, where the descent to
+ * it turns right, with their left subtrees. They are looked at from the
+ * deepest one up, a subtree is only entered if its greatest extent end
+ * reaches the sector, so the extent is found in one descent and one ascent.
+ */
+struct rbtree_node *rbtree_cover(struct rbtree *rbt, sector_t sector)
+{
+	struct rb_node *node = rbt->root.rb_root.rb_node;
+	struct rb_node *floor = NULL;
+	struct rb_node *parent = NULL;
+	struct rbtree_node *data = NULL;
 
-	if (node) {
-		node = node->rb_left;
-		while (node && node->rb_right)
+	while (node) {
+		data = container_of(node, struct rbtree_node, node);
+		if (sector < data->key) {
+			node = node->rb_left;
+		} else {
+			floor = node;
+			if (sector == data->key)
+				return data;
 			node = node->rb_right;
-		curr = container_of(node, struct rbtree_node, node);
-		*prev_key = curr->key;
-		return curr;
+		}
 	}
 
+	for (node = floor; node; node = parent) {
+		data = container_of(node, struct rbtree_node, node);
+		if (data->last >= sector)
+			return data;
+		if (node->rb_left &&
+			container_of(node->rb_left, struct rbtree_node, node)->subtree_last >= sector)
+			return rbtree_subtree_cover(node->rb_left, sector);
+
+		/* Up to the next node, that the descent went right at */
+		while ((parent = rb_parent(node)) && node == parent->rb_left)
+			node = parent;
+	}
 	return NULL;
 }
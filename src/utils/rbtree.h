@@ -5,22 +5,31 @@
 
 #pragma once
 
+/*
+ * Every node describes an extent [key, last], a single key unless it is
+ * added by rbtree_add_extent(). The tree is augmented with the greatest
+ * extent end of each subtree for rbtree_cover().
+ */
 struct rbtree_node {
 	struct rb_node node;
 	sector_t key;
-	void *value;
+	sector_t last;
+	sector_t subtree_last;
+	u64 value;
 };
 
 struct rbtree {
-	struct rb_root root;
+	struct rb_root_cached root;
+	struct rb_node *rightmost;
 	u64 node_num;
-	//struct rbtree_node *last_el; can be added in future
 };
 
 struct rbtree *rbtree_init(void);
 void rbtree_free(struct rbtree *rbt);
-void rbtree_add(struct rbtree *rbt, sector_t key, void *value);
+s32 rbtree_add(struct rbtree *rbt, sector_t key, u64 value);
+s32 rbtree_add_extent(struct rbtree *rbt, sector_t key, sector_t last, u64 value);
 void rbtree_remove(struct rbtree *rbt, sector_t key);
 struct rbtree_node *rbtree_find_node(struct rbtree *rbt, sector_t key);
 struct rbtree_node *rbtree_prev(struct rbtree *rbt, sector_t key, sector_t *prev_key);
 struct rbtree_node *rbtree_last(struct rbtree *rbt);
+struct rbtree_node *rbtree_cover(struct rbtree *rbt, sector_t sector);
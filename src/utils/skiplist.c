@@ -22,7 +22,7 @@ static void free_node_full(struct skiplist_node *node)
 	return;
 }
 
-static struct skiplist_node *create_node_tall(sector_t key, void **value,
+static struct skiplist_node *create_node_tall(sector_t key, u64 value,
 								s32 h)
 {
 	struct skiplist_node *last;
@@ -49,7 +49,7 @@ alloc_fail:
 	return NULL;
 }
 
-static struct skiplist_node *create_node(sector_t key, void *value)
+static struct skiplist_node *create_node(sector_t key, u64 value)
 {
 	return create_node_tall(key, value, 1);
 }
@@ -85,9 +85,9 @@ struct skiplist_node *skiplist_find_node(struct skiplist *sl, sector_t key)
 	struct skiplist_node *curr = sl->head;
 
 	while (curr) {
-		if (curr->next->key == key)
+		if (curr->next && curr->next->key == key)
 			return curr->next;
-		else if (curr->next && curr->next->key && curr->next->key < key)
+		else if (curr->next && curr->next->key < key)
 			curr = curr->next;
 		else
 			curr = curr->lower;
@@ -188,7 +188,7 @@ static void get_prev_nodes(sector_t key, struct skiplist *sl,
 }
 
 static struct skiplist_node *skiplist_insert_at_lvl(sector_t key,
-		void *value, struct skiplist *sl, s32 lvl)
+		u64 value, struct skiplist *sl, s32 lvl)
 {
 	struct skiplist_node *prev[MAX_LVL+1];
 	struct skiplist_node *new;
@@ -218,7 +218,7 @@ fail:
 	return ERR_PTR(-ENOMEM);
 }
 
-struct skiplist_node *skiplist_add(struct skiplist *sl, sector_t key, void *value)
+struct skiplist_node *skiplist_add(struct skiplist *sl, sector_t key, u64 value)
 {
 	struct skiplist_node *old;
 	struct skiplist_node *new;
@@ -235,8 +235,6 @@ struct skiplist_node *skiplist_add(struct skiplist *sl, sector_t key, void *valu
 		goto fail;
 
 	new = skiplist_insert_at_lvl(key, value, sl, lvl);
-	if (IS_ERR(new))
-		goto fail;
 
 	return new;
 
@@ -246,35 +244,25 @@ fail:
 
 void skiplist_free(struct skiplist *sl)
 {
+	struct skiplist_node *head;
+	struct skiplist_node *lower;
 	struct skiplist_node *curr;
 	struct skiplist_node *next;
-	struct skiplist_node *tofree;
-	struct skiplist_node *tofree_stack[MAX_LVL + 1];
-	s32 stack_i;
 
 	if (!sl)
 		return;
 
-	stack_i = 0;
-	tofree_stack[stack_i++] = sl->head;
-
-	while (stack_i > 0 && tofree_stack[stack_i]) {
-		tofree = tofree_stack[stack_i];
-
-		curr = tofree;
+	/* Every node belongs to exactly one level, so free them level by level */
+	head = sl->head;
+	while (head) {
+		lower = head->lower;
+		curr = head;
 		while (curr) {
 			next = curr->next;
-			if (!next)
-				break;
-
-			if (next->key < tofree_stack[stack_i]->key)
-				tofree_stack[++stack_i] = next;
-
-			curr = curr->lower;
+			kfree(curr);
+			curr = next;
 		}
-
-		free_node_full(tofree);
-		tofree_stack[stack_i--] = NULL;
+		head = lower;
 	}
 
 	kfree(sl);
@@ -294,7 +282,7 @@ void skiplist_print(struct skiplist *sl)
 			else if (curr->key == TAIL_KEY && curr->value == TAIL_VALUE)
 				pr_cont("tail->");
 			else
-				pr_cont("(%llu-%p)->", curr->key, curr->value);
+				pr_cont("(%llu-%llx)->", curr->key, curr->value);
 
 			curr = curr->next;
 		}
@@ -323,38 +311,50 @@ void skiplist_remove(struct skiplist *sl, sector_t key)
 			curr = curr->lower;
 	}
 
-	curr = prev[0]->next;
-
-	if (curr && curr->key == key) {
-		for (i = 0; i <= sl->head_lvl; ++i) {
-			if (prev[i]->next == curr)
-				prev[i]->next = curr->next;
-			curr = prev[i]->next;
-		}
+	/* Unlink and free the node of every level the key reaches */
+	for (i = 0; i <= sl->head_lvl; ++i) {
+		curr = prev[i]->next;
+		if (!curr || curr->key != key)
+			break;
 
-		while (sl->head_lvl > 0 && !sl->head->next) {
-			struct skiplist_node *old_head = sl->head;
+		prev[i]->next = curr->next;
+		kfree(curr);
+	}
 
-			sl->head = sl->head->lower;
-			kfree(old_head);
-			--sl->head_lvl;
-		}
+	while (sl->head_lvl > 0 && sl->head->next->key == TAIL_KEY) {
+		struct skiplist_node *old_head = sl->head;
 
-		return;
+		sl->head = sl->head->lower;
+		kfree(old_head->next);
+		kfree(old_head);
+		--sl->head_lvl;
 	}
 }
 
-struct skiplist_node *skiplist_last(struct skiplist *sl)
+bool skiplist_empty(struct skiplist *sl)
 {
 	struct skiplist_node *curr = sl->head;
 
 	while (curr->lower)
 		curr = curr->lower;
 
-	while (curr->next && curr->next->key && curr->next->key != TAIL_KEY)
-		curr = curr->next;
+	return curr->next->key == TAIL_KEY;
+}
 
-	return curr;
+struct skiplist_node *skiplist_last(struct skiplist *sl)
+{
+	struct skiplist_node *curr = sl->head;
+
+	/* Rightmost node of every level, from the top, instead of walking the bottom one */
+	while (true) {
+		while (curr->next && curr->next->key != TAIL_KEY)
+			curr = curr->next;
+
+		if (!curr->lower)
+			return curr;
+
+		curr = curr->lower;
+	}
 }
 
 
@@ -11,16 +11,16 @@
 #include <linux/module.h>
 
 #define HEAD_KEY ((sector_t)0)
-#define HEAD_VALUE NULL
+#define HEAD_VALUE ((u64)0)
 #define TAIL_KEY ((sector_t)U64_MAX)
-#define TAIL_VALUE ((sector_t)0)
+#define TAIL_VALUE ((u64)0)
 #define MAX_LVL 20
 
 struct skiplist_node {
 	struct skiplist_node *next;
 	struct skiplist_node *lower;
 	sector_t key;
-	void *value;
+	u64 value;
 };
 
 struct skiplist {
@@ -33,7 +33,8 @@ struct skiplist *skiplist_init(void);
 struct skiplist_node *skiplist_find_node(struct skiplist *sl, sector_t key);
 void skiplist_free(struct skiplist *sl);
 void skiplist_print(struct skiplist *sl);
-struct skiplist_node *skiplist_add(struct skiplist *sl, sector_t key, void *data);
+struct skiplist_node *skiplist_add(struct skiplist *sl, sector_t key, u64 value);
 void skiplist_remove(struct skiplist *sl, sector_t key);
+bool skiplist_empty(struct skiplist *sl);
 struct skiplist_node *skiplist_prev(struct skiplist *sl, sector_t key, sector_t *prev_key);
 struct skiplist_node *skiplist_last(struct skiplist *sl);
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include "utils/ds-control.h"
+#include "main.h"
+#include "zoned.h"
+
+static struct lsbdd_zone *lsbdd_zoned_zone(struct lsbdd_zoned *zd, sector_t sector)
+{
+	return &zd->zones[(sector & LSBDD_STRIPE_SECTOR_MASK) >> zd->zone_shift];
+}
+
+/**
+ * Queues a zone, that takes no more appends, for the worker once no I/O to
+ * it is in flight: it is reset if no mapping points into it, finished if it
+ * wasn't written up to its capacity, so it doesn't stay active on the device.
+ * Must be called with the lock held.
+ */
+static void lsbdd_zoned_check(struct lsbdd_zoned *zd, struct lsbdd_zone *zone)
+{
+	if (zone->state != LSBDD_ZONE_FULL || zone->users || !list_empty(&zone->list))
+		return;
+	if (zone->live && zone->allocated >= zone->capacity)
+		return;
+
+	list_add_tail(&zone->list, &zd->pending);
+	queue_work(system_unbound_wq, &zd->work);
+}
+
+static void lsbdd_zoned_work(struct work_struct *work)
+{
+	struct lsbdd_zoned *zd = container_of(work, struct lsbdd_zoned, work);
+	struct lsbdd_zone *zone = NULL;
+	unsigned long flags;
+	enum req_op op;
+	s32 status;
+
+	spin_lock_irqsave(&zd->lock, flags);
+	while (!zd->stop && !list_empty(&zd->pending)) {
+		zone = list_first_entry(&zd->pending, struct lsbdd_zone, list);
+		list_del_init(&zone->list);
+		op = zone->live ? REQ_OP_ZONE_FINISH : REQ_OP_ZONE_RESET;
+		spin_unlock_irqrestore(&zd->lock, flags);
+
+		status = blkdev_zone_mgmt(zd->bdev, op, zone->start, 1ULL << zd->zone_shift, GFP_NOIO);
+
+		spin_lock_irqsave(&zd->lock, flags);
+		if (status) {
+			/* The zone is left as it is, it isn't retried */
+			pr_err("Zone at %llu: %s failed with %d\n", (u64)zone->start,
+				op == REQ_OP_ZONE_RESET ? "reset" : "finish", status);
+			zone->allocated = zone->capacity;
+		} else if (op == REQ_OP_ZONE_FINISH) {
+			zone->allocated = zone->capacity;
+			zd->finishes++;
+			/* The last mapping might have gone meanwhile */
+			lsbdd_zoned_check(zd, zone);
+		} else {
+			zone->allocated = 0;
+			zone->state = LSBDD_ZONE_FREE;
+			list_add_tail(&zone->list, &zd->free);
+			zd->nr_free++;
+			zd->resets++;
+		}
+	}
+	spin_unlock_irqrestore(&zd->lock, flags);
+}
+
+/* Takes the zones of the report, a sequential zone with data is reset first */
+static int lsbdd_zoned_report(struct blk_zone *blkz, unsigned int idx, void *data)
+{
+	struct lsbdd_zoned *zd = data;
+	struct lsbdd_zone *zone = &zd->zones[idx];
+
+	zone->start = blkz->start;
+	zone->capacity = blkz->capacity;
+	INIT_LIST_HEAD(&zone->list);
+	if (blkz->type == BLK_ZONE_TYPE_CONVENTIONAL || blkz->cond == BLK_ZONE_COND_OFFLINE ||
+		blkz->cond == BLK_ZONE_COND_READONLY) {
+		zone->state = LSBDD_ZONE_UNUSABLE;
+		return 0;
+	}
+
+	zd->capacity += zone->capacity;
+	if (blkz->cond == BLK_ZONE_COND_EMPTY) {
+		zone->state = LSBDD_ZONE_FREE;
+		list_add_tail(&zone->list, &zd->free);
+		zd->nr_free++;
+	} else {
+		zone->state = LSBDD_ZONE_FULL;
+		zone->allocated = zone->capacity;
+		list_add_tail(&zone->list, &zd->pending);
+	}
+	return 0;
+}
+
+/**
+ * Sets up the log of a BD on a zoned device. The log takes all of the
+ * sequential zones, the data in them is dropped. At most nr_open zones are
+ * appended to in parallel, and half of the open and active zones of the
+ * device, as a retired zone stays active until the worker finished it.
+ *
+ * It returns 0 on success, -EOPNOTSUPP if the BD isn't a single device
+ * with a mapping in memory, -ENOSPC if there is no sequential zone,
+ * negative error code if the zones can't be reported.
+ */
+s32 lsbdd_zoned_init(struct bd_manager *manager, u32 nr_open)
+{
+	struct block_device *bdev = manager->stripes[0].bd_handler->bdev;
+	struct lsbdd_zoned *zd = NULL;
+	u32 limit;
+	s32 status;
+
+	/* The DFTL table and the pool are written in place */
+	if (manager->nr_stripes != 1 || manager->pool || manager->defer_io)
+		return -EOPNOTSUPP;
+
+	zd = kzalloc(sizeof(*zd), GFP_KERNEL);
+	if (!zd)
+		return -ENOMEM;
+
+	zd->nr_zones = bdev_nr_zones(bdev);
+	zd->zones = kvcalloc(zd->nr_zones, sizeof(*zd->zones), GFP_KERNEL);
+	if (!zd->zones) {
+		kfree(zd);
+		return -ENOMEM;
+	}
+
+	zd->manager = manager;
+	zd->bdev = bdev;
+	zd->zone_shift = ilog2(bdev_zone_sectors(bdev));
+	zd->nr_open = clamp_t(u32, nr_open, 1, LSBDD_ZONED_MAX_OPEN);
+	limit = min_not_zero(bdev_max_active_zones(bdev), bdev_max_open_zones(bdev));
+	if (limit)
+		zd->nr_open = min(zd->nr_open, max(limit / 2, 1U));
+	spin_lock_init(&zd->lock);
+	INIT_LIST_HEAD(&zd->free);
+	INIT_LIST_HEAD(&zd->pending);
+	INIT_WORK(&zd->work, lsbdd_zoned_work);
+
+	status = blkdev_report_zones(bdev, 0, zd->nr_zones, lsbdd_zoned_report, zd);
+	if (status >= 0 && !zd->capacity)
+		status = -ENOSPC;
+	if (status < 0) {
+		kvfree(zd->zones);
+		kfree(zd);
+		return status;
+	}
+
+	manager->stripes[0].capacity = zd->capacity;
+	manager->zoned = zd;
+	if (!list_empty(&zd->pending))
+		queue_work(system_unbound_wq, &zd->work);
+
+	pr_info("Zoned BD: %u zones of %llu sectors, %u open\n", zd->nr_zones, 1ULL << zd->zone_shift,
+		zd->nr_open);
+	return 0;
+}
+
+/* Stops the worker and frees the zones, must be called once no I/O comes to the BD */
+void lsbdd_zoned_free(struct bd_manager *manager)
+{
+	struct lsbdd_zoned *zd = manager->zoned;
+
+	if (!zd)
+		return;
+
+	spin_lock_irq(&zd->lock);
+	zd->stop = true;
+	spin_unlock_irq(&zd->lock);
+	cancel_work_sync(&zd->work);
+	kvfree(zd->zones);
+	kfree(zd);
+	manager->zoned = NULL;
+}
+
+/* Caps the bios of the BD at the zone append size, an append can't be split by the device */
+void lsbdd_zoned_limits(struct lsbdd_zoned *zd, struct request_queue *q)
+{
+	blk_queue_max_hw_sectors(q, min(queue_max_hw_sectors(q),
+			queue_max_zone_append_sectors(bdev_get_queue(zd->bdev))));
+}
+
+/**
+ * Picks an open zone with room for an append of sectors, round-robin, and
+ * holds it until the append completes. An open zone without room is retired,
+ * a free one takes its place.
+ *
+ * It returns the zone or NULL, if no zone has room.
+ */
+struct lsbdd_zone *lsbdd_zoned_alloc(struct lsbdd_zoned *zd, u32 sectors)
+{
+	struct lsbdd_zone *zone = NULL;
+	unsigned long flags;
+	u32 i, slot = 0;
+
+	spin_lock_irqsave(&zd->lock, flags);
+	for (i = 0; i < zd->nr_open; i++) {
+		slot = (zd->next_open + i) % zd->nr_open;
+		zone = zd->open[slot];
+		if (zone && zone->allocated + sectors > zone->capacity) {
+			zone->state = LSBDD_ZONE_FULL;
+			zd->open[slot] = NULL;
+			lsbdd_zoned_check(zd, zone);
+			zone = NULL;
+		}
+		if (!zone && !list_empty(&zd->free)) {
+			zone = list_first_entry(&zd->free, struct lsbdd_zone, list);
+			list_del_init(&zone->list);
+			zd->nr_free--;
+			zone->state = LSBDD_ZONE_OPEN;
+			zd->open[slot] = zone;
+		}
+		if (zone && zone->allocated + sectors <= zone->capacity)
+			break;
+		zone = NULL;
+	}
+
+	if (zone) {
+		zone->allocated += sectors;
+		zone->users++;
+		zd->appends++;
+		zd->next_open = (slot + 1) % zd->nr_open;
+	}
+	spin_unlock_irqrestore(&zd->lock, flags);
+
+	return zone;
+}
+
+/* Holds the zone of the sector, so it isn't reset under a read */
+struct lsbdd_zone *lsbdd_zoned_get(struct lsbdd_zoned *zd, sector_t sector)
+{
+	struct lsbdd_zone *zone = lsbdd_zoned_zone(zd, sector);
+	unsigned long flags;
+
+	spin_lock_irqsave(&zd->lock, flags);
+	zone->users++;
+	spin_unlock_irqrestore(&zd->lock, flags);
+
+	return zone;
+}
+
+/* Drops the hold of an append or a read, called from the completions as well */
+void lsbdd_zoned_put(struct lsbdd_zoned *zd, struct lsbdd_zone *zone)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&zd->lock, flags);
+	zone->users--;
+	lsbdd_zoned_check(zd, zone);
+	spin_unlock_irqrestore(&zd->lock, flags);
+}
+
+/*
+ * Counts a block of the log as mapped or no longer mapped, a zone without
+ * mapped blocks is reset once it is full. Called with ds_lock held for write.
+ */
+void lsbdd_zoned_account(struct lsbdd_zoned *zd, const struct redir_sector_info *rs_info, bool live)
+{
+	struct lsbdd_zone *zone = lsbdd_zoned_zone(zd, rs_info->redirected_sector);
+	unsigned long flags;
+
+	spin_lock_irqsave(&zd->lock, flags);
+	if (live) {
+		zone->live += ds_stored_sectors(rs_info);
+	} else {
+		zone->live -= ds_stored_sectors(rs_info);
+		lsbdd_zoned_check(zd, zone);
+	}
+	spin_unlock_irqrestore(&zd->lock, flags);
+}
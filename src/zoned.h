@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+/* Zones appended to in parallel by default, and at most */
+#define LSBDD_ZONED_OPEN_DEFAULT 4
+#define LSBDD_ZONED_MAX_OPEN 64
+
+struct bd_manager;
+struct request_queue;
+struct redir_sector_info;
+
+enum lsbdd_zone_state {
+	/* Conventional, offline or read-only, the log doesn't use it */
+	LSBDD_ZONE_UNUSABLE,
+	LSBDD_ZONE_FREE,
+	LSBDD_ZONE_OPEN,
+	/* Takes no more appends, it is finished and reset by the worker */
+	LSBDD_ZONE_FULL
+};
+
+/* Sequential zone of the backing device */
+struct lsbdd_zone {
+	sector_t start;
+	/* Sectors, that can be written, and that were handed out to appends */
+	sector_t capacity;
+	sector_t allocated;
+	/* Sectors of the mapped blocks in the zone */
+	sector_t live;
+	/* Appends and reads in flight to the zone */
+	u32 users;
+	enum lsbdd_zone_state state;
+	/* In the free or the pending list */
+	struct list_head list;
+};
+
+/*
+ * Log of a BD on a zoned device. Writes are zone appends to one of the open
+ * zones, the device picks their sector and the mapping is inserted once the
+ * append completes. A full zone is finished, and reset to be used again once
+ * no mapping points into it. Both wait until no I/O to the zone is in flight.
+ */
+struct lsbdd_zoned {
+	struct bd_manager *manager;
+	struct block_device *bdev;
+	struct work_struct work;
+	u8 zone_shift;
+	u32 nr_zones;
+	u32 nr_open;
+	/* Sectors of the usable zones */
+	sector_t capacity;
+	/* Protects everything below, taken from the completions */
+	spinlock_t lock;
+	struct lsbdd_zone *zones;
+	struct lsbdd_zone *open[LSBDD_ZONED_MAX_OPEN];
+	u32 next_open;
+	struct list_head free;
+	u32 nr_free;
+	/* Full zones to be finished or reset by the worker */
+	struct list_head pending;
+	bool stop;
+	u64 appends;
+	u64 finishes;
+	u64 resets;
+};
+
+s32 lsbdd_zoned_init(struct bd_manager *manager, u32 nr_open);
+void lsbdd_zoned_free(struct bd_manager *manager);
+void lsbdd_zoned_limits(struct lsbdd_zoned *zd, struct request_queue *q);
+struct lsbdd_zone *lsbdd_zoned_alloc(struct lsbdd_zoned *zd, u32 sectors);
+struct lsbdd_zone *lsbdd_zoned_get(struct lsbdd_zoned *zd, sector_t sector);
+void lsbdd_zoned_put(struct lsbdd_zoned *zd, struct lsbdd_zone *zone);
+void lsbdd_zoned_account(struct lsbdd_zoned *zd, const struct redir_sector_info *rs_info, bool live);
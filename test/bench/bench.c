@@ -0,0 +1,536 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+/*
+ * Userspace microbenchmark of the ds-control backends.
+ *
+ * src/utils is built against the kernel-API shim in shim/, every backend is
+ * driven through ds_*() the same way the driver does it: writes take the
+ * mapping lock for write and replace an existing mapping (lookup, remove,
+ * insert), reads (lookup, prev, last) take it for read. Redirected sectors
+ * come from a log cursor, as in lsbdd_write().
+ *
+ * For every data structure, key stream and thread count it prints ns/op and
+ * Mops/s of each operation and the bytes of memory per mapped key.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/bio.h>
+#include <linux/mm.h>
+#include <linux/rwsem.h>
+#include "ds-control.h"
+#include "dftl.h"
+
+/* Same as LSBDD_SECTOR_OFFSET, the first redirected sector */
+#define BENCH_SECTOR_OFFSET 32
+/* Block size of the fixed-size streams, 4K */
+#define BENCH_BS_SECTORS 8
+#define BENCH_ZIPF_THETA 0.99
+/* Read threads check the time budget every that many ops */
+#define BENCH_TIME_CHECK 256
+#define BENCH_MAX_THREADS 256
+
+enum bench_pattern {
+	PATTERN_SEQ,
+	PATTERN_RAND,
+	PATTERN_ZIPF,
+	PATTERN_MIXED,
+	PATTERN_NR
+};
+
+static const char *pattern_names[] = {"seq", "rand", "zipf", "mixed"};
+static const char *ds_names[] = {"bt", "sl", "ht", "rb", "li", "df", "pt"};
+/* Block sizes of the mixed stream, 1K - 128K */
+static const u32 mixed_bs[] = {2, 4, 8, 16, 32, 64, 128, 256};
+
+enum bench_op {
+	OP_WRITE,
+	OP_LOOKUP,
+	OP_PREV,
+	OP_LAST
+};
+
+static const char *op_names[] = {"write", "lookup", "prev", "last"};
+
+/*
+ * Keys in write order, with the size of their blocks. Reads pick keys out
+ * of the writes, so they follow the same distribution.
+ */
+struct bench_stream {
+	sector_t *keys;
+	u32 *bs;
+	u64 nr;
+	u64 *reads;
+	u64 nr_reads;
+	u64 nr_distinct;
+	/* Sectors needed for the keys and for the log */
+	sector_t span;
+};
+
+struct bench_run {
+	struct data_struct ds;
+	struct rw_semaphore lock;
+	struct block_device *bdev;
+	struct bench_stream *stream;
+	sector_t next_free_sector;
+	enum bench_op op;
+	u32 nr_threads;
+	u64 deadline_ns;
+	pthread_barrier_t barrier;
+	u64 done;
+	u64 misses;
+	u64 busy_ns;
+	u64 first_start_ns;
+	u64 last_stop_ns;
+	pthread_mutex_t stats_lock;
+};
+
+struct bench_thread {
+	struct bench_run *run;
+	u32 id;
+	pthread_t thread;
+};
+
+static u64 nr_writes = 1 << 18;
+static u64 nr_ops;
+static double max_seconds = 5;
+static u32 dftl_cache_mb = DFTL_CACHE_DEFAULT_MB;
+static u64 seed = 1;
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 xorshift64(u64 *state)
+{
+	u64 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static double rand_unit(u64 *state)
+{
+	return (xorshift64(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * Zipfian ranks in [0, n) after Gray et al. (the YCSB generator), rank 0 is
+ * the hottest one.
+ */
+struct zipf {
+	u64 n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+static void zipf_init(struct zipf *z, u64 n, double theta)
+{
+	double zeta2 = 1 + pow(0.5, theta);
+	u64 i;
+
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (i = 1; i <= n; i++)
+		z->zetan += 1 / pow((double)i, theta);
+	z->alpha = 1 / (1 - theta);
+	z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static u64 zipf_next(struct zipf *z, u64 *state)
+{
+	double u = rand_unit(state);
+	double uz = u * z->zetan;
+	u64 rank;
+
+	if (uz < 1)
+		return 0;
+	if (uz < 1 + pow(0.5, z->theta))
+		return 1;
+
+	rank = (u64)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+	return min_t(u64, rank, z->n - 1);
+}
+
+static void shuffle(sector_t *keys, u32 *bs, u64 nr, u64 *state)
+{
+	sector_t key;
+	u64 i, j;
+	u32 size;
+
+	for (i = nr - 1; i > 0; i--) {
+		j = xorshift64(state) % (i + 1);
+		key = keys[i];
+		keys[i] = keys[j];
+		keys[j] = key;
+		size = bs[i];
+		bs[i] = bs[j];
+		bs[j] = size;
+	}
+}
+
+static s32 stream_init(struct bench_stream *stream, enum bench_pattern pattern, u64 nr, u64 nr_reads)
+{
+	unsigned long *written = NULL;
+	struct zipf z = {0};
+	u64 state = seed;
+	sector_t log_end;
+	sector_t key = 0;
+	u64 i, slot;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->nr = nr;
+	stream->nr_reads = nr_reads;
+	stream->keys = calloc(nr, sizeof(sector_t));
+	stream->bs = calloc(nr, sizeof(u32));
+	stream->reads = calloc(nr_reads, sizeof(u64));
+	written = calloc(BITS_TO_LONGS(nr), sizeof(unsigned long));
+	if (!stream->keys || !stream->bs || !stream->reads || !written)
+		goto mem_err;
+
+	if (pattern == PATTERN_ZIPF)
+		zipf_init(&z, nr, BENCH_ZIPF_THETA);
+
+	for (i = 0; i < nr; i++) {
+		stream->bs[i] = BENCH_BS_SECTORS;
+		if (pattern == PATTERN_SEQ || pattern == PATTERN_RAND) {
+			stream->keys[i] = i * BENCH_BS_SECTORS;
+		} else if (pattern == PATTERN_ZIPF) {
+			/* Scatter the hot ranks over the device */
+			slot = zipf_next(&z, &state) * 0x9E3779B97F4A7C15ULL % nr;
+			stream->keys[i] = slot * BENCH_BS_SECTORS;
+			if (!test_bit(slot, written))
+				stream->nr_distinct++;
+			set_bit(slot, written);
+		} else {
+			stream->bs[i] = mixed_bs[xorshift64(&state) % ARRAY_SIZE(mixed_bs)];
+			stream->keys[i] = key;
+			key += stream->bs[i];
+		}
+	}
+	if (pattern != PATTERN_ZIPF)
+		stream->nr_distinct = nr;
+	if (pattern == PATTERN_RAND || pattern == PATTERN_MIXED)
+		shuffle(stream->keys, stream->bs, nr, &state);
+
+	/* Sequential reads go in the write order, others pick random writes */
+	for (i = 0; i < nr_reads; i++)
+		stream->reads[i] = pattern == PATTERN_SEQ ? i % nr : xorshift64(&state) % nr;
+
+	log_end = BENCH_SECTOR_OFFSET;
+	for (i = 0; i < nr; i++) {
+		stream->span = max(stream->span, stream->keys[i] + stream->bs[i]);
+		log_end += stream->bs[i];
+	}
+	stream->span = max(stream->span, log_end);
+
+	free(written);
+	return 0;
+
+mem_err:
+	free(written);
+	free(stream->keys);
+	free(stream->bs);
+	free(stream->reads);
+	return -ENOMEM;
+}
+
+static void stream_free(struct bench_stream *stream)
+{
+	free(stream->keys);
+	free(stream->bs);
+	free(stream->reads);
+}
+
+/* Same steps as a write of the driver to an already mapped or a new block */
+static void bench_write(struct bench_run *run, u64 i)
+{
+	struct bench_stream *stream = run->stream;
+	struct redir_sector_info rs_info;
+	sector_t key = stream->keys[i];
+
+	down_write(&run->lock);
+	if (!ds_lookup(&run->ds, key, &rs_info))
+		ds_remove(&run->ds, key);
+
+	rs_info.redirected_sector = run->next_free_sector;
+	rs_info.block_size = stream->bs[i] << SECTOR_SHIFT;
+	rs_info.stored_size = 0;
+	run->next_free_sector += stream->bs[i];
+	if (ds_insert(&run->ds, key, &rs_info))
+		run->misses++;
+	up_write(&run->lock);
+}
+
+/*
+ * A read that misses is counted. Lookups and last must find a mapping,
+ * prev is asked for the middle of a written block and must find its start.
+ */
+static bool bench_read(struct bench_run *run, u64 i)
+{
+	struct bench_stream *stream = run->stream;
+	struct redir_sector_info rs_info;
+	u64 w = stream->reads[i];
+	sector_t prev_key;
+	s32 status = 0;
+
+	down_read(&run->lock);
+	if (run->op == OP_LOOKUP) {
+		status = ds_lookup(&run->ds, stream->keys[w], &rs_info);
+	} else if (run->op == OP_PREV) {
+		status = ds_prev(&run->ds, stream->keys[w] + stream->bs[w] / 2, &prev_key, &rs_info);
+		if (!status && prev_key != stream->keys[w])
+			status = -ENOENT;
+	} else {
+		status = ds_last(&run->ds, stream->keys[w], &rs_info);
+	}
+	up_read(&run->lock);
+
+	return !status;
+}
+
+static void *bench_thread_fn(void *arg)
+{
+	struct bench_thread *thread = arg;
+	struct bench_run *run = thread->run;
+	u64 nr = run->op == OP_WRITE ? run->stream->nr : run->stream->nr_reads;
+	u64 first = nr * thread->id / run->nr_threads;
+	u64 last = nr * (thread->id + 1) / run->nr_threads;
+	u64 misses = 0;
+	u64 start, stop;
+	u64 i;
+
+	pthread_barrier_wait(&run->barrier);
+	start = now_ns();
+
+	for (i = first; i < last; i++) {
+		if (run->op == OP_WRITE) {
+			bench_write(run, i);
+			continue;
+		}
+		if (!bench_read(run, i))
+			misses++;
+		if (!((i - first + 1) % BENCH_TIME_CHECK) && now_ns() > run->deadline_ns) {
+			i++;
+			break;
+		}
+	}
+
+	stop = now_ns();
+	pthread_mutex_lock(&run->stats_lock);
+	run->done += i - first;
+	run->misses += misses;
+	run->busy_ns += stop - start;
+	if (!run->first_start_ns || start < run->first_start_ns)
+		run->first_start_ns = start;
+	run->last_stop_ns = max(run->last_stop_ns, stop);
+	pthread_mutex_unlock(&run->stats_lock);
+
+	return NULL;
+}
+
+static void bench_phase(struct bench_run *run, enum bench_op op, const char *ds_name,
+			enum bench_pattern pattern, long long mem_before)
+{
+	struct bench_thread threads[BENCH_MAX_THREADS];
+	double wall_ns;
+	u32 i;
+
+	run->op = op;
+	run->done = 0;
+	run->misses = 0;
+	run->busy_ns = 0;
+	run->first_start_ns = 0;
+	run->last_stop_ns = 0;
+	run->deadline_ns = now_ns() + (u64)(max_seconds * 1e9);
+	pthread_barrier_init(&run->barrier, NULL, run->nr_threads);
+
+	for (i = 0; i < run->nr_threads; i++) {
+		threads[i].run = run;
+		threads[i].id = i;
+		pthread_create(&threads[i].thread, NULL, bench_thread_fn, &threads[i]);
+	}
+	for (i = 0; i < run->nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	pthread_barrier_destroy(&run->barrier);
+
+	wall_ns = run->last_stop_ns - run->first_start_ns;
+	printf("%-3s %-6s %7u %-6s %10llu %10.1f %8.3f ", ds_name, pattern_names[pattern],
+	       run->nr_threads, op_names[op], run->done,
+	       run->done ? (double)run->busy_ns / run->done : 0,
+	       wall_ns ? run->done * 1e3 / wall_ns : 0);
+	if (op == OP_WRITE)
+		printf("%9.1f", (double)(shim_alloc_bytes - mem_before) / run->stream->nr_distinct);
+	else
+		printf("%9s", "-");
+	printf(" %8llu\n", run->misses);
+	fflush(stdout);
+}
+
+static s32 bench_ds_init(struct bench_run *run, const char *ds_name)
+{
+	u64 nr_pages;
+
+	if (strcmp(ds_name, "df"))
+		return ds_init(&run->ds, (char *)ds_name);
+
+	/* DFTL maps the sectors in front of its table, it has to cover the span */
+	nr_pages = (run->stream->span + DFTL_ENTRIES_PER_PAGE - 1) / DFTL_ENTRIES_PER_PAGE;
+	run->bdev = shim_ram_bdev(nr_pages * (DFTL_ENTRIES_PER_PAGE + DFTL_PAGE_SECTORS));
+	if (!run->bdev)
+		return -ENOMEM;
+
+	return ds_init_dftl(&run->ds, run->bdev, (u64)dftl_cache_mb << (20 - PAGE_SHIFT));
+}
+
+static s32 bench_one(const char *ds_name, enum bench_pattern pattern, struct bench_stream *stream,
+		     u32 nr_threads)
+{
+	struct bench_run run = {
+		.stream = stream,
+		.nr_threads = nr_threads,
+		.next_free_sector = BENCH_SECTOR_OFFSET,
+	};
+	long long mem_before = shim_alloc_bytes;
+	s32 status;
+
+	init_rwsem(&run.lock);
+	pthread_mutex_init(&run.stats_lock, NULL);
+	status = bench_ds_init(&run, ds_name);
+	if (status) {
+		fprintf(stderr, "%s: init failed (%d)\n", ds_name, status);
+		goto out;
+	}
+
+	bench_phase(&run, OP_WRITE, ds_name, pattern, mem_before);
+	bench_phase(&run, OP_LOOKUP, ds_name, pattern, mem_before);
+	bench_phase(&run, OP_PREV, ds_name, pattern, mem_before);
+	bench_phase(&run, OP_LAST, ds_name, pattern, mem_before);
+
+	ds_free(&run.ds);
+out:
+	if (run.bdev)
+		shim_ram_bdev_free(run.bdev);
+	pthread_mutex_destroy(&run.stats_lock);
+	return status;
+}
+
+static bool list_has(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *pos = list;
+
+	while ((pos = strstr(pos, name))) {
+		if ((pos == list || pos[-1] == ',') && (pos[len] == ',' || !pos[len]))
+			return true;
+		pos += len;
+	}
+	return false;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d LIST  data structures (default bt,sl,ht,rb,li,df,pt)\n"
+		"  -p LIST  key streams: seq,rand,zipf,mixed (default all)\n"
+		"  -t LIST  thread counts (default 1)\n"
+		"  -n NUM   writes per run (default %llu)\n"
+		"  -o NUM   ops of every read phase (default = writes)\n"
+		"  -s SEC   time limit of a read phase (default %.0f)\n"
+		"  -c MIB   DFTL translation page cache (default %u)\n"
+		"  -S NUM   seed of the key streams (default %llu)\n",
+		prog, nr_writes, max_seconds, dftl_cache_mb, seed);
+}
+
+int main(int argc, char **argv)
+{
+	const char *ds_list = "bt,sl,ht,rb,li,df,pt";
+	const char *pattern_list = "seq,rand,zipf,mixed";
+	char *thread_list = "1";
+	struct bench_stream stream;
+	char *threads_copy = NULL;
+	char *tok = NULL;
+	u32 nr_threads;
+	s32 status = 0;
+	u32 p, d;
+	s32 opt;
+
+	while ((opt = getopt(argc, argv, "d:p:t:n:o:s:c:S:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			ds_list = optarg;
+			break;
+		case 'p':
+			pattern_list = optarg;
+			break;
+		case 't':
+			thread_list = optarg;
+			break;
+		case 'n':
+			nr_writes = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			nr_ops = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			max_seconds = strtod(optarg, NULL);
+			break;
+		case 'c':
+			dftl_cache_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0) ?: 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!nr_writes) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!nr_ops)
+		nr_ops = nr_writes;
+
+	printf("%-3s %-6s %7s %-6s %10s %10s %8s %9s %8s\n",
+	       "ds", "keys", "threads", "op", "ops", "ns/op", "Mops/s", "B/entry", "misses");
+
+	for (p = 0; p < PATTERN_NR; p++) {
+		if (!list_has(pattern_list, pattern_names[p]))
+			continue;
+
+		if (stream_init(&stream, p, nr_writes, nr_ops)) {
+			fprintf(stderr, "Failed to generate the %s stream\n", pattern_names[p]);
+			return 1;
+		}
+
+		for (d = 0; d < ARRAY_SIZE(ds_names); d++) {
+			if (!list_has(ds_list, ds_names[d]))
+				continue;
+
+			threads_copy = strdup(thread_list);
+			for (tok = strtok(threads_copy, ","); tok; tok = strtok(NULL, ",")) {
+				nr_threads = clamp_t(u32, strtoul(tok, NULL, 0), 1, BENCH_MAX_THREADS);
+				status |= bench_one(ds_names[d], p, &stream, nr_threads);
+			}
+			free(threads_copy);
+		}
+		stream_free(&stream);
+	}
+
+	return status ? 1 : 0;
+}
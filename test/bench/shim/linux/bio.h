@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ * Synchronous bios over the RAM-backed block_device of blk_types.h: a bio
+ * completes inside submit_bio().
+ */
+
+#pragma once
+
+#include "blk_types.h"
+
+struct blk_plug {
+	int unused;
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline sector_t bdev_nr_sectors(struct block_device *bdev)
+{
+	return bdev->nr_sectors;
+}
+
+static inline void bio_init(struct bio *bio, struct block_device *bdev, struct bio_vec *table,
+			    unsigned short max_vecs, blk_opf_t opf)
+{
+	memset(bio, 0, sizeof(*bio));
+	bio->bi_bdev = bdev;
+	bio->bi_opf = opf;
+	bio->bi_io_vec = table;
+	bio->bi_max_vecs = max_vecs;
+}
+
+static inline void bio_uninit(struct bio *bio)
+{
+}
+
+static inline struct bio *bio_alloc(struct block_device *bdev, unsigned short nr_vecs,
+				    blk_opf_t opf, gfp_t gfp)
+{
+	struct bio *bio = shim_malloc(sizeof(*bio) + nr_vecs * sizeof(struct bio_vec), true);
+
+	BUG_ON(!bio);
+	bio_init(bio, bdev, (struct bio_vec *)(bio + 1), nr_vecs, opf);
+	bio->allocated = true;
+	return bio;
+}
+
+static inline void bio_put(struct bio *bio)
+{
+	if (bio->allocated)
+		shim_free(bio);
+}
+
+static inline void __bio_add_page(struct bio *bio, struct page *page, unsigned int len,
+				  unsigned int off)
+{
+	BUG_ON(bio->bi_vcnt >= bio->bi_max_vecs);
+	bio->bi_io_vec[bio->bi_vcnt].bv_page = page;
+	bio->bi_io_vec[bio->bi_vcnt].bv_len = len;
+	bio->bi_io_vec[bio->bi_vcnt].bv_offset = off;
+	bio->bi_vcnt++;
+	bio->bi_iter.bi_size += len;
+}
+
+static inline void shim_bio_rw(struct bio *bio)
+{
+	struct block_device *bdev = bio->bi_bdev;
+	u64 pos = (u64)bio->bi_iter.bi_sector << SECTOR_SHIFT;
+	unsigned short i;
+
+	if (bio->bi_iter.bi_sector + (bio->bi_iter.bi_size >> SECTOR_SHIFT) > bdev->nr_sectors) {
+		bio->bi_status = BLK_STS_IOERR;
+		return;
+	}
+
+	for (i = 0; i < bio->bi_vcnt; i++) {
+		u8 *buf = (u8 *)page_address(bio->bi_io_vec[i].bv_page) + bio->bi_io_vec[i].bv_offset;
+
+		if ((bio->bi_opf & 1) == REQ_OP_WRITE)
+			memcpy(bdev->data + pos, buf, bio->bi_io_vec[i].bv_len);
+		else
+			memcpy(buf, bdev->data + pos, bio->bi_io_vec[i].bv_len);
+		pos += bio->bi_io_vec[i].bv_len;
+	}
+	if ((bio->bi_opf & 1) == REQ_OP_WRITE)
+		__atomic_add_fetch(&bdev->writes, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&bdev->reads, 1, __ATOMIC_RELAXED);
+}
+
+static inline void submit_bio(struct bio *bio)
+{
+	shim_bio_rw(bio);
+	if (bio->bi_end_io)
+		bio->bi_end_io(bio);
+}
+
+static inline int submit_bio_wait(struct bio *bio)
+{
+	shim_bio_rw(bio);
+	return bio->bi_status ? -EIO : 0;
+}
+
+static inline int blk_status_to_errno(blk_status_t status)
+{
+	return status ? -EIO : 0;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+#include "mm.h"
+
+typedef u8 blk_status_t;
+typedef u32 blk_opf_t;
+
+#define BLK_STS_OK 0
+#define BLK_STS_IOERR 10
+#define BIO_MAX_VECS 256
+
+enum req_op {
+	REQ_OP_READ = 0,
+	REQ_OP_WRITE = 1,
+};
+
+/* RAM-backed stand-in for a block device */
+struct block_device {
+	u8 *data;
+	sector_t nr_sectors;
+	u64 reads;
+	u64 writes;
+};
+
+struct block_device *shim_ram_bdev(sector_t nr_sectors);
+void shim_ram_bdev_free(struct block_device *bdev);
+
+struct bvec_iter {
+	sector_t bi_sector;
+	unsigned int bi_size;
+};
+
+struct bio_vec {
+	struct page *bv_page;
+	unsigned int bv_len;
+	unsigned int bv_offset;
+};
+
+struct bio;
+typedef void (bio_end_io_t)(struct bio *);
+
+struct bio {
+	struct block_device *bi_bdev;
+	blk_opf_t bi_opf;
+	blk_status_t bi_status;
+	struct bvec_iter bi_iter;
+	bio_end_io_t *bi_end_io;
+	void *bi_private;
+	struct bio_vec *bi_io_vec;
+	unsigned short bi_vcnt;
+	unsigned short bi_max_vecs;
+	bool allocated;
+	struct bio_vec inline_vecs[1];
+};
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+
+struct btree_head {
+	unsigned long *node;
+	void *mempool;
+	int height;
+};
+
+struct btree_geo;
+
+extern struct btree_geo btree_geo32;
+extern struct btree_geo btree_geo64;
+extern struct btree_geo btree_geo128;
+
+int btree_init(struct btree_head *head);
+void btree_destroy(struct btree_head *head);
+void *btree_lookup(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+int btree_insert(struct btree_head *head, struct btree_geo *geo, unsigned long *key,
+		 void *val, gfp_t gfp);
+int btree_update(struct btree_head *head, struct btree_geo *geo, unsigned long *key,
+		 void *val);
+void *btree_remove(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+void *btree_last(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+void *btree_get_prev(struct btree_head *head, struct btree_geo *geo, unsigned long *key);
+size_t btree_grim_visitor(struct btree_head *head, struct btree_geo *geo, unsigned long opaque,
+			  void (*func)(void *elem, unsigned long opaque, unsigned long *key,
+				       size_t index, void *func2),
+			  void *func2);
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+
+/* Bios complete synchronously, so a completion never has to sleep */
+struct completion {
+	bool done;
+};
+
+typedef struct {
+	s32 counter;
+} atomic_t;
+
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_inc(v) ((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED))
+#define atomic_dec_and_test(v) (__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_ACQ_REL) == 0)
+
+static inline void init_completion(struct completion *x)
+{
+	x->done = false;
+}
+
+static inline void complete(struct completion *x)
+{
+	x->done = true;
+}
+
+static inline void wait_for_completion_io(struct completion *x)
+{
+	BUG_ON(!x->done);
+}
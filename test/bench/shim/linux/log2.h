@@ -0,0 +1,7 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+
+#define ilog2(n) (63 - __builtin_clzll((u64)(n)))
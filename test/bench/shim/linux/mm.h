@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "slab.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define __GFP_ZERO 0x100u
+
+/* A page is just its PAGE_SIZE bytes */
+struct page;
+
+static inline struct page *alloc_page(gfp_t flags)
+{
+	return (struct page *)shim_malloc(PAGE_SIZE, flags & __GFP_ZERO);
+}
+
+static inline void __free_page(struct page *page)
+{
+	shim_free(page);
+}
+
+static inline void *page_address(const struct page *page)
+{
+	return (void *)page;
+}
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <pthread.h>
+#include "kernel.h"
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define mutex_init(m) pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m) pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m) pthread_mutex_unlock(&(m)->lock)
+#define mutex_trylock(m) (!pthread_mutex_trylock(&(m)->lock))
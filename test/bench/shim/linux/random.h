@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+
+u32 get_random_u32(void);
+
+static inline u8 get_random_u8(void)
+{
+	return (u8)get_random_u32();
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <pthread.h>
+#include "kernel.h"
+
+struct rw_semaphore {
+	pthread_rwlock_t lock;
+};
+
+static inline void init_rwsem(struct rw_semaphore *sem)
+{
+	pthread_rwlock_init(&sem->lock, NULL);
+}
+
+static inline void down_read(struct rw_semaphore *sem)
+{
+	pthread_rwlock_rdlock(&sem->lock);
+}
+
+static inline void up_read(struct rw_semaphore *sem)
+{
+	pthread_rwlock_unlock(&sem->lock);
+}
+
+static inline void down_write(struct rw_semaphore *sem)
+{
+	pthread_rwlock_wrlock(&sem->lock);
+}
+
+static inline void up_write(struct rw_semaphore *sem)
+{
+	pthread_rwlock_unlock(&sem->lock);
+}
@@ -0,0 +1,8 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <sched.h>
+#include "kernel.h"
+
+#define cond_resched() sched_yield()
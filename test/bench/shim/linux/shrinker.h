@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ * There is no memory pressure in userspace, shrinkers are only registered
+ * so that a test can run them by hand through shim_shrink().
+ */
+
+#pragma once
+
+#include "slab.h"
+
+#define SHRINK_STOP (~0UL)
+#define SHRINK_EMPTY (~0UL - 1)
+
+struct shrink_control {
+	gfp_t gfp_mask;
+	unsigned long nr_to_scan;
+};
+
+struct shrinker {
+	unsigned long (*count_objects)(struct shrinker *, struct shrink_control *);
+	unsigned long (*scan_objects)(struct shrinker *, struct shrink_control *);
+	void *private_data;
+};
+
+static inline struct shrinker *shrinker_alloc(unsigned int flags, const char *fmt, ...)
+{
+	return shim_malloc(sizeof(struct shrinker), true);
+}
+
+static inline void shrinker_register(struct shrinker *shrinker)
+{
+}
+
+static inline void shrinker_free(struct shrinker *shrinker)
+{
+	shim_free(shrinker);
+}
+
+static inline unsigned long shim_shrink(struct shrinker *shrinker, unsigned long nr)
+{
+	struct shrink_control sc = { .nr_to_scan = nr };
+
+	return shrinker->scan_objects(shrinker, &sc);
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include "kernel.h"
+
+/* Bytes handed out by the allocators below, for bytes/entry accounting */
+extern long long shim_alloc_bytes;
+
+void *shim_malloc(size_t size, bool zero);
+void shim_free(const void *ptr);
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return shim_malloc(size, false);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	return shim_malloc(size, true);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+	return shim_malloc(n * size, false);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+	return shim_malloc(n * size, true);
+}
+
+static inline void kfree(const void *ptr)
+{
+	shim_free(ptr);
+}
+
+#define kvmalloc(size, flags) kmalloc(size, flags)
+#define kvzalloc(size, flags) kzalloc(size, flags)
+#define kvmalloc_array(n, size, flags) kmalloc_array(n, size, flags)
+#define kvcalloc(n, size, flags) kcalloc(n, size, flags)
+#define kvfree(ptr) kfree(ptr)
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#pragma once
+
+#include <stdlib.h>
+#include "kernel.h"
+
+/* The swap callback is only an optimization in the kernel, qsort() does without */
+static inline void sort(void *base, size_t num, size_t size, int (*cmp)(const void *, const void *),
+		void (*swap)(void *, void *, int))
+{
+	qsort(base, num, size, cmp);
+}
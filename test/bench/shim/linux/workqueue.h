@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ * Every queued work gets its own thread, flush_work() joins it.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include "kernel.h"
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	pthread_t thread;
+	bool queued;
+};
+
+struct workqueue_struct;
+#define system_wq ((struct workqueue_struct *)NULL)
+#define system_unbound_wq ((struct workqueue_struct *)NULL)
+
+#define INIT_WORK(w, f) do { (w)->func = (f); (w)->queued = false; } while (0)
+
+static inline void *shim_work_thread(void *arg)
+{
+	struct work_struct *work = arg;
+
+	work->func(work);
+	return NULL;
+}
+
+static inline bool flush_work(struct work_struct *work)
+{
+	if (!work->queued)
+		return false;
+
+	pthread_join(work->thread, NULL);
+	work->queued = false;
+	return true;
+}
+
+static inline bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	flush_work(work);
+	work->queued = true;
+	return !pthread_create(&work->thread, NULL, shim_work_thread, work);
+}
+
+static inline bool cancel_work_sync(struct work_struct *work)
+{
+	return flush_work(work);
+}
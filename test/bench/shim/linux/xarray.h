@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ * Flat, grow-on-demand array with the xarray interface, enough for the
+ * dense small indices of the userspace tests.
+ */
+
+#pragma once
+
+#include "slab.h"
+
+struct xarray {
+	void **slots;
+	unsigned long size;
+};
+
+static inline void xa_init(struct xarray *xa)
+{
+	xa->slots = NULL;
+	xa->size = 0;
+}
+
+static inline void *xa_load(struct xarray *xa, unsigned long index)
+{
+	return index < xa->size ? xa->slots[index] : NULL;
+}
+
+static inline void *xa_store(struct xarray *xa, unsigned long index, void *entry, gfp_t gfp)
+{
+	void *old;
+
+	if (index >= xa->size) {
+		unsigned long size = max(index + 1, xa->size * 2);
+		void **slots = shim_malloc(size * sizeof(void *), true);
+
+		if (!slots)
+			return ERR_PTR(-ENOMEM);
+		if (xa->slots)
+			memcpy(slots, xa->slots, xa->size * sizeof(void *));
+		shim_free(xa->slots);
+		xa->slots = slots;
+		xa->size = size;
+	}
+	old = xa->slots[index];
+	xa->slots[index] = entry;
+	return old;
+}
+
+static inline int xa_err(void *entry)
+{
+	return IS_ERR_VALUE(entry) ? (int)PTR_ERR(entry) : 0;
+}
+
+static inline void *xa_erase(struct xarray *xa, unsigned long index)
+{
+	void *old = xa_load(xa, index);
+
+	if (old)
+		xa->slots[index] = NULL;
+	return old;
+}
+
+static inline void xa_destroy(struct xarray *xa)
+{
+	shim_free(xa->slots);
+	xa_init(xa);
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <malloc.h>
+#include <sys/mman.h>
+#include <linux/blk_types.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+
+long long shim_alloc_bytes;
+
+void *shim_malloc(size_t size, bool zero)
+{
+	void *ptr = zero ? calloc(1, size) : malloc(size);
+
+	if (ptr)
+		__atomic_add_fetch(&shim_alloc_bytes, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+	return ptr;
+}
+
+void shim_free(const void *ptr)
+{
+	if (!ptr)
+		return;
+
+	__atomic_sub_fetch(&shim_alloc_bytes, malloc_usable_size((void *)ptr), __ATOMIC_RELAXED);
+	free((void *)ptr);
+}
+
+u32 get_random_u32(void)
+{
+	static __thread u64 state = 0x9E3779B97F4A7C15ULL;
+
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return (u32)state;
+}
+
+/*
+ * The data area of the device is never touched by the backends, so the
+ * memory is reserved lazily and only the translation pages get backed.
+ */
+struct block_device *shim_ram_bdev(sector_t nr_sectors)
+{
+	struct block_device *bdev = calloc(1, sizeof(*bdev));
+
+	if (!bdev)
+		return NULL;
+
+	bdev->nr_sectors = nr_sectors;
+	bdev->data = mmap(NULL, nr_sectors << SECTOR_SHIFT, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (bdev->data == MAP_FAILED) {
+		free(bdev);
+		return NULL;
+	}
+	return bdev;
+}
+
+void shim_ram_bdev_free(struct block_device *bdev)
+{
+	munmap(bdev->data, bdev->nr_sectors << SECTOR_SHIFT);
+	free(bdev);
+}
@@ -0,0 +1,283 @@
+# SPDX-License-Identifier: GPL-2.0-only
+
+"""fio benchmark matrix of lsbdd.
+
+'run' loads the module once per data structure on top of a local backing
+device (brd, null_blk, a loop file or any block device), fills the vbd and
+sweeps block size x iodepth x numjobs x read/write mix with fio. IOPS,
+bandwidth and p50/p99/p99.9 completion latency of every job are saved in one
+JSON file, together with the driver counters from debugfs.
+
+'compare' matches two such files job by job and flags the jobs, that lost
+more IOPS or gained more p99 latency than the thresholds. It exits with 1 if
+there is a regression, so it can gate a CI run.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import subprocess
+import sys
+import time
+from itertools import product
+
+VBD = "/dev/lsvbd1"
+PARAMS_DIR = "/sys/module/lsbdd/parameters"
+DEBUGFS_STATS = "/sys/kernel/debug/lsbdd/lsvbd1/stats"
+PERCENTILES = ["50.000000", "99.000000", "99.900000"]
+KEY_FIELDS = ("ds", "pattern", "bs", "iodepth", "numjobs", "rwmix")
+
+
+def run_command(command, check=True):
+    print(f"Executing command: {command}")
+    return subprocess.run(command, shell=True, check=check, text=True, capture_output=True)
+
+
+def size_to_bytes(size):
+    units = {"k": 1 << 10, "m": 1 << 20, "g": 1 << 30}
+    size = size.strip().lower()
+    if size[-1] in units:
+        return int(size[:-1]) * units[size[-1]]
+    return int(size)
+
+
+def write_param(name, value):
+    with open(os.path.join(PARAMS_DIR, name), "w") as f:
+        f.write(value)
+
+
+class Backing:
+    """Local backing device of the vbd, created and removed by the matrix."""
+    def __init__(self, kind, size, loop_file):
+        self.kind = kind
+        self.size = size
+        self.loop_file = loop_file
+        self.path = None
+
+    def setup(self):
+        size_mb = self.size >> 20
+        if self.kind == "brd":
+            run_command(f"modprobe brd rd_nr=1 rd_size={size_mb * 1024}")
+            self.path = "/dev/ram0"
+        elif self.kind == "null_blk":
+            run_command(f"modprobe null_blk nr_devices=1 gb={max(1, size_mb >> 10)} memory_backed=1")
+            self.path = "/dev/nullb0"
+        elif self.kind == "loop":
+            run_command(f"truncate -s {size_mb}M {self.loop_file}")
+            self.path = run_command(f"losetup -f --show --direct-io=on {self.loop_file}").stdout.strip()
+        else:
+            self.path = self.kind
+        print(f"Backing device: {self.path}")
+
+    def capacity(self):
+        name = os.path.basename(os.path.realpath(self.path))
+        with open(f"/sys/class/block/{name}/size") as f:
+            return int(f.read()) * 512
+
+    def teardown(self):
+        if self.kind == "brd":
+            run_command("rmmod brd", check=False)
+        elif self.kind == "null_blk":
+            run_command("rmmod null_blk", check=False)
+        elif self.kind == "loop":
+            run_command(f"losetup -d {self.path}", check=False)
+            os.unlink(self.loop_file)
+
+
+class Matrix:
+    """Runs the fio jobs of every data structure and collects the results."""
+    def __init__(self, args):
+        self.args = args
+        self.jobs = list(product(args.pattern.split(","), args.bs.split(","),
+                                 [int(x) for x in args.iodepth.split(",")],
+                                 [int(x) for x in args.numjobs.split(",")],
+                                 [int(x) for x in args.rwmix.split(",")]))
+        self.size = size_to_bytes(args.size)
+        self.io_size = size_to_bytes(args.io_size)
+        self.raw_dir = os.path.splitext(args.out)[0] + "-raw"
+
+    def log_bytes(self):
+        """The vbd is a log, so everything written in a module life needs room on the backing device."""
+        written = self.size
+        for _, _, _, numjobs, rwmix in self.jobs:
+            written += self.io_size * numjobs * (100 - rwmix) // 100
+        return written
+
+    def load_module(self, ds, backing_path):
+        run_command(f"insmod {self.args.module}")
+        write_param("set_data_structure", ds)
+        write_param("set_redirect_bd", f"1 {backing_path}")
+        for _ in range(50):
+            if os.path.exists(VBD):
+                return
+            time.sleep(0.1)
+        raise RuntimeError(f"{VBD} didn't show up")
+
+    def unload_module(self):
+        write_param("delete_bd", "1")
+        run_command("rmmod lsbdd", check=False)
+
+    def prefill(self):
+        """Maps the whole region, so the reads of the jobs are remapped instead of passed through."""
+        run_command(f"fio --name=prefill --filename={VBD} --ioengine=libaio --direct=1 --rw=write "
+                    f"--bs={self.args.prefill_bs} --iodepth=32 --size={self.size}")
+
+    def run_job(self, ds, pattern, bs, iodepth, numjobs, rwmix):
+        if rwmix == 100:
+            rw = "read" if pattern == "seq" else "randread"
+        elif rwmix == 0:
+            rw = "write" if pattern == "seq" else "randwrite"
+        else:
+            rw = "rw" if pattern == "seq" else "randrw"
+        name = f"{ds}_{pattern}_{bs}_qd{iodepth}_j{numjobs}_r{rwmix}"
+        raw_path = os.path.join(self.raw_dir, name + ".json")
+
+        run_command(f"fio --name={name} --filename={VBD} --ioengine=libaio --direct=1 --rw={rw} "
+                    f"--rwmixread={rwmix} --bs={bs} --iodepth={iodepth} --numjobs={numjobs} "
+                    f"--size={self.size} --io_size={self.io_size} --runtime={self.args.runtime} "
+                    f"--randrepeat=1 --randseed=1 --group_reporting "
+                    f"--percentile_list=50:99:99.9 --output-format=json --output={raw_path}")
+
+        with open(raw_path) as f:
+            job = json.load(f)["jobs"][0]
+
+        result = dict(ds=ds, pattern=pattern, bs=bs, iodepth=iodepth, numjobs=numjobs, rwmix=rwmix)
+        for direction in ("read", "write"):
+            stats = job[direction]
+            if not stats["total_ios"]:
+                continue
+            clat = stats["clat_ns"].get("percentile", {})
+            result[direction] = {
+                "iops": stats["iops"],
+                "bw_kib": stats["bw"],
+                "p50_us": clat.get(PERCENTILES[0], 0) / 1000,
+                "p99_us": clat.get(PERCENTILES[1], 0) / 1000,
+                "p999_us": clat.get(PERCENTILES[2], 0) / 1000,
+            }
+        return result
+
+    @staticmethod
+    def driver_stats():
+        if not os.path.exists(DEBUGFS_STATS):
+            return {}
+        with open(DEBUGFS_STATS) as f:
+            return dict(line.split(": ", 1) for line in f.read().splitlines())
+
+    def run(self):
+        backing = Backing(self.args.backing, size_to_bytes(self.args.backing_size), self.args.loop_file)
+        results = {
+            "meta": {
+                "date": datetime.datetime.now().isoformat(timespec="seconds"),
+                "kernel": os.uname().release,
+                "fio": run_command("fio --version").stdout.strip(),
+                "commit": run_command("git rev-parse --short HEAD", check=False).stdout.strip(),
+                "backing": self.args.backing,
+                "size": self.args.size,
+                "io_size": self.args.io_size,
+            },
+            "results": [],
+            "driver_stats": {},
+        }
+        os.makedirs(self.raw_dir, exist_ok=True)
+
+        backing.setup()
+        try:
+            if self.log_bytes() > backing.capacity():
+                raise RuntimeError(f"Backing device holds {backing.capacity() >> 20}M, the matrix writes "
+                                   f"{self.log_bytes() >> 20}M per data structure: "
+                                   "raise --backing-size or lower --size/--io-size")
+
+            for ds in self.args.ds.split(","):
+                print('\033[1m' + f"=== {ds} ===" + '\033[0m')
+                self.load_module(ds, backing.path)
+                try:
+                    self.prefill()
+                    for job in self.jobs:
+                        results["results"].append(self.run_job(ds, *job))
+                    results["driver_stats"][ds] = self.driver_stats()
+                finally:
+                    self.unload_module()
+        finally:
+            backing.teardown()
+
+        with open(self.args.out, "w") as f:
+            json.dump(results, f, indent=2)
+        print(f"Results saved to {self.args.out}")
+
+
+def job_key(result):
+    return tuple(result[field] for field in KEY_FIELDS)
+
+
+def compare(args):
+    with open(args.baseline) as f:
+        baseline = {job_key(r): r for r in json.load(f)["results"]}
+    with open(args.current) as f:
+        current = {job_key(r): r for r in json.load(f)["results"]}
+
+    regressions = 0
+    print(f"{'job':<40} {'dir':<6} {'iops':>12} {'delta':>8} {'p99 us':>10} {'delta':>8}")
+    for key in sorted(baseline.keys() & current.keys(), key=str):
+        name = "_".join(str(field) for field in key)
+        for direction in ("read", "write"):
+            old = baseline[key].get(direction)
+            new = current[key].get(direction)
+            if not old or not new:
+                continue
+
+            iops_delta = (new["iops"] - old["iops"]) * 100 / old["iops"] if old["iops"] else 0
+            p99_delta = (new["p99_us"] - old["p99_us"]) * 100 / old["p99_us"] if old["p99_us"] else 0
+            flag = ""
+            if iops_delta < -args.iops_threshold or p99_delta > args.lat_threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            print(f"{name:<40} {direction:<6} {new['iops']:>12.0f} {iops_delta:>+7.1f}% "
+                  f"{new['p99_us']:>10.1f} {p99_delta:>+7.1f}%{flag}")
+
+    for key in baseline.keys() - current.keys():
+        print(f"Missing in current: {'_'.join(str(field) for field in key)}")
+
+    if regressions:
+        print('\033[1m' + f"{regressions} regression(s) against {args.baseline}" + '\033[0m')
+        return 1
+    print('\033[1m' + "No regressions" + '\033[0m')
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="fio benchmark matrix of the lsbdd data structures.")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    run = sub.add_parser("run", help="Run the matrix and save the results as JSON")
+    run.add_argument('--module', default="lsbdd.ko", help="Path of the built module")
+    run.add_argument('--backing', default="brd", help='"brd", "null_blk", "loop" or a block device path')
+    run.add_argument('--backing-size', default="8g", help="Size of the created brd/null_blk/loop device")
+    run.add_argument('--loop-file', default="/tmp/lsbdd-matrix.img", help="Backing file of the loop device")
+    run.add_argument('--ds', default="bt,sl,ht,rb", help="Data structures")
+    run.add_argument('--pattern', default="rand", help="Access patterns: rand, seq")
+    run.add_argument('--bs', default="4k,16k,64k", help="Block sizes")
+    run.add_argument('--iodepth', default="1,32", help="iodepths")
+    run.add_argument('--numjobs', default="1,4", help="Numbers of fio jobs")
+    run.add_argument('--rwmix', default="0,70,100", help="Read percentages (0 - writes only, 100 - reads only)")
+    run.add_argument('--size', default="512m", help="Region of the vbd the jobs run in, it is prefilled")
+    run.add_argument('--io-size', default="256m", help="I/O done by every fio job")
+    run.add_argument('--prefill-bs', default="4k", help="Block size of the prefill writes")
+    run.add_argument('--runtime', default=30, type=int, help="Cap of every job in seconds")
+    run.add_argument('--out', default="results.json", help="Results file, raw fio output goes next to it")
+
+    cmp = sub.add_parser("compare", help="Compare results against a baseline")
+    cmp.add_argument('baseline', help="Baseline results file")
+    cmp.add_argument('current', help="Results file to check")
+    cmp.add_argument('--iops-threshold', default=5.0, type=float, help="Max IOPS drop in percent")
+    cmp.add_argument('--lat-threshold', default=10.0, type=float, help="Max p99 latency growth in percent")
+
+    args = parser.parse_args()
+    if args.command == "run":
+        Matrix(args).run()
+        return 0
+    return compare(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())